@@ -0,0 +1,62 @@
+/* Anderson acceleration of a fixed-point iteration u <- G(u), as used to speed up ICP in "Fast and Robust Iterative Closest Point", Zhang et al, 2021 */
+#include <AndersonAcceleration.hpp>
+
+#include <iostream>
+
+#include <Eigen/Dense>
+
+#include <Exceptions.hpp>
+
+AndersonAcceleration::AndersonAcceleration(int history, int dimension)
+    : history(history), stored(0), newest(-1),
+      f(dimension), g_previous(dimension), f_previous(dimension),
+      delta_g(dimension, history), delta_f(dimension, history) {
+    if(history < 1 || history > max_history || dimension < 1) {
+        std::cerr << "Anderson acceleration needs a history of 1 to " << max_history << " and a dimension of at least one." << std::endl;
+        throw(PointMatchingEx);
+    }
+}
+
+void AndersonAcceleration::compute(const Eigen::Ref<const Eigen::VectorXd>& u, const Eigen::Ref<const Eigen::VectorXd>& g, Eigen::Ref<Eigen::VectorXd> accelerated) {
+    // Differences of successive residuals f = g - u and images g are kept in ring buffers. The extrapolation is
+    // g - delta_g * theta, where theta minimises |f - delta_f * theta| (solved through the small normal equations).
+    f = g - u;
+    accelerated = g;
+
+    if(newest < 0) {
+        newest = 0;
+        g_previous = g;
+        f_previous = f;
+        return;
+    }
+
+    int column = stored < history ? stored : (newest + 1) % history;
+    delta_g.col(column) = g - g_previous;
+    delta_f.col(column) = f - f_previous;
+    newest = column;
+    if(stored < history) {
+        stored++;
+    }
+
+    g_previous = g;
+    f_previous = f;
+
+    SmallMatrix normal = delta_f.leftCols(stored).transpose().lazyProduct(delta_f.leftCols(stored));
+    SmallVector rhs = delta_f.leftCols(stored).transpose().lazyProduct(f);
+
+    Eigen::LDLT<SmallMatrix> ldlt(normal);
+    if(ldlt.info() != Eigen::Success) {
+        return;
+    }
+    SmallVector theta = ldlt.solve(rhs);
+    if(!theta.allFinite()) {
+        return;
+    }
+
+    accelerated.noalias() -= delta_g.leftCols(stored).lazyProduct(theta);
+}
+
+void AndersonAcceleration::reset() {
+    stored = 0;
+    newest = -1;
+}
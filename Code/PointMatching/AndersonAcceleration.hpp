@@ -0,0 +1,33 @@
+/* Anderson acceleration of a fixed-point iteration u <- G(u), as used to speed up ICP in "Fast and Robust Iterative Closest Point", Zhang et al, 2021 */
+#ifndef ANDERSONACCELERATION_INCLUDED
+#define ANDERSONACCELERATION_INCLUDED
+
+#include <Eigen/Dense>
+
+class AndersonAcceleration {
+public:
+    static const int max_history = 16;
+
+    AndersonAcceleration(int history, int dimension);
+
+    // Given the current iterate u and its image g = G(u), write the extrapolated next iterate into accelerated. Buffers are
+    // allocated once in the constructor, so this does not allocate.
+    void compute(const Eigen::Ref<const Eigen::VectorXd>& u, const Eigen::Ref<const Eigen::VectorXd>& g, Eigen::Ref<Eigen::VectorXd> accelerated);
+
+    // Forget the stored history, e.g. after an extrapolated step was rejected.
+    void reset();
+
+private:
+    typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, 0, max_history, max_history> SmallMatrix;
+    typedef Eigen::Matrix<double, Eigen::Dynamic, 1, 0, max_history, 1> SmallVector;
+
+    int history;
+    int stored;
+    int newest;
+    Eigen::VectorXd f;
+    Eigen::VectorXd g_previous;
+    Eigen::VectorXd f_previous;
+    Eigen::MatrixXd delta_g;
+    Eigen::MatrixXd delta_f;
+};
+#endif
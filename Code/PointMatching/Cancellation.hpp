@@ -0,0 +1,50 @@
+/* Cooperative cancellation of long-running registrations. A caller shares a token with the work it starts and cancels it
+   from any thread; each stage polls the token between blocks of work and, once it is cancelled, abandons what it was
+   doing by throwing RegistrationCancelledEx. */
+#ifndef CANCELLATION_INCLUDED
+#define CANCELLATION_INCLUDED
+
+#include <atomic>
+#include <iostream>
+
+#include <Exceptions.hpp>
+
+class CancellationToken {
+public:
+    CancellationToken() : cancelled(false) {
+    }
+
+    void cancel() {
+        cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    // Makes the token usable for another request.
+    void reset() {
+        cancelled.store(false, std::memory_order_relaxed);
+    }
+
+    bool is_cancelled() const {
+        return cancelled.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<bool> cancelled;
+};
+
+// Loops over points poll their token once per block of this many points, which keeps the cost of polling negligible
+// while still stopping within a small fraction of a millisecond.
+static const int cancellation_block = 256;
+
+// True once token (which may be null, for work that cannot be cancelled) has been cancelled. Safe to call from worker
+// threads, which should return early and leave the throwing to their caller.
+inline bool cancellation_requested(const CancellationToken* token) {
+    return token && token->is_cancelled();
+}
+
+inline void throw_if_cancelled(const CancellationToken* token) {
+    if(cancellation_requested(token)) {
+        std::cerr << "Registration cancelled." << std::endl;
+        throw(RegistrationCancelledEx);
+    }
+}
+#endif
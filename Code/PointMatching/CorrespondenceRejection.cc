@@ -0,0 +1,86 @@
+/* Correspondence rejection: pairs that are unlikely to be true matches (too far apart, with disagreeing normals, or on the
+   boundary of either surface) are dropped between matching and the least-squares solve of each ICP iteration. */
+#include <CorrespondenceRejection.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+#include <Exceptions.hpp>
+#include <SurfaceCache.hpp>
+
+// Converts a median absolute deviation to a standard deviation, for normally distributed values.
+static const double mad_to_sigma = 1.4826;
+
+bool CorrespondenceRejection::enabled() const {
+    return max_distance > 0 || mad_factor > 0 || max_normal_angle > 0 || reject_boundary;
+}
+
+bool CorrespondenceRejection::needs_normals() const {
+    return max_normal_angle > 0 || reject_boundary;
+}
+
+double mad_distance_threshold(Eigen::Ref<Eigen::VectorXd> distances, double mad_factor) {
+    // Two selections (linear time): the median, then the median of the absolute deviations from it.
+    if(distances.size() == 0) {
+        return 0;
+    }
+
+    auto middle = distances.data() + distances.size() / 2;
+    std::nth_element(distances.data(), middle, distances.data() + distances.size());
+    double median = *middle;
+
+    distances.array() = (distances.array() - median).abs();
+    std::nth_element(distances.data(), middle, distances.data() + distances.size());
+
+    return median + mad_factor * mad_to_sigma * (*middle);
+}
+
+double reject_correspondences(const CorrespondenceRejection& rejection, const SurfaceCache* source, const SurfaceCache* target, const Eigen::Matrix3d& rotation,
+                              RobustKernel kernel, double scale, Eigen::VectorXd& distances, Eigen::ArrayXi& lookup_table, int& kept) {
+    bool check_normals = rejection.max_normal_angle > 0;
+    if((rejection.needs_normals() && (source == 0 || target == 0))
+       || (check_normals && (source->normal_neighbours == 0 || target->normal_neighbours == 0))
+       || (rejection.reject_boundary && (source->boundary_neighbours == 0 || target->boundary_neighbours == 0))) {
+        std::cerr << "Correspondence rejection needs normals and boundary points for both surfaces -- call prepare_surface_cache first." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    double max_distance = rejection.max_distance > 0 ? rejection.max_distance : std::numeric_limits<double>::infinity();
+    double min_cosine = cos(rejection.max_normal_angle);
+
+    kept = 0;
+    double loss_sum = 0;
+    for(int i = 0; i < lookup_table.size(); i++) {
+        int j = lookup_table(i);
+        if(j < 0) {
+            continue;
+        }
+
+        // The normal and boundary tests come first: they do not depend on the distance threshold, which moves between iterations.
+        bool mismatched = false;
+        if(check_normals) {
+            mismatched = std::abs((rotation * source->normals.col(i)).dot(target->normals.col(j))) < min_cosine;
+        }
+        if(rejection.reject_boundary && !mismatched) {
+            mismatched = source->boundary[i] || target->boundary[j];
+        }
+        if(mismatched) {
+            distances(i) = std::numeric_limits<double>::quiet_NaN();
+        }
+
+        if(mismatched || distances(i) > max_distance) {
+            lookup_table(i) = -1;
+        } else {
+            kept++;
+            loss_sum += robust_loss(kernel, distances(i), scale);
+        }
+    }
+
+    if(kept == 0) {
+        std::cerr << "Every correspondence was rejected." << std::endl;
+        throw(PointMatchingEx);
+    }
+    return sqrt(2 * loss_sum / kept);
+}
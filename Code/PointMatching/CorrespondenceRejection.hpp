@@ -0,0 +1,46 @@
+/* Correspondence rejection: pairs that are unlikely to be true matches (too far apart, with disagreeing normals, or on the
+   boundary of either surface) are dropped between matching and the least-squares solve of each ICP iteration. */
+#ifndef CORRESPONDENCEREJECTION_INCLUDED
+#define CORRESPONDENCEREJECTION_INCLUDED
+
+#include <Eigen/Dense>
+
+#include <RobustEstimation.hpp>
+
+struct SurfaceCache;
+
+struct CorrespondenceRejection {
+    // Each rejector is disabled when zero (or false).
+
+    // Pairs farther apart than this.
+    double max_distance = 0;
+
+    // Pairs farther apart than median + mad_factor * sigma of the previous iteration's distances, where sigma is estimated
+    // from their median absolute deviation.
+    double mad_factor = 0;
+
+    // Pairs whose (unoriented) normals differ by more than this angle (radians).
+    double max_normal_angle = 0;
+
+    // Pairs with a point on the boundary of either surface, which partly overlapping surfaces mostly match to.
+    bool reject_boundary = false;
+
+    bool enabled() const;
+
+    bool needs_normals() const;
+};
+
+// The distance beyond which mad_factor rejects pairs, from the distances of the previous iteration. distances is left
+// reordered, and overwritten with absolute deviations.
+double mad_distance_threshold(Eigen::Ref<Eigen::VectorXd> distances, double mad_factor);
+
+// Drops rejected pairs in place, by setting lookup_table(i) to -1, where point i of source is paired with point
+// lookup_table(i) of target at distance distances(i); pairs already -1 are skipped. All rejectors apply in one pass, with
+// max_distance standing for both distance rejectors (register_surfaces resolves mad_factor into it before each iteration).
+// rotation takes source normals into the frame of target; the caches may be null if no rejector needs normals. Returns the
+// robust RMS error sqrt(2*sum(rho)/N) over the pairs kept, and sets kept to their number. Pairs dropped by the normal or
+// boundary rejector also have their distance set to NaN, so that whether any other pair counts depends on the distance
+// threshold alone.
+double reject_correspondences(const CorrespondenceRejection& rejection, const SurfaceCache* source, const SurfaceCache* target, const Eigen::Matrix3d& rotation,
+                              RobustKernel kernel, double scale, Eigen::VectorXd& distances, Eigen::ArrayXi& lookup_table, int& kept);
+#endif
@@ -0,0 +1,256 @@
+/* Coherent Point Drift, after "Point Set Registration: Coherent Point Drift", Myronenko and Song, 2010. The moving points
+   are the centroids of a Gaussian mixture, with a uniform outlier component, fitted to the fixed points by expectation
+   maximisation: rigidly, or with a smooth displacement field regularised by a Gaussian kernel. The E-step's sums over
+   all pairs of points are Gauss transforms, evaluated by the fast Gauss transform or a truncated k-d tree search. */
+#include <Cpd.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include <Exceptions.hpp>
+#include <Parallel.hpp>
+#include <Util.hpp>
+
+// The posterior sums of an E-step: P1 and Pt1 are the row and column sums of the posterior matrix P (moving by fixed
+// points), PX is P times the fixed points, and Np is the total.
+struct Expectation {
+    Eigen::VectorXd P1;
+    Eigen::VectorXd Pt1;
+    Eigen::MatrixXd PX;
+    double Np;
+    double negative_log_likelihood;
+};
+
+static void expectation(const Eigen::MatrixXd& fixed, const Eigen::MatrixXd& moving, double sigma2, const CpdOptions& options, Expectation& result) {
+    // P(m, n) = k(m, n) / (sum over m of k(m, n) + c), with the kernel k(m, n) = exp(-|x_n - y_m|^2 / (2 sigma2)) and c
+    // the outlier component's share. The denominators are one Gauss transform from the moving points to the fixed ones,
+    // and P1 and PX one more, with four rows of weights, back from the fixed points to the moving ones.
+    int n = fixed.cols();
+    int m = moving.cols();
+    double bandwidth = sqrt(2 * sigma2);
+    double c = pow(2 * M_PI * sigma2, 1.5) * options.outlier_weight / (1 - options.outlier_weight) * m / n;
+
+    Eigen::MatrixXd denominators;
+    gauss_transform(moving, Eigen::MatrixXd::Ones(1, m), fixed, bandwidth, denominators, options.gauss_transform);
+
+    Eigen::MatrixXd weights(4, n);
+    weights.row(0) = (denominators.array() + c).inverse();
+    for(int d = 0; d < 3; d++) {
+        weights.row(d + 1) = fixed.row(d).cwiseProduct(weights.row(0));
+    }
+
+    Eigen::MatrixXd sums;
+    gauss_transform(fixed, weights, moving, bandwidth, sums, options.gauss_transform);
+
+    result.P1 = sums.row(0).transpose();
+    result.PX = sums.bottomRows(3);
+    result.Pt1 = denominators.cwiseProduct(weights.row(0)).transpose();
+    result.Np = result.P1.sum();
+    result.negative_log_likelihood = -(denominators.array() + c).log().sum() + 1.5 * n * log(sigma2);
+}
+
+static double initial_variance(const Eigen::MatrixXd& fixed, const Eigen::MatrixXd& moving) {
+    // Mean squared distance over all pairs of points, from the clouds' sums and sums of squared norms.
+    double n = fixed.cols();
+    double m = moving.cols();
+    double squared_distances = m * fixed.colwise().squaredNorm().sum() + n * moving.colwise().squaredNorm().sum()
+                               - 2 * fixed.rowwise().sum().dot(moving.rowwise().sum());
+    return squared_distances / (3 * n * m);
+}
+
+// Clouds scaled about the fixed cloud's centroid to give it unit RMS radius, which CPD's parameters assume.
+struct Normalisation {
+    Eigen::Vector3d centre;
+    double scale;
+};
+
+static void validate_clouds(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, const CpdOptions& options) {
+    if(surface1.rows() != 3 || surface2.rows() != 3 || surface1.cols() < 1 || surface2.cols() < 1) {
+        std::cerr << "CPD needs two non-empty 3D clouds." << std::endl;
+        throw(PointMatchingEx);
+    }
+    if(!(options.outlier_weight >= 0 && options.outlier_weight < 1)) {
+        std::cerr << "CPD outlier weight must be in [0, 1)." << std::endl;
+        throw(PointMatchingEx);
+    }
+}
+
+static Normalisation normalise(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init,
+                               Eigen::MatrixXd& fixed, Eigen::MatrixXd& moving) {
+    Normalisation normalisation;
+    normalisation.centre = surface1.rowwise().mean();
+    normalisation.scale = sqrt((surface1.colwise() - normalisation.centre).colwise().squaredNorm().mean());
+    if(!(normalisation.scale > 0)) {
+        normalisation.scale = 1;
+    }
+    fixed = (surface1.colwise() - normalisation.centre) / normalisation.scale;
+    moving = (apply_transform(surface2, transform_init).colwise() - normalisation.centre) / normalisation.scale;
+    return normalisation;
+}
+
+static bool likelihood_converged(double negative_log_likelihood, double previous, double tolerance) {
+    return std::abs(negative_log_likelihood - previous) <= tolerance * std::abs(negative_log_likelihood);
+}
+
+// Variances below this (in normalised units) mean that the clouds fit exactly, and EM stops.
+static const double min_variance = 1E-12;
+
+CpdResult cpd_register_surfaces(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init,
+                                const CpdOptions& options) {
+    // The M-step is a weighted Procrustes problem: with A the weighted cross-covariance of the fixed points and the moving
+    // points they are matched to, R comes from the SVD of A, t matches the weighted centroids, and sigma2 is the weighted
+    // residual.
+    validate_clouds(surface1, surface2, options);
+    Eigen::MatrixXd fixed;
+    Eigen::MatrixXd moving;
+    auto normalisation = normalise(surface1, surface2, transform_init, fixed, moving);
+
+    Eigen::Matrix3d rotation = Eigen::Matrix3d::Identity();
+    Eigen::Vector3d translation = Eigen::Vector3d::Zero();
+    double sigma2 = initial_variance(fixed, moving);
+    double fixed_squared_norms = 0;
+
+    CpdResult result;
+    result.iterations = 0;
+    result.converged = false;
+
+    Expectation e;
+    double previous = 0;
+    Eigen::MatrixXd transformed;
+    while(result.iterations < options.max_iterations && sigma2 > min_variance) {
+        transformed = (rotation * moving).colwise() + translation;
+        expectation(fixed, transformed, sigma2, options, e);
+        if(result.iterations > 0 && likelihood_converged(e.negative_log_likelihood, previous, options.tolerance)) {
+            result.converged = true;
+            break;
+        }
+        previous = e.negative_log_likelihood;
+
+        Eigen::Vector3d fixed_mean = fixed * e.Pt1 / e.Np;
+        Eigen::Vector3d moving_mean = moving * e.P1 / e.Np;
+        Eigen::Matrix3d A = e.PX * moving.transpose() - e.Np * fixed_mean * moving_mean.transpose();
+        Eigen::JacobiSVD<Eigen::Matrix3d> svd(A, Eigen::ComputeFullU | Eigen::ComputeFullV);
+        Eigen::Matrix3d correction = Eigen::Matrix3d::Identity();
+        correction(2, 2) = (svd.matrixU() * svd.matrixV().transpose()).determinant();
+        rotation = svd.matrixU() * correction * svd.matrixV().transpose();
+        translation = fixed_mean - rotation * moving_mean;
+
+        fixed_squared_norms = e.Pt1.dot(fixed.colwise().squaredNorm().transpose()) - e.Np * fixed_mean.squaredNorm();
+        double moving_squared_norms = e.P1.dot(moving.colwise().squaredNorm().transpose()) - e.Np * moving_mean.squaredNorm();
+        sigma2 = (fixed_squared_norms - 2 * (A.transpose() * rotation).trace() + moving_squared_norms) / (3 * e.Np);
+        result.iterations++;
+    }
+    if(sigma2 <= min_variance) {
+        result.converged = true;
+        sigma2 = min_variance;
+    }
+
+    // Undo the normalisation: x = R (T_init y - c) + scale t + c.
+    Eigen::Matrix4d increment = Eigen::Matrix4d::Identity();
+    increment.block(0,0,3,3) = rotation;
+    increment.block(0,3,3,1) = normalisation.scale * translation + normalisation.centre - rotation * normalisation.centre;
+    result.transform = increment * transform_init;
+    result.points = apply_transform(surface2, result.transform);
+    result.sigma2 = sigma2 * normalisation.scale * normalisation.scale;
+    return result;
+}
+
+static Eigen::MatrixXd nystrom_factor(const Eigen::MatrixXd& points, double beta, int rank, int threads) {
+    // B with B B' approximating the kernel matrix G(i, j) = exp(-|y_i - y_j|^2 / (2 beta^2)): with C the kernel between
+    // all points and a random set of landmarks, and W = U S U' its rows at the landmarks, G ~ C W^-1 C' = B B' for
+    // B = C U S^-1/2. Directions of W with negligible eigenvalues are dropped. With every point a landmark, B B' = G.
+    int m = points.cols();
+    std::vector<int> landmarks(m);
+    std::iota(landmarks.begin(), landmarks.end(), 0);
+    if(rank < m) {
+        std::mt19937 generator(1);
+        std::shuffle(landmarks.begin(), landmarks.end(), generator);
+        landmarks.resize(rank);
+    }
+    int k = static_cast<int>(landmarks.size());
+
+    Eigen::MatrixXd C(m, k);
+    double scale = 1 / (2 * beta * beta);
+    parallel_for_blocks(m, threads, [&](int begin, int end, int) {
+        for(int i = begin; i < end; i++) {
+            for(int j = 0; j < k; j++) {
+                C(i, j) = exp(-scale * (points.col(i) - points.col(landmarks[j])).squaredNorm());
+            }
+        }
+    });
+
+    Eigen::MatrixXd W(k, k);
+    for(int j = 0; j < k; j++) {
+        W.row(j) = C.row(landmarks[j]);
+    }
+    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(W);
+    const auto& eigenvalues = solver.eigenvalues();
+    int kept = 0;
+    for(int j = 0; j < k; j++) {
+        kept += eigenvalues(j) > 1E-10 * eigenvalues(k - 1);
+    }
+    Eigen::MatrixXd U = solver.eigenvectors().rightCols(kept);
+    Eigen::VectorXd inverse_roots = eigenvalues.tail(kept).cwiseSqrt().cwiseInverse();
+    return C * U * inverse_roots.asDiagonal();
+}
+
+CpdResult cpd_deform_surfaces(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init,
+                              const CpdOptions& options) {
+    // The moving points y_m become y_m + (G W)_m. The M-step solves (d(P1) G + lambda sigma2 I) W = PX - d(P1) Y, which
+    // with G = B B' (B being M x rank) reduces by the Woodbury identity to a rank x rank system, so that G is never formed.
+    validate_clouds(surface1, surface2, options);
+    if(!(options.beta > 0 && options.lambda > 0) || options.rank < 1) {
+        std::cerr << "Non-rigid CPD needs positive beta, lambda and rank." << std::endl;
+        throw(PointMatchingEx);
+    }
+    Eigen::MatrixXd fixed;
+    Eigen::MatrixXd moving;
+    auto normalisation = normalise(surface1, surface2, transform_init, fixed, moving);
+
+    Eigen::MatrixXd B = nystrom_factor(moving, options.beta, options.rank, options.gauss_transform.threads);
+    Eigen::MatrixXd displacements = Eigen::MatrixXd::Zero(moving.cols(), 3);
+    Eigen::MatrixXd deformed = moving;
+    double sigma2 = initial_variance(fixed, moving);
+
+    CpdResult result;
+    result.iterations = 0;
+    result.converged = false;
+
+    Expectation e;
+    double previous = 0;
+    while(result.iterations < options.max_iterations && sigma2 > min_variance) {
+        expectation(fixed, deformed, sigma2, options, e);
+        if(result.iterations > 0 && likelihood_converged(e.negative_log_likelihood, previous, options.tolerance)) {
+            result.converged = true;
+            break;
+        }
+        previous = e.negative_log_likelihood;
+
+        double a = options.lambda * sigma2;
+        Eigen::MatrixXd F = e.PX.transpose() - e.P1.asDiagonal() * moving.transpose();
+        Eigen::MatrixXd BtF = B.transpose() * F;
+        Eigen::MatrixXd BtPB = B.transpose() * e.P1.asDiagonal() * B;
+        Eigen::MatrixXd system = BtPB;
+        system.diagonal().array() += a;
+        displacements = B * (BtF - BtPB * system.ldlt().solve(BtF)) / a;
+        deformed = moving + displacements.transpose();
+
+        double fixed_squared_norms = e.Pt1.dot(fixed.colwise().squaredNorm().transpose());
+        double deformed_squared_norms = e.P1.dot(deformed.colwise().squaredNorm().transpose());
+        sigma2 = (fixed_squared_norms - 2 * e.PX.cwiseProduct(deformed).sum() + deformed_squared_norms) / (3 * e.Np);
+        result.iterations++;
+    }
+    if(sigma2 <= min_variance) {
+        result.converged = true;
+        sigma2 = min_variance;
+    }
+
+    result.transform = transform_init;
+    result.points = (normalisation.scale * deformed).colwise() + normalisation.centre;
+    result.sigma2 = sigma2 * normalisation.scale * normalisation.scale;
+    return result;
+}
@@ -0,0 +1,57 @@
+/* Coherent Point Drift, after "Point Set Registration: Coherent Point Drift", Myronenko and Song, 2010. The moving points
+   are the centroids of a Gaussian mixture, with a uniform outlier component, fitted to the fixed points by expectation
+   maximisation: rigidly, or with a smooth displacement field regularised by a Gaussian kernel. The E-step's sums over
+   all pairs of points are Gauss transforms, evaluated by the fast Gauss transform or a truncated k-d tree search. */
+#ifndef CPD_INCLUDED
+#define CPD_INCLUDED
+
+#include <Eigen/Dense>
+
+#include <GaussTransform.hpp>
+
+struct CpdOptions {
+    // Weight of the uniform outlier component, between 0 and 1.
+    double outlier_weight = 0.1;
+
+    // EM stops after max_iterations, or once the negative log-likelihood changes by less than tolerance times its magnitude.
+    int max_iterations = 150;
+    double tolerance = 1E-6;
+
+    // Width of the Gaussian smoothing the displacement field, and the weight of the smoothness term, for
+    // cpd_deform_surfaces. Both are in units in which the fixed cloud has unit RMS radius about its centroid.
+    double beta = 2;
+    double lambda = 2;
+
+    // Number of landmark points through which the smoothing kernel is approximated (by the Nystrom method), or all the
+    // moving points if there are fewer.
+    int rank = 100;
+
+    // Method and precision of the E-step's Gauss transforms, and the threads used for them.
+    GaussTransformOptions gauss_transform;
+};
+
+struct CpdResult {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    // Maps the moving cloud onto the fixed one, as for register_surfaces (for cpd_deform_surfaces, the transform_init
+    // that the displacements are added after).
+    Eigen::Matrix4d transform;
+
+    // The moving cloud after registration.
+    Eigen::MatrixXd points;
+
+    // Final variance of the mixture components, which shrinks towards the squared registration error.
+    double sigma2;
+
+    int iterations;
+    bool converged;
+};
+
+// Rigid CPD, starting from transform_init.
+CpdResult cpd_register_surfaces(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init,
+                                const CpdOptions& options = CpdOptions());
+
+// Non-rigid CPD: each point of surface2, after transform_init, is displaced by a smooth field to fit surface1.
+CpdResult cpd_deform_surfaces(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init,
+                              const CpdOptions& options = CpdOptions());
+#endif
@@ -0,0 +1,385 @@
+/* Distance to a point cloud, precomputed on a regular grid so that it can be looked up in constant time, and signed
+   distance to a triangle mesh, precomputed in a narrow band around it */
+#include <DistanceField.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <unordered_map>
+
+#include <Exceptions.hpp>
+#include <Parallel.hpp>
+#include <TriangleBvh.hpp>
+
+DistanceField::DistanceField(const Eigen::MatrixXd& surface, double cell_size, double margin) : cell(cell_size) {
+    // Closest points are propagated across the grid rather than searched for at every node: the nodes within a cell or
+    // so of each point are seeded with it, and a forward and a backward raster sweep then pass each node's closest point
+    // on to its neighbours wherever it is closer than theirs. Near the surface this is exact or nearly so; further away
+    // it can overestimate by a fraction of a cell.
+    if(surface.rows() != 3 || surface.cols() < 1) {
+        std::cerr << "A distance field needs a non-empty 3D point cloud." << std::endl;
+        throw(PointMatchingEx);
+    }
+    if(!(cell_size > 0) || !(margin >= 0)) {
+        std::cerr << "Distance field cell size must be positive, and its margin non-negative." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    Eigen::Vector3d lower = surface.rowwise().minCoeff();
+    Eigen::Vector3d upper = surface.rowwise().maxCoeff();
+    origin = lower - Eigen::Vector3d::Constant(margin);
+    for(int d = 0; d < 3; d++) {
+        dimensions[d] = static_cast<int>(ceil((upper(d) - lower(d) + 2 * margin) / cell)) + 1;
+    }
+    size_t node_count = static_cast<size_t>(dimensions[0]) * dimensions[1] * dimensions[2];
+
+    std::vector<int> closest(node_count, -1);
+    std::vector<double> squared_distances(node_count, std::numeric_limits<double>::infinity());
+    const double* points = surface.data();
+    auto offer = [&](int x, int y, int z, int point) {
+        size_t node = (static_cast<size_t>(z) * dimensions[1] + y) * dimensions[0] + x;
+        double offset_x = origin(0) + cell * x - points[3 * point];
+        double offset_y = origin(1) + cell * y - points[3 * point + 1];
+        double offset_z = origin(2) + cell * z - points[3 * point + 2];
+        double squared_distance = offset_x * offset_x + offset_y * offset_y + offset_z * offset_z;
+        if(squared_distance < squared_distances[node]) {
+            squared_distances[node] = squared_distance;
+            closest[node] = point;
+        }
+    };
+
+    for(int i = 0; i < surface.cols(); i++) {
+        int base[3];
+        for(int d = 0; d < 3; d++) {
+            base[d] = std::min(static_cast<int>(floor((surface(d, i) - origin(d)) / cell)), dimensions[d] - 1);
+        }
+        for(int z = std::max(base[2] - 1, 0); z <= std::min(base[2] + 2, dimensions[2] - 1); z++) {
+            for(int y = std::max(base[1] - 1, 0); y <= std::min(base[1] + 2, dimensions[1] - 1); y++) {
+                for(int x = std::max(base[0] - 1, 0); x <= std::min(base[0] + 2, dimensions[0] - 1); x++) {
+                    offer(x, y, z, i);
+                }
+            }
+        }
+    }
+
+    // The forward sweep looks at the 13 neighbours already visited in raster order, and the backward sweep at the other 13.
+    for(int direction = 1; direction >= -1; direction -= 2) {
+        int first_z = direction > 0 ? 0 : dimensions[2] - 1;
+        int first_y = direction > 0 ? 0 : dimensions[1] - 1;
+        int first_x = direction > 0 ? 0 : dimensions[0] - 1;
+        for(int z = first_z; z >= 0 && z < dimensions[2]; z += direction) {
+            for(int y = first_y; y >= 0 && y < dimensions[1]; y += direction) {
+                for(int x = first_x; x >= 0 && x < dimensions[0]; x += direction) {
+                    for(int dz = -1; dz <= 0; dz++) {
+                        for(int dy = -1; dy <= 1; dy++) {
+                            for(int dx = -1; dx <= 1; dx++) {
+                                if(dz == 0 && (dy > 0 || (dy == 0 && dx >= 0))) {
+                                    continue;
+                                }
+                                int nx = x + direction * dx;
+                                int ny = y + direction * dy;
+                                int nz = z + direction * dz;
+                                if(nx < 0 || ny < 0 || nz < 0 || nx >= dimensions[0] || ny >= dimensions[1] || nz >= dimensions[2]) {
+                                    continue;
+                                }
+                                int candidate = closest[(static_cast<size_t>(nz) * dimensions[1] + ny) * dimensions[0] + nx];
+                                if(candidate >= 0) {
+                                    offer(x, y, z, candidate);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    values.resize(node_count);
+    for(size_t node = 0; node < node_count; node++) {
+        values[node] = static_cast<float>(sqrt(squared_distances[node]));
+    }
+}
+
+double DistanceField::value(int x, int y, int z) const {
+    return values[(static_cast<size_t>(z) * dimensions[1] + y) * dimensions[0] + x];
+}
+
+double DistanceField::distance(const Eigen::Vector3d& point) const {
+    double outside;
+    double interpolated = interpolate(point, outside);
+    return interpolated + outside;
+}
+
+double DistanceField::lower_distance(const Eigen::Vector3d& point) const {
+    // The true distance is 1-Lipschitz, so it is at least that at the nearest grid point less outside, and the grid's
+    // interpolant exceeds it there by at most the interpolation and propagation errors.
+    double outside;
+    double interpolated = interpolate(point, outside);
+    return interpolated - (sqrt(3.0) / 2 + 1) * cell - outside;
+}
+
+double DistanceField::interpolate(const Eigen::Vector3d& point, double& outside) const {
+    Eigen::Vector3d grid = (point - origin) / cell;
+
+    // Clamp into the grid, remembering how far outside the point was.
+    Eigen::Vector3d clamped;
+    int base[3];
+    double fraction[3];
+    for(int d = 0; d < 3; d++) {
+        clamped(d) = std::min(std::max(grid(d), 0.0), static_cast<double>(dimensions[d] - 1));
+        base[d] = std::min(static_cast<int>(clamped(d)), dimensions[d] - 2 < 0 ? 0 : dimensions[d] - 2);
+        fraction[d] = dimensions[d] > 1 ? clamped(d) - base[d] : 0;
+    }
+    outside = (grid - clamped).norm() * cell;
+
+    double interpolated = 0;
+    for(int corner = 0; corner < 8; corner++) {
+        int offset[3] = { corner & 1, (corner >> 1) & 1, (corner >> 2) & 1 };
+        double weight = 1;
+        int index[3];
+        for(int d = 0; d < 3; d++) {
+            weight *= offset[d] ? fraction[d] : 1 - fraction[d];
+            index[d] = std::min(base[d] + offset[d], dimensions[d] - 1);
+        }
+        if(weight > 0) {
+            interpolated += weight * value(index[0], index[1], index[2]);
+        }
+    }
+
+    return interpolated;
+}
+
+double DistanceField::cell_size() const {
+    return cell;
+}
+
+Eigen::Vector3d DistanceField::lower_corner() const {
+    return origin;
+}
+
+Eigen::Vector3d DistanceField::upper_corner() const {
+    return origin + cell * Eigen::Vector3d(dimensions[0] - 1, dimensions[1] - 1, dimensions[2] - 1);
+}
+
+// Angle-weighted pseudo-normals of a mesh's vertices and edges, after "Signed Distance Computation Using the Angle Weighted
+// Pseudonormal", Baerentzen and Aanaes, 2005: the sign of (p - q) . n, for q the closest point on the mesh to p and n the
+// pseudo-normal of the face, edge or vertex that q lies on, tells which side of the surface p is on.
+struct PseudoNormals {
+    Eigen::MatrixXd vertices;
+    std::unordered_map<long long, Eigen::Vector3d> edges;
+
+    static long long edge_key(int a, int b) {
+        return static_cast<long long>(std::min(a, b)) * (1LL << 32) + std::max(a, b);
+    }
+
+    PseudoNormals(const TriangleMesh& mesh, const Eigen::MatrixXd& face_normals) : vertices(Eigen::MatrixXd::Zero(3, mesh.vertices.cols())) {
+        for(int t = 0; t < mesh.triangles.cols(); t++) {
+            for(int k = 0; k < 3; k++) {
+                int v = mesh.triangles(k, t);
+                int next = mesh.triangles((k + 1) % 3, t);
+                int previous = mesh.triangles((k + 2) % 3, t);
+                Eigen::Vector3d to_next = mesh.vertices.col(next) - mesh.vertices.col(v);
+                Eigen::Vector3d to_previous = mesh.vertices.col(previous) - mesh.vertices.col(v);
+                double angle = atan2(to_next.cross(to_previous).norm(), to_next.dot(to_previous));
+                vertices.col(v) += angle * face_normals.col(t);
+                auto edge = edges.emplace(edge_key(v, next), Eigen::Vector3d::Zero()).first;
+                edge->second += face_normals.col(t);
+            }
+        }
+    }
+
+    Eigen::Vector3d normal(const TriangleMesh& mesh, const Eigen::MatrixXd& face_normals, int t, const Eigen::Vector3d& point) const {
+        // The barycentric coordinates of point, which lies on triangle t, say which feature it is on.
+        static const double tolerance = 1E-9;
+        Eigen::Vector3d a = mesh.vertices.col(mesh.triangles(0, t));
+        Eigen::Vector3d e0 = mesh.vertices.col(mesh.triangles(1, t)) - a;
+        Eigen::Vector3d e1 = mesh.vertices.col(mesh.triangles(2, t)) - a;
+        Eigen::Vector3d d = point - a;
+        double d00 = e0.squaredNorm();
+        double d01 = e0.dot(e1);
+        double d11 = e1.squaredNorm();
+        double determinant = d00 * d11 - d01 * d01;
+        if(!(determinant > 0)) {
+            return face_normals.col(t);
+        }
+        double weights[3];
+        weights[1] = (d11 * d.dot(e0) - d01 * d.dot(e1)) / determinant;
+        weights[2] = (d00 * d.dot(e1) - d01 * d.dot(e0)) / determinant;
+        weights[0] = 1 - weights[1] - weights[2];
+
+        int zeros = 0;
+        int nonzero[3];
+        int count = 0;
+        for(int k = 0; k < 3; k++) {
+            if(weights[k] < tolerance) {
+                zeros++;
+            } else {
+                nonzero[count++] = k;
+            }
+        }
+        if(zeros >= 2 && count == 1) {
+            return vertices.col(mesh.triangles(nonzero[0], t));
+        }
+        if(zeros == 1) {
+            auto edge = edges.find(edge_key(mesh.triangles(nonzero[0], t), mesh.triangles(nonzero[1], t)));
+            if(edge != edges.end()) {
+                return edge->second;
+            }
+        }
+        return face_normals.col(t);
+    }
+};
+
+SignedDistanceField::SignedDistanceField(const TriangleMesh& mesh, double cell_size, double band, int threads)
+    : SignedDistanceField(mesh, TriangleBvh(mesh), cell_size, band, threads) {
+}
+
+SignedDistanceField::SignedDistanceField(const TriangleMesh& mesh, const TriangleBvh& bvh, double cell_size, double band, int threads)
+    : cell(cell_size), band_width(band) {
+    // Bricks are allocated wherever a triangle's bounding box, grown by band, reaches, and every node in them is then
+    // given its exact distance from a closest-point query on a bounding volume hierarchy, limited to a little beyond the
+    // band, and signed by the pseudo-normal of the feature the closest point lies on. Bricks are filled in parallel.
+    if(!(cell_size > 0) || !(band > 0)) {
+        std::cerr << "Signed distance field cell size and band must be positive." << std::endl;
+        throw(PointMatchingEx);
+    }
+    PseudoNormals pseudo_normals(mesh, bvh.normals());
+
+    Eigen::Vector3d lower = mesh.vertices.rowwise().minCoeff();
+    Eigen::Vector3d upper = mesh.vertices.rowwise().maxCoeff();
+    origin = lower - Eigen::Vector3d::Constant(band + cell);
+    for(int d = 0; d < 3; d++) {
+        dimensions[d] = static_cast<int>(ceil((upper(d) - lower(d) + 2 * (band + cell)) / cell)) + 1;
+        brick_dimensions[d] = (dimensions[d] + brick_size - 1) / brick_size;
+    }
+    size_t brick_count = static_cast<size_t>(brick_dimensions[0]) * brick_dimensions[1] * brick_dimensions[2];
+    bricks.assign(brick_count, -1);
+
+    std::vector<size_t> stored;
+    for(int t = 0; t < mesh.triangles.cols(); t++) {
+        Eigen::Vector3d triangle_lower = mesh.vertices.col(mesh.triangles(0, t));
+        Eigen::Vector3d triangle_upper = triangle_lower;
+        for(int k = 1; k < 3; k++) {
+            triangle_lower = triangle_lower.cwiseMin(mesh.vertices.col(mesh.triangles(k, t)));
+            triangle_upper = triangle_upper.cwiseMax(mesh.vertices.col(mesh.triangles(k, t)));
+        }
+        int first[3];
+        int last[3];
+        for(int d = 0; d < 3; d++) {
+            first[d] = std::max(0, static_cast<int>(floor((triangle_lower(d) - band - origin(d)) / cell)) / brick_size);
+            last[d] = std::min(brick_dimensions[d] - 1, static_cast<int>(ceil((triangle_upper(d) + band - origin(d)) / cell)) / brick_size);
+        }
+        for(int z = first[2]; z <= last[2]; z++) {
+            for(int y = first[1]; y <= last[1]; y++) {
+                for(int x = first[0]; x <= last[0]; x++) {
+                    size_t brick = (static_cast<size_t>(z) * brick_dimensions[1] + y) * brick_dimensions[0] + x;
+                    if(bricks[brick] < 0) {
+                        bricks[brick] = static_cast<int>(stored.size());
+                        stored.push_back(brick);
+                    }
+                }
+            }
+        }
+    }
+
+    // Nodes with no triangle within reach are left unsigned, at band. Every cell with such a corner has all its corners
+    // beyond the band, and is not interpolated.
+    const int brick_nodes = brick_size * brick_size * brick_size;
+    double reach = band + 2 * cell;
+    values.resize(stored.size() * brick_nodes);
+    parallel_for_blocks(static_cast<int>(stored.size()), threads, [&](int begin, int end, int) {
+        Eigen::Vector3d closest;
+        double squared_distance;
+        for(int b = begin; b < end; b++) {
+            size_t brick = stored[b];
+            int corner[3] = { static_cast<int>(brick % brick_dimensions[0]), static_cast<int>(brick / brick_dimensions[0] % brick_dimensions[1]),
+                              static_cast<int>(brick / brick_dimensions[0] / brick_dimensions[1]) };
+            for(int node = 0; node < brick_nodes; node++) {
+                Eigen::Vector3d point = origin + cell * Eigen::Vector3d(corner[0] * brick_size + node % brick_size,
+                                                                        corner[1] * brick_size + node / brick_size % brick_size,
+                                                                        corner[2] * brick_size + node / (brick_size * brick_size));
+                int t = bvh.closest_point(point, reach, closest, squared_distance);
+                double distance = band;
+                if(t >= 0) {
+                    distance = std::min(sqrt(squared_distance), band);
+                    if((point - closest).dot(pseudo_normals.normal(mesh, bvh.normals(), t, closest)) < 0) {
+                        distance = -distance;
+                    }
+                }
+                values[static_cast<size_t>(b) * brick_nodes + node] = static_cast<float>(distance);
+            }
+        }
+    });
+}
+
+bool SignedDistanceField::distance(const Eigen::Vector3d& point, double& value, Eigen::Vector3d& gradient) const {
+    value = band_width;
+    gradient.setZero();
+
+    Eigen::Vector3d grid = (point - origin) / cell;
+    int base[3];
+    double fraction[3];
+    for(int d = 0; d < 3; d++) {
+        if(!(grid(d) >= 0 && grid(d) < dimensions[d] - 1)) {
+            return false;
+        }
+        base[d] = static_cast<int>(grid(d));
+        fraction[d] = grid(d) - base[d];
+    }
+
+    // The eight corners' values, then the interpolant and its derivative along each axis.
+    double corners[8];
+    for(int corner = 0; corner < 8; corner++) {
+        int x = base[0] + (corner & 1);
+        int y = base[1] + ((corner >> 1) & 1);
+        int z = base[2] + ((corner >> 2) & 1);
+        int brick = bricks[(static_cast<size_t>(z / brick_size) * brick_dimensions[1] + y / brick_size) * brick_dimensions[0] + x / brick_size];
+        if(brick < 0) {
+            return false;
+        }
+        int node = ((z % brick_size) * brick_size + y % brick_size) * brick_size + x % brick_size;
+        corners[corner] = values[static_cast<size_t>(brick) * brick_size * brick_size * brick_size + node];
+        if(std::abs(corners[corner]) >= band_width) {
+            return false;
+        }
+    }
+
+    double interpolated = 0;
+    Eigen::Vector3d derivative = Eigen::Vector3d::Zero();
+    for(int corner = 0; corner < 8; corner++) {
+        double weights[3];
+        double slopes[3];
+        for(int d = 0; d < 3; d++) {
+            bool upper = (corner >> d) & 1;
+            weights[d] = upper ? fraction[d] : 1 - fraction[d];
+            slopes[d] = upper ? 1 : -1;
+        }
+        interpolated += weights[0] * weights[1] * weights[2] * corners[corner];
+        derivative(0) += slopes[0] * weights[1] * weights[2] * corners[corner];
+        derivative(1) += weights[0] * slopes[1] * weights[2] * corners[corner];
+        derivative(2) += weights[0] * weights[1] * slopes[2] * corners[corner];
+    }
+    value = interpolated;
+    gradient = derivative / cell;
+    return true;
+}
+
+double SignedDistanceField::distance(const Eigen::Vector3d& point) const {
+    double value;
+    Eigen::Vector3d gradient;
+    distance(point, value, gradient);
+    return value;
+}
+
+double SignedDistanceField::cell_size() const {
+    return cell;
+}
+
+double SignedDistanceField::band() const {
+    return band_width;
+}
+
+int SignedDistanceField::stored_nodes() const {
+    return static_cast<int>(values.size());
+}
@@ -0,0 +1,81 @@
+/* Distance to a point cloud, precomputed on a regular grid so that it can be looked up in constant time, and signed
+   distance to a triangle mesh, precomputed in a narrow band around it */
+#ifndef DISTANCEFIELD_INCLUDED
+#define DISTANCEFIELD_INCLUDED
+
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include <TriangleBvh.hpp>
+#include <TriangleMesh.hpp>
+
+class DistanceField {
+public:
+    // Samples the distance to the nearest point of surface at the nodes of a grid with the given cell size, covering the
+    // surface's bounding box grown by margin on every side.
+    DistanceField(const Eigen::MatrixXd& surface, double cell_size, double margin);
+
+    // Trilinearly interpolated distance. Beyond the grid, the distance at the nearest grid point plus the distance to it.
+    double distance(const Eigen::Vector3d& point) const;
+
+    // A distance no greater than the true distance from point to the surface. Interpolation can overestimate by up to
+    // sqrt(3)/2 cells, propagation by a fraction of a cell (taken as a whole cell), and beyond the grid the distance to
+    // the nearest grid point is subtracted rather than added.
+    double lower_distance(const Eigen::Vector3d& point) const;
+
+    double cell_size() const;
+
+    Eigen::Vector3d lower_corner() const;
+
+    Eigen::Vector3d upper_corner() const;
+
+private:
+    double value(int x, int y, int z) const;
+
+    // The interpolated distance at the grid point nearest to point, and how far point is from it.
+    double interpolate(const Eigen::Vector3d& point, double& outside) const;
+
+    Eigen::Vector3d origin;
+    double cell;
+    int dimensions[3];
+    std::vector<float> values;
+};
+
+class SignedDistanceField {
+public:
+    // Samples the signed distance to mesh, positive on the side its triangles' normals face, at the nodes of a grid with
+    // the given cell size, in bricks of 8x8x8 nodes. Only bricks within band of a triangle are stored, and their values
+    // are clamped to [-band, band]; everywhere else reads as band.
+    SignedDistanceField(const TriangleMesh& mesh, double cell_size, double band, int threads = 0);
+
+    // As above, with closest points from bvh, which must have been built over mesh, so that callers with one can share it.
+    SignedDistanceField(const TriangleMesh& mesh, const TriangleBvh& bvh, double cell_size, double band, int threads = 0);
+
+    // Trilinearly interpolated signed distance, and the gradient of the interpolant. Returns false, with a value of band
+    // and a zero gradient, for points in cells with a corner outside the stored bricks or clamped to the band.
+    bool distance(const Eigen::Vector3d& point, double& value, Eigen::Vector3d& gradient) const;
+
+    double distance(const Eigen::Vector3d& point) const;
+
+    double cell_size() const;
+
+    double band() const;
+
+    // Number of grid nodes stored, which is a small fraction of the grid for a thin band.
+    int stored_nodes() const;
+
+private:
+    static const int brick_size = 8;
+
+    Eigen::Vector3d origin;
+    double cell;
+    double band_width;
+    int dimensions[3];
+    int brick_dimensions[3];
+
+    // Index of each brick's values (in units of brick_size^3 nodes), or -1 for bricks outside the band.
+    std::vector<int> bricks;
+    std::vector<float> values;
+};
+#endif
@@ -6,3 +6,9 @@ const char* PointMatchingException::what() const throw() {
 }
 
 PointMatchingException PointMatchingEx;
+
+const char* RegistrationCancelledException::what() const throw() {
+    return "Registration cancelled";
+}
+
+RegistrationCancelledException RegistrationCancelledEx;
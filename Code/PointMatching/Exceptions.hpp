@@ -6,4 +6,9 @@
 extern class PointMatchingException : public std::exception {
     virtual const char* what() const throw();
 } PointMatchingEx;
+
+// Thrown when a registration notices that its cancellation token has been cancelled.
+extern class RegistrationCancelledException : public PointMatchingException {
+    virtual const char* what() const throw();
+} RegistrationCancelledEx;
 #endif
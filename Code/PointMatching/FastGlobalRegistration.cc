@@ -0,0 +1,129 @@
+/* Fast Global Registration, after "Fast Global Registration", Zhou, Park and Koltun, 2016. A robust objective over
+   feature matches is minimised directly, with no nearest-neighbour search inside the loop; a scaled Geman-McClure penalty
+   is relaxed from nearly convex to its final width as iterations proceed (graduated non-convexity). */
+#include <FastGlobalRegistration.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <Exceptions.hpp>
+#include <Util.hpp>
+
+static std::vector<int> tuple_test(const Eigen::MatrixXd& fixed, const Eigen::MatrixXd& moving, const Eigen::ArrayXi& matches,
+                                   const FastGlobalRegistrationOptions& options) {
+    // Keep the matches that belong to at least one random triple whose three edge lengths agree between the clouds to
+    // within tuple_scale, as those of a rigid motion must. Stops once as many triples have passed as there are matches.
+    int n = moving.cols();
+    std::vector<char> kept(n, false);
+    std::mt19937 random(options.seed);
+    std::uniform_int_distribution<int> pick(0, n - 1);
+
+    int passed = 0;
+    for(long long trial = 0; trial < static_cast<long long>(options.tuple_trials) * n && passed < n; trial++) {
+        int sample[3] = { pick(random), pick(random), pick(random) };
+        if(sample[0] == sample[1] || sample[1] == sample[2] || sample[0] == sample[2]) {
+            continue;
+        }
+
+        bool consistent = true;
+        for(int a = 0; a < 3 && consistent; a++) {
+            int b = (a + 1) % 3;
+            double moving_length = (moving.col(sample[a]) - moving.col(sample[b])).norm();
+            double fixed_length = (fixed.col(matches(sample[a])) - fixed.col(matches(sample[b]))).norm();
+            consistent = std::min(moving_length, fixed_length) >= options.tuple_scale * std::max(moving_length, fixed_length);
+        }
+        if(consistent) {
+            kept[sample[0]] = kept[sample[1]] = kept[sample[2]] = true;
+            passed++;
+        }
+    }
+
+    std::vector<int> indices;
+    for(int i = 0; i < n; i++) {
+        if(kept[i]) {
+            indices.push_back(i);
+        }
+    }
+    return indices;
+}
+
+FastGlobalRegistrationResult fast_global_registration(const Eigen::MatrixXd& fixed, const Eigen::MatrixXd& moving, const Eigen::ArrayXi& matches,
+                                                      const FastGlobalRegistrationOptions& options) {
+    // Each iteration weights every match by (mu / (mu + r^2))^2, the line-process weight that makes the weighted least
+    // squares problem equivalent to the Geman-McClure one at the current transform, then takes a single Gauss-Newton step
+    // on the weighted problem, which is a dense 6x6 solve.
+    if(matches.size() != moving.cols() || moving.rows() != 3 || fixed.rows() != 3) {
+        std::cerr << "Fast global registration needs 3D clouds and one match per moving point." << std::endl;
+        throw(PointMatchingEx);
+    }
+    if(options.iterations < 1 || !(options.annealing_factor > 1) || options.annealing_interval < 1) {
+        std::cerr << "Fast global registration needs at least one iteration, and an annealing factor above one." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    std::vector<int> correspondences;
+    if(options.tuple_test) {
+        correspondences = tuple_test(fixed, moving, matches, options);
+    } else {
+        for(int i = 0; i < moving.cols(); i++) {
+            correspondences.push_back(i);
+        }
+    }
+    if(correspondences.size() < 3) {
+        std::cerr << "Too few consistent matches for fast global registration." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    double diameter = (fixed.rowwise().maxCoeff() - fixed.rowwise().minCoeff()).norm();
+    double max_distance = options.max_correspondence_distance > 0 ? options.max_correspondence_distance : diameter / 40;
+    double width = diameter;
+
+    Eigen::Matrix4d transform = Eigen::Matrix4d::Identity();
+    for(int iteration = 0; iteration < options.iterations; iteration++) {
+        if(iteration % options.annealing_interval == 0 && iteration > 0) {
+            width = std::max(width / options.annealing_factor, max_distance);
+        }
+        double mu = width * width;
+
+        Eigen::Matrix3d rotation = transform.block(0,0,3,3);
+        Eigen::Vector3d translation = transform.block(0,3,3,1);
+
+        Eigen::Matrix<double, 6, 6> JtJ = Eigen::Matrix<double, 6, 6>::Zero();
+        Vector6d Jtr = Vector6d::Zero();
+        for(unsigned int k = 0; k < correspondences.size(); k++) {
+            int i = correspondences[k];
+            Eigen::Vector3d x = rotation * moving.col(i) + translation;
+            Eigen::Vector3d d = fixed.col(matches(i)) - x;
+            double weight = mu / (mu + d.squaredNorm());
+            weight *= weight;
+
+            // d(xi) = q - exp(xi) x, so the Jacobian with respect to (omega, v) is [skew(x), -I].
+            Eigen::Matrix<double, 3, 6> J;
+            J << skew(x), -Eigen::Matrix3d::Identity();
+
+            JtJ += weight * J.transpose() * J;
+            Jtr += weight * J.transpose() * d;
+        }
+
+        Vector6d increment = -JtJ.ldlt().solve(Jtr);
+        if(!increment.allFinite()) {
+            break;
+        }
+        transform = se3_exp(increment) * transform;
+    }
+
+    FastGlobalRegistrationResult result;
+    result.transform = transform;
+    result.correspondences = correspondences.size();
+    result.inliers = 0;
+    for(unsigned int k = 0; k < correspondences.size(); k++) {
+        int i = correspondences[k];
+        Eigen::Vector3d x = transform.block(0,0,3,3) * moving.col(i) + transform.block(0,3,3,1);
+        if((fixed.col(matches(i)) - x).norm() < max_distance) {
+            result.inliers++;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,39 @@
+/* Fast Global Registration, after "Fast Global Registration", Zhou, Park and Koltun, 2016. A robust objective over
+   feature matches is minimised directly, with no nearest-neighbour search inside the loop; a scaled Geman-McClure penalty
+   is relaxed from nearly convex to its final width as iterations proceed (graduated non-convexity). */
+#ifndef FASTGLOBALREGISTRATION_INCLUDED
+#define FASTGLOBALREGISTRATION_INCLUDED
+
+#include <Eigen/Dense>
+
+struct FastGlobalRegistrationOptions {
+    int iterations = 64;
+
+    // The Geman-McClure width starts at the diameter of the fixed cloud, and is divided by annealing_factor every
+    // annealing_interval iterations until it reaches max_correspondence_distance. Zero picks 1/40 of the diameter.
+    double annealing_factor = 1.4;
+    int annealing_interval = 4;
+    double max_correspondence_distance = 0;
+
+    // Matches are first filtered by checking that random triples of them have similar edge lengths in both clouds.
+    bool tuple_test = true;
+    double tuple_scale = 0.9;
+    int tuple_trials = 100;
+    unsigned int seed = 1;
+};
+
+struct FastGlobalRegistrationResult {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    // Maps the moving cloud onto the fixed one, as for register_surfaces.
+    Eigen::Matrix4d transform;
+
+    // Matches left after the tuple test, and how many of those end within max_correspondence_distance.
+    int correspondences;
+    int inliers;
+};
+
+// fixed.col(matches(i)) is taken to correspond to moving.col(i), as for ransac_registration.
+FastGlobalRegistrationResult fast_global_registration(const Eigen::MatrixXd& fixed, const Eigen::MatrixXd& moving, const Eigen::ArrayXi& matches,
+                                                      const FastGlobalRegistrationOptions& options = FastGlobalRegistrationOptions());
+#endif
@@ -0,0 +1,129 @@
+/* Fast Point Feature Histograms, after "Fast Point Feature Histograms (FPFH) for 3D Registration", Rusu, Blodow and Beetz,
+   2009. Each point is described by histograms of the angles between its normal and those of its neighbours, which do not
+   change under rigid motion and so can be matched between clouds in arbitrary frames. */
+#include <Features.hpp>
+
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include <Exceptions.hpp>
+#include <Parallel.hpp>
+
+void orient_normals_from_centroid(const Eigen::MatrixXd& surface, Eigen::MatrixXd& normals) {
+    Eigen::Vector3d centroid = surface.rowwise().mean();
+    for(int i = 0; i < surface.cols(); i++) {
+        if(normals.col(i).dot(surface.col(i) - centroid) < 0) {
+            normals.col(i) *= -1;
+        }
+    }
+}
+
+static int histogram_bin(double value, double lower, double upper) {
+    int bin = static_cast<int>(floor(fpfh_bins * (value - lower) / (upper - lower)));
+    return std::max(0, std::min(fpfh_bins - 1, bin));
+}
+
+static bool pair_features(const Eigen::Vector3d& p1, const Eigen::Vector3d& n1, const Eigen::Vector3d& p2, const Eigen::Vector3d& n2,
+                          double& f1, double& f2, double& f3) {
+    // The Darboux frame angles between two oriented points, built on whichever normal makes the smaller angle with the
+    // line between them so that the features do not depend on the order of the pair.
+    Eigen::Vector3d d = p2 - p1;
+    double length = d.norm();
+    if(length == 0) {
+        return false;
+    }
+    d /= length;
+
+    Eigen::Vector3d u = n1;
+    Eigen::Vector3d other = n2;
+    double angle1 = n1.dot(d);
+    double angle2 = n2.dot(d);
+    if(std::abs(angle1) < std::abs(angle2)) {
+        u = n2;
+        other = n1;
+        d = -d;
+        f3 = -angle2;
+    } else {
+        f3 = angle1;
+    }
+
+    Eigen::Vector3d v = d.cross(u);
+    double v_norm = v.norm();
+    if(v_norm == 0) {
+        return false;
+    }
+    v /= v_norm;
+    Eigen::Vector3d w = u.cross(v);
+
+    f2 = v.dot(other);
+    f1 = atan2(w.dot(other), u.dot(other));
+    return true;
+}
+
+Eigen::MatrixXd compute_fpfh_features(const Eigen::MatrixXd& surface, const Eigen::MatrixXd& normals, const KdTree& tree, double radius, int threads) {
+    // Two parallel passes: the simplified histogram (SPFH) of each point against its own neighbours, then the FPFH of each
+    // point as its SPFH plus the distance-weighted mean SPFH of its neighbours.
+    if(normals.cols() != surface.cols() || tree.size() != surface.cols()) {
+        std::cerr << "Normals and the k-d tree must match the surface point for point." << std::endl;
+        throw(PointMatchingEx);
+    }
+    if(!(radius > 0)) {
+        std::cerr << "Feature radius must be positive." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    int n = surface.cols();
+    Eigen::MatrixXd spfh = Eigen::MatrixXd::Zero(fpfh_dimension, n);
+    parallel_for_blocks(n, threads, [&](int begin, int end, int) {
+        std::vector<int> neighbours;
+        for(int i = begin; i < end; i++) {
+            tree.within_radius(surface.col(i), radius, neighbours);
+
+            int pairs = 0;
+            for(unsigned int k = 0; k < neighbours.size(); k++) {
+                double f1, f2, f3;
+                int j = neighbours[k];
+                if(j == i || !pair_features(surface.col(i), normals.col(i), surface.col(j), normals.col(j), f1, f2, f3)) {
+                    continue;
+                }
+                spfh(histogram_bin(f1, -M_PI, M_PI), i) += 1;
+                spfh(fpfh_bins + histogram_bin(f2, -1, 1), i) += 1;
+                spfh(2 * fpfh_bins + histogram_bin(f3, -1, 1), i) += 1;
+                pairs++;
+            }
+            // Each histogram sums to 100, whatever the number of neighbours.
+            if(pairs > 0) {
+                spfh.col(i) *= 100.0 / pairs;
+            }
+        }
+    });
+
+    Eigen::MatrixXd features(fpfh_dimension, n);
+    parallel_for_blocks(n, threads, [&](int begin, int end, int) {
+        std::vector<int> neighbours;
+        Eigen::VectorXd weighted(fpfh_dimension);
+        for(int i = begin; i < end; i++) {
+            tree.within_radius(surface.col(i), radius, neighbours);
+
+            weighted.setZero();
+            for(unsigned int k = 0; k < neighbours.size(); k++) {
+                int j = neighbours[k];
+                double distance = (surface.col(j) - surface.col(i)).norm();
+                if(j == i || distance == 0) {
+                    continue;
+                }
+                weighted += spfh.col(j) / distance;
+            }
+            for(int h = 0; h < 3; h++) {
+                double sum = weighted.segment(h * fpfh_bins, fpfh_bins).sum();
+                if(sum > 0) {
+                    weighted.segment(h * fpfh_bins, fpfh_bins) *= 100.0 / sum;
+                }
+            }
+            features.col(i) = spfh.col(i) + weighted;
+        }
+    });
+
+    return features;
+}
@@ -0,0 +1,21 @@
+/* Fast Point Feature Histograms, after "Fast Point Feature Histograms (FPFH) for 3D Registration", Rusu, Blodow and Beetz,
+   2009. Each point is described by histograms of the angles between its normal and those of its neighbours, which do not
+   change under rigid motion and so can be matched between clouds in arbitrary frames. */
+#ifndef FEATURES_INCLUDED
+#define FEATURES_INCLUDED
+
+#include <Eigen/Dense>
+
+#include <KdTree.hpp>
+
+// Bins in each of the three angle histograms, which are concatenated into one descriptor.
+const int fpfh_bins = 11;
+const int fpfh_dimension = 3 * fpfh_bins;
+
+// Flip each normal to point away from the centroid of the surface. This is a rigid-motion-invariant orientation, which
+// is what descriptors built from normals need.
+void orient_normals_from_centroid(const Eigen::MatrixXd& surface, Eigen::MatrixXd& normals);
+
+// FPFH descriptors (fpfh_dimension x N) for every point, over neighbours within radius. tree must index surface.
+Eigen::MatrixXd compute_fpfh_features(const Eigen::MatrixXd& surface, const Eigen::MatrixXd& normals, const KdTree& tree, double radius, int threads = 0);
+#endif
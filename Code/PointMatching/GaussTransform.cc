@@ -0,0 +1,259 @@
+/* Discrete Gauss transforms: weighted sums of Gaussians centred on a set of sources, evaluated at a set of targets. The
+   improved fast Gauss transform ("Efficient Kernel Machines Using the Improved Fast Gauss Transform", Yang, Duraiswami
+   and Davis, 2004) clusters the sources and expands each cluster in a truncated Taylor series, which is cheap when the
+   bandwidth is wide; a k-d tree over the sources, dropping pairs too far apart to matter, is cheap when it is narrow. */
+#include <GaussTransform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include <Exceptions.hpp>
+#include <KdTree.hpp>
+#include <Parallel.hpp>
+
+// The monomials d^alpha of a 3D vector with total degree below some order, in order of degree. Each is its parent times
+// one coordinate, and constant holds 2^|alpha| / alpha!, the coefficient of the Taylor series of exp(2 a . b).
+struct Monomials {
+    std::vector<int> parent;
+    std::vector<int> axis;
+    std::vector<double> constant;
+
+    explicit Monomials(int order) {
+        // New monomials multiply in axes no lower than the highest axis already used, so that each is made once.
+        std::vector<int> highest_axis;
+        std::vector<Eigen::Vector3i> exponents;
+        parent.push_back(-1);
+        axis.push_back(0);
+        constant.push_back(1);
+        highest_axis.push_back(0);
+        exponents.push_back(Eigen::Vector3i::Zero());
+
+        int begin = 0;
+        for(int degree = 1; degree < order; degree++) {
+            int end = static_cast<int>(parent.size());
+            for(int term = begin; term < end; term++) {
+                for(int a = highest_axis[term]; a < 3; a++) {
+                    Eigen::Vector3i exponent = exponents[term];
+                    exponent(a)++;
+                    parent.push_back(term);
+                    axis.push_back(a);
+                    constant.push_back(constant[term] * 2 / exponent(a));
+                    highest_axis.push_back(a);
+                    exponents.push_back(exponent);
+                }
+            }
+            begin = end;
+        }
+    }
+
+    int size() const {
+        return static_cast<int>(parent.size());
+    }
+
+    void evaluate(const Eigen::Vector3d& d, Eigen::VectorXd& values) const {
+        values(0) = 1;
+        for(int term = 1; term < size(); term++) {
+            values(term) = values(parent[term]) * d(axis[term]);
+        }
+    }
+};
+
+static double cluster_sources(const Eigen::MatrixXd& sources, double radius, int max_clusters, std::vector<int>& centres, std::vector<int>& assignment) {
+    // Farthest-point clustering (Gonzalez's algorithm): the point farthest from every centre becomes the next centre,
+    // until all points are within radius of one or there are max_clusters. Returns the largest distance to a centre.
+    int n = sources.cols();
+    centres.assign(1, 0);
+    assignment.assign(n, 0);
+    Eigen::VectorXd squared_distances = (sources.colwise() - sources.col(0)).colwise().squaredNorm();
+
+    while(true) {
+        int farthest;
+        double largest = squared_distances.maxCoeff(&farthest);
+        if(sqrt(largest) <= radius || static_cast<int>(centres.size()) >= max_clusters) {
+            return sqrt(largest);
+        }
+
+        int cluster = static_cast<int>(centres.size());
+        centres.push_back(farthest);
+        for(int i = 0; i < n; i++) {
+            double squared_distance = (sources.col(i) - sources.col(farthest)).squaredNorm();
+            if(squared_distance < squared_distances(i)) {
+                squared_distances(i) = squared_distance;
+                assignment[i] = cluster;
+            }
+        }
+    }
+}
+
+static void direct_transform(const Eigen::MatrixXd& sources, const Eigen::MatrixXd& weights, const Eigen::MatrixXd& targets, double bandwidth,
+                             Eigen::MatrixXd& sums, int threads) {
+    double scale = 1 / (bandwidth * bandwidth);
+    parallel_for_blocks(targets.cols(), threads, [&](int begin, int end, int) {
+        for(int j = begin; j < end; j++) {
+            for(int i = 0; i < sources.cols(); i++) {
+                sums.col(j) += weights.col(i) * exp(-scale * (targets.col(j) - sources.col(i)).squaredNorm());
+            }
+        }
+    });
+}
+
+static void truncated_transform(const Eigen::MatrixXd& sources, const Eigen::MatrixXd& weights, const Eigen::MatrixXd& targets, double bandwidth,
+                                double cutoff, Eigen::MatrixXd& sums, int threads) {
+    // Only the sources within cutoff of each target, as found by a k-d tree, are summed.
+    KdTree tree(sources);
+    double scale = 1 / (bandwidth * bandwidth);
+    parallel_for_blocks(targets.cols(), threads, [&](int begin, int end, int) {
+        std::vector<int> neighbours;
+        for(int j = begin; j < end; j++) {
+            tree.within_radius(targets.col(j), cutoff, neighbours);
+            for(auto i : neighbours) {
+                sums.col(j) += weights.col(i) * exp(-scale * (targets.col(j) - sources.col(i)).squaredNorm());
+            }
+        }
+    });
+}
+
+static void fast_transform(const Eigen::MatrixXd& sources, const Eigen::MatrixXd& weights, const Eigen::MatrixXd& targets, double bandwidth,
+                           const std::vector<int>& centres, const std::vector<int>& assignment, double cluster_radius, double cutoff,
+                           const Monomials& monomials, Eigen::MatrixXd& sums, int threads) {
+    // With d = (s - c) / h and e = (t - c) / h for a source s and target t about a cluster centre c,
+    // exp(-|t - s|^2 / h^2) = exp(-|e|^2) exp(-|d|^2) exp(2 d . e), and the last factor's Taylor series separates into
+    // coefficients that depend only on the sources, accumulated once per cluster, and monomials of e. Targets further
+    // than cutoff from a cluster's sources skip it.
+    int clusters = static_cast<int>(centres.size());
+    int terms = monomials.size();
+    int rows = weights.rows();
+    Eigen::MatrixXd centre_points(3, clusters);
+    for(int k = 0; k < clusters; k++) {
+        centre_points.col(k) = sources.col(centres[k]);
+    }
+
+    int blocks = std::max(1, std::min(thread_count(threads), static_cast<int>(sources.cols())));
+    std::vector<Eigen::MatrixXd> block_coefficients(blocks);
+    parallel_for_blocks(sources.cols(), threads, [&](int begin, int end, int block) {
+        auto& coefficients = block_coefficients[block];
+        coefficients = Eigen::MatrixXd::Zero(rows, clusters * terms);
+        Eigen::VectorXd values(terms);
+        for(int i = begin; i < end; i++) {
+            int k = assignment[i];
+            Eigen::Vector3d d = (sources.col(i) - centre_points.col(k)) / bandwidth;
+            monomials.evaluate(d, values);
+            values *= exp(-d.squaredNorm());
+            coefficients.middleCols(k * terms, terms) += weights.col(i) * values.transpose();
+        }
+    });
+
+    Eigen::MatrixXd coefficients = block_coefficients[0];
+    for(int block = 1; block < blocks; block++) {
+        coefficients += block_coefficients[block];
+    }
+    for(int k = 0; k < clusters; k++) {
+        for(int term = 0; term < terms; term++) {
+            coefficients.col(k * terms + term) *= monomials.constant[term];
+        }
+    }
+
+    double reach = cluster_radius + cutoff;
+    parallel_for_blocks(targets.cols(), threads, [&](int begin, int end, int) {
+        Eigen::VectorXd values(terms);
+        for(int j = begin; j < end; j++) {
+            for(int k = 0; k < clusters; k++) {
+                Eigen::Vector3d offset = targets.col(j) - centre_points.col(k);
+                if(offset.squaredNorm() > reach * reach) {
+                    continue;
+                }
+                Eigen::Vector3d e = offset / bandwidth;
+                monomials.evaluate(e, values);
+                sums.col(j) += exp(-e.squaredNorm()) * (coefficients.middleCols(k * terms, terms) * values);
+            }
+        }
+    });
+}
+
+static double expansion_error(double radius, double reach, int order) {
+    // Bound on the error of a source's truncated expansion, relative to its weight, for a source within radius of its
+    // cluster's centre and a target within reach of it (both in bandwidths). The Taylor remainder of exp(2 d . e) is at
+    // most (2 |d| |e|)^p / p! exp(2 |d| |e|), which the factor exp(-|d|^2 - |e|^2) brings down to
+    // (2 |d| |e|)^p / p! exp(-(|e| - |d|)^2). For radius below sqrt(p / 2) this grows with |d|, and over |e| it peaks at
+    // (radius + sqrt(radius^2 + 2p)) / 2.
+    double y = std::min(reach, (radius + sqrt(radius * radius + 2 * order)) / 2);
+    return exp(order * log(2 * radius * y) - std::lgamma(order + 1.0) - (y - radius) * (y - radius));
+}
+
+// Cost of a kernel evaluation in the truncated sum, relative to one term of an expansion (as measured on the test data).
+static const double kernel_cost = 16;
+
+GaussTransformMethod gauss_transform(const Eigen::MatrixXd& sources, const Eigen::MatrixXd& weights, const Eigen::MatrixXd& targets, double bandwidth,
+                                     Eigen::MatrixXd& sums, const GaussTransformOptions& options) {
+    if(sources.rows() != 3 || targets.rows() != 3 || weights.cols() != sources.cols()) {
+        std::cerr << "Gauss transforms need 3D sources and targets, and a column of weights per source." << std::endl;
+        throw(PointMatchingEx);
+    }
+    if(!(bandwidth > 0) || !(options.epsilon > 0 && options.epsilon < 1) || options.order < 1) {
+        std::cerr << "Gauss transforms need a positive bandwidth and order, and an epsilon between 0 and 1." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    sums = Eigen::MatrixXd::Zero(weights.rows(), targets.cols());
+    if(sources.cols() == 0 || targets.cols() == 0) {
+        return options.method;
+    }
+    if(options.method == GaussTransformMethod::Direct) {
+        direct_transform(sources, weights, targets, bandwidth, sums, options.threads);
+        return GaussTransformMethod::Direct;
+    }
+
+    // Pairs further apart than cutoff have kernel values below epsilon.
+    double cutoff = bandwidth * sqrt(-log(options.epsilon));
+    if(options.method == GaussTransformMethod::Truncated) {
+        truncated_transform(sources, weights, targets, bandwidth, cutoff, sums, options.threads);
+        return GaussTransformMethod::Truncated;
+    }
+    Monomials monomials(options.order);
+
+    // The cluster radius is the largest that keeps the expansions' error below epsilon at this order (about a quarter
+    // of the bandwidth at the defaults), found by bisection as the bound grows with the radius. Automatic stops adding clusters once the expansions would cost more than the pairs the truncated sum is expected
+    // to visit (those within cutoff, if the sources filled their bounding box evenly), each of which costs about as much
+    // as kernel_cost expansion terms.
+    double reach = cutoff / bandwidth;
+    double lower = 0;
+    double upper = std::min(sqrt(options.order / 2.0), reach);
+    if(expansion_error(upper, upper + reach, options.order) > options.epsilon) {
+        for(int step = 0; step < 50; step++) {
+            double middle = (lower + upper) / 2;
+            if(expansion_error(middle, middle + reach, options.order) > options.epsilon) {
+                upper = middle;
+            } else {
+                lower = middle;
+            }
+        }
+        upper = lower;
+    }
+    double radius = upper * bandwidth;
+    int max_clusters = sources.cols();
+    if(options.method == GaussTransformMethod::Automatic) {
+        Eigen::Vector3d extent = sources.rowwise().maxCoeff() - sources.rowwise().minCoeff();
+        double fraction = 1;
+        for(int d = 0; d < 3; d++) {
+            if(extent(d) > 0) {
+                fraction *= std::min(1.0, 2 * cutoff / extent(d));
+            }
+        }
+        double pairs = fraction * sources.cols() * targets.cols();
+        double cost_per_cluster = static_cast<double>(sources.cols() + targets.cols()) * monomials.size();
+        max_clusters = static_cast<int>(std::min(static_cast<double>(sources.cols()), kernel_cost * pairs / cost_per_cluster));
+    }
+
+    std::vector<int> centres;
+    std::vector<int> assignment;
+    double cluster_radius = max_clusters >= 1 ? cluster_sources(sources, radius, max_clusters, centres, assignment) : radius + 1;
+    if(cluster_radius > radius) {
+        truncated_transform(sources, weights, targets, bandwidth, cutoff, sums, options.threads);
+        return GaussTransformMethod::Truncated;
+    }
+
+    fast_transform(sources, weights, targets, bandwidth, centres, assignment, cluster_radius, cutoff, monomials, sums, options.threads);
+    return GaussTransformMethod::Fast;
+}
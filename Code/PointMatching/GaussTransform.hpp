@@ -0,0 +1,31 @@
+/* Discrete Gauss transforms: weighted sums of Gaussians centred on a set of sources, evaluated at a set of targets. The
+   improved fast Gauss transform ("Efficient Kernel Machines Using the Improved Fast Gauss Transform", Yang, Duraiswami
+   and Davis, 2004) clusters the sources and expands each cluster in a truncated Taylor series, which is cheap when the
+   bandwidth is wide; a k-d tree over the sources, dropping pairs too far apart to matter, is cheap when it is narrow. */
+#ifndef GAUSSTRANSFORM_INCLUDED
+#define GAUSSTRANSFORM_INCLUDED
+
+#include <Eigen/Dense>
+
+enum class GaussTransformMethod { Automatic, Direct, Truncated, Fast };
+
+struct GaussTransformOptions {
+    // Automatic picks whichever of Truncated and Fast is expected to be cheaper; Direct sums every pair exactly.
+    GaussTransformMethod method = GaussTransformMethod::Automatic;
+
+    // Kernel values below this are dropped by Truncated and Fast, and their error is of this order relative to the sum
+    // of the absolute weights.
+    double epsilon = 1E-6;
+
+    // Order of the Taylor expansions of Fast (terms of total degree below this are kept). Together with epsilon it sets
+    // the radius of the clusters, which shrinks as epsilon does.
+    int order = 8;
+
+    int threads = 0;
+};
+
+// sums.col(j) = sum over i of weights.col(i) * exp(-|targets.col(j) - sources.col(i)|^2 / bandwidth^2), for any number
+// of rows of weights, and 3D sources and targets. Returns the method used.
+GaussTransformMethod gauss_transform(const Eigen::MatrixXd& sources, const Eigen::MatrixXd& weights, const Eigen::MatrixXd& targets, double bandwidth,
+                                     Eigen::MatrixXd& sums, const GaussTransformOptions& options = GaussTransformOptions());
+#endif
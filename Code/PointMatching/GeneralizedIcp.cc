@@ -0,0 +1,123 @@
+/* Generalized-ICP, after "Generalized-ICP", Segal, Haehnel and Thrun, 2009. Each point is modelled as a Gaussian that is flat
+   across its local surface, so that matching becomes plane-to-plane. */
+#include <GeneralizedIcp.hpp>
+
+#include <cmath>
+#include <iostream>
+
+#include <Eigen/Dense>
+#include <Eigen/Eigenvalues>
+
+#include <Exceptions.hpp>
+#include <PoseSolver.hpp>
+#include <SurfaceBasedRegistration.hpp>
+#include <SurfaceCache.hpp>
+#include <Util.hpp>
+
+// Gauss-Newton iterations taken per set of correspondences.
+static const int gauss_newton_iterations = 3;
+
+// d^T w (C_fixed + R0 C_moving R0^T)^-1 d for matched points, with the combined covariances held at the rotation R0 the
+// correspondences were found under.
+struct GicpMetric {
+    static const int dimension = 3;
+
+    const SurfaceCache& fixed;
+    const SurfaceCache& moving;
+    const Eigen::Matrix3d& rotation;
+    RobustKernel kernel;
+    double scale;
+    const Eigen::ArrayXi& correspondences;
+    const Eigen::VectorXd& residuals;
+
+    int size() const {
+        return correspondences.size();
+    }
+
+    bool evaluate(int i, const Eigen::Matrix3d& rotation_next, const Eigen::Vector3d& translation_next, Eigen::Vector3d& d,
+                  Eigen::Matrix<double, 3, 6>& J, Eigen::Matrix3d& information) const {
+        int j = correspondences(i);
+        auto w = robust_weight(kernel, residuals(i), scale);
+        if(j < 0 || w <= 0) {
+            return false;
+        }
+
+        Eigen::Vector3d x = rotation_next * moving.points.col(i) + translation_next;
+        d = fixed.points.col(j) - x;
+        Eigen::Matrix3d combined = fixed.covariances[j] + rotation * moving.covariances[i] * rotation.transpose();
+        information = w * combined.inverse();
+
+        // d(xi) = q - exp(xi) x, so the Jacobian with respect to (omega, v) is [skew(x), -I].
+        J << skew(x), -Eigen::Matrix3d::Identity();
+        return true;
+    }
+};
+
+std::vector<Eigen::Matrix3d> compute_point_covariances(const Eigen::MatrixXd& surface, const KdTree& tree, int neighbours, double epsilon,
+                                                       const CancellationToken* cancellation) {
+    // Covariance of each point's neighbourhood, with its eigenvalues replaced by (epsilon, 1, 1): uncertain along the local
+    // surface and confident along the normal.
+    if(neighbours < 3) {
+        std::cerr << "At least three neighbours are needed to estimate a point covariance." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    std::vector<Eigen::Matrix3d> covariances(surface.cols());
+    std::vector<int> indices;
+    std::vector<double> squared_distances;
+
+    for(int i = 0; i < surface.cols(); i++) {
+        if(i % cancellation_block == 0) {
+            throw_if_cancelled(cancellation);
+        }
+        tree.nearest_k(surface.col(i), neighbours, indices, squared_distances);
+
+        Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+        for(unsigned int k = 0; k < indices.size(); k++) {
+            mean += surface.col(indices[k]);
+        }
+        mean /= indices.size();
+
+        Eigen::Matrix3d covariance = Eigen::Matrix3d::Zero();
+        for(unsigned int k = 0; k < indices.size(); k++) {
+            Eigen::Vector3d offset = surface.col(indices[k]) - mean;
+            covariance += offset * offset.transpose();
+        }
+
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigen(covariance);
+        Eigen::Matrix3d axes = eigen.eigenvectors();
+        covariances[i] = axes * Eigen::Vector3d(epsilon, 1, 1).asDiagonal() * axes.transpose();
+    }
+
+    return covariances;
+}
+
+double gicp_step(const SurfaceCache& fixed, const SurfaceCache& moving, const Eigen::Matrix4d& transform, RobustKernel kernel, double scale,
+                 const CorrespondenceRejection& rejection, Eigen::ArrayXi& correspondences, Eigen::VectorXd& residuals, Eigen::Matrix4d& transform_next,
+                 double search_epsilon, const CancellationToken* cancellation, StageClock* clock) {
+    // Match each moving point to its nearest fixed point under transform, drop the rejected matches, then minimise the sum of d^T (C_fixed + R C_moving R^T)^-1 d
+    // over the pose by Gauss-Newton, with the combined covariances held at transform. Returns the (robust) RMS
+    // point-to-point error of transform, as for point-to-point ICP. clock, if given, is lapped after the search and after
+    // the rejection.
+    double error = find_nearest_points(fixed.tree, moving.points, transform, kernel, scale, correspondences, residuals, search_epsilon, cancellation);
+    if(clock) {
+        clock->lap(&StageTimes::search);
+    }
+
+    Eigen::Matrix3d rotation = transform.block(0,0,3,3);
+    if(rejection.enabled()) {
+        int kept;
+        error = reject_correspondences(rejection, &moving, &fixed, rotation, kernel, scale, residuals, correspondences, kept);
+    }
+    if(clock) {
+        clock->lap(&StageTimes::rejection);
+    }
+
+    GicpMetric metric = {fixed, moving, rotation, kernel, scale, correspondences, residuals};
+    PoseSolverOptions solver;
+    solver.max_iterations = gauss_newton_iterations;
+    solver.levenberg_marquardt = false;
+    transform_next = solve_pose(metric, transform, solver).transform;
+
+    return error;
+}
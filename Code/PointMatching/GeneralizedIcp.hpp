@@ -0,0 +1,24 @@
+/* Generalized-ICP, after "Generalized-ICP", Segal, Haehnel and Thrun, 2009. Each point is modelled as a Gaussian that is flat
+   across its local surface, so that matching becomes plane-to-plane. */
+#ifndef GENERALIZEDICP_INCLUDED
+#define GENERALIZEDICP_INCLUDED
+
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include <Cancellation.hpp>
+#include <CorrespondenceRejection.hpp>
+#include <KdTree.hpp>
+#include <RegistrationObserver.hpp>
+#include <RobustEstimation.hpp>
+
+struct SurfaceCache;
+
+std::vector<Eigen::Matrix3d> compute_point_covariances(const Eigen::MatrixXd& surface, const KdTree& tree, int neighbours, double epsilon = 1E-3,
+                                                       const CancellationToken* cancellation = 0);
+
+double gicp_step(const SurfaceCache& fixed, const SurfaceCache& moving, const Eigen::Matrix4d& transform, RobustKernel kernel, double scale,
+                 const CorrespondenceRejection& rejection, Eigen::ArrayXi& correspondences, Eigen::VectorXd& residuals, Eigen::Matrix4d& transform_next,
+                 double search_epsilon = 0, const CancellationToken* cancellation = 0, StageClock* clock = 0);
+#endif
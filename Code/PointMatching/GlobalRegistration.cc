@@ -0,0 +1,294 @@
+/* Global initialisation for surface-based registration: FPFH descriptors are matched between the clouds, and RANSAC (or
+   fast global registration) over those matches finds a rough transform from any starting pose, for register_surfaces to
+   refine. */
+#include <GlobalRegistration.hpp>
+
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include <Cancellation.hpp>
+#include <Exceptions.hpp>
+#include <Features.hpp>
+#include <KdTree.hpp>
+#include <Parallel.hpp>
+#include <PointMatching.hpp>
+#include <SurfaceCache.hpp>
+
+GlobalRegistrationMethod global_registration_method_from_string(const std::string& name) {
+    if(name == "ransac") {
+        return GlobalRegistrationMethod::Ransac;
+    } else if(name == "fgr") {
+        return GlobalRegistrationMethod::FastGlobal;
+    }
+
+    std::cerr << "Unknown global registration method " << name << " -- expected ransac or fgr." << std::endl;
+    throw(PointMatchingEx);
+}
+
+Eigen::MatrixXd voxel_downsample(const Eigen::MatrixXd& surface, double voxel_size) {
+    // Replace the points in each occupied voxel by their mean, in order of first occupation.
+    if(!(voxel_size > 0)) {
+        std::cerr << "Voxel size must be positive." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    Eigen::Vector3d origin = surface.rowwise().minCoeff();
+    std::unordered_map<long long, int> voxels;
+    std::vector<int> voxel_of_point(surface.cols());
+    for(int i = 0; i < surface.cols(); i++) {
+        long long key = 0;
+        for(int d = 0; d < 3; d++) {
+            key = key * 2097152 + static_cast<long long>(floor((surface(d, i) - origin(d)) / voxel_size));
+        }
+        auto inserted = voxels.insert(std::make_pair(key, static_cast<int>(voxels.size())));
+        voxel_of_point[i] = inserted.first->second;
+    }
+
+    Eigen::MatrixXd downsampled = Eigen::MatrixXd::Zero(3, voxels.size());
+    Eigen::VectorXd counts = Eigen::VectorXd::Zero(voxels.size());
+    for(int i = 0; i < surface.cols(); i++) {
+        downsampled.col(voxel_of_point[i]) += surface.col(i);
+        counts(voxel_of_point[i]) += 1;
+    }
+    for(int v = 0; v < downsampled.cols(); v++) {
+        downsampled.col(v) /= counts(v);
+    }
+
+    return downsampled;
+}
+
+Eigen::ArrayXi match_features(const Eigen::MatrixXd& fixed_features, const Eigen::MatrixXd& moving_features, int threads) {
+    if(fixed_features.rows() != moving_features.rows()) {
+        std::cerr << "Features must have the same dimension in both clouds." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    KdTree tree(fixed_features);
+    Eigen::ArrayXi matches(moving_features.cols());
+    parallel_for_blocks(moving_features.cols(), threads, [&](int begin, int end, int) {
+        for(int i = begin; i < end; i++) {
+            double squared_distance;
+            matches(i) = tree.nearest(moving_features.col(i), squared_distance);
+        }
+    });
+
+    return matches;
+}
+
+static bool sample_transform(const Eigen::MatrixXd& fixed, const Eigen::MatrixXd& moving, const Eigen::ArrayXi& matches, const int sample[3],
+                             double edge_length_ratio, Eigen::Matrix4d& transform) {
+    // The least-squares transform for three matched points, or false if the sample is degenerate or its edge lengths
+    // disagree between the clouds (in which case it cannot be a rigid match).
+    Eigen::Vector3d p[3];
+    Eigen::Vector3d q[3];
+    for(int k = 0; k < 3; k++) {
+        p[k] = moving.col(sample[k]);
+        q[k] = fixed.col(matches(sample[k]));
+    }
+
+    for(int a = 0; a < 3; a++) {
+        int b = (a + 1) % 3;
+        double moving_length = (p[a] - p[b]).norm();
+        double fixed_length = (q[a] - q[b]).norm();
+        if(std::min(moving_length, fixed_length) < edge_length_ratio * std::max(moving_length, fixed_length)) {
+            return false;
+        }
+    }
+
+    Eigen::Vector3d moving_edge = p[1] - p[0];
+    Eigen::Vector3d fixed_edge = q[1] - q[0];
+    if(moving_edge.cross(p[2] - p[0]).norm() <= 1E-6 * moving_edge.squaredNorm()
+       || fixed_edge.cross(q[2] - q[0]).norm() <= 1E-6 * fixed_edge.squaredNorm()) {
+        return false;
+    }
+
+    Eigen::Vector3d p_average = (p[0] + p[1] + p[2]) / 3;
+    Eigen::Vector3d q_average = (q[0] + q[1] + q[2]) / 3;
+    Eigen::Matrix3d H = Eigen::Matrix3d::Zero();
+    for(int k = 0; k < 3; k++) {
+        H += (p[k] - p_average) * (q[k] - q_average).transpose();
+    }
+
+    // find_rotation is not used here, as it reports (and throws on) the near-degenerate samples that RANSAC expects to
+    // draw; the reflection is corrected unconditionally instead, as three points always span a plane.
+    Eigen::JacobiSVD<Eigen::Matrix3d> svd(H, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    Eigen::Matrix3d V = svd.matrixV();
+    if((V * svd.matrixU().transpose()).determinant() < 0) {
+        V.col(2) *= -1;
+    }
+    Eigen::Matrix3d rotation = V * svd.matrixU().transpose();
+
+    transform = Eigen::Matrix4d::Identity();
+    transform.block(0,0,3,3) = rotation;
+    transform.block(0,3,3,1) = q_average - rotation * p_average;
+    return true;
+}
+
+static int count_inliers(const Eigen::MatrixXd& fixed, const Eigen::MatrixXd& moving, const Eigen::ArrayXi& matches, const Eigen::Matrix4d& transform,
+                         double inlier_distance, int to_beat) {
+    // Inlier count of transform, giving up (and returning -1) as soon as it can no longer exceed to_beat.
+    Eigen::Matrix3d rotation = transform.block(0,0,3,3);
+    Eigen::Vector3d translation = transform.block(0,3,3,1);
+    double squared_inlier_distance = inlier_distance * inlier_distance;
+
+    int n = moving.cols();
+    int inliers = 0;
+    for(int i = 0; i < n; i++) {
+        if(inliers + (n - i) <= to_beat) {
+            return -1;
+        }
+        if((rotation * moving.col(i) + translation - fixed.col(matches(i))).squaredNorm() < squared_inlier_distance) {
+            inliers++;
+        }
+    }
+    return inliers > to_beat ? inliers : -1;
+}
+
+GlobalRegistrationResult ransac_registration(const Eigen::MatrixXd& fixed, const Eigen::MatrixXd& moving, const Eigen::ArrayXi& matches,
+                                             double inlier_distance, const GlobalRegistrationOptions& options) {
+    // Each thread draws its own samples and scores them against the best inlier count found by any thread, so that most
+    // hypotheses are rejected after a few matches. The number of hypotheses needed for the requested confidence is
+    // lowered as better hypotheses are found.
+    if(moving.cols() < 3 || matches.size() != moving.cols()) {
+        std::cerr << "RANSAC needs at least three matches, and one match per moving point." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    int n = moving.cols();
+    int threads = thread_count(options.threads);
+    std::atomic<int> next_hypothesis(0);
+    std::atomic<int> hypothesis_limit(options.max_hypotheses);
+    std::atomic<int> best_inliers(0);
+
+    std::vector<int> thread_inliers(threads, 0);
+    std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d> > thread_transforms(threads, Eigen::Matrix4d::Identity());
+
+    parallel_for_blocks(threads, threads, [&](int begin, int end, int) {
+        for(int thread = begin; thread < end; thread++) {
+            std::mt19937 random(options.seed + thread);
+            std::uniform_int_distribution<int> pick(0, n - 1);
+
+            while(!cancellation_requested(options.cancellation) && next_hypothesis.fetch_add(1) < hypothesis_limit.load()) {
+                int sample[3];
+                sample[0] = pick(random);
+                do { sample[1] = pick(random); } while(sample[1] == sample[0]);
+                do { sample[2] = pick(random); } while(sample[2] == sample[0] || sample[2] == sample[1]);
+
+                Eigen::Matrix4d hypothesis;
+                if(!sample_transform(fixed, moving, matches, sample, options.edge_length_ratio, hypothesis)) {
+                    continue;
+                }
+
+                int inliers = count_inliers(fixed, moving, matches, hypothesis, inlier_distance, best_inliers.load());
+                if(inliers <= thread_inliers[thread]) {
+                    continue;
+                }
+                thread_inliers[thread] = inliers;
+                thread_transforms[thread] = hypothesis;
+
+                int previous = best_inliers.load();
+                while(inliers > previous && !best_inliers.compare_exchange_weak(previous, inliers)) {
+                }
+
+                double inlier_ratio = static_cast<double>(inliers) / n;
+                double outlier_probability = 1 - inlier_ratio * inlier_ratio * inlier_ratio;
+                if(outlier_probability <= 0) {
+                    hypothesis_limit.store(0);
+                } else {
+                    double required = log(1 - options.confidence) / log(outlier_probability);
+                    int limit = hypothesis_limit.load();
+                    while(required < limit && !hypothesis_limit.compare_exchange_weak(limit, static_cast<int>(ceil(required)))) {
+                    }
+                }
+            }
+        }
+    });
+
+    throw_if_cancelled(options.cancellation);
+
+    GlobalRegistrationResult result;
+    result.transform = Eigen::Matrix4d::Identity();
+    result.inliers = 0;
+    result.correspondences = n;
+    result.hypotheses = std::min(next_hypothesis.load(), options.max_hypotheses);
+    for(int thread = 0; thread < threads; thread++) {
+        if(thread_inliers[thread] > result.inliers) {
+            result.inliers = thread_inliers[thread];
+            result.transform = thread_transforms[thread];
+        }
+    }
+
+    // Refit to all the inliers of the best hypothesis, keeping the refit only if it is at least as good.
+    if(result.inliers >= 4) {
+        Eigen::Matrix3d rotation = result.transform.block(0,0,3,3);
+        Eigen::Vector3d translation = result.transform.block(0,3,3,1);
+        Eigen::MatrixXd inlier_moving(3, result.inliers);
+        Eigen::MatrixXd inlier_fixed(3, result.inliers);
+        int k = 0;
+        for(int i = 0; i < n && k < result.inliers; i++) {
+            if((rotation * moving.col(i) + translation - fixed.col(matches(i))).squaredNorm() < inlier_distance * inlier_distance) {
+                inlier_moving.col(k) = moving.col(i);
+                inlier_fixed.col(k) = fixed.col(matches(i));
+                k++;
+            }
+        }
+
+        auto refit = estimate_rigid_transform(inlier_moving, inlier_fixed);
+        int refit_inliers = count_inliers(fixed, moving, matches, refit, inlier_distance, result.inliers - 1);
+        if(refit_inliers >= result.inliers) {
+            result.inliers = refit_inliers;
+            result.transform = refit;
+        }
+    }
+
+    return result;
+}
+
+GlobalRegistrationResult global_register_surfaces(const Eigen::MatrixXd& fixed, const Eigen::MatrixXd& moving, const GlobalRegistrationOptions& options) {
+    double voxel_size = options.voxel_size;
+    if(voxel_size <= 0) {
+        voxel_size = (fixed.rowwise().maxCoeff() - fixed.rowwise().minCoeff()).norm() / 50;
+    }
+    if(!(voxel_size > 0)) {
+        std::cerr << "Could not choose a voxel size -- the fixed cloud has no extent." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    Eigen::MatrixXd fixed_points = voxel_downsample(fixed, voxel_size);
+    Eigen::MatrixXd moving_points = voxel_downsample(moving, voxel_size);
+    KdTree fixed_tree(fixed_points);
+    KdTree moving_tree(moving_points);
+
+    Eigen::MatrixXd fixed_normals = compute_point_normals(fixed_points, fixed_tree, options.normal_neighbours, options.cancellation);
+    Eigen::MatrixXd moving_normals = compute_point_normals(moving_points, moving_tree, options.normal_neighbours, options.cancellation);
+    orient_normals_from_centroid(fixed_points, fixed_normals);
+    orient_normals_from_centroid(moving_points, moving_normals);
+
+    double feature_radius = options.feature_radius * voxel_size;
+    auto fixed_features = compute_fpfh_features(fixed_points, fixed_normals, fixed_tree, feature_radius, options.threads);
+    throw_if_cancelled(options.cancellation);
+    auto moving_features = compute_fpfh_features(moving_points, moving_normals, moving_tree, feature_radius, options.threads);
+    throw_if_cancelled(options.cancellation);
+
+    auto matches = match_features(fixed_features, moving_features, options.threads);
+    throw_if_cancelled(options.cancellation);
+    if(options.method == GlobalRegistrationMethod::FastGlobal) {
+        auto fast_global_options = options.fast_global;
+        if(fast_global_options.max_correspondence_distance <= 0) {
+            fast_global_options.max_correspondence_distance = options.inlier_distance * voxel_size;
+        }
+        auto fast_global_result = fast_global_registration(fixed_points, moving_points, matches, fast_global_options);
+
+        GlobalRegistrationResult result;
+        result.transform = fast_global_result.transform;
+        result.inliers = fast_global_result.inliers;
+        result.correspondences = fast_global_result.correspondences;
+        result.hypotheses = 0;
+        return result;
+    }
+    return ransac_registration(fixed_points, moving_points, matches, options.inlier_distance * voxel_size, options);
+}
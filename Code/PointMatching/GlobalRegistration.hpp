@@ -0,0 +1,70 @@
+/* Global initialisation for surface-based registration: FPFH descriptors are matched between the clouds, and RANSAC (or
+   fast global registration) over those matches finds a rough transform from any starting pose, for register_surfaces to
+   refine. */
+#ifndef GLOBALREGISTRATION_INCLUDED
+#define GLOBALREGISTRATION_INCLUDED
+
+#include <string>
+
+#include <Eigen/Dense>
+
+#include <Cancellation.hpp>
+#include <FastGlobalRegistration.hpp>
+
+enum class GlobalRegistrationMethod { Ransac, FastGlobal };
+
+GlobalRegistrationMethod global_registration_method_from_string(const std::string& name);
+
+struct GlobalRegistrationOptions {
+    GlobalRegistrationMethod method = GlobalRegistrationMethod::Ransac;
+
+    // Both clouds are downsampled to this voxel size before matching; zero picks 1/50 of the fixed cloud's bounding box
+    // diagonal. The remaining lengths are multiples of the voxel size.
+    double voxel_size = 0;
+    double feature_radius = 5;
+    double inlier_distance = 1.5;
+
+    int normal_neighbours = 10;
+
+    // RANSAC stops after max_hypotheses, or once a hypothesis has been found with the given confidence.
+    int max_hypotheses = 100000;
+    double confidence = 0.999;
+
+    // Samples whose edge lengths differ between the clouds by more than this ratio are rejected before fitting.
+    double edge_length_ratio = 0.9;
+
+    int threads = 0;
+    unsigned int seed = 1;
+
+    // For GlobalRegistrationMethod::FastGlobal. A zero max_correspondence_distance is replaced by the inlier distance.
+    FastGlobalRegistrationOptions fast_global;
+
+    // When set, normal estimation and RANSAC poll this token, as does the pipeline between its stages, and throw
+    // RegistrationCancelledEx soon after it is cancelled.
+    const CancellationToken* cancellation = 0;
+};
+
+struct GlobalRegistrationResult {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    // Maps the moving cloud onto the fixed one, as for register_surfaces.
+    Eigen::Matrix4d transform;
+    int inliers;
+    int correspondences;
+
+    // RANSAC hypotheses tried (zero for fast global registration).
+    int hypotheses;
+};
+
+Eigen::MatrixXd voxel_downsample(const Eigen::MatrixXd& surface, double voxel_size);
+
+// For each moving feature, the index of the nearest fixed feature.
+Eigen::ArrayXi match_features(const Eigen::MatrixXd& fixed_features, const Eigen::MatrixXd& moving_features, int threads = 0);
+
+// RANSAC over matched points: fixed.col(matches(i)) is taken to correspond to moving.col(i).
+GlobalRegistrationResult ransac_registration(const Eigen::MatrixXd& fixed, const Eigen::MatrixXd& moving, const Eigen::ArrayXi& matches,
+                                             double inlier_distance, const GlobalRegistrationOptions& options);
+
+GlobalRegistrationResult global_register_surfaces(const Eigen::MatrixXd& fixed, const Eigen::MatrixXd& moving,
+                                                  const GlobalRegistrationOptions& options = GlobalRegistrationOptions());
+#endif
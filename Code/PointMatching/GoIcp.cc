@@ -0,0 +1,319 @@
+/* Globally optimal registration by branch and bound, after "Go-ICP: A Globally Optimal Solution to 3D ICP Point-Set
+   Registration", Yang, Li, Campbell and Jia, 2016. Rotation space is searched with nested translation searches, bounding
+   the point-to-point objective over each box of poses, and local ICP runs tighten the best solution as it is found. */
+#include <GoIcp.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <queue>
+#include <vector>
+
+#include <Eigen/Geometry>
+
+#include <Exceptions.hpp>
+#include <Parallel.hpp>
+#include <SurfaceCache.hpp>
+
+// A cube of rotation (angle-axis) or translation space, with the lower bound of the objective over it.
+struct SearchBox {
+    double center[3];
+    double half_side;
+    double lower_bound;
+};
+
+struct LowerBoundFirst {
+    bool operator()(const SearchBox& a, const SearchBox& b) const {
+        return a.lower_bound > b.lower_bound;
+    }
+};
+
+typedef std::priority_queue<SearchBox, std::vector<SearchBox>, LowerBoundFirst> SearchQueue;
+
+static SearchBox child_box(const SearchBox& box, int child) {
+    SearchBox result;
+    result.half_side = box.half_side / 2;
+    for(int d = 0; d < 3; d++) {
+        result.center[d] = box.center[d] + ((child >> d) & 1 ? result.half_side : -result.half_side);
+    }
+    result.lower_bound = box.lower_bound;
+    return result;
+}
+
+typedef std::chrono::steady_clock::time_point TimePoint;
+
+// Translation searches split at most this many boxes; the bounds they give hold regardless, and a box of rotations whose
+// bounds are too loose is split in turn. Searches for upper bounds also stop within a relative tolerance.
+static const int search_expansions = 256;
+static const double upper_search_tolerance = 0.1;
+
+static double translation_search(const DistanceField& field, const std::vector<Eigen::Vector3d>& rotated, const Eigen::VectorXd& rotation_uncertainty,
+                                 const SearchBox& domain, double best_error, double tolerance, int max_expansions, const TimePoint* deadline,
+                                 Eigen::Vector3d& best_translation, double& lower_bound) {
+    // Least sum of squared distances, each reduced by rotation_uncertainty, over translations in domain. Distances are the
+    // field's lower bounds on the true ones, so the sums bound the objective from below, and a translation that beats
+    // best_error is only a candidate to be checked exactly. Boxes are split until their lower bound comes within tolerance
+    // of the best found, or reaches best_error, which is returned if no translation beats it. A box with half side s moves
+    // any point by at most sqrt(3) s from its centre. lower_bound is set to a bound on the objective over the whole domain,
+    // which holds however early the search stops.
+    double optimum = best_error;
+    double set_aside = std::numeric_limits<double>::infinity();
+    int n = rotated.size();
+
+    SearchQueue queue;
+    queue.push(domain);
+    for(int expanded = 0; !queue.empty(); expanded++) {
+        SearchBox box = queue.top();
+        if(box.lower_bound >= optimum - tolerance || (max_expansions > 0 && expanded >= max_expansions)) {
+            break;
+        }
+        if(deadline && expanded % 64 == 63 && std::chrono::steady_clock::now() >= *deadline) {
+            break;
+        }
+        queue.pop();
+
+        for(int child = 0; child < 8; child++) {
+            SearchBox next = child_box(box, child);
+            Eigen::Vector3d translation(next.center[0], next.center[1], next.center[2]);
+            double translation_uncertainty = sqrt(3.0) * next.half_side;
+
+            double upper = 0;
+            double lower = 0;
+            for(int i = 0; i < n && lower < optimum; i++) {
+                double d = field.lower_distance(rotated[i] + translation) - rotation_uncertainty(i);
+                if(d > 0) {
+                    upper += d * d;
+                }
+                double d_lower = d - translation_uncertainty;
+                if(d_lower > 0) {
+                    lower += d_lower * d_lower;
+                }
+            }
+            if(lower >= optimum) {
+                continue;
+            }
+
+            if(upper < optimum) {
+                optimum = upper;
+                best_translation = translation;
+            }
+            next.lower_bound = std::max(lower, box.lower_bound);
+            if(next.lower_bound < optimum - tolerance) {
+                queue.push(next);
+            } else {
+                set_aside = std::min(set_aside, next.lower_bound);
+            }
+        }
+    }
+
+    lower_bound = std::min(optimum, set_aside);
+    if(!queue.empty()) {
+        lower_bound = std::min(lower_bound, queue.top().lower_bound);
+    }
+    return optimum;
+}
+
+static Eigen::Matrix3d box_rotation(const SearchBox& box) {
+    // The rotation at the centre of a box of angle-axis space.
+    Eigen::Vector3d axis_angle(box.center[0], box.center[1], box.center[2]);
+    if(axis_angle.norm() == 0) {
+        return Eigen::Matrix3d::Identity();
+    }
+    return Eigen::AngleAxisd(axis_angle.norm(), axis_angle.normalized()).toRotationMatrix();
+}
+
+static double squared_error(const KdTree& tree, const Eigen::MatrixXd& surface, const Eigen::Matrix4d& transform) {
+    // The objective itself, from exact nearest neighbours in the fixed cloud.
+    double sum = 0;
+    for(int i = 0; i < surface.cols(); i++) {
+        double squared_distance;
+        tree.nearest(transform.block(0,0,3,3) * surface.col(i) + transform.block(0,3,3,1), squared_distance);
+        sum += squared_distance;
+    }
+    return sum;
+}
+
+GoIcpResult go_icp_register_surfaces(const DistanceField& field, const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, const GoIcpOptions& options) {
+    // Boxes of rotation space are taken best-first, a batch at a time, and their children are bounded in parallel: the
+    // upper bound from a translation search at the box's central rotation, and the lower bound from one in which each
+    // point may be up to 2 sin(min(sqrt(3) s / 2, pi / 2)) |x| closer to the fixed cloud. Each improved upper bound is
+    // polished by a local registration. Upper bounds are exact errors, from the fixed cloud's k-d tree, and the field only
+    // proposes poses for them. The moving cloud is centred first, so that rotations turn it about its centroid.
+    auto start_time = std::chrono::steady_clock::now();
+    TimePoint deadline = start_time + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(options.time_limit));
+    const TimePoint* deadline_pointer = options.time_limit > 0 ? &deadline : 0;
+    int n = surface2.cols();
+    if(n < 1 || surface2.rows() != 3) {
+        std::cerr << "Go-ICP needs a non-empty 3D moving point cloud." << std::endl;
+        throw(PointMatchingEx);
+    }
+    if(options.local_options.initial_alignment != InitialAlignment::None) {
+        std::cerr << "Go-ICP polishes the poses it finds, so local_options.initial_alignment must be None." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    Eigen::Vector3d moving_centroid = surface2.rowwise().mean();
+    Eigen::MatrixXd centred = surface2.colwise() - moving_centroid;
+    Eigen::VectorXd radii = centred.colwise().norm().transpose();
+
+    double tolerance = options.tolerance > 0 ? options.tolerance : 0.25 * field.cell_size() * field.cell_size();
+    tolerance *= n;
+
+    Eigen::Vector3d field_center = (field.lower_corner() + field.upper_corner()) / 2;
+    SearchBox translation_domain;
+    for(int d = 0; d < 3; d++) {
+        translation_domain.center[d] = field_center(d);
+    }
+    translation_domain.half_side = (field.upper_corner() - field.lower_corner()).maxCoeff() / 2;
+    translation_domain.lower_bound = 0;
+
+    auto pose = [&](const Eigen::Matrix3d& rotation, const Eigen::Vector3d& translation) {
+        Eigen::Matrix4d transform = Eigen::Matrix4d::Identity();
+        transform.block(0,0,3,3) = rotation;
+        transform.block(0,3,3,1) = translation - rotation * moving_centroid;
+        return transform;
+    };
+
+    // The first upper bound comes from local registration with the centroids aligned. Local registrations share one pair
+    // of surface caches.
+    SurfaceCache fixed_cache(surface1);
+    SurfaceCache moving_cache(surface2);
+    prepare_surface_cache(fixed_cache, options.local_options);
+    prepare_surface_cache(moving_cache, options.local_options);
+    RegistrationWorkspace workspace;
+
+    Eigen::Matrix4d best_transform = pose(Eigen::Matrix3d::Identity(), field_center);
+    double best_error = squared_error(fixed_cache.tree, surface2, best_transform);
+    auto polish = [&](const Eigen::Matrix4d& transform) {
+        try {
+            RegistrationResult local;
+            if(options.local_options.mode == RegistrationMode::PointToPoint) {
+                local = register_surfaces(surface1, surface2, transform, options.local_options, workspace);
+            } else {
+                local = register_surfaces(fixed_cache, moving_cache, transform, options.local_options, workspace);
+            }
+            double local_error = squared_error(fixed_cache.tree, surface2, local.transform);
+            if(local_error < best_error) {
+                best_error = local_error;
+                best_transform = local.transform;
+            }
+        } catch(RegistrationCancelledException&) {
+            throw;
+        } catch(PointMatchingException&) {
+            // A failed local registration leaves the bound as it was.
+        }
+    };
+    polish(best_transform);
+
+    SearchQueue queue;
+    SearchBox root = { { 0, 0, 0 }, M_PI, 0 };
+    queue.push(root);
+
+    // Boxes dropped for coming within tolerance of the best error still count towards the final lower bound.
+    double set_aside = std::numeric_limits<double>::infinity();
+    int threads = thread_count(options.threads);
+    int nodes = 0;
+    bool optimal = false;
+    while(true) {
+        if(queue.empty() || best_error - queue.top().lower_bound <= tolerance) {
+            optimal = true;
+            break;
+        }
+        if(deadline_pointer && std::chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+
+        std::vector<SearchBox> children;
+        while(!queue.empty() && static_cast<int>(children.size()) < 8 * threads && queue.top().lower_bound < best_error - tolerance) {
+            SearchBox box = queue.top();
+            queue.pop();
+            for(int child = 0; child < 8; child++) {
+                SearchBox next = child_box(box, child);
+                // Boxes wholly outside the ball of radius pi hold no rotations that are not also inside it.
+                if(Eigen::Vector3d(next.center[0], next.center[1], next.center[2]).norm() - sqrt(3.0) * next.half_side <= M_PI) {
+                    children.push_back(next);
+                }
+            }
+        }
+        nodes += children.size();
+
+        int count = children.size();
+        std::vector<double> upper_bounds(count);
+        std::vector<double> lower_bounds(count);
+        std::vector<Eigen::Vector3d> translations(count);
+        double bound_to_beat = best_error;
+        parallel_for_blocks(count, threads, [&](int begin, int end, int) {
+            std::vector<Eigen::Vector3d> rotated(n);
+            Eigen::VectorXd no_uncertainty = Eigen::VectorXd::Zero(n);
+            Eigen::VectorXd uncertainty(n);
+            for(int c = begin; c < end; c++) {
+                Eigen::Matrix3d rotation = box_rotation(children[c]);
+                for(int i = 0; i < n; i++) {
+                    rotated[i] = rotation * centred.col(i);
+                }
+
+                // The lower bound comes first, as most boxes can be discarded on it without the costlier upper bound search.
+                // That search is only a source of good poses, so it need not run to the full tolerance.
+                double angle = std::min(sqrt(3.0) * children[c].half_side / 2, M_PI / 2);
+                uncertainty = 2 * sin(angle) * radii;
+                Eigen::Vector3d unused;
+                translation_search(field, rotated, uncertainty, translation_domain, bound_to_beat, tolerance, search_expansions, deadline_pointer, unused,
+                                   lower_bounds[c]);
+                lower_bounds[c] = std::max(lower_bounds[c], children[c].lower_bound);
+
+                upper_bounds[c] = bound_to_beat;
+                if(lower_bounds[c] < bound_to_beat - tolerance) {
+                    double unused_bound;
+                    translations[c] = Eigen::Vector3d(translation_domain.center[0], translation_domain.center[1], translation_domain.center[2]);
+                    upper_bounds[c] = translation_search(field, rotated, no_uncertainty, translation_domain, bound_to_beat,
+                                                         std::max(tolerance, upper_search_tolerance * bound_to_beat), search_expansions, deadline_pointer,
+                                                         translations[c], unused_bound);
+                }
+            }
+        });
+
+        for(int c = 0; c < count; c++) {
+            if(upper_bounds[c] < best_error) {
+                Eigen::Matrix4d candidate = pose(box_rotation(children[c]), translations[c]);
+                double candidate_error = squared_error(fixed_cache.tree, surface2, candidate);
+                if(candidate_error < best_error) {
+                    best_error = candidate_error;
+                    best_transform = candidate;
+                }
+                polish(candidate);
+            }
+        }
+        for(int c = 0; c < count; c++) {
+            children[c].lower_bound = lower_bounds[c];
+            if(lower_bounds[c] < best_error - tolerance) {
+                queue.push(children[c]);
+            } else {
+                set_aside = std::min(set_aside, lower_bounds[c]);
+            }
+        }
+    }
+
+    double lower_bound = std::min(best_error, set_aside);
+    if(!queue.empty()) {
+        lower_bound = std::min(lower_bound, queue.top().lower_bound);
+    }
+
+    GoIcpResult result;
+    result.transform = best_transform;
+    result.error = sqrt(best_error / n);
+    result.lower_bound = sqrt(std::max(lower_bound, 0.0) / n);
+    result.gap = result.error - result.lower_bound;
+    result.optimal = optimal;
+    result.nodes = nodes;
+    return result;
+}
+
+GoIcpResult go_icp_register_surfaces(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, const GoIcpOptions& options) {
+    // The field extends beyond the fixed cloud by a quarter of its diagonal, which covers moving points that overhang it.
+    double diagonal = (surface1.rowwise().maxCoeff() - surface1.rowwise().minCoeff()).norm();
+    double cell_size = options.cell_size > 0 ? options.cell_size : diagonal / 64;
+    DistanceField field(surface1, cell_size, diagonal / 4);
+    return go_icp_register_surfaces(field, surface1, surface2, options);
+}
@@ -0,0 +1,60 @@
+/* Globally optimal registration by branch and bound, after "Go-ICP: A Globally Optimal Solution to 3D ICP Point-Set
+   Registration", Yang, Li, Campbell and Jia, 2016. Rotation space is searched with nested translation searches, bounding
+   the point-to-point objective over each box of poses, and local ICP runs tighten the best solution as it is found. */
+#ifndef GOICP_INCLUDED
+#define GOICP_INCLUDED
+
+#include <Eigen/Dense>
+
+#include <DistanceField.hpp>
+#include <SurfaceBasedRegistration.hpp>
+
+struct GoIcpOptions {
+    GoIcpOptions() {
+        // The original point-to-point mode needs clouds of equal size, which a subsampled moving cloud rarely has.
+        local_options.mode = RegistrationMode::Generalized;
+    }
+
+    // Cell size of the distance field over the fixed cloud; zero picks 1/64 of its bounding box diagonal.
+    double cell_size = 0;
+
+    // The search stops once the best mean squared error is within this of the lower bound. Zero uses a quarter of the
+    // squared cell size. The field's lower bounds allow for its own error of about two cells, so the gap only closes where
+    // the optimum is nearly exact.
+    double tolerance = 0;
+
+    // Seconds of search after which the best transform so far is returned, with its optimality gap (zero for no limit).
+    double time_limit = 0;
+
+    int threads = 0;
+
+    // Used for the local registrations that tighten the upper bound.
+    RegistrationOptions local_options;
+};
+
+struct GoIcpResult {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    // Maps the moving cloud onto the fixed one, as for register_surfaces.
+    Eigen::Matrix4d transform;
+
+    // RMS distance of the moving points from the fixed cloud at transform, a lower bound on it over all poses, and the
+    // difference between the two.
+    double error;
+    double lower_bound;
+    double gap;
+
+    // False if the time limit stopped the search before the gap closed.
+    bool optimal;
+
+    // Boxes of rotation space that were bounded.
+    int nodes;
+};
+
+// The objective is the sum of squared distances from each moving point to its nearest point in the fixed cloud. field,
+// which should have been built over surface1, bounds it from below over boxes of poses, allowing for its own error.
+GoIcpResult go_icp_register_surfaces(const DistanceField& field, const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2,
+                                     const GoIcpOptions& options = GoIcpOptions());
+
+GoIcpResult go_icp_register_surfaces(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, const GoIcpOptions& options = GoIcpOptions());
+#endif
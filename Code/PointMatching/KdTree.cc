@@ -0,0 +1,186 @@
+/* k-d tree over the columns of a point matrix, for nearest-neighbour queries in any (small) number of dimensions */
+#include <KdTree.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+#include <Eigen/Dense>
+
+#include <Exceptions.hpp>
+
+KdTree::KdTree() {
+}
+
+KdTree::KdTree(const Eigen::MatrixXd& points, int leaf_size) : order(points.cols()) {
+    if(points.cols() < 1 || points.rows() < 1) {
+        std::cerr << "Cannot build a k-d tree over an empty point cloud." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    for(int i = 0; i < points.cols(); i++) {
+        order[i] = i;
+    }
+
+    // Order the indices first, using the caller's points, then copy them into leaf order.
+    this->points = points;
+    nodes.reserve(2 * points.cols() / leaf_size + 1);
+    build(0, points.cols(), std::max(1, leaf_size));
+
+    for(int i = 0; i < points.cols(); i++) {
+        this->points.col(i) = points.col(order[i]);
+    }
+}
+
+int KdTree::size() const {
+    return points.cols();
+}
+
+int KdTree::dimension() const {
+    return points.rows();
+}
+
+int KdTree::build(int begin, int end, int leaf_size) {
+    // Split on the axis of greatest spread, at the median, until leaves hold at most leaf_size points.
+    int node_index = nodes.size();
+    Node node = { begin, end, -1, -1, 0, 0 };
+    nodes.push_back(node);
+
+    if(end - begin <= leaf_size) {
+        return node_index;
+    }
+
+    Eigen::VectorXd lower = points.col(order[begin]);
+    Eigen::VectorXd upper = lower;
+    for(int i = begin + 1; i < end; i++) {
+        lower = lower.cwiseMin(points.col(order[i]));
+        upper = upper.cwiseMax(points.col(order[i]));
+    }
+
+    int axis;
+    (upper - lower).maxCoeff(&axis);
+
+    int middle = begin + (end - begin) / 2;
+    const Eigen::MatrixXd& p = points;
+    std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+                     [&p, axis](int a, int b) { return p(axis, a) < p(axis, b); });
+
+    nodes[node_index].axis = axis;
+    nodes[node_index].split = points(axis, order[middle]);
+
+    int left = build(begin, middle, leaf_size);
+    int right = build(middle, end, leaf_size);
+    nodes[node_index].left = left;
+    nodes[node_index].right = right;
+
+    return node_index;
+}
+
+int KdTree::nearest(const Eigen::Ref<const Eigen::VectorXd>& query, double& squared_distance) const {
+    return nearest(query, squared_distance, 0);
+}
+
+int KdTree::nearest(const Eigen::Ref<const Eigen::VectorXd>& query, double& squared_distance, double epsilon) const {
+    int best = -1;
+    squared_distance = std::numeric_limits<double>::infinity();
+    search_nearest(0, query, (1 + epsilon) * (1 + epsilon), best, squared_distance);
+
+    return order[best];
+}
+
+void KdTree::search_nearest(int node_index, const Eigen::Ref<const Eigen::VectorXd>& query, double prune_factor, int& best, double& best_distance) const {
+    const Node& node = nodes[node_index];
+    if(node.left < 0) {
+        for(int i = node.begin; i < node.end; i++) {
+            double distance = (points.col(i) - query).squaredNorm();
+            if(distance < best_distance) {
+                best_distance = distance;
+                best = i;
+            }
+        }
+        return;
+    }
+
+    // Descend into the side containing the query first; the other side is only visited if the splitting plane is closer
+    // than the best point found so far, shrunk by the approximation factor.
+    double offset = query(node.axis) - node.split;
+    int near_child = offset < 0 ? node.left : node.right;
+    int far_child = offset < 0 ? node.right : node.left;
+
+    search_nearest(near_child, query, prune_factor, best, best_distance);
+    if(offset * offset * prune_factor < best_distance) {
+        search_nearest(far_child, query, prune_factor, best, best_distance);
+    }
+}
+
+void KdTree::nearest_k(const Eigen::Ref<const Eigen::VectorXd>& query, int k, std::vector<int>& indices, std::vector<double>& squared_distances) const {
+    indices.clear();
+    squared_distances.clear();
+    if(k < 1) {
+        return;
+    }
+
+    search_k(0, query, std::min(k, size()), indices, squared_distances);
+
+    for(unsigned int i = 0; i < indices.size(); i++) {
+        indices[i] = order[indices[i]];
+    }
+}
+
+void KdTree::search_k(int node_index, const Eigen::Ref<const Eigen::VectorXd>& query, int k, std::vector<int>& indices, std::vector<double>& squared_distances) const {
+    // indices and squared_distances are kept sorted by distance, and hold at most k entries.
+    const Node& node = nodes[node_index];
+    if(node.left < 0) {
+        for(int i = node.begin; i < node.end; i++) {
+            double distance = (points.col(i) - query).squaredNorm();
+            if((int)indices.size() < k || distance < squared_distances.back()) {
+                if((int)indices.size() == k) {
+                    indices.pop_back();
+                    squared_distances.pop_back();
+                }
+                auto position = std::upper_bound(squared_distances.begin(), squared_distances.end(), distance) - squared_distances.begin();
+                squared_distances.insert(squared_distances.begin() + position, distance);
+                indices.insert(indices.begin() + position, i);
+            }
+        }
+        return;
+    }
+
+    double offset = query(node.axis) - node.split;
+    int near_child = offset < 0 ? node.left : node.right;
+    int far_child = offset < 0 ? node.right : node.left;
+
+    search_k(near_child, query, k, indices, squared_distances);
+    if((int)indices.size() < k || offset * offset < squared_distances.back()) {
+        search_k(far_child, query, k, indices, squared_distances);
+    }
+}
+
+void KdTree::within_radius(const Eigen::Ref<const Eigen::VectorXd>& query, double radius, std::vector<int>& indices) const {
+    indices.clear();
+    search_radius(0, query, radius * radius, indices);
+
+    for(unsigned int i = 0; i < indices.size(); i++) {
+        indices[i] = order[indices[i]];
+    }
+}
+
+void KdTree::search_radius(int node_index, const Eigen::Ref<const Eigen::VectorXd>& query, double squared_radius, std::vector<int>& indices) const {
+    const Node& node = nodes[node_index];
+    if(node.left < 0) {
+        for(int i = node.begin; i < node.end; i++) {
+            if((points.col(i) - query).squaredNorm() <= squared_radius) {
+                indices.push_back(i);
+            }
+        }
+        return;
+    }
+
+    double offset = query(node.axis) - node.split;
+    if(offset < 0 || offset * offset <= squared_radius) {
+        search_radius(node.left, query, squared_radius, indices);
+    }
+    if(offset >= 0 || offset * offset <= squared_radius) {
+        search_radius(node.right, query, squared_radius, indices);
+    }
+}
@@ -0,0 +1,57 @@
+/* k-d tree over the columns of a point matrix, for nearest-neighbour queries in any (small) number of dimensions */
+#ifndef KDTREE_INCLUDED
+#define KDTREE_INCLUDED
+
+#include <vector>
+
+#include <Eigen/Dense>
+
+class KdTree {
+public:
+    // An empty tree, which answers no queries until another is assigned to it.
+    KdTree();
+
+    explicit KdTree(const Eigen::MatrixXd& points, int leaf_size = 8);
+
+    int size() const;
+
+    int dimension() const;
+
+    // Index (column in the original matrix) of the point nearest to query, and its squared distance.
+    int nearest(const Eigen::Ref<const Eigen::VectorXd>& query, double& squared_distance) const;
+
+    // As above, but approximate: the point returned is within (1 + epsilon) times the distance of the nearest one, and
+    // larger epsilon visits fewer nodes. Zero gives the exact search.
+    int nearest(const Eigen::Ref<const Eigen::VectorXd>& query, double& squared_distance, double epsilon) const;
+
+    // The k nearest points to query, closest first. Fewer are returned if the tree holds fewer than k points.
+    void nearest_k(const Eigen::Ref<const Eigen::VectorXd>& query, int k, std::vector<int>& indices, std::vector<double>& squared_distances) const;
+
+    // All points within radius of query, in no particular order.
+    void within_radius(const Eigen::Ref<const Eigen::VectorXd>& query, double radius, std::vector<int>& indices) const;
+
+private:
+    struct Node {
+        // Leaves have left == -1 and own the points [begin, end).
+        int begin;
+        int end;
+        int left;
+        int right;
+        int axis;
+        double split;
+    };
+
+    int build(int begin, int end, int leaf_size);
+
+    void search_nearest(int node, const Eigen::Ref<const Eigen::VectorXd>& query, double prune_factor, int& best, double& best_distance) const;
+
+    void search_k(int node, const Eigen::Ref<const Eigen::VectorXd>& query, int k, std::vector<int>& indices, std::vector<double>& squared_distances) const;
+
+    void search_radius(int node, const Eigen::Ref<const Eigen::VectorXd>& query, double squared_radius, std::vector<int>& indices) const;
+
+    // Points are stored reordered so that each leaf is contiguous in memory; order maps back to original columns.
+    Eigen::MatrixXd points;
+    std::vector<int> order;
+    std::vector<Node> nodes;
+};
+#endif
@@ -0,0 +1,133 @@
+/* ICP against a triangle mesh: each moving point is matched to its exact projection onto the fixed surface, found through
+   a bounding volume hierarchy, rather than to the nearest of the surface's vertices, so that the accuracy of the
+   registration is not limited by the spacing of the vertices. */
+#include <MeshRegistration.hpp>
+
+#include <cmath>
+#include <iostream>
+
+#include <Exceptions.hpp>
+#include <Parallel.hpp>
+#include <PointMatching.hpp>
+#include <PoseSolver.hpp>
+#include <Util.hpp>
+
+double project_onto_mesh(const TriangleBvh& mesh, const Eigen::MatrixXd& surface, const Eigen::Matrix4d& transform, Eigen::MatrixXd& closest_points,
+                         Eigen::ArrayXi& triangles, Eigen::VectorXd& distances, int threads, const CancellationToken* cancellation) {
+    int n = surface.cols();
+    closest_points.resize(3, n);
+    triangles.resize(n);
+    distances.resize(n);
+    Eigen::Matrix3d rotation = transform.block(0,0,3,3);
+    Eigen::Vector3d translation = transform.block(0,3,3,1);
+    parallel_for_blocks(n, threads, [&](int begin, int end, int) {
+        Eigen::Vector3d point;
+        double squared_distance;
+        for(int i = begin; i < end; i++) {
+            if((i - begin) % cancellation_block == 0 && cancellation_requested(cancellation)) {
+                return;
+            }
+            triangles(i) = mesh.closest_point(rotation * surface.col(i) + translation, point, squared_distance);
+            closest_points.col(i) = point;
+            distances(i) = sqrt(squared_distance);
+        }
+    });
+    throw_if_cancelled(cancellation);
+
+    return n > 0 ? sqrt(distances.squaredNorm() / n) : 0;
+}
+
+RegistrationResult register_surface_to_mesh(const TriangleBvh& mesh, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init,
+                                            const MeshRegistrationOptions& options) {
+    // Each iteration projects the moving points onto the mesh under the current transform and takes one least-squares
+    // step towards the projections: a closed-form point-to-point fit, or a Gauss-Newton point-to-plane step using the
+    // normals of the triangles projected onto. The stopping rules are those of register_surfaces.
+    if(surface2.rows() != 3 || surface2.cols() < 3) {
+        std::cerr << "Registering to a mesh needs at least three 3D points." << std::endl;
+        throw(PointMatchingEx);
+    }
+    const auto& policy = options.convergence;
+
+    Eigen::MatrixXd closest_points;
+    Eigen::ArrayXi triangles;
+    Eigen::VectorXd distances;
+    Eigen::MatrixXd normals(3, surface2.cols());
+    Eigen::ArrayXi correspondences(surface2.cols());
+    Eigen::VectorXd weights(surface2.cols());
+
+    Eigen::Matrix4d transform = transform_init;
+    double error = project_onto_mesh(mesh, surface2, transform, closest_points, triangles, distances, options.threads, options.cancellation);
+
+    RegistrationResult result;
+    result.transform = transform;
+    result.error = error;
+    result.iterations = 0;
+    result.stop_reason = StopReason::MaxIterations;
+    result.sample_size = surface2.cols();
+
+    PoseSolverOptions solver_options;
+    solver_options.max_iterations = 1;
+    solver_options.levenberg_marquardt = false;
+    solver_options.threads = options.threads;
+
+    while(result.iterations < policy.max_iterations) {
+        for(int i = 0; i < surface2.cols(); i++) {
+            bool kept = options.max_distance <= 0 || distances(i) <= options.max_distance;
+            correspondences(i) = kept ? i : -1;
+            weights(i) = kept ? 1 : 0;
+        }
+        if(weights.sum() < 3) {
+            std::cerr << "Too few points lie within the maximum distance of the mesh." << std::endl;
+            throw(PointMatchingEx);
+        }
+
+        Eigen::Matrix4d transform_new;
+        if(options.point_to_plane) {
+            for(int i = 0; i < surface2.cols(); i++) {
+                normals.col(i) = mesh.normals().col(triangles(i));
+            }
+            PointToPlaneMetric metric(closest_points, normals, surface2, correspondences);
+            transform_new = solve_pose(metric, transform, solver_options).transform;
+        } else {
+            transform_new = estimate_weighted_rigid_transform(surface2, closest_points, weights);
+        }
+
+        double error_new = project_onto_mesh(mesh, surface2, transform_new, closest_points, triangles, distances, options.threads, options.cancellation);
+        result.iterations++;
+        if(error_new < result.error) {
+            result.transform = transform_new;
+            result.error = error_new;
+        }
+
+        auto transform_old = transform;
+        transform = transform_new;
+
+        if(policy.stop_on_error_increase && !(error_new < error)) {
+            result.stop_reason = StopReason::ErrorIncreased;
+            break;
+        }
+        if(policy.absolute_error_tolerance > 0 && error_new <= policy.absolute_error_tolerance) {
+            result.stop_reason = StopReason::ErrorThresholdReached;
+            break;
+        }
+        if(increment_converged(transform_old, transform, policy)) {
+            result.stop_reason = StopReason::IncrementConverged;
+            break;
+        }
+        if(policy.relative_error_tolerance > 0 && std::abs(error - error_new) <= policy.relative_error_tolerance * error) {
+            result.stop_reason = StopReason::RelativeErrorConverged;
+            break;
+        }
+
+        error = error_new;
+    }
+
+    result.converged = result.stop_reason != StopReason::MaxIterations;
+    return result;
+}
+
+RegistrationResult register_surface_to_mesh(const TriangleMesh& mesh, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init,
+                                            const MeshRegistrationOptions& options) {
+    TriangleBvh bvh(mesh);
+    return register_surface_to_mesh(bvh, surface2, transform_init, options);
+}
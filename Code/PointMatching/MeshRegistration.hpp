@@ -0,0 +1,41 @@
+/* ICP against a triangle mesh: each moving point is matched to its exact projection onto the fixed surface, found through
+   a bounding volume hierarchy, rather than to the nearest of the surface's vertices, so that the accuracy of the
+   registration is not limited by the spacing of the vertices. */
+#ifndef MESHREGISTRATION_INCLUDED
+#define MESHREGISTRATION_INCLUDED
+
+#include <Eigen/Dense>
+
+#include <Cancellation.hpp>
+#include <SurfaceBasedRegistration.hpp>
+#include <TriangleBvh.hpp>
+#include <TriangleMesh.hpp>
+
+struct MeshRegistrationOptions {
+    // Point-to-plane steps, against the plane of the triangle each point projects onto, converge in far fewer iterations
+    // than point-to-point steps to the projections themselves.
+    bool point_to_plane = true;
+
+    // Points further than this from the mesh are left out of each step (zero keeps every point).
+    double max_distance = 0;
+
+    // As for register_surfaces, except that there is no time limit.
+    ConvergencePolicy convergence;
+
+    const CancellationToken* cancellation = 0;
+
+    int threads = 0;
+};
+
+// Closest points on the mesh to the columns of surface under transform, the triangles they lie on and their distances.
+// Returns the RMS distance.
+double project_onto_mesh(const TriangleBvh& mesh, const Eigen::MatrixXd& surface, const Eigen::Matrix4d& transform, Eigen::MatrixXd& closest_points,
+                         Eigen::ArrayXi& triangles, Eigen::VectorXd& distances, int threads = 0, const CancellationToken* cancellation = 0);
+
+// Registers surface2 to the mesh, as register_surfaces does to a point cloud. The error is the RMS distance from the
+// moving points to the mesh.
+RegistrationResult register_surface_to_mesh(const TriangleBvh& mesh, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init,
+                                            const MeshRegistrationOptions& options = MeshRegistrationOptions());
+RegistrationResult register_surface_to_mesh(const TriangleMesh& mesh, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init,
+                                            const MeshRegistrationOptions& options = MeshRegistrationOptions());
+#endif
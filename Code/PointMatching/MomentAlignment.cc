@@ -0,0 +1,104 @@
+/* Moment-based initial alignment: the centroids and principal axes of the two clouds are matched, which is enough to
+   bring clouds in arbitrary frames within reach of ICP whenever their shapes are not too symmetric. */
+#include <MomentAlignment.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+#include <Exceptions.hpp>
+#include <MultiStartRegistration.hpp>
+#include <Parallel.hpp>
+
+CloudMoments compute_cloud_moments(const Eigen::MatrixXd& surface, int threads) {
+    // One pass over the points: each thread keeps a running mean and sum of squared deviations for its block (Welford's
+    // update, which does not lose precision to cancellation as raw sums of squares do), and the blocks are merged
+    // pairwise afterwards (Chan et al's update).
+    if(surface.rows() != 3 || surface.cols() < 1) {
+        std::cerr << "Moments need a non-empty 3D cloud." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    int blocks = std::max(1, std::min(thread_count(threads), static_cast<int>(surface.cols())));
+    std::vector<CloudMoments, Eigen::aligned_allocator<CloudMoments> > block_moments(blocks);
+    parallel_for_blocks(surface.cols(), threads, [&](int begin, int end, int block) {
+        Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+        Eigen::Matrix3d deviations = Eigen::Matrix3d::Zero();
+        for(int i = begin; i < end; i++) {
+            Eigen::Vector3d delta = surface.col(i) - mean;
+            mean += delta / (i - begin + 1);
+            deviations += delta * (surface.col(i) - mean).transpose();
+        }
+        block_moments[block].count = end - begin;
+        block_moments[block].centroid = mean;
+        block_moments[block].covariance = deviations;
+    });
+
+    CloudMoments moments = block_moments[0];
+    for(int block = 1; block < blocks; block++) {
+        const auto& other = block_moments[block];
+        int count = moments.count + other.count;
+        Eigen::Vector3d delta = other.centroid - moments.centroid;
+        moments.centroid += delta * other.count / count;
+        moments.covariance += other.covariance + delta * delta.transpose() * (static_cast<double>(moments.count) * other.count / count);
+        moments.count = count;
+    }
+    moments.covariance /= moments.count;
+
+    return moments;
+}
+
+static Eigen::Matrix3d principal_axes(const Eigen::Matrix3d& covariance) {
+    // Eigenvectors as columns, in order of increasing variance, and forming a right-handed frame.
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(covariance);
+    Eigen::Matrix3d axes = solver.eigenvectors();
+    if(axes.determinant() < 0) {
+        axes.col(0) *= -1;
+    }
+    return axes;
+}
+
+Eigen::Matrix4d moment_alignment(const Eigen::MatrixXd& fixed, const Eigen::MatrixXd& moving, int subsample, int threads) {
+    // The moving axes are taken onto the fixed axes through each of the 24 rotations of the cube, which are exactly the
+    // proper signed permutations of the axes.
+    if(subsample < 1) {
+        std::cerr << "Moment alignment needs a positive subsample size." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    auto fixed_moments = compute_cloud_moments(fixed, threads);
+    auto moving_moments = compute_cloud_moments(moving, threads);
+    Eigen::Matrix3d fixed_axes = principal_axes(fixed_moments.covariance);
+    Eigen::Matrix3d moving_axes = principal_axes(moving_moments.covariance);
+
+    // Evenly strided subsamples; the fixed one is larger, so that nearest-neighbour distances are not dominated by its
+    // spacing.
+    int moving_stride = std::max(1, static_cast<int>(moving.cols() / subsample));
+    int fixed_stride = std::max(1, static_cast<int>(fixed.cols() / (4 * subsample)));
+
+    Eigen::Matrix4d best = Eigen::Matrix4d::Identity();
+    double best_error = std::numeric_limits<double>::infinity();
+    for(const auto& permutation : rotation_group(24)) {
+        Eigen::Matrix3d rotation = fixed_axes * permutation * moving_axes.transpose();
+        Eigen::Vector3d translation = fixed_moments.centroid - rotation * moving_moments.centroid;
+
+        double error = 0;
+        for(int i = 0; i < moving.cols() && error < best_error; i += moving_stride) {
+            Eigen::Vector3d x = rotation * moving.col(i) + translation;
+            double nearest = std::numeric_limits<double>::infinity();
+            for(int j = 0; j < fixed.cols(); j += fixed_stride) {
+                nearest = std::min(nearest, (fixed.col(j) - x).squaredNorm());
+            }
+            error += nearest;
+        }
+
+        if(error < best_error) {
+            best_error = error;
+            best.block(0,0,3,3) = rotation;
+            best.block(0,3,3,1) = translation;
+        }
+    }
+
+    return best;
+}
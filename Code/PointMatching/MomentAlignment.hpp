@@ -0,0 +1,24 @@
+/* Moment-based initial alignment: the centroids and principal axes of the two clouds are matched, which is enough to
+   bring clouds in arbitrary frames within reach of ICP whenever their shapes are not too symmetric. */
+#ifndef MOMENTALIGNMENT_INCLUDED
+#define MOMENTALIGNMENT_INCLUDED
+
+#include <Eigen/Dense>
+
+struct CloudMoments {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    int count;
+    Eigen::Vector3d centroid;
+
+    // Population covariance of the points about centroid.
+    Eigen::Matrix3d covariance;
+};
+
+CloudMoments compute_cloud_moments(const Eigen::MatrixXd& surface, int threads = 0);
+
+// Maps the moving cloud onto the fixed one, as for register_surfaces. Principal axes are only defined up to sign and, for
+// near-equal variances, order, so every proper rotation between the two sets of axes is scored by the RMS distance from
+// up to subsample moving points to their nearest neighbours among a subsample of the fixed cloud, and the best is kept.
+Eigen::Matrix4d moment_alignment(const Eigen::MatrixXd& fixed, const Eigen::MatrixXd& moving, int subsample = 64, int threads = 0);
+#endif
@@ -0,0 +1,169 @@
+/* Multi-start registration: ICP is run from a set of rotations covering SO(3), concurrently, and the best result is kept.
+   This finds the global minimum for clouds in arbitrary frames at the cost of a few single-start registrations. */
+#include <MultiStartRegistration.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <mutex>
+
+#include <Eigen/Geometry>
+
+#include <Cancellation.hpp>
+#include <Exceptions.hpp>
+#include <Parallel.hpp>
+#include <SurfaceCache.hpp>
+
+std::vector<Eigen::Matrix3d> rotation_group(int order) {
+    // Close a pair of generators under multiplication. The cube group is generated by quarter turns about x and y, and the
+    // icosahedral group by a fifth turn about a vertex of the icosahedron with vertices (0, +-1, +-phi) and cyclic
+    // permutations, together with a half turn about z (which passes through the midpoint of an edge).
+    std::vector<Eigen::Matrix3d> generators;
+    if(order == 24) {
+        generators.push_back(Eigen::AngleAxisd(M_PI / 2, Eigen::Vector3d::UnitX()).toRotationMatrix());
+        generators.push_back(Eigen::AngleAxisd(M_PI / 2, Eigen::Vector3d::UnitY()).toRotationMatrix());
+    } else if(order == 60) {
+        double phi = (1 + sqrt(5.0)) / 2;
+        generators.push_back(Eigen::AngleAxisd(2 * M_PI / 5, Eigen::Vector3d(0, 1, phi).normalized()).toRotationMatrix());
+        generators.push_back(Eigen::AngleAxisd(M_PI, Eigen::Vector3d::UnitZ()).toRotationMatrix());
+    } else {
+        std::cerr << "Rotation groups of order 24 or 60 are available, not " << order << "." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    std::vector<Eigen::Matrix3d> group(1, Eigen::Matrix3d::Identity());
+    for(unsigned int i = 0; i < group.size(); i++) {
+        for(unsigned int g = 0; g < generators.size(); g++) {
+            Eigen::Matrix3d product = generators[g] * group[i];
+            bool found = false;
+            for(unsigned int j = 0; j < group.size() && !found; j++) {
+                found = (group[j] - product).cwiseAbs().maxCoeff() < 1E-9;
+            }
+            if(!found) {
+                group.push_back(product);
+            }
+        }
+    }
+
+    return group;
+}
+
+MultiStartResult multi_start_register_surfaces(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, const RegistrationOptions& options,
+                                               const MultiStartOptions& multi_start_options) {
+    // Threads take starts from a shared counter and run each in rounds of iterations_per_round, chaining each round from
+    // the last. Between rounds a start compares its error against the best so far and gives up if it is clearly worse,
+    // so most of the time goes on the starts heading for the global minimum.
+    if(multi_start_options.iterations_per_round < 1 || !(multi_start_options.abandon_ratio >= 1)) {
+        std::cerr << "Multi-start registration needs at least one iteration per round, and an abandon ratio of at least one." << std::endl;
+        throw(PointMatchingEx);
+    }
+    if(options.initial_alignment != InitialAlignment::None) {
+        std::cerr << "Multi-start registration sets each start's transform itself, so initial_alignment must be None." << std::endl;
+        throw(PointMatchingEx);
+    }
+    // Each round is a fresh registration, which would restart the extrapolation history, the time limit and the batch
+    // schedule.
+    if(options.anderson_history > 0) {
+        std::cerr << "Multi-start registration runs each start in rounds, so cannot be combined with Anderson acceleration." << std::endl;
+        throw(PointMatchingEx);
+    }
+    if(options.convergence.time_limit > 0) {
+        std::cerr << "Multi-start registration runs each start in rounds, so cannot be combined with a time limit." << std::endl;
+        throw(PointMatchingEx);
+    }
+    if(options.mini_batch.initial_batch_size > 0) {
+        std::cerr << "Multi-start registration runs each start in rounds, so cannot be combined with mini-batches." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    auto rotations = rotation_group(multi_start_options.starts);
+
+    // The caches are shared read-only between threads; each thread has its own workspace.
+    SurfaceCache fixed(surface1);
+    SurfaceCache moving(surface2);
+    prepare_surface_cache(fixed, options);
+    prepare_surface_cache(moving, options);
+
+    Eigen::Vector3d fixed_centroid = surface1.rowwise().mean();
+    Eigen::Vector3d moving_centroid = surface2.rowwise().mean();
+
+    std::mutex best_mutex;
+    MultiStartResult result;
+    result.best.error = std::numeric_limits<double>::infinity();
+    result.best_start = -1;
+    result.abandoned = 0;
+    result.failed = 0;
+    std::atomic<double> best_error(std::numeric_limits<double>::infinity());
+    std::atomic<int> next_start(0);
+    std::atomic<int> abandoned(0);
+    std::atomic<int> failed(0);
+
+    int threads = std::min(thread_count(multi_start_options.threads), static_cast<int>(rotations.size()));
+    parallel_for_blocks(threads, threads, [&](int, int, int) {
+        RegistrationWorkspace workspace;
+        RegistrationOptions round_options = options;
+        for(int start = next_start.fetch_add(1); start < static_cast<int>(rotations.size()); start = next_start.fetch_add(1)) {
+            if(cancellation_requested(options.cancellation)) {
+                break;
+            }
+            Eigen::Matrix4d transform = Eigen::Matrix4d::Identity();
+            transform.block(0,0,3,3) = rotations[start];
+            transform.block(0,3,3,1) = fixed_centroid - rotations[start] * moving_centroid;
+
+            RegistrationResult start_result;
+            int iterations = 0;
+            bool finished = false;
+            try {
+                while(!finished) {
+                    round_options.convergence.max_iterations = std::min(multi_start_options.iterations_per_round, options.convergence.max_iterations - iterations);
+                    // Always through the caches, so that rounds do not rebuild trees, normals or boundary flags.
+                    start_result = register_surfaces(fixed, moving, transform, round_options, workspace);
+                    iterations += start_result.iterations;
+                    transform = start_result.transform;
+
+                    // Any start's error so far bounds the final error, so the best of them is what the others must compete with.
+                    double best = best_error.load();
+                    while(start_result.error < best && !best_error.compare_exchange_weak(best, start_result.error)) {
+                    }
+
+                    finished = start_result.stop_reason != StopReason::MaxIterations || iterations >= options.convergence.max_iterations
+                               || start_result.iterations == 0;
+                    if(!finished && start_result.error > multi_start_options.abandon_ratio * best) {
+                        abandoned++;
+                        break;
+                    }
+                }
+            } catch(RegistrationCancelledException&) {
+                // Every other thread will see the same token; the whole search is abandoned below.
+                break;
+            } catch(PointMatchingException&) {
+                // A start can fail where another succeeds (for example, by matching every point to a line), so it is
+                // dropped rather than ending the whole search.
+                failed++;
+                continue;
+            }
+            if(!finished) {
+                continue;
+            }
+            start_result.iterations = iterations;
+
+            std::lock_guard<std::mutex> lock(best_mutex);
+            if(start_result.error < result.best.error) {
+                result.best = start_result;
+                result.best_start = start;
+            }
+        }
+    });
+
+    throw_if_cancelled(options.cancellation);
+
+    result.abandoned = abandoned.load();
+    result.failed = failed.load();
+    if(result.best_start < 0) {
+        std::cerr << "Registration failed from every start." << std::endl;
+        throw(PointMatchingEx);
+    }
+    return result;
+}
@@ -0,0 +1,46 @@
+/* Multi-start registration: ICP is run from a set of rotations covering SO(3), concurrently, and the best result is kept.
+   This finds the global minimum for clouds in arbitrary frames at the cost of a few single-start registrations. */
+#ifndef MULTISTARTREGISTRATION_INCLUDED
+#define MULTISTARTREGISTRATION_INCLUDED
+
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+
+#include <SurfaceBasedRegistration.hpp>
+
+// The rotation group of the cube (24 elements) or of the icosahedron (60 elements).
+std::vector<Eigen::Matrix3d> rotation_group(int order);
+
+struct MultiStartOptions {
+    // Size of the set of starting rotations: 24 or 60.
+    int starts = 24;
+
+    int threads = 0;
+
+    // Every start runs for this many iterations at a time, and after each round is abandoned if its error is more than
+    // abandon_ratio times the best error found so far by any start.
+    int iterations_per_round = 5;
+    double abandon_ratio = 1.5;
+};
+
+struct MultiStartResult {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    // The best start's registration; its iterations count every round it ran.
+    RegistrationResult best;
+    int best_start;
+
+    // Starts given up for being clearly worse than the best, and starts whose registration threw.
+    int abandoned;
+    int failed;
+};
+
+// Starts rotate the moving cloud about its centroid, after moving its centroid onto the fixed cloud's. options apply to
+// every start, and options.convergence.max_iterations bounds each start's total iterations. Each round is a separate
+// registration, so the robust scale and rejection thresholds are estimated afresh every round, and Anderson acceleration,
+// time limits and mini-batches are refused.
+MultiStartResult multi_start_register_surfaces(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, const RegistrationOptions& options,
+                                               const MultiStartOptions& multi_start_options = MultiStartOptions());
+#endif
@@ -0,0 +1,288 @@
+/* Multi-view registration: many overlapping scans are brought into one frame by registering every pair that overlaps,
+   concurrently, and then solving a pose graph over all the pairwise results at once, so that their errors are spread
+   over the whole set rather than accumulating along a chain of registrations. */
+#include <MultiViewRegistration.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <queue>
+
+#include <Eigen/Sparse>
+
+#include <Cancellation.hpp>
+#include <Exceptions.hpp>
+#include <KdTree.hpp>
+#include <Parallel.hpp>
+#include <SurfaceCache.hpp>
+#include <Util.hpp>
+
+typedef Eigen::Matrix<double, 6, 6> Matrix6d;
+typedef std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d> > PoseVector;
+
+static void world_bounds(const Eigen::MatrixXd& scan, const Eigen::Matrix4d& pose, Eigen::Vector3d& lower, Eigen::Vector3d& upper) {
+    // Bounding box, in the common frame, of the scan's own bounding box under pose.
+    Eigen::Vector3d local_lower = scan.rowwise().minCoeff();
+    Eigen::Vector3d local_upper = scan.rowwise().maxCoeff();
+    lower.setConstant(std::numeric_limits<double>::infinity());
+    upper.setConstant(-std::numeric_limits<double>::infinity());
+    for(int corner = 0; corner < 8; corner++) {
+        Eigen::Vector3d point;
+        for(int d = 0; d < 3; d++) {
+            point(d) = (corner >> d) & 1 ? local_upper(d) : local_lower(d);
+        }
+        point = pose.block(0,0,3,3) * point + pose.block(0,3,3,1);
+        lower = lower.cwiseMin(point);
+        upper = upper.cwiseMax(point);
+    }
+}
+
+static double box_overlap(const Eigen::Vector3d& lower1, const Eigen::Vector3d& upper1, const Eigen::Vector3d& lower2, const Eigen::Vector3d& upper2) {
+    // Volume of the intersection of two boxes, as a fraction of the smaller box's volume.
+    double intersection = (upper1.cwiseMin(upper2) - lower1.cwiseMax(lower2)).cwiseMax(0).prod();
+    double smaller = std::min((upper1 - lower1).prod(), (upper2 - lower2).prod());
+    return smaller > 0 ? intersection / smaller : 0;
+}
+
+static Matrix6d adjoint(const Eigen::Matrix4d& transform) {
+    // Maps a twist (omega, v) through transform: exp(Ad_T xi) = T exp(xi) T^-1.
+    Eigen::Matrix3d rotation = transform.block(0,0,3,3);
+    Matrix6d result = Matrix6d::Zero();
+    result.block(0,0,3,3) = rotation;
+    result.block(3,3,3,3) = rotation;
+    result.block(3,0,3,3) = skew(transform.block(0,3,3,1)) * rotation;
+    return result;
+}
+
+static Matrix6d inverse_right_jacobian(const Vector6d& twist) {
+    // First-order approximation I + ad(xi) / 2, which is accurate for the small residuals of a converged pose graph.
+    Matrix6d ad = Matrix6d::Zero();
+    ad.block(0,0,3,3) = skew(twist.head<3>());
+    ad.block(3,3,3,3) = skew(twist.head<3>());
+    ad.block(3,0,3,3) = skew(twist.tail<3>());
+    return Matrix6d::Identity() + ad / 2;
+}
+
+static bool edge_information(const SurfaceCache& fixed, const Eigen::MatrixXd& moving, const Eigen::Matrix4d& transform, double max_distance,
+                             Matrix6d& information) {
+    // The Gauss-Newton Hessian of the sum of squared distances between matched points, with respect to a perturbation
+    // T exp(xi) of the pair's transform: each moving point p matched within max_distance adds A^T A, A = [-skew(p), I].
+    // Returns false if the Hessian is singular, when the pair does not constrain every degree of freedom.
+    information.setZero();
+    Eigen::Matrix<double, 3, 6> A;
+    A.block(0,3,3,3).setIdentity();
+    double squared_max = max_distance * max_distance;
+    for(int i = 0; i < moving.cols(); i++) {
+        Eigen::Vector3d x = transform.block(0,0,3,3) * moving.col(i) + transform.block(0,3,3,1);
+        double squared_distance;
+        fixed.tree.nearest(x, squared_distance);
+        if(squared_distance <= squared_max) {
+            A.block(0,0,3,3) = -skew(moving.col(i));
+            information.noalias() += A.transpose() * A;
+        }
+    }
+    Eigen::SelfAdjointEigenSolver<Matrix6d> solver(information);
+    return solver.eigenvalues()(0) > 1E-12 * solver.eigenvalues()(5);
+}
+
+static double pose_graph_cost(const std::vector<MultiViewEdge, Eigen::aligned_allocator<MultiViewEdge> >& edges, const PoseVector& poses) {
+    double cost = 0;
+    for(const auto& edge : edges) {
+        if(edge.used) {
+            Vector6d residual = se3_log(edge.transform.inverse() * poses[edge.from].inverse() * poses[edge.to]);
+            cost += residual.dot(edge.information * residual);
+        }
+    }
+    return cost;
+}
+
+MultiViewResult multi_view_register_surfaces(const std::vector<Eigen::MatrixXd>& scans, const PoseVector& initial_poses, const MultiViewOptions& options) {
+    // 1. Pair the scans whose boxes overlap under the initial poses. 2. Register the pairs concurrently, each thread taking
+    // the next pair from a shared counter, against caches prepared once per scan. 3. Chain the pairwise transforms along a
+    // breadth-first spanning tree from the first scan for starting poses. 4. Minimise the sum over pairs of
+    // r^T Omega r, r = log(T_ij^-1 X_i^-1 X_j), over the poses X with Gauss-Newton, the first pose held fixed. The
+    // normal equations couple only paired scans, so they are assembled and solved as a sparse system.
+    int n = static_cast<int>(scans.size());
+    if(n < 2) {
+        std::cerr << "Multi-view registration needs at least two scans." << std::endl;
+        throw(PointMatchingEx);
+    }
+    for(const auto& scan : scans) {
+        if(scan.rows() != 3 || scan.cols() < 3) {
+            std::cerr << "Every scan must hold at least three 3D points." << std::endl;
+            throw(PointMatchingEx);
+        }
+    }
+    if(options.pairwise.initial_alignment != InitialAlignment::None) {
+        std::cerr << "Multi-view registration starts each pair from the initial poses, so initial_alignment must be None." << std::endl;
+        throw(PointMatchingEx);
+    }
+    if(!initial_poses.empty() && static_cast<int>(initial_poses.size()) != n) {
+        std::cerr << "There must be one initial pose per scan, or none." << std::endl;
+        throw(PointMatchingEx);
+    }
+    PoseVector initial = initial_poses.empty() ? PoseVector(n, Eigen::Matrix4d::Identity()) : initial_poses;
+
+    MultiViewResult result;
+    std::vector<Eigen::Vector3d> lowers(n);
+    std::vector<Eigen::Vector3d> uppers(n);
+    for(int i = 0; i < n; i++) {
+        world_bounds(scans[i], initial[i], lowers[i], uppers[i]);
+    }
+    for(int i = 0; i < n; i++) {
+        for(int j = i + 1; j < n; j++) {
+            if(j == i + 1 || box_overlap(lowers[i], uppers[i], lowers[j], uppers[j]) >= options.min_overlap) {
+                MultiViewEdge edge;
+                edge.from = i;
+                edge.to = j;
+                edge.transform = Eigen::Matrix4d::Identity();
+                edge.information = Eigen::Matrix<double, 6, 6>::Zero();
+                edge.error = std::numeric_limits<double>::infinity();
+                edge.used = false;
+                result.edges.push_back(edge);
+            }
+        }
+    }
+
+    // Each scan's cache is prepared once, in parallel, and then shared read-only by every pair it is in. A failure (bad
+    // options, say) is recorded and rethrown once the threads have joined.
+    std::vector<SurfaceCache> caches;
+    caches.reserve(n);
+    for(const auto& scan : scans) {
+        caches.emplace_back(scan);
+    }
+    std::atomic<bool> failed(false);
+    parallel_for_blocks(n, options.threads, [&](int begin, int end, int) {
+        for(int i = begin; i < end; i++) {
+            try {
+                prepare_surface_cache(caches[i], options.pairwise);
+            } catch(RegistrationCancelledException&) {
+                return;
+            } catch(PointMatchingException&) {
+                failed = true;
+                return;
+            }
+        }
+    });
+    throw_if_cancelled(options.pairwise.cancellation);
+    if(failed) {
+        throw(PointMatchingEx);
+    }
+
+    std::atomic<int> next_edge(0);
+    int edge_count = static_cast<int>(result.edges.size());
+    int threads = std::min(thread_count(options.threads), edge_count);
+    parallel_for_blocks(threads, threads, [&](int, int, int) {
+        RegistrationWorkspace workspace;
+        for(int e = next_edge.fetch_add(1); e < edge_count; e = next_edge.fetch_add(1)) {
+            auto& edge = result.edges[e];
+            Eigen::Matrix4d transform_init = initial[edge.from].inverse() * initial[edge.to];
+            try {
+                auto pair = register_surfaces(caches[edge.from], caches[edge.to], transform_init, options.pairwise, workspace);
+                edge.transform = pair.transform;
+                edge.error = pair.error;
+                edge.used = (options.max_edge_error <= 0 || pair.error <= options.max_edge_error)
+                            && edge_information(caches[edge.from], scans[edge.to], pair.transform, 3 * pair.error, edge.information);
+            } catch(RegistrationCancelledException&) {
+                break;
+            } catch(PointMatchingException&) {
+                // A pair that barely overlaps can fail to register; the pose graph does without it.
+                edge.error = std::numeric_limits<double>::infinity();
+            }
+        }
+    });
+    throw_if_cancelled(options.pairwise.cancellation);
+
+    // Starting poses from a breadth-first spanning tree over the usable pairs.
+    std::vector<std::vector<int> > incident(n);
+    for(int e = 0; e < edge_count; e++) {
+        if(result.edges[e].used) {
+            incident[result.edges[e].from].push_back(e);
+            incident[result.edges[e].to].push_back(e);
+        }
+    }
+    PoseVector& poses = result.poses;
+    poses.assign(n, Eigen::Matrix4d::Identity());
+    std::vector<char> reached(n, 0);
+    std::queue<int> queue;
+    reached[0] = 1;
+    queue.push(0);
+    while(!queue.empty()) {
+        int scan = queue.front();
+        queue.pop();
+        for(int e : incident[scan]) {
+            const auto& edge = result.edges[e];
+            int other = edge.from == scan ? edge.to : edge.from;
+            if(!reached[other]) {
+                poses[other] = edge.from == scan ? Eigen::Matrix4d(poses[scan] * edge.transform) : Eigen::Matrix4d(poses[scan] * edge.transform.inverse());
+                reached[other] = 1;
+                queue.push(other);
+            }
+        }
+    }
+    for(int i = 0; i < n; i++) {
+        if(!reached[i]) {
+            std::cerr << "Scan " << i << " could not be registered to any scan connected to the first." << std::endl;
+            throw(PointMatchingEx);
+        }
+    }
+
+    // Gauss-Newton over the poses of scans 1 to n-1, perturbed as exp(delta) X.
+    int unknowns = 6 * (n - 1);
+    Eigen::VectorXd gradient(unknowns);
+    std::vector<Eigen::Triplet<double> > triplets;
+    Eigen::SparseMatrix<double> hessian(unknowns, unknowns);
+    Eigen::SimplicialLDLT<Eigen::SparseMatrix<double> > solver;
+    result.iterations = 0;
+    while(result.iterations < options.max_iterations) {
+        gradient.setZero();
+        triplets.clear();
+        for(const auto& edge : result.edges) {
+            if(!edge.used) {
+                continue;
+            }
+            Vector6d residual = se3_log(edge.transform.inverse() * poses[edge.from].inverse() * poses[edge.to]);
+            Matrix6d jacobian_to = inverse_right_jacobian(residual) * adjoint(poses[edge.to].inverse());
+            int scans_of_edge[2] = { edge.from, edge.to };
+            Matrix6d jacobians[2] = { -jacobian_to, jacobian_to };
+            for(int a = 0; a < 2; a++) {
+                if(scans_of_edge[a] == 0) {
+                    continue;
+                }
+                int row = 6 * (scans_of_edge[a] - 1);
+                gradient.segment<6>(row) += jacobians[a].transpose() * edge.information * residual;
+                for(int b = 0; b < 2; b++) {
+                    if(scans_of_edge[b] == 0) {
+                        continue;
+                    }
+                    int column = 6 * (scans_of_edge[b] - 1);
+                    Matrix6d block = jacobians[a].transpose() * edge.information * jacobians[b];
+                    for(int r = 0; r < 6; r++) {
+                        for(int c = 0; c < 6; c++) {
+                            triplets.emplace_back(row + r, column + c, block(r, c));
+                        }
+                    }
+                }
+            }
+        }
+        hessian.setFromTriplets(triplets.begin(), triplets.end());
+        solver.compute(hessian);
+        if(solver.info() != Eigen::Success) {
+            std::cerr << "The pose graph is singular." << std::endl;
+            throw(PointMatchingEx);
+        }
+        Eigen::VectorXd step = -solver.solve(gradient);
+        result.iterations++;
+        for(int i = 1; i < n; i++) {
+            poses[i] = se3_exp(step.segment<6>(6 * (i - 1))) * poses[i];
+        }
+        if(step.cwiseAbs().maxCoeff() < options.step_tolerance) {
+            break;
+        }
+    }
+
+    result.cost = pose_graph_cost(result.edges, poses);
+    return result;
+}
@@ -0,0 +1,66 @@
+/* Multi-view registration: many overlapping scans are brought into one frame by registering every pair that overlaps,
+   concurrently, and then solving a pose graph over all the pairwise results at once, so that their errors are spread
+   over the whole set rather than accumulating along a chain of registrations. */
+#ifndef MULTIVIEWREGISTRATION_INCLUDED
+#define MULTIVIEWREGISTRATION_INCLUDED
+
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+
+#include <SurfaceBasedRegistration.hpp>
+
+struct MultiViewOptions {
+    // Options for every pairwise registration. Each scan's cache (k-d tree, and normals or covariances) is prepared once
+    // for them and shared by all the pairs it is in.
+    RegistrationOptions pairwise;
+
+    // Scans are paired when their bounding boxes, under the initial poses, overlap by at least this fraction of the
+    // smaller box's volume. Consecutive scans are always paired.
+    double min_overlap = 0.3;
+
+    // Pairs whose registration error exceeds this are left out of the pose graph (zero keeps every pair).
+    double max_edge_error = 0;
+
+    // Gauss-Newton iterations over the pose graph, which stop once every pose moves by less than step_tolerance.
+    int max_iterations = 20;
+    double step_tolerance = 1E-10;
+
+    int threads = 0;
+};
+
+// A registered pair of scans: transform maps scan `to` into the frame of scan `from`, and information is the Gauss-Newton
+// Hessian of the pair's alignment error, which weights the pair in the pose graph.
+struct MultiViewEdge {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    int from;
+    int to;
+    Eigen::Matrix4d transform;
+    Eigen::Matrix<double, 6, 6> information;
+    double error;
+
+    // False for pairs whose registration threw or whose error was too large.
+    bool used;
+};
+
+struct MultiViewResult {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    // Maps each scan into the frame of the first scan.
+    std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d> > poses;
+
+    std::vector<MultiViewEdge, Eigen::aligned_allocator<MultiViewEdge> > edges;
+
+    // Pose graph iterations, and its cost (the sum over the used edges of their weighted squared residuals) at the end.
+    int iterations;
+    double cost;
+};
+
+// Registers the scans into the frame of the first. initial_poses, one per scan mapping it into a common frame, give the
+// rough alignment that the pairs are chosen and started from; if empty, the scans are taken to be roughly aligned already.
+MultiViewResult multi_view_register_surfaces(const std::vector<Eigen::MatrixXd>& scans,
+                                             const std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d> >& initial_poses,
+                                             const MultiViewOptions& options = MultiViewOptions());
+#endif
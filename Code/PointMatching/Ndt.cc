@@ -0,0 +1,324 @@
+/* Normal Distributions Transform registration, after "The Three-Dimensional Normal-Distributions Transform", Magnusson,
+   2009. The fixed cloud is replaced by a grid of voxels, each holding the mean and covariance of the points inside it,
+   and the moving cloud is aligned by Newton's method to maximise the likelihood of its points under those Gaussians.
+   Each point costs one voxel lookup rather than a nearest-neighbour search, which suits large, noisy scans. */
+#include <Ndt.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include <Exceptions.hpp>
+#include <Parallel.hpp>
+#include <Util.hpp>
+
+// Voxel indices are packed 21 bits to an axis into a key, as for voxel_downsample.
+static const long long voxel_index_range = 2097152;
+
+long long ndt_voxel_key(const NdtGrid& grid, const Eigen::Vector3d& point) {
+    long long key = 0;
+    for(int d = 0; d < 3; d++) {
+        double index = floor((point(d) - grid.origin(d)) / grid.voxel_size);
+        if(!(index >= 0 && index < voxel_index_range)) {
+            return -1;
+        }
+        key = key * voxel_index_range + static_cast<long long>(index);
+    }
+    return key;
+}
+
+// Running moments of the points in one voxel.
+struct VoxelMoments {
+    int count;
+    Eigen::Vector3d mean;
+    Eigen::Matrix3d deviations;
+};
+
+NdtGrid build_ndt_grid(const Eigen::MatrixXd& surface, double voxel_size, int min_points, int threads) {
+    // One pass over the points: each thread keeps the running moments of the voxels its block touches (Welford's update),
+    // and the blocks' voxels are merged afterwards (Chan et al's update), as for compute_cloud_moments.
+    if(surface.rows() != 3 || surface.cols() < 1) {
+        std::cerr << "NDT needs a non-empty 3D fixed cloud." << std::endl;
+        throw(PointMatchingEx);
+    }
+    if(!(voxel_size > 0)) {
+        std::cerr << "Voxel size must be positive." << std::endl;
+        throw(PointMatchingEx);
+    }
+    if(min_points < 3) {
+        std::cerr << "NDT voxels need at least 3 points each." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    NdtGrid grid;
+    grid.voxel_size = voxel_size;
+    grid.origin = surface.rowwise().minCoeff();
+
+    int blocks = std::max(1, std::min(thread_count(threads), static_cast<int>(surface.cols())));
+    std::vector<std::unordered_map<long long, VoxelMoments> > block_moments(blocks);
+    parallel_for_blocks(surface.cols(), threads, [&](int begin, int end, int block) {
+        auto& moments = block_moments[block];
+        for(int i = begin; i < end; i++) {
+            Eigen::Vector3d point = surface.col(i);
+            long long key = ndt_voxel_key(grid, point);
+            if(key < 0) {
+                continue;
+            }
+            auto& voxel = moments.emplace(key, VoxelMoments{0, Eigen::Vector3d::Zero(), Eigen::Matrix3d::Zero()}).first->second;
+            voxel.count++;
+            Eigen::Vector3d delta = point - voxel.mean;
+            voxel.mean += delta / voxel.count;
+            voxel.deviations += delta * (point - voxel.mean).transpose();
+        }
+    });
+
+    auto& moments = block_moments[0];
+    for(int block = 1; block < blocks; block++) {
+        for(const auto& entry : block_moments[block]) {
+            const auto& other = entry.second;
+            auto inserted = moments.insert(entry);
+            if(inserted.second) {
+                continue;
+            }
+            auto& voxel = inserted.first->second;
+            int count = voxel.count + other.count;
+            Eigen::Vector3d delta = other.mean - voxel.mean;
+            voxel.mean += delta * other.count / count;
+            voxel.deviations += other.deviations + delta * delta.transpose() * (static_cast<double>(voxel.count) * other.count / count);
+            voxel.count = count;
+        }
+    }
+
+    // Voxels in key order, so that the grid does not depend on the number of threads.
+    std::vector<long long> keys;
+    for(const auto& entry : moments) {
+        if(entry.second.count >= min_points) {
+            keys.push_back(entry.first);
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+
+    for(auto key : keys) {
+        const auto& voxel = moments[key];
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(voxel.deviations / (voxel.count - 1));
+        Eigen::Vector3d eigenvalues = solver.eigenvalues();
+        if(!(eigenvalues(2) > 0)) {
+            continue;
+        }
+        eigenvalues = eigenvalues.cwiseMax(0.01 * eigenvalues(2));
+
+        NdtVoxel ndt_voxel;
+        ndt_voxel.count = voxel.count;
+        ndt_voxel.mean = voxel.mean;
+        ndt_voxel.covariance = solver.eigenvectors() * eigenvalues.asDiagonal() * solver.eigenvectors().transpose();
+        ndt_voxel.inverse_covariance = solver.eigenvectors() * eigenvalues.cwiseInverse().asDiagonal() * solver.eigenvectors().transpose();
+        grid.index[key] = static_cast<int>(grid.voxels.size());
+        grid.voxels.push_back(ndt_voxel);
+    }
+
+    return grid;
+}
+
+// The constants d1 and d2 of the score d1 * exp(-d2 / 2 * x' C x), fitted to the log of a Gaussian mixed with a uniform
+// outlier density over the voxel. Both densities are taken per unit voxel volume, so that the score does not depend on the
+// units of the clouds.
+struct ScoreConstants {
+    double d1;
+    double d2;
+};
+
+static ScoreConstants score_constants(double outlier_ratio) {
+    double c1 = 10 * (1 - outlier_ratio);
+    double c2 = outlier_ratio;
+    double d3 = -log(c2);
+    ScoreConstants constants;
+    constants.d1 = -log(c1 + c2) - d3;
+    constants.d2 = -2 * log((-log(c1 * exp(-0.5) + c2) - d3) / constants.d1);
+    return constants;
+}
+
+// The score of the moving cloud and its derivatives with respect to a twist applied on the left of the transform.
+struct NdtTerms {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    double score;
+    Eigen::Matrix<double, 6, 1> gradient;
+    Eigen::Matrix<double, 6, 6> hessian;
+    int matched;
+
+    void clear() {
+        score = 0;
+        gradient.setZero();
+        hessian.setZero();
+        matched = 0;
+    }
+};
+
+// Voxels far enough from a point that it scores less than this fraction of a voxel's best are left out, sparing the
+// derivatives of terms too small to matter.
+static const double negligible_score = 1E-6;
+
+static void accumulate_terms(const NdtGrid& grid, const ScoreConstants& constants, const Eigen::MatrixXd& surface, const Eigen::Matrix4d& transform,
+                             bool derivatives, int begin, int end, NdtTerms& terms) {
+    // Each point y = T p scores d1 exp(-d2 / 2 x' C x) against its own voxel and the six sharing a face with it, with
+    // x = y - m for a voxel with mean m and inverse covariance C; taking the neighbours as well smooths the score across
+    // voxel faces. Under a twist (omega, v), y moves by omega x y + v to first order and by (omega x (omega x y) + omega x v) / 2
+    // to second, which gives the analytic gradient and Hessian below, accumulated in 3x3 blocks (the lower left one is
+    // filled in by symmetry afterwards) unless only the score is wanted.
+    static const long long face_offsets[7] = { 0, 1, -1, voxel_index_range, -voxel_index_range, voxel_index_range * voxel_index_range,
+                                               -voxel_index_range * voxel_index_range };
+    Eigen::Matrix3d rotation = transform.block(0,0,3,3);
+    Eigen::Vector3d translation = transform.block(0,3,3,1);
+    for(int i = begin; i < end; i++) {
+        Eigen::Vector3d y = rotation * surface.col(i) + translation;
+        long long key = ndt_voxel_key(grid, y);
+        if(key < 0) {
+            continue;
+        }
+        Eigen::Matrix3d y_hat = skew(y);
+
+        bool matched = false;
+        for(auto offset : face_offsets) {
+            auto found = grid.index.find(key + offset);
+            if(found == grid.index.end()) {
+                continue;
+            }
+            const auto& voxel = grid.voxels[found->second];
+            const auto& C = voxel.inverse_covariance;
+
+            Eigen::Vector3d x = y - voxel.mean;
+            Eigen::Vector3d u = C * x;
+            double e = exp(-0.5 * constants.d2 * x.dot(u));
+            if(e < negligible_score) {
+                continue;
+            }
+            terms.score += constants.d1 * e;
+            matched = true;
+            if(!derivatives) {
+                continue;
+            }
+
+            // The gradient of x' C x / 2 is (y x u, u); its Hessian adds the second-order motion of y to J' C J, with
+            // J = (-y_hat, I).
+            Eigen::Vector3d yu = y.cross(u);
+            Eigen::Matrix3d C_y_hat = C * y_hat;
+            double a = -constants.d1 * constants.d2 * e;
+            terms.gradient.head<3>() += a * yu;
+            terms.gradient.tail<3>() += a * u;
+            terms.hessian.topLeftCorner<3,3>() += a * (-y_hat * C_y_hat + 0.5 * (y * u.transpose() + u * y.transpose()) - y.dot(u) * Eigen::Matrix3d::Identity()
+                                                       - constants.d2 * yu * yu.transpose());
+            terms.hessian.topRightCorner<3,3>() += a * (-C_y_hat.transpose() - 0.5 * skew(u) - constants.d2 * yu * u.transpose());
+            terms.hessian.bottomRightCorner<3,3>() += a * (C - constants.d2 * u * u.transpose());
+        }
+        terms.matched += matched;
+    }
+}
+
+static void evaluate_terms(const NdtGrid& grid, const ScoreConstants& constants, const Eigen::MatrixXd& surface, const Eigen::Matrix4d& transform,
+                           bool derivatives, int threads, NdtTerms& terms) {
+    // accumulate_terms over all points, on per-thread accumulators that are summed afterwards.
+    int blocks = std::max(1, std::min(thread_count(threads), static_cast<int>(surface.cols())));
+    std::vector<NdtTerms, Eigen::aligned_allocator<NdtTerms> > block_terms(blocks);
+    parallel_for_blocks(surface.cols(), threads, [&](int begin, int end, int block) {
+        block_terms[block].clear();
+        accumulate_terms(grid, constants, surface, transform, derivatives, begin, end, block_terms[block]);
+    });
+
+    terms = block_terms[0];
+    for(int block = 1; block < blocks; block++) {
+        terms.score += block_terms[block].score;
+        terms.gradient += block_terms[block].gradient;
+        terms.hessian += block_terms[block].hessian;
+        terms.matched += block_terms[block].matched;
+    }
+    terms.hessian.bottomLeftCorner<3,3>() = terms.hessian.topRightCorner<3,3>().transpose();
+}
+
+// Halvings of a Newton step tried before giving up on improving the score.
+static const int max_step_halvings = 10;
+
+NdtResult ndt_register_surfaces(const NdtGrid& grid, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init, const NdtOptions& options) {
+    // Newton's method on the total score, with the step halved until it lowers the score.
+    if(surface2.rows() != 3 || surface2.cols() < 1) {
+        std::cerr << "NDT needs a non-empty 3D moving cloud." << std::endl;
+        throw(PointMatchingEx);
+    }
+    if(!(options.outlier_ratio > 0 && options.outlier_ratio < 1)) {
+        std::cerr << "NDT outlier ratio must be between 0 and 1." << std::endl;
+        throw(PointMatchingEx);
+    }
+    if(grid.voxels.empty()) {
+        std::cerr << "NDT grid has no voxels; use a larger voxel size." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    auto constants = score_constants(options.outlier_ratio);
+
+    NdtResult result;
+    result.transform = transform_init;
+    result.iterations = 0;
+    result.voxels = static_cast<int>(grid.voxels.size());
+    result.converged = false;
+
+    NdtTerms terms;
+    NdtTerms trial_terms;
+    evaluate_terms(grid, constants, surface2, result.transform, true, options.threads, terms);
+
+    // Steps are capped so that no moving point moves further than a voxel, beyond which the score knows nothing; a point's
+    // motion is bounded through the cloud's centroid and radius.
+    Eigen::Vector3d centroid = surface2.rowwise().mean();
+    double radius = (surface2.colwise() - centroid).colwise().norm().maxCoeff();
+
+    // The line search starts from twice the fraction of the Newton step taken last time, so that steps which keep
+    // overshooting are not each tried in full.
+    double fraction = 1;
+    while(result.iterations < options.max_iterations && terms.hessian.allFinite() && terms.gradient.allFinite()) {
+        // Away from the optimum the score is not convex, so the Hessian's eigenvalues are replaced by their magnitudes:
+        // directions of negative curvature are then descended rather than climbed.
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix<double, 6, 6> > solver(terms.hessian);
+        Vector6d curvatures = solver.eigenvalues().cwiseAbs();
+        curvatures = curvatures.cwiseMax(1E-9 * std::max(curvatures.maxCoeff(), 1E-300));
+        Vector6d newton_step = -solver.eigenvectors() * (solver.eigenvectors().transpose() * terms.gradient).cwiseQuotient(curvatures);
+        Eigen::Vector3d centre = result.transform.block(0,0,3,3) * centroid + result.transform.block(0,3,3,1);
+        double motion = newton_step.head<3>().norm() * radius + (newton_step.head<3>().cross(centre) + newton_step.tail<3>()).norm();
+        if(motion > grid.voxel_size) {
+            newton_step *= grid.voxel_size / motion;
+        }
+
+        // Trial poses only need their score; the derivatives are taken once a pose is accepted.
+        fraction = std::min(1.0, 2 * fraction);
+        double score = terms.score;
+        bool improved = false;
+        for(int halving = 0; halving <= max_step_halvings && !improved; halving++) {
+            Eigen::Matrix4d trial = se3_exp(fraction * newton_step) * result.transform;
+            evaluate_terms(grid, constants, surface2, trial, false, options.threads, trial_terms);
+            if(trial_terms.score < terms.score) {
+                result.transform = trial;
+                evaluate_terms(grid, constants, surface2, trial, true, options.threads, terms);
+                improved = true;
+            } else {
+                fraction /= 2;
+            }
+        }
+
+        result.iterations++;
+        if(!improved || fraction * newton_step.norm() < options.step_tolerance || score - terms.score < options.score_tolerance * std::abs(score)) {
+            result.converged = true;
+            break;
+        }
+    }
+
+    result.score = terms.score / (-constants.d1 * surface2.cols());
+    result.matched_points = terms.matched;
+    return result;
+}
+
+NdtResult ndt_register_surfaces(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init,
+                                const NdtOptions& options) {
+    double voxel_size = options.voxel_size;
+    if(voxel_size == 0 && surface1.rows() == 3 && surface1.cols() > 0) {
+        voxel_size = (surface1.rowwise().maxCoeff() - surface1.rowwise().minCoeff()).norm() / 20;
+    }
+    auto grid = build_ndt_grid(surface1, voxel_size, options.min_points_per_voxel, options.threads);
+    return ndt_register_surfaces(grid, surface2, transform_init, options);
+}
@@ -0,0 +1,87 @@
+/* Normal Distributions Transform registration, after "The Three-Dimensional Normal-Distributions Transform", Magnusson,
+   2009. The fixed cloud is replaced by a grid of voxels, each holding the mean and covariance of the points inside it,
+   and the moving cloud is aligned by Newton's method to maximise the likelihood of its points under those Gaussians.
+   Each point costs one voxel lookup rather than a nearest-neighbour search, which suits large, noisy scans. */
+#ifndef NDT_INCLUDED
+#define NDT_INCLUDED
+
+#include <unordered_map>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+
+struct NdtOptions {
+    // Edge length of the voxels; zero picks 1/20 of the fixed cloud's bounding box diagonal.
+    double voxel_size = 0;
+
+    // Voxels holding fewer points than this are left out, as their covariance is not meaningful.
+    int min_points_per_voxel = 6;
+
+    // Expected fraction of outlying points, which sets how quickly a point's influence falls off with its distance from
+    // its voxel's mean.
+    double outlier_ratio = 0.55;
+
+    // Newton iterations stop after max_iterations, once a step's twist is shorter than step_tolerance, or once a step
+    // improves the score by less than score_tolerance times its magnitude (the score has kinks where points cross voxel
+    // faces, around which steps only creep).
+    int max_iterations = 50;
+    double step_tolerance = 1E-8;
+    double score_tolerance = 1E-6;
+
+    int threads = 0;
+};
+
+// A voxel of the fixed cloud, with its covariance's eigenvalues clamped to at least 1/100 of the largest, so that points
+// scattered on a plane or a line still give an invertible covariance.
+struct NdtVoxel {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    int count;
+    Eigen::Vector3d mean;
+    Eigen::Matrix3d covariance;
+    Eigen::Matrix3d inverse_covariance;
+};
+
+// The fixed cloud's voxels, found by the key of the voxel containing a point (see ndt_voxel_key), which can be built once
+// and reused for every registration against the same cloud.
+struct NdtGrid {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    double voxel_size;
+    Eigen::Vector3d origin;
+    std::vector<NdtVoxel, Eigen::aligned_allocator<NdtVoxel> > voxels;
+    std::unordered_map<long long, int> index;
+};
+
+struct NdtResult {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    // Maps the moving cloud onto the fixed one, as for register_surfaces.
+    Eigen::Matrix4d transform;
+
+    // Mean NDT score of the moving points under transform, scaled so that a point at the mean of a lone voxel scores -1;
+    // lower is better.
+    double score;
+
+    int iterations;
+
+    // Whether Newton's method stopped on a short or unproductive step, rather than at max_iterations.
+    bool converged;
+
+    // Voxels of the fixed cloud used, and moving points with at least one of them nearby under transform.
+    int voxels;
+    int matched_points;
+};
+
+// The key of the voxel of grid containing point, or -1 if it lies outside the range the keys can address.
+long long ndt_voxel_key(const NdtGrid& grid, const Eigen::Vector3d& point);
+
+// The voxels of surface that hold at least min_points points, built in one parallel pass.
+NdtGrid build_ndt_grid(const Eigen::MatrixXd& surface, double voxel_size, int min_points, int threads = 0);
+
+NdtResult ndt_register_surfaces(const NdtGrid& grid, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init,
+                                const NdtOptions& options = NdtOptions());
+NdtResult ndt_register_surfaces(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init,
+                                const NdtOptions& options = NdtOptions());
+#endif
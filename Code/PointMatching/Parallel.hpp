@@ -0,0 +1,35 @@
+/* Splitting loops across threads. Work is handed out in contiguous blocks, one per thread, so that each thread can keep
+   its own scratch buffers and accumulators and the results can be combined afterwards. */
+#ifndef PARALLEL_INCLUDED
+#define PARALLEL_INCLUDED
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// The number of threads to use for a requested count, where zero (the default everywhere) means one per hardware thread.
+inline int thread_count(int requested) {
+    if(requested > 0) {
+        return requested;
+    }
+    int hardware = static_cast<int>(std::thread::hardware_concurrency());
+    return hardware > 0 ? hardware : 1;
+}
+
+// Calls body(begin, end, block) for consecutive blocks covering [0, n), on up to thread_count(threads) threads, and waits
+// for all of them. Block b is always the b-th block of the range, and the calling thread runs the last one itself. body
+// must not throw, since an exception escaping a worker thread terminates the program.
+template<typename Body>
+void parallel_for_blocks(int n, int threads, Body body) {
+    int blocks = std::max(1, std::min(thread_count(threads), n));
+    std::vector<std::thread> workers;
+    workers.reserve(blocks - 1);
+    for(int block = 0; block < blocks - 1; block++) {
+        workers.emplace_back(body, static_cast<int>((long long) n * block / blocks), static_cast<int>((long long) n * (block + 1) / blocks), block);
+    }
+    body(static_cast<int>((long long) n * (blocks - 1) / blocks), n, blocks - 1);
+    for(auto& worker : workers) {
+        worker.join();
+    }
+}
+#endif
@@ -10,13 +10,20 @@
 #include <Exceptions.hpp>
 #include <Util.hpp>
 
-Eigen::Matrix3d find_rotation(const Eigen::MatrixXd& H) {
+Eigen::Matrix3d find_rotation(const Eigen::Matrix3d& H) {
     // Estimate rotation matrix given H, the matrix product of residuals in both pointsets.
 
-    Eigen::JacobiSVD<Eigen::MatrixXd> svd(H, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    Eigen::JacobiSVD<Eigen::Matrix3d> svd(H, Eigen::ComputeFullU | Eigen::ComputeFullV);
 
     Eigen::Matrix3d rotation;
 
+    auto singular_values = svd.singularValues();
+    if(singular_values(1) <= 1E-10 * singular_values(0)) {
+        // Fewer than two significant singular values means the points are colinear (or coincident), so the rotation about that line is undetermined.
+        std::cerr << "Could not find a rotation. Colinear point cloud seems likely, or perhaps very noisy data?" << std::endl;
+        throw(PointMatchingEx);
+    }
+
     auto proposed_rotation = svd.matrixV()*(svd.matrixU()).transpose();
     if(isApproxEqual(proposed_rotation.determinant(), 1)) {
         rotation = proposed_rotation;
@@ -39,8 +46,8 @@ Eigen::Matrix3d find_rotation(const Eigen::MatrixXd& H) {
     return rotation;
 }
 
-Eigen::Matrix4d estimate_rigid_transform(const Eigen::MatrixXd& pointset, const Eigen::MatrixXd& pointset_dash) {
-    // Find a rigid transform that maps pointset to pointset_dash, with least error.
+void validate_pointsets(const Eigen::MatrixXd& pointset, const Eigen::MatrixXd& pointset_dash) {
+    // Check that two pointsets can be registered against each other, throwing if not.
 
     if(pointset.cols() < 4 || pointset_dash.cols() < 4) {
         std::cerr << "Not enough points provided -- there should be at least four points in the point cloud." << std::endl;
@@ -56,29 +63,86 @@ Eigen::Matrix4d estimate_rigid_transform(const Eigen::MatrixXd& pointset, const
         std::cerr << "Pointsets must have the same number of points." << std::endl;
         throw(PointMatchingEx);
     }
+}
 
-    auto p_average = find_pointset_average(pointset);
-    auto p_dash_average = find_pointset_average(pointset_dash);
+Eigen::Matrix4d PointPairSums::fit(bool estimate_scale) const {
+    // The rotation is that of the rigid fit to the cross-covariance H, and the scale is trace(R H) over the spread of the
+    // points p about their centroid.
+    Eigen::Vector3d p_average = p_sum / weight_sum;
+    Eigen::Vector3d p_dash_average = p_dash_sum / weight_sum;
+    Eigen::Matrix3d H = pp_dash_sum - weight_sum * p_average * p_dash_average.transpose();
+
+    Eigen::Matrix3d rotation = find_rotation(H);
+    if(estimate_scale) {
+        // find_rotation has already rejected coincident points, which have no spread.
+        double scale = (rotation * H).trace() / (p_squared_sum - weight_sum * p_average.squaredNorm());
+        if(!(scale > 0)) {
+            std::cerr << "Could not find a positive scale. Very noisy or otherwise invalid data?" << std::endl;
+            throw(PointMatchingEx);
+        }
+        rotation *= scale;
+    }
 
-    auto q = residuals_from_point(pointset, p_average);
-    auto q_dash = residuals_from_point(pointset_dash, p_dash_average);
+    auto translation = (p_dash_average + p_dash_origin) - rotation * (p_average + p_origin);
 
-    auto H = q * q_dash.transpose();
+    return compose_final_transform(rotation, translation);
+}
 
-    auto rotation = find_rotation(H);
+Eigen::Matrix4d estimate_rigid_transform(const Eigen::MatrixXd& pointset, const Eigen::MatrixXd& pointset_dash) {
+    // Find a rigid transform that maps pointset to pointset_dash, with least error.
+    validate_pointsets(pointset, pointset_dash);
 
-    auto translation = p_dash_average - rotation*p_average;
+    PointPairSums sums;
+    for(int i = 0; i < pointset.cols(); i++) {
+        sums.add(pointset.col(i), pointset_dash.col(i));
+    }
+
+    return sums.fit();
+}
 
-    auto final_transform = compose_final_transform(rotation, translation);
+Eigen::Matrix4d estimate_similarity_transform(const Eigen::MatrixXd& pointset, const Eigen::MatrixXd& pointset_dash) {
+    // Find a similarity transform that maps pointset to pointset_dash, with least error.
+    validate_pointsets(pointset, pointset_dash);
 
-    return final_transform;
+    PointPairSums sums;
+    for(int i = 0; i < pointset.cols(); i++) {
+        sums.add(pointset.col(i), pointset_dash.col(i));
+    }
+
+    return sums.fit(true);
+}
+
+Eigen::Matrix4d estimate_weighted_rigid_transform(const Eigen::MatrixXd& pointset, const Eigen::MatrixXd& pointset_dash, const Eigen::VectorXd& weights) {
+    // Find a rigid transform that maps pointset to pointset_dash, minimising the weighted sum of squared distances.
+    validate_pointsets(pointset, pointset_dash);
+
+    if(weights.size() != pointset.cols()) {
+        std::cerr << "There must be exactly one weight per point." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    PointPairSums sums;
+    for(int i = 0; i < pointset.cols(); i++) {
+        sums.add(pointset.col(i), pointset_dash.col(i), weights(i));
+    }
+
+    if(!(sums.weight_sum > 0)) {
+        std::cerr << "Weights must sum to a positive value." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    return sums.fit();
 }
 
 double fiducial_registration_error(const Eigen::MatrixXd& pointset, const Eigen::MatrixXd& pointset_dash, const Eigen::Matrix4d& transform) {
-    auto transformed = apply_transform(pointset, transform);
+    // RMS distance between the transformed pointset and pointset_dash, computed in one pass without intermediate matrices.
+    Eigen::Matrix3d rotation = transform.block(0,0,3,3);
+    Eigen::Vector3d translation = transform.block(0,3,3,1);
 
-    auto error_per_vector = distances_between_pointsets(transformed, pointset_dash);
-    auto fre = root_mean_square(error_per_vector);
+    double sum_squared = 0;
+    for(int i = 0; i < pointset.cols(); i++) {
+        sum_squared += (rotation * pointset.col(i) + translation - pointset_dash.col(i)).squaredNorm();
+    }
 
-    return fre;
+    return sqrt(sum_squared / pointset.cols());
 }
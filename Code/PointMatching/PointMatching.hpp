@@ -2,9 +2,49 @@
 #ifndef POINTMATCHING_INCLUDED
 #define POINTMATCHING_INCLUDED
 
-Eigen::Matrix3d find_rotation(const Eigen::MatrixXd& H);
+Eigen::Matrix3d find_rotation(const Eigen::Matrix3d& H);
+
+void validate_pointsets(const Eigen::MatrixXd& pointset, const Eigen::MatrixXd& pointset_dash);
+
+// Weighted sums over pairs of points p -> p_dash, from which their least-squares rigid or similarity transform follows in
+// one pass. The sums are taken relative to the first pair added, to avoid cancellation when the points are far from the
+// origin.
+struct PointPairSums {
+    int pairs = 0;
+    double weight_sum = 0;
+    Eigen::Vector3d p_origin = Eigen::Vector3d::Zero();
+    Eigen::Vector3d p_dash_origin = Eigen::Vector3d::Zero();
+    Eigen::Vector3d p_sum = Eigen::Vector3d::Zero();
+    Eigen::Vector3d p_dash_sum = Eigen::Vector3d::Zero();
+    Eigen::Matrix3d pp_dash_sum = Eigen::Matrix3d::Zero();
+    double p_squared_sum = 0;
+
+    void add(const Eigen::Vector3d& p, const Eigen::Vector3d& p_dash, double weight = 1) {
+        if(pairs++ == 0) {
+            p_origin = p;
+            p_dash_origin = p_dash;
+        }
+        Eigen::Vector3d p_local = p - p_origin;
+        Eigen::Vector3d p_dash_local = p_dash - p_dash_origin;
+        weight_sum += weight;
+        p_sum += weight * p_local;
+        p_dash_sum += weight * p_dash_local;
+        pp_dash_sum += weight * p_local * p_dash_local.transpose();
+        p_squared_sum += weight * p_local.squaredNorm();
+    }
+
+    // The transform mapping the points p onto their p_dash with least weighted squared error: rigid, or with estimate_scale a
+    // similarity transform. The weights must sum to a positive value.
+    Eigen::Matrix4d fit(bool estimate_scale = false) const;
+};
 
 Eigen::Matrix4d estimate_rigid_transform(const Eigen::MatrixXd& pointset, const Eigen::MatrixXd& pointset_dash);
 
+// The similarity transform (uniform scale, then rotation and translation) that maps pointset to pointset_dash with least
+// error, after "Least-Squares Estimation of Transformation Parameters Between Two Point Patterns", Umeyama, 1991.
+Eigen::Matrix4d estimate_similarity_transform(const Eigen::MatrixXd& pointset, const Eigen::MatrixXd& pointset_dash);
+
+Eigen::Matrix4d estimate_weighted_rigid_transform(const Eigen::MatrixXd& pointset, const Eigen::MatrixXd& pointset_dash, const Eigen::VectorXd& weights);
+
 double fiducial_registration_error(const Eigen::MatrixXd& pointset, const Eigen::MatrixXd& pointset_dash, const Eigen::Matrix4d& transform);
 #endif
@@ -0,0 +1,242 @@
+/* Levenberg-Marquardt (or Gauss-Newton) over se(3) for least-squares pose problems whose error metric has no closed-form
+   solution. A metric is a functor type supplying, for each of its terms, a residual of fixed dimension, its analytic
+   Jacobian with respect to a left perturbation exp(xi) of the pose, and an information (weight) matrix; the solver only
+   ever sees fixed-size blocks, so new metrics plug in at compile time and nothing is allocated per residual. */
+#ifndef POSESOLVER_INCLUDED
+#define POSESOLVER_INCLUDED
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+
+#include <Parallel.hpp>
+#include <Util.hpp>
+
+// A metric provides
+//
+//     static const int dimension;
+//     int size() const;
+//     bool evaluate(int k, const Eigen::Matrix3d& rotation, const Eigen::Vector3d& translation,
+//                   Eigen::Matrix<double, dimension, 1>& residual, Eigen::Matrix<double, dimension, 6>& jacobian,
+//                   Eigen::Matrix<double, dimension, dimension>& information) const;
+//
+// where evaluate gives term k at the pose (rotation, translation), or returns false to leave the term out. The cost is
+// the sum of residual^T information residual over the terms. Twists are ordered (omega, v), so for a term that depends on
+// a moving point through x = R p + t, the Jacobian is d(residual)/dx * [-skew(x), I].
+
+// ||q - x||^2 for matched points, optionally weighted.
+struct PointToPointMetric {
+    static const int dimension = 3;
+
+    const Eigen::MatrixXd& fixed;
+    const Eigen::MatrixXd& moving;
+    const Eigen::ArrayXi& correspondences;
+    const Eigen::VectorXd* weights;
+
+    // moving.col(i) is matched to fixed.col(correspondences(i)); negative entries are skipped.
+    PointToPointMetric(const Eigen::MatrixXd& fixed, const Eigen::MatrixXd& moving, const Eigen::ArrayXi& correspondences, const Eigen::VectorXd* weights = 0)
+        : fixed(fixed), moving(moving), correspondences(correspondences), weights(weights) {
+    }
+
+    int size() const {
+        return correspondences.size();
+    }
+
+    bool evaluate(int k, const Eigen::Matrix3d& rotation, const Eigen::Vector3d& translation, Eigen::Vector3d& residual,
+                  Eigen::Matrix<double, 3, 6>& jacobian, Eigen::Matrix3d& information) const {
+        int j = correspondences(k);
+        double w = weights ? (*weights)(k) : 1.0;
+        if(j < 0 || w <= 0) {
+            return false;
+        }
+        Eigen::Vector3d x = rotation * moving.col(k) + translation;
+        residual = fixed.col(j) - x;
+        jacobian << skew(x), -Eigen::Matrix3d::Identity();
+        information = w * Eigen::Matrix3d::Identity();
+        return true;
+    }
+};
+
+// ((q - x) . n_q)^2 for matched points, with n_q the fixed cloud's normal.
+struct PointToPlaneMetric {
+    static const int dimension = 1;
+
+    const Eigen::MatrixXd& fixed;
+    const Eigen::MatrixXd& fixed_normals;
+    const Eigen::MatrixXd& moving;
+    const Eigen::ArrayXi& correspondences;
+    const Eigen::VectorXd* weights;
+
+    PointToPlaneMetric(const Eigen::MatrixXd& fixed, const Eigen::MatrixXd& fixed_normals, const Eigen::MatrixXd& moving, const Eigen::ArrayXi& correspondences,
+                       const Eigen::VectorXd* weights = 0)
+        : fixed(fixed), fixed_normals(fixed_normals), moving(moving), correspondences(correspondences), weights(weights) {
+    }
+
+    int size() const {
+        return correspondences.size();
+    }
+
+    bool evaluate(int k, const Eigen::Matrix3d& rotation, const Eigen::Vector3d& translation, Eigen::Matrix<double, 1, 1>& residual,
+                  Eigen::Matrix<double, 1, 6>& jacobian, Eigen::Matrix<double, 1, 1>& information) const {
+        int j = correspondences(k);
+        double w = weights ? (*weights)(k) : 1.0;
+        if(j < 0 || w <= 0) {
+            return false;
+        }
+        Eigen::Vector3d x = rotation * moving.col(k) + translation;
+        Eigen::Vector3d normal = fixed_normals.col(j);
+        residual(0) = (fixed.col(j) - x).dot(normal);
+        jacobian << normal.cross(x).transpose(), -normal.transpose();
+        information(0, 0) = w;
+        return true;
+    }
+};
+
+struct PoseSolverOptions {
+    int max_iterations = 10;
+
+    // Levenberg-Marquardt damps the normal equations by lambda * diag(JtJ), starting from initial_damping and shrinking
+    // or growing it tenfold as steps succeed or fail. Gauss-Newton takes every undamped step without checking the cost,
+    // so it does not linearise at its final pose, and the cost it reports is that of the last pose it linearised at.
+    bool levenberg_marquardt = true;
+    double initial_damping = 1E-4;
+
+    // Stop once a step's twist is shorter than this.
+    double step_tolerance = 1E-10;
+
+    int threads = 1;
+};
+
+struct PoseSolverResult {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    Eigen::Matrix4d transform;
+
+    // Cost at transform, and the number of linearisations made.
+    double cost;
+    int iterations;
+
+    // Whether a step shorter than step_tolerance ended the solve, rather than max_iterations or a failed solve.
+    bool converged;
+};
+
+// The 6x6 normal equations and cost of a metric at one pose.
+struct NormalEquations {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    Eigen::Matrix<double, 6, 6> JtJ;
+    Vector6d Jtr;
+    double cost;
+
+    void clear() {
+        JtJ.setZero();
+        Jtr.setZero();
+        cost = 0;
+    }
+
+    void add(const NormalEquations& other) {
+        JtJ += other.JtJ;
+        Jtr += other.Jtr;
+        cost += other.cost;
+    }
+};
+
+template<typename Metric>
+void accumulate_terms(const Metric& metric, const Eigen::Matrix3d& rotation, const Eigen::Vector3d& translation, int begin, int end, NormalEquations& equations) {
+    Eigen::Matrix<double, Metric::dimension, 1> residual;
+    Eigen::Matrix<double, Metric::dimension, 6> jacobian;
+    Eigen::Matrix<double, Metric::dimension, Metric::dimension> information;
+    equations.clear();
+    for(int k = begin; k < end; k++) {
+        if(!metric.evaluate(k, rotation, translation, residual, jacobian, information)) {
+            continue;
+        }
+        Eigen::Matrix<double, 6, Metric::dimension> weighted = jacobian.transpose() * information;
+        equations.JtJ.noalias() += weighted * jacobian;
+        equations.Jtr.noalias() += weighted * residual;
+        equations.cost += residual.dot(information * residual);
+    }
+}
+
+template<typename Metric>
+void linearise(const Metric& metric, const Eigen::Matrix4d& transform, int threads, NormalEquations& equations) {
+    // Each thread accumulates its own block of terms into fixed-size normal equations, which are then summed. A single
+    // thread accumulates directly, without allocating.
+    Eigen::Matrix3d rotation = transform.block(0,0,3,3);
+    Eigen::Vector3d translation = transform.block(0,3,3,1);
+    int blocks = std::max(1, std::min(thread_count(threads), metric.size()));
+    if(blocks == 1) {
+        accumulate_terms(metric, rotation, translation, 0, metric.size(), equations);
+        return;
+    }
+
+    std::vector<NormalEquations, Eigen::aligned_allocator<NormalEquations> > block_equations(blocks);
+    parallel_for_blocks(metric.size(), threads, [&](int begin, int end, int block) {
+        accumulate_terms(metric, rotation, translation, begin, end, block_equations[block]);
+    });
+    equations = block_equations[0];
+    for(int block = 1; block < blocks; block++) {
+        equations.add(block_equations[block]);
+    }
+}
+
+template<typename Metric>
+PoseSolverResult solve_pose(const Metric& metric, const Eigen::Matrix4d& transform_init, const PoseSolverOptions& options = PoseSolverOptions()) {
+    // Each accepted step's normal equations are those of the new pose, so every linearisation is used for the next step.
+    NormalEquations equations;
+    linearise(metric, transform_init, options.threads, equations);
+
+    PoseSolverResult result;
+    result.transform = transform_init;
+    result.cost = equations.cost;
+    result.iterations = 1;
+    result.converged = false;
+
+    double damping = options.initial_damping;
+    NormalEquations candidate_equations;
+    for(int iteration = 0; iteration < options.max_iterations; iteration++) {
+        Eigen::Matrix<double, 6, 6> A = equations.JtJ;
+        if(options.levenberg_marquardt) {
+            A.diagonal() += damping * equations.JtJ.diagonal();
+        }
+        Vector6d step = -A.ldlt().solve(equations.Jtr);
+        if(!step.allFinite()) {
+            break;
+        }
+
+        Eigen::Matrix4d candidate = se3_exp(step) * result.transform;
+        bool converged = step.norm() < options.step_tolerance;
+        result.converged = converged;
+        if(!options.levenberg_marquardt) {
+            result.transform = candidate;
+            if(converged || iteration + 1 == options.max_iterations) {
+                break;
+            }
+            linearise(metric, candidate, options.threads, equations);
+            result.cost = equations.cost;
+            result.iterations++;
+            continue;
+        }
+
+        linearise(metric, candidate, options.threads, candidate_equations);
+        result.iterations++;
+        if(candidate_equations.cost < result.cost) {
+            result.transform = candidate;
+            result.cost = candidate_equations.cost;
+            equations = candidate_equations;
+            damping /= 10;
+        } else {
+            damping *= 10;
+        }
+
+        if(converged) {
+            break;
+        }
+    }
+
+    return result;
+}
+#endif
@@ -0,0 +1,83 @@
+/* Observing ICP as it runs: an observer set in RegistrationOptions is called once per iteration with the iteration's
+   error, transform increment, correspondence count and time per stage. Without an observer, none of this is measured. */
+#ifndef REGISTRATIONOBSERVER_INCLUDED
+#define REGISTRATIONOBSERVER_INCLUDED
+
+#include <chrono>
+
+// Seconds spent in each stage of an iteration.
+struct StageTimes {
+    double search = 0;
+    double rejection = 0;
+    double solve = 0;
+};
+
+struct IterationStats {
+    // Iterations so far, counting this one.
+    int iteration;
+
+    // Error of the transform this iteration moved to, and the lowest error seen so far.
+    double error;
+    double best_error;
+
+    // Rotation angle (radians) and translation of the change this iteration made to the transform.
+    double rotation_increment;
+    double translation_increment;
+
+    // Correspondences used for the pose estimate, after rejection, and the points they were drawn from.
+    int correspondences;
+    int points;
+
+    StageTimes times;
+};
+
+class RegistrationObserver {
+public:
+    virtual ~RegistrationObserver() {
+    }
+
+    virtual void iteration(const IterationStats& stats) = 0;
+};
+
+// Adapts any callable taking const IterationStats& (a lambda, say) to RegistrationObserver.
+template<typename Callable>
+class CallableObserver : public RegistrationObserver {
+public:
+    explicit CallableObserver(Callable callable) : callable(callable) {
+    }
+
+    void iteration(const IterationStats& stats) {
+        callable(stats);
+    }
+
+private:
+    Callable callable;
+};
+
+template<typename Callable>
+CallableObserver<Callable> make_observer(Callable callable) {
+    return CallableObserver<Callable>(callable);
+}
+
+// Adds the time since the previous lap to one of the stages of times. With no times to fill in, it never reads the clock.
+class StageClock {
+public:
+    explicit StageClock(StageTimes* times) : times(times) {
+        if(times) {
+            last = std::chrono::steady_clock::now();
+        }
+    }
+
+    void lap(double StageTimes::* stage) {
+        if(times) {
+            auto now = std::chrono::steady_clock::now();
+            times->*stage += std::chrono::duration<double>(now - last).count();
+            last = now;
+        }
+    }
+
+private:
+    StageTimes* times;
+    std::chrono::steady_clock::time_point last;
+};
+#endif
@@ -0,0 +1,170 @@
+/* Robust M-estimator kernels, used to down-weight outlying correspondences via iteratively reweighted least squares */
+#include <RobustEstimation.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include <Eigen/Dense>
+
+#include <PointMatching.hpp>
+#include <Exceptions.hpp>
+#include <Util.hpp>
+
+// Tuning constants giving 95% efficiency on Gaussian residuals, in units of the residual scale.
+static const double huber_k = 1.345;
+static const double tukey_c = 4.685;
+static const double cauchy_c = 2.385;
+
+// Converts a median absolute residual into a consistent estimate of the Gaussian standard deviation.
+static const double mad_to_sigma = 1.4826;
+
+RobustKernel robust_kernel_from_string(const std::string& name) {
+    if(name == "none") {
+        return RobustKernel::None;
+    } else if(name == "huber") {
+        return RobustKernel::Huber;
+    } else if(name == "tukey") {
+        return RobustKernel::Tukey;
+    } else if(name == "cauchy") {
+        return RobustKernel::Cauchy;
+    }
+
+    std::cerr << "Unknown robust kernel " << name << " -- expected none, huber, tukey or cauchy." << std::endl;
+    throw(PointMatchingEx);
+}
+
+double robust_weight(RobustKernel kernel, double residual, double scale) {
+    // IRLS weight w(r) = rho'(r)/r for the chosen kernel. A non-positive scale means every residual is an inlier.
+    if(kernel == RobustKernel::None || scale <= 0) {
+        return 1;
+    }
+
+    auto r = std::abs(residual);
+    switch(kernel) {
+        case RobustKernel::Huber: {
+            auto k = huber_k * scale;
+            return r <= k ? 1 : k / r;
+        }
+        case RobustKernel::Tukey: {
+            auto c = tukey_c * scale;
+            if(r >= c) {
+                return 0;
+            }
+            auto u = 1 - (r / c) * (r / c);
+            return u * u;
+        }
+        case RobustKernel::Cauchy: {
+            auto c = cauchy_c * scale;
+            return 1 / (1 + (r / c) * (r / c));
+        }
+        default:
+            return 1;
+    }
+}
+
+double robust_loss(RobustKernel kernel, double residual, double scale) {
+    // The objective rho(r) minimised by IRLS; for the plain kernel this is r^2/2.
+    auto r = std::abs(residual);
+    if(kernel == RobustKernel::None || scale <= 0) {
+        return r * r / 2;
+    }
+
+    switch(kernel) {
+        case RobustKernel::Huber: {
+            auto k = huber_k * scale;
+            return r <= k ? r * r / 2 : k * (r - k / 2);
+        }
+        case RobustKernel::Tukey: {
+            auto c = tukey_c * scale;
+            if(r >= c) {
+                return c * c / 6;
+            }
+            auto u = 1 - (r / c) * (r / c);
+            return c * c / 6 * (1 - u * u * u);
+        }
+        case RobustKernel::Cauchy: {
+            auto c = cauchy_c * scale;
+            return c * c / 2 * std::log(1 + (r / c) * (r / c));
+        }
+        default:
+            return r * r / 2;
+    }
+}
+
+double robust_scale_from_residuals(Eigen::Ref<Eigen::VectorXd> residuals) {
+    // Estimate the residual scale from the median absolute residual. The median is found by selection (linear time), so
+    // residuals is left partially reordered.
+    if(residuals.size() == 0) {
+        return 0;
+    }
+
+    residuals.array() = residuals.array().abs();
+    auto middle = residuals.data() + residuals.size() / 2;
+    std::nth_element(residuals.data(), middle, residuals.data() + residuals.size());
+
+    return mad_to_sigma * (*middle);
+}
+
+static double robust_step(const Eigen::MatrixXd& pointset, const Eigen::MatrixXd& pointset_dash, const Eigen::Matrix4d& transform,
+                          RobustKernel kernel, double scale, Eigen::VectorXd& residuals, Eigen::Matrix4d& next_transform,
+                          const Eigen::ArrayXi* lookup_table, bool estimate_scale) {
+    // One IRLS iteration. A single pass over the correspondences computes each residual under transform, its robust weight and
+    // loss, and accumulates the weighted centroids and cross-covariance. Returns the robust error sqrt(2*sum(rho)/N), which is the
+    // RMS error when no kernel is used, and sets next_transform to the weighted least-squares rigid transform, or similarity
+    // transform when estimate_scale is set.
+    validate_pointsets(pointset, pointset_dash);
+
+    auto n = pointset.cols();
+    residuals.resize(n);
+
+    Eigen::Matrix3d rotation = transform.block(0,0,3,3);
+    Eigen::Vector3d translation = transform.block(0,3,3,1);
+
+    double loss_sum = 0;
+    int used = 0;
+    PointPairSums sums;
+
+    for(int i = 0; i < n; i++) {
+        if(lookup_table && (*lookup_table)(i) < 0) {
+            continue;
+        }
+        Eigen::Vector3d p = pointset.col(i);
+        Eigen::Vector3d p_dash = pointset_dash.col(i);
+
+        auto residual = (rotation * p + translation - p_dash).norm();
+        residuals(i) = residual;
+        loss_sum += robust_loss(kernel, residual, scale);
+        used++;
+
+        auto w = robust_weight(kernel, residual, scale);
+        if(w > 0) {
+            sums.add(p, p_dash, w);
+        }
+    }
+
+    if(used == 0) {
+        std::cerr << "Every correspondence was rejected." << std::endl;
+        throw(PointMatchingEx);
+    }
+    if(!(sums.weight_sum > 0)) {
+        std::cerr << "Every correspondence was rejected by the robust kernel." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    next_transform = sums.fit(estimate_scale);
+
+    return std::sqrt(2 * loss_sum / used);
+}
+
+double robust_rigid_step(const Eigen::MatrixXd& pointset, const Eigen::MatrixXd& pointset_dash, const Eigen::Matrix4d& transform,
+                         RobustKernel kernel, double scale, Eigen::VectorXd& residuals, Eigen::Matrix4d& next_transform,
+                         const Eigen::ArrayXi* lookup_table) {
+    return robust_step(pointset, pointset_dash, transform, kernel, scale, residuals, next_transform, lookup_table, false);
+}
+
+double robust_similarity_step(const Eigen::MatrixXd& pointset, const Eigen::MatrixXd& pointset_dash, const Eigen::Matrix4d& transform,
+                              RobustKernel kernel, double scale, Eigen::VectorXd& residuals, Eigen::Matrix4d& next_transform,
+                              const Eigen::ArrayXi* lookup_table) {
+    return robust_step(pointset, pointset_dash, transform, kernel, scale, residuals, next_transform, lookup_table, true);
+}
@@ -0,0 +1,30 @@
+/* Robust M-estimator kernels, used to down-weight outlying correspondences via iteratively reweighted least squares */
+#ifndef ROBUSTESTIMATION_INCLUDED
+#define ROBUSTESTIMATION_INCLUDED
+
+#include <string>
+
+#include <Eigen/Dense>
+
+enum class RobustKernel { None, Huber, Tukey, Cauchy };
+
+RobustKernel robust_kernel_from_string(const std::string& name);
+
+double robust_weight(RobustKernel kernel, double residual, double scale);
+
+double robust_loss(RobustKernel kernel, double residual, double scale);
+
+double robust_scale_from_residuals(Eigen::Ref<Eigen::VectorXd> residuals);
+
+// If lookup_table is given, pairs i with lookup_table(i) < 0 (unmatched or rejected) are left out, and their residuals are
+// left as they were.
+double robust_rigid_step(const Eigen::MatrixXd& pointset, const Eigen::MatrixXd& pointset_dash, const Eigen::Matrix4d& transform,
+                         RobustKernel kernel, double scale, Eigen::VectorXd& residuals, Eigen::Matrix4d& next_transform,
+                         const Eigen::ArrayXi* lookup_table = 0);
+
+// As robust_rigid_step, but next_transform is the weighted least-squares similarity transform (Umeyama, 1991), whose scale
+// comes from the same pass.
+double robust_similarity_step(const Eigen::MatrixXd& pointset, const Eigen::MatrixXd& pointset_dash, const Eigen::Matrix4d& transform,
+                              RobustKernel kernel, double scale, Eigen::VectorXd& residuals, Eigen::Matrix4d& next_transform,
+                              const Eigen::ArrayXi* lookup_table = 0);
+#endif
@@ -0,0 +1,51 @@
+/* Registration to a signed distance field: the moving points are aligned by minimising the sum of their squared signed
+   distances to the fixed surface, read from a SignedDistanceField precomputed once, so that no correspondences are
+   searched for. Gradients come from the field's trilinear interpolation, and the pose from the se(3) pose solver. */
+#include <SdfRegistration.hpp>
+
+#include <cmath>
+#include <iostream>
+
+#include <Exceptions.hpp>
+#include <PoseSolver.hpp>
+
+SdfRegistrationResult sdf_register_surfaces(const SignedDistanceField& field, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init,
+                                            const SdfRegistrationOptions& options) {
+    if(surface2.rows() != 3 || surface2.cols() < 3) {
+        std::cerr << "Registering to a signed distance field needs at least three 3D points." << std::endl;
+        throw(PointMatchingEx);
+    }
+    if(options.max_iterations < 1) {
+        std::cerr << "Registering to a signed distance field needs at least one iteration." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    PoseSolverOptions solver_options;
+    solver_options.max_iterations = options.max_iterations;
+    solver_options.step_tolerance = options.step_tolerance;
+    solver_options.threads = options.threads;
+    auto solution = solve_pose(SignedDistanceMetric(field, surface2), transform_init, solver_options);
+
+    SdfRegistrationResult result;
+    result.transform = solution.transform;
+    // The solver counts linearisations, one more than the steps taken.
+    result.iterations = solution.iterations - 1;
+    result.converged = solution.converged;
+    result.matched_points = 0;
+    double squared_sum = 0;
+    Eigen::Vector3d gradient;
+    for(int i = 0; i < surface2.cols(); i++) {
+        double value;
+        Eigen::Vector3d point = solution.transform.block(0,0,3,3) * surface2.col(i) + solution.transform.block(0,3,3,1);
+        if(field.distance(point, value, gradient)) {
+            squared_sum += value * value;
+            result.matched_points++;
+        }
+    }
+    if(result.matched_points == 0) {
+        std::cerr << "No points are within the signed distance field's band." << std::endl;
+        throw(PointMatchingEx);
+    }
+    result.error = sqrt(squared_sum / result.matched_points);
+    return result;
+}
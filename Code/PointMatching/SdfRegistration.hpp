@@ -0,0 +1,65 @@
+/* Registration to a signed distance field: the moving points are aligned by minimising the sum of their squared signed
+   distances to the fixed surface, read from a SignedDistanceField precomputed once, so that no correspondences are
+   searched for. Gradients come from the field's trilinear interpolation, and the pose from the se(3) pose solver. */
+#ifndef SDFREGISTRATION_INCLUDED
+#define SDFREGISTRATION_INCLUDED
+
+#include <Eigen/Dense>
+
+#include <DistanceField.hpp>
+#include <Util.hpp>
+
+// phi(x)^2 for the moving points, with phi the field's signed distance. Points beyond the band keep a constant residual
+// of band, so that leaving the band never lowers the cost.
+struct SignedDistanceMetric {
+    static const int dimension = 1;
+
+    const SignedDistanceField& field;
+    const Eigen::MatrixXd& moving;
+
+    SignedDistanceMetric(const SignedDistanceField& field, const Eigen::MatrixXd& moving) : field(field), moving(moving) {
+    }
+
+    int size() const {
+        return moving.cols();
+    }
+
+    bool evaluate(int k, const Eigen::Matrix3d& rotation, const Eigen::Vector3d& translation, Eigen::Matrix<double, 1, 1>& residual,
+                  Eigen::Matrix<double, 1, 6>& jacobian, Eigen::Matrix<double, 1, 1>& information) const {
+        Eigen::Vector3d x = rotation * moving.col(k) + translation;
+        Eigen::Vector3d gradient;
+        field.distance(x, residual(0), gradient);
+        jacobian << x.cross(gradient).transpose(), gradient.transpose();
+        information(0, 0) = 1;
+        return true;
+    }
+};
+
+struct SdfRegistrationOptions {
+    // Levenberg-Marquardt iterations, each a handful of field reads per point, and the step length at which they stop.
+    int max_iterations = 50;
+    double step_tolerance = 1E-10;
+
+    int threads = 0;
+};
+
+struct SdfRegistrationResult {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    // Maps the moving cloud onto the fixed surface, as for register_surfaces.
+    Eigen::Matrix4d transform;
+
+    // RMS signed distance of the moving points within the band under transform, and how many there are.
+    double error;
+    int matched_points;
+
+    // Steps taken, at most max_iterations.
+    int iterations;
+
+    // Whether the solver's step fell below step_tolerance within max_iterations.
+    bool converged;
+};
+
+SdfRegistrationResult sdf_register_surfaces(const SignedDistanceField& field, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init,
+                                            const SdfRegistrationOptions& options = SdfRegistrationOptions());
+#endif
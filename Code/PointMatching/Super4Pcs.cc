@@ -0,0 +1,484 @@
+/* Super4PCS coarse alignment, after "Super 4PCS: Fast Global Pointcloud Registration via Smart Indexing", Mellado, Aiger
+   and Mitra, 2014. Bases of four roughly coplanar points are drawn from the moving cloud, and the sets of fixed points
+   congruent to them are found through the affine invariants of the base; every congruent set gives a candidate pose,
+   which is scored by how much of the moving cloud it brings onto the fixed one. Needs no features, and copes with clouds
+   that overlap by only a fraction. */
+#include <Super4Pcs.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <Exceptions.hpp>
+#include <GlobalRegistration.hpp>
+#include <KdTree.hpp>
+#include <Parallel.hpp>
+#include <PoseSolver.hpp>
+#include <SurfaceCache.hpp>
+
+namespace {
+
+struct PointGrid {
+    // Points bucketed into cubic cells: the points of cell c are points[cell_start[c]] .. points[cell_start[c + 1] - 1].
+    Eigen::Vector3d origin;
+    double cell;
+    int dimensions[3];
+    std::vector<int> cell_start;
+    std::vector<int> points;
+};
+
+struct Base {
+    // Four moving points, such that the lines through points 0, 1 and through points 2, 3 cross at
+    // point0 + ratio1 * (point1 - point0) = point2 + ratio2 * (point3 - point2).
+    int points[4];
+    double ratio1;
+    double ratio2;
+};
+
+struct PairSignature {
+    // What a rigid motion keeps of a pair of points with (unoriented) normals: its length, and the angles between the two
+    // normals and between each normal and the line joining the points.
+    double length;
+    double normal_angle;
+    double first_angle;
+    double second_angle;
+};
+
+}
+
+static void build_grid(const Eigen::MatrixXd& points, double cell, PointGrid& grid) {
+    // Counting sort of the points by cell.
+    grid.origin = points.rowwise().minCoeff();
+    grid.cell = cell;
+    Eigen::Vector3d extent = points.rowwise().maxCoeff() - grid.origin;
+    for(int d = 0; d < 3; d++) {
+        grid.dimensions[d] = static_cast<int>(floor(extent(d) / cell)) + 1;
+    }
+
+    int n = points.cols();
+    std::vector<int> cell_of_point(n);
+    grid.cell_start.assign(grid.dimensions[0] * grid.dimensions[1] * grid.dimensions[2] + 1, 0);
+    for(int i = 0; i < n; i++) {
+        int index[3];
+        for(int d = 0; d < 3; d++) {
+            index[d] = std::min(static_cast<int>(floor((points(d, i) - grid.origin(d)) / cell)), grid.dimensions[d] - 1);
+        }
+        cell_of_point[i] = (index[2] * grid.dimensions[1] + index[1]) * grid.dimensions[0] + index[0];
+        grid.cell_start[cell_of_point[i] + 1]++;
+    }
+    for(unsigned int c = 1; c < grid.cell_start.size(); c++) {
+        grid.cell_start[c] += grid.cell_start[c - 1];
+    }
+
+    grid.points.resize(n);
+    std::vector<int> next(grid.cell_start.begin(), grid.cell_start.end() - 1);
+    for(int i = 0; i < n; i++) {
+        grid.points[next[cell_of_point[i]]++] = i;
+    }
+}
+
+static double unoriented_angle(const Eigen::Vector3d& u, const Eigen::Vector3d& w) {
+    return acos(std::min(1.0, std::abs(u.dot(w)) / (u.norm() * w.norm())));
+}
+
+static PairSignature pair_signature(const Eigen::MatrixXd& points, const Eigen::MatrixXd& normals, int first, int second) {
+    Eigen::Vector3d segment = points.col(second) - points.col(first);
+    PairSignature signature;
+    signature.length = segment.norm();
+    signature.normal_angle = unoriented_angle(normals.col(first), normals.col(second));
+    signature.first_angle = unoriented_angle(normals.col(first), segment);
+    signature.second_angle = unoriented_angle(normals.col(second), segment);
+    return signature;
+}
+
+static void extract_pairs(const Eigen::MatrixXd& points, const Eigen::MatrixXd& normals, const PairSignature& signature, double tolerance, double max_angle,
+                          int threads, std::vector<std::pair<int, int> >& pairs) {
+    // All ordered pairs of points whose length is within tolerance of the signature's, and whose normal angles are
+    // within max_angle of it. The points are bucketed into cells a quarter of the length across, and only the cells that
+    // the spherical shell of that radius around a point's cell can reach are visited: the shell is rasterised once into a
+    // stencil of cell offsets, so each point costs about the same however large the cloud is.
+    double length = signature.length;
+    PointGrid grid;
+    build_grid(points, std::max(length / 4, tolerance), grid);
+
+    double cell = grid.cell;
+    int reach = static_cast<int>(ceil((length + tolerance) / cell)) + 1;
+    std::vector<Eigen::Vector3i, Eigen::aligned_allocator<Eigen::Vector3i> > stencil;
+    for(int x = -reach; x <= reach; x++) {
+        for(int y = -reach; y <= reach; y++) {
+            for(int z = -reach; z <= reach; z++) {
+                Eigen::Vector3d nearest(std::max(std::abs(x) - 1, 0), std::max(std::abs(y) - 1, 0), std::max(std::abs(z) - 1, 0));
+                Eigen::Vector3d farthest(std::abs(x) + 1, std::abs(y) + 1, std::abs(z) + 1);
+                if(cell * nearest.norm() <= length + tolerance && cell * farthest.norm() >= length - tolerance) {
+                    stencil.push_back(Eigen::Vector3i(x, y, z));
+                }
+            }
+        }
+    }
+
+    double lower = std::max(length - tolerance, 0.0);
+    double upper = length + tolerance;
+    int blocks = thread_count(threads);
+    std::vector<std::vector<std::pair<int, int> > > block_pairs(blocks);
+    parallel_for_blocks(points.cols(), threads, [&](int begin, int end, int block) {
+        auto& found = block_pairs[block];
+        for(int i = begin; i < end; i++) {
+            Eigen::Vector3i index;
+            for(int d = 0; d < 3; d++) {
+                index(d) = std::min(static_cast<int>(floor((points(d, i) - grid.origin(d)) / cell)), grid.dimensions[d] - 1);
+            }
+
+            for(const auto& offset : stencil) {
+                Eigen::Vector3i neighbour = index + offset;
+                if((neighbour.array() < 0).any() || neighbour(0) >= grid.dimensions[0] || neighbour(1) >= grid.dimensions[1] || neighbour(2) >= grid.dimensions[2]) {
+                    continue;
+                }
+                int c = (neighbour(2) * grid.dimensions[1] + neighbour(1)) * grid.dimensions[0] + neighbour(0);
+                for(int k = grid.cell_start[c]; k < grid.cell_start[c + 1]; k++) {
+                    int j = grid.points[k];
+                    double distance = (points.col(j) - points.col(i)).norm();
+                    if(j == i || distance < lower || distance > upper) {
+                        continue;
+                    }
+                    auto candidate = pair_signature(points, normals, i, j);
+                    if(std::abs(candidate.normal_angle - signature.normal_angle) <= max_angle
+                       && std::abs(candidate.first_angle - signature.first_angle) <= max_angle
+                       && std::abs(candidate.second_angle - signature.second_angle) <= max_angle) {
+                        found.push_back(std::make_pair(i, j));
+                    }
+                }
+            }
+        }
+    });
+
+    pairs.clear();
+    for(const auto& found : block_pairs) {
+        pairs.insert(pairs.end(), found.begin(), found.end());
+    }
+}
+
+static bool line_crossing(const Eigen::Vector3d& a, const Eigen::Vector3d& b, const Eigen::Vector3d& c, const Eigen::Vector3d& d, double& s, double& t) {
+    // Parameters of the closest points a + s (b - a) and c + t (d - c) of two lines, or false if they are near parallel.
+    Eigen::Vector3d u = b - a;
+    Eigen::Vector3d w = d - c;
+    Eigen::Matrix2d normal;
+    normal << u.dot(u), -u.dot(w), -u.dot(w), w.dot(w);
+    if(std::abs(normal.determinant()) <= 1E-6 * normal(0, 0) * normal(1, 1)) {
+        return false;
+    }
+    Eigen::Vector2d parameters = normal.inverse() * Eigen::Vector2d(u.dot(c - a), -w.dot(c - a));
+    s = parameters(0);
+    t = parameters(1);
+    return true;
+}
+
+static bool select_base(const Eigen::MatrixXd& moving, const KdTree& tree, double base_diameter, double tolerance, std::mt19937& random, Base& base) {
+    // A wide, nearly coplanar base within base_diameter of a random point: two more random points spanning a
+    // well-shaped triangle with it, then the point closest to their plane that lies farthest from all three. The points
+    // are paired so that the two lines cross between the points of each pair, as the diagonals of a quadrilateral do.
+    std::uniform_int_distribution<int> pick_point(0, moving.cols() - 1);
+    int first = pick_point(random);
+    std::vector<int> neighbours;
+    tree.within_radius(moving.col(first), base_diameter, neighbours);
+    if(neighbours.size() < 4) {
+        return false;
+    }
+
+    std::uniform_int_distribution<int> pick_neighbour(0, neighbours.size() - 1);
+    double min_separation = base_diameter / 4;
+    for(int attempt = 0; attempt < 16; attempt++) {
+        int second = neighbours[pick_neighbour(random)];
+        int third = neighbours[pick_neighbour(random)];
+        Eigen::Vector3d p0 = moving.col(first);
+        Eigen::Vector3d p1 = moving.col(second);
+        Eigen::Vector3d p2 = moving.col(third);
+        Eigen::Vector3d normal = (p1 - p0).cross(p2 - p0);
+        if(normal.norm() < base_diameter * base_diameter / 10 || (p1 - p2).norm() > base_diameter) {
+            continue;
+        }
+        normal.normalize();
+
+        int fourth = -1;
+        double best_separation = min_separation;
+        for(int candidate : neighbours) {
+            Eigen::Vector3d p3 = moving.col(candidate);
+            if(std::abs(normal.dot(p3 - p0)) > tolerance || (p3 - p1).norm() > base_diameter || (p3 - p2).norm() > base_diameter) {
+                continue;
+            }
+            double separation = std::min((p3 - p0).norm(), std::min((p3 - p1).norm(), (p3 - p2).norm()));
+            if(separation > best_separation) {
+                best_separation = separation;
+                fourth = candidate;
+            }
+        }
+        if(fourth < 0) {
+            continue;
+        }
+
+        const int points[4] = { first, second, third, fourth };
+        const int pairings[3][4] = { { 0, 1, 2, 3 }, { 0, 2, 1, 3 }, { 0, 3, 1, 2 } };
+        for(const auto& pairing : pairings) {
+            double s, t;
+            if(line_crossing(moving.col(points[pairing[0]]), moving.col(points[pairing[1]]), moving.col(points[pairing[2]]), moving.col(points[pairing[3]]), s, t)
+               && s > 0 && s < 1 && t > 0 && t < 1) {
+                for(int k = 0; k < 4; k++) {
+                    base.points[k] = points[pairing[k]];
+                }
+                base.ratio1 = s;
+                base.ratio2 = t;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static double fit_base(const Eigen::MatrixXd& moving, const Eigen::MatrixXd& fixed, const Base& base, const int congruent[4], Eigen::Matrix4d& transform) {
+    // Least-squares rigid transform taking the base onto a congruent set of fixed points, and its RMS residual.
+    Eigen::Vector3d p_average = Eigen::Vector3d::Zero();
+    Eigen::Vector3d q_average = Eigen::Vector3d::Zero();
+    for(int k = 0; k < 4; k++) {
+        p_average += moving.col(base.points[k]) / 4;
+        q_average += fixed.col(congruent[k]) / 4;
+    }
+    Eigen::Matrix3d H = Eigen::Matrix3d::Zero();
+    for(int k = 0; k < 4; k++) {
+        H += (moving.col(base.points[k]) - p_average) * (fixed.col(congruent[k]) - q_average).transpose();
+    }
+
+    // As for RANSAC samples, the reflection is corrected unconditionally, since the base is nearly planar.
+    Eigen::JacobiSVD<Eigen::Matrix3d> svd(H, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    Eigen::Matrix3d V = svd.matrixV();
+    if((V * svd.matrixU().transpose()).determinant() < 0) {
+        V.col(2) *= -1;
+    }
+    Eigen::Matrix3d rotation = V * svd.matrixU().transpose();
+
+    transform = Eigen::Matrix4d::Identity();
+    transform.block(0,0,3,3) = rotation;
+    transform.block(0,3,3,1) = q_average - rotation * p_average;
+
+    double squared_error = 0;
+    for(int k = 0; k < 4; k++) {
+        squared_error += (rotation * moving.col(base.points[k]) + transform.block(0,3,3,1) - fixed.col(congruent[k])).squaredNorm();
+    }
+    return sqrt(squared_error / 4);
+}
+
+static int count_aligned(const KdTree& fixed_tree, const Eigen::MatrixXd& fixed_normals, const Eigen::MatrixXd& moving, const Eigen::MatrixXd& moving_normals,
+                         const std::vector<int>& sample, const Eigen::Matrix4d& transform, double distance, double max_angle, int to_beat) {
+    // Number of sample points that transform brings within distance of the fixed cloud, with their normals within
+    // max_angle of the normal there (which keeps poses that merely slide one smooth surface across another from scoring
+    // well). Gives up (and returns -1) as soon as it can no longer exceed to_beat. The sample is in random order, so a
+    // candidate is also given up once a sixteenth, an eighth, a quarter or a half of it has been checked with fewer than
+    // half as many points aligned as to_beat would have at that stage; most wrong candidates are rejected after a few
+    // queries this way.
+    Eigen::Matrix3d rotation = transform.block(0,0,3,3);
+    Eigen::Vector3d translation = transform.block(0,3,3,1);
+    double squared_distance_limit = distance * distance;
+
+    int n = sample.size();
+    int aligned = 0;
+    for(int k = 0; k < n; k++) {
+        if(aligned + (n - k) <= to_beat) {
+            return -1;
+        }
+        if((k == n / 16 || k == n / 8 || k == n / 4 || k == n / 2) && k > 0 && 2 * aligned * n < to_beat * k) {
+            return -1;
+        }
+        double squared_distance;
+        int nearest = fixed_tree.nearest(rotation * moving.col(sample[k]) + translation, squared_distance);
+        if(squared_distance <= squared_distance_limit && unoriented_angle(rotation * moving_normals.col(sample[k]), fixed_normals.col(nearest)) <= max_angle) {
+            aligned++;
+        }
+    }
+    return aligned > to_beat ? aligned : -1;
+}
+
+// Point-to-plane steps by which verify_candidate refines a candidate before scoring it.
+static const int verification_steps = 3;
+
+static int verify_candidate(const KdTree& fixed_tree, const Eigen::MatrixXd& fixed, const Eigen::MatrixXd& fixed_normals, const Eigen::MatrixXd& sample_points,
+                            const Eigen::MatrixXd& sample_normals, double distance, double max_angle, Eigen::Matrix4d& transform) {
+    // A candidate is only as accurate as its base, so it is first refined by a few point-to-plane steps on the sample
+    // points it aligns, and then scored by how many of them lie within a quarter of distance of the fixed surface's
+    // tangent planes. Poses that merely lay one smooth patch across another (a mirror image of the overlap, say) align
+    // many points loosely but few this closely.
+    Eigen::ArrayXi correspondences(sample_points.cols());
+    int aligned = 0;
+    for(int round = 0; round <= verification_steps; round++) {
+        Eigen::Matrix3d rotation = transform.block(0,0,3,3);
+        Eigen::Vector3d translation = transform.block(0,3,3,1);
+        int matched = 0;
+        aligned = 0;
+        for(int k = 0; k < sample_points.cols(); k++) {
+            Eigen::Vector3d x = rotation * sample_points.col(k) + translation;
+            double squared_distance;
+            int nearest = fixed_tree.nearest(x, squared_distance);
+            correspondences(k) = -1;
+            if(squared_distance <= distance * distance && unoriented_angle(rotation * sample_normals.col(k), fixed_normals.col(nearest)) <= max_angle) {
+                correspondences(k) = nearest;
+                matched++;
+                aligned += std::abs((x - fixed.col(nearest)).dot(fixed_normals.col(nearest))) <= distance / 4;
+            }
+        }
+        if(round == verification_steps || matched < 6) {
+            break;
+        }
+
+        PoseSolverOptions solver_options;
+        solver_options.max_iterations = 1;
+        solver_options.levenberg_marquardt = false;
+        transform = solve_pose(PointToPlaneMetric(fixed, fixed_normals, sample_points, correspondences), transform, solver_options).transform;
+    }
+    return aligned;
+}
+
+static double segment_angle(const Eigen::Vector3d& u, const Eigen::Vector3d& w) {
+    return acos(std::max(-1.0, std::min(1.0, u.dot(w) / (u.norm() * w.norm()))));
+}
+
+Super4PcsResult super4pcs_register_surfaces(const Eigen::MatrixXd& fixed, const Eigen::MatrixXd& moving, const Super4PcsOptions& options) {
+    // For each base, the fixed pairs as long as each of its two segments are extracted, and pairs from the two lists
+    // whose invariant crossing points coincide (and whose segments meet at the base's angle) form congruent sets. The
+    // crossing points of the first list are indexed in a k-d tree, and the second list is split across threads, each
+    // scoring its candidates as it finds them against the best score of any thread so far.
+    if(!(options.overlap > 0 && options.overlap <= 1) || options.sample_size < 1 || options.max_bases < 1) {
+        std::cerr << "Super4PCS needs an overlap in (0, 1], and a positive sample size and number of bases." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    double voxel_size = options.voxel_size;
+    if(voxel_size <= 0) {
+        voxel_size = (fixed.rowwise().maxCoeff() - fixed.rowwise().minCoeff()).norm() / 50;
+    }
+    if(!(voxel_size > 0)) {
+        std::cerr << "Could not choose a voxel size -- the fixed cloud has no extent." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    Eigen::MatrixXd fixed_points = voxel_downsample(fixed, voxel_size);
+    Eigen::MatrixXd moving_points = voxel_downsample(moving, voxel_size);
+    if(fixed_points.cols() < 4 || moving_points.cols() < 4) {
+        std::cerr << "Super4PCS needs at least four points in each cloud after downsampling." << std::endl;
+        throw(PointMatchingEx);
+    }
+    KdTree fixed_tree(fixed_points);
+    KdTree moving_tree(moving_points);
+    Eigen::MatrixXd fixed_normals = compute_point_normals(fixed_points, fixed_tree, options.normal_neighbours);
+    Eigen::MatrixXd moving_normals = compute_point_normals(moving_points, moving_tree, options.normal_neighbours);
+
+    double tolerance = options.accuracy * voxel_size;
+    double base_diameter = options.overlap * (moving_points.rowwise().maxCoeff() - moving_points.rowwise().minCoeff()).norm();
+
+    std::mt19937 random(options.seed);
+    std::vector<int> sample(moving_points.cols());
+    for(unsigned int i = 0; i < sample.size(); i++) {
+        sample[i] = i;
+    }
+    std::shuffle(sample.begin(), sample.end(), random);
+    sample.resize(std::min<int>(sample.size(), options.sample_size));
+    int good_enough = static_cast<int>(ceil(options.overlap * sample.size()));
+    Eigen::MatrixXd sample_points(3, sample.size());
+    Eigen::MatrixXd sample_normals(3, sample.size());
+    for(unsigned int k = 0; k < sample.size(); k++) {
+        sample_points.col(k) = moving_points.col(sample[k]);
+        sample_normals.col(k) = moving_normals.col(sample[k]);
+    }
+
+    int threads = thread_count(options.threads);
+    std::atomic<int> best_aligned(0);
+    std::atomic<int> candidates(0);
+    std::vector<int> thread_aligned(threads, 0);
+    std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d> > thread_transforms(threads, Eigen::Matrix4d::Identity());
+
+    std::vector<std::pair<int, int> > pairs1;
+    std::vector<std::pair<int, int> > pairs2;
+    int bases = 0;
+    while(bases < options.max_bases && best_aligned.load() < good_enough) {
+        bases++;
+        Base base;
+        if(!select_base(moving_points, moving_tree, base_diameter, tolerance, random, base)) {
+            continue;
+        }
+
+        Eigen::Vector3d segment1 = moving_points.col(base.points[1]) - moving_points.col(base.points[0]);
+        Eigen::Vector3d segment2 = moving_points.col(base.points[3]) - moving_points.col(base.points[2]);
+        double base_angle = segment_angle(segment1, segment2);
+
+        auto signature1 = pair_signature(moving_points, moving_normals, base.points[0], base.points[1]);
+        auto signature2 = pair_signature(moving_points, moving_normals, base.points[2], base.points[3]);
+        extract_pairs(fixed_points, fixed_normals, signature1, tolerance, options.max_angle, options.threads, pairs1);
+        extract_pairs(fixed_points, fixed_normals, signature2, tolerance, options.max_angle, options.threads, pairs2);
+        if(pairs1.empty() || pairs2.empty()) {
+            continue;
+        }
+
+        Eigen::MatrixXd crossings(3, pairs1.size());
+        for(unsigned int k = 0; k < pairs1.size(); k++) {
+            crossings.col(k) = fixed_points.col(pairs1[k].first) + base.ratio1 * (fixed_points.col(pairs1[k].second) - fixed_points.col(pairs1[k].first));
+        }
+        KdTree crossing_tree(crossings);
+
+        parallel_for_blocks(pairs2.size(), threads, [&](int begin, int end, int block) {
+            std::vector<int> coincident;
+            for(int k = begin; k < end; k++) {
+                if(best_aligned.load() >= good_enough) {
+                    return;
+                }
+
+                Eigen::Vector3d p2 = fixed_points.col(pairs2[k].first);
+                Eigen::Vector3d p3 = fixed_points.col(pairs2[k].second);
+                crossing_tree.within_radius(p2 + base.ratio2 * (p3 - p2), tolerance, coincident);
+                for(int c : coincident) {
+                    Eigen::Vector3d p0 = fixed_points.col(pairs1[c].first);
+                    Eigen::Vector3d p1 = fixed_points.col(pairs1[c].second);
+                    if(std::abs(segment_angle(p1 - p0, p3 - p2) - base_angle) > options.max_angle) {
+                        continue;
+                    }
+
+                    const int congruent[4] = { pairs1[c].first, pairs1[c].second, pairs2[k].first, pairs2[k].second };
+                    Eigen::Matrix4d candidate;
+                    if(fit_base(moving_points, fixed_points, base, congruent, candidate) > tolerance) {
+                        continue;
+                    }
+                    candidates++;
+
+                    // The quick count only needs to beat the best verified score, which is the stricter of the two.
+                    if(count_aligned(fixed_tree, fixed_normals, moving_points, moving_normals, sample, candidate, tolerance, options.max_angle,
+                                     best_aligned.load()) < 0) {
+                        continue;
+                    }
+                    int aligned = verify_candidate(fixed_tree, fixed_points, fixed_normals, sample_points, sample_normals, tolerance, options.max_angle, candidate);
+                    if(aligned <= thread_aligned[block]) {
+                        continue;
+                    }
+                    thread_aligned[block] = aligned;
+                    thread_transforms[block] = candidate;
+
+                    int previous = best_aligned.load();
+                    while(aligned > previous && !best_aligned.compare_exchange_weak(previous, aligned)) {
+                    }
+                }
+            }
+        });
+    }
+
+    Super4PcsResult result;
+    result.transform = Eigen::Matrix4d::Identity();
+    int aligned = 0;
+    for(int thread = 0; thread < threads; thread++) {
+        if(thread_aligned[thread] > aligned) {
+            aligned = thread_aligned[thread];
+            result.transform = thread_transforms[thread];
+        }
+    }
+    result.overlap = static_cast<double>(aligned) / sample.size();
+    result.bases = bases;
+    result.candidates = candidates.load();
+    return result;
+}
@@ -0,0 +1,53 @@
+/* Super4PCS coarse alignment, after "Super 4PCS: Fast Global Pointcloud Registration via Smart Indexing", Mellado, Aiger
+   and Mitra, 2014. Bases of four roughly coplanar points are drawn from the moving cloud, and the sets of fixed points
+   congruent to them are found through the affine invariants of the base; every congruent set gives a candidate pose,
+   which is scored by how much of the moving cloud it brings onto the fixed one. Needs no features, and copes with clouds
+   that overlap by only a fraction. */
+#ifndef SUPER4PCS_INCLUDED
+#define SUPER4PCS_INCLUDED
+
+#include <Eigen/Dense>
+
+struct Super4PcsOptions {
+    // Rough fraction of the moving cloud that overlaps the fixed one. Bases are drawn with about this fraction of the
+    // moving cloud's diameter, and the search stops as soon as a pose brings this fraction of the sample into alignment.
+    double overlap = 0.5;
+
+    // Both clouds are voxel-downsampled first; zero picks 1/50 of the fixed cloud's diameter.
+    double voxel_size = 0;
+
+    // Tolerance on pair lengths and base intersections, and distance within which a moving point counts as aligned, as
+    // multiples of the voxel size.
+    double accuracy = 1.0;
+
+    // Largest difference between the angles of a base and of a congruent set (radians): between its two segments, and
+    // between the normals at its points and their segments.
+    double max_angle = 0.25;
+
+    // Neighbourhood size for the normals of the downsampled clouds.
+    int normal_neighbours = 10;
+
+    // Moving points used to score each candidate pose, and number of bases tried before giving up.
+    int sample_size = 200;
+    int max_bases = 200;
+
+    int threads = 0;
+    unsigned int seed = 1;
+};
+
+struct Super4PcsResult {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    // Maps the moving cloud onto the fixed one, as for register_surfaces.
+    Eigen::Matrix4d transform;
+
+    // Fraction of the sample brought within a quarter of the tolerance of the fixed cloud's tangent planes by transform.
+    double overlap;
+
+    // Bases tried, and candidate poses scored over all of them.
+    int bases;
+    int candidates;
+};
+
+Super4PcsResult super4pcs_register_surfaces(const Eigen::MatrixXd& fixed, const Eigen::MatrixXd& moving, const Super4PcsOptions& options = Super4PcsOptions());
+#endif
@@ -1,18 +1,46 @@
 #include <SurfaceBasedRegistration.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
 #include <PointMatching.hpp>
 #include <Util.hpp>
+#include <AndersonAcceleration.hpp>
+#include <Exceptions.hpp>
+#include <GeneralizedIcp.hpp>
+#include <MomentAlignment.hpp>
+#include <SymmetricIcp.hpp>
 
 Eigen::ArrayXi find_closest_points(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2) {
-    Eigen::ArrayXi lookup_table(surface1.cols());
-    bool used[surface1.cols()];
+    Eigen::ArrayXi lookup_table;
+    std::vector<char> used;
+    find_closest_points(surface1, surface2, lookup_table, used);
+
+    return lookup_table;
+}
+
+void find_closest_points(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, Eigen::ArrayXi& lookup_table, std::vector<char>& used,
+                         const CancellationToken* cancellation) {
+    // As above, writing into caller-owned buffers. used flags points of surface2 that have already been claimed.
+    lookup_table.resize(surface1.cols());
+    used.assign(surface2.cols(), false);
 
     for(int i = 0; i < surface1.cols(); i++) {
-        lookup_table(i) = 0;
-        used[i] = false;
+        lookup_table(i) = -1;
     }
 
     // For each point in the floating surface, find the closest point in the reference surface, then update lookup_table accordingly.
     for(int j = 0; j < surface1.cols(); j++) {
+        if(j % cancellation_block == 0) {
+            throw_if_cancelled(cancellation);
+        }
         auto v1 = surface1.col(j);
         double distance_old = 1E10; 
 
@@ -21,7 +49,9 @@ Eigen::ArrayXi find_closest_points(const Eigen::MatrixXd& surface1, const Eigen:
                 auto v2 = surface2.col(k);
                 auto distance_new = (v2 - v1).norm();
                 if(distance_new < distance_old) {
-                    used[lookup_table[j]] = false;
+                    if(lookup_table[j] >= 0) {
+                        used[lookup_table[j]] = false;
+                    }
                     lookup_table[j] = k;
                     used[k] = true;
                     distance_old = distance_new;
@@ -29,48 +59,697 @@ Eigen::ArrayXi find_closest_points(const Eigen::MatrixXd& surface1, const Eigen:
             }
         }
     }
+}
 
-    return lookup_table;
+double find_nearest_points(const KdTree& tree, const Eigen::MatrixXd& surface, const Eigen::Matrix4d& transform, RobustKernel kernel, double scale,
+                           Eigen::ArrayXi& lookup_table, Eigen::VectorXd& distances, double search_epsilon, const CancellationToken* cancellation) {
+    // For each point of surface under transform, find the nearest point in tree (duplicates allowed), or one within a factor
+    // (1 + search_epsilon) of it. Returns the robust RMS error sqrt(2*sum(rho)/N) of the matches, which is the plain RMS
+    // distance when no kernel is used.
+    auto n = surface.cols();
+    lookup_table.resize(n);
+    distances.resize(n);
+
+    Eigen::Matrix3d rotation = transform.block(0,0,3,3);
+    Eigen::Vector3d translation = transform.block(0,3,3,1);
+
+    double loss_sum = 0;
+    for(int i = 0; i < n; i++) {
+        if(i % cancellation_block == 0) {
+            throw_if_cancelled(cancellation);
+        }
+        Eigen::Vector3d x = rotation * surface.col(i) + translation;
+        double squared_distance;
+        lookup_table(i) = tree.nearest(x, squared_distance, search_epsilon);
+        distances(i) = sqrt(squared_distance);
+        loss_sum += robust_loss(kernel, distances(i), scale);
+    }
+
+    return sqrt(2 * loss_sum / n);
 }
 
 Eigen::MatrixXd reorder_points(const Eigen::MatrixXd& surface, const Eigen::ArrayXi& lookup_table) {
-    auto reordered = surface;
-    for(int i = 0; i < surface.cols(); i++) {
-        reordered.col(i) << surface.col(lookup_table(i));
-    }
+    Eigen::MatrixXd reordered;
+    reorder_points(surface, lookup_table, reordered);
 
     return reordered;
 }
 
-Eigen::Matrix4d register_surfaces(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init) {
-    auto transform = transform_init;
-    auto transform_old = transform;
+void reorder_points(const Eigen::MatrixXd& surface, const Eigen::ArrayXi& lookup_table, Eigen::MatrixXd& reordered) {
+    // Columns for unmatched or rejected entries (lookup_table(i) < 0) are left unset.
+    reordered.resize(surface.rows(), lookup_table.size());
+    for(int i = 0; i < lookup_table.size(); i++) {
+        if(lookup_table(i) >= 0) {
+            reordered.col(i) = surface.col(lookup_table(i));
+        }
+    }
+}
+
+void RegistrationWorkspace::reserve(int fixed_points, int moving_points) {
+    transformed.resize(3, moving_points);
+    closest_points.resize(3, fixed_points);
+    lookup.resize(fixed_points);
+    used.reserve(moving_points);
+    residuals.resize(fixed_points);
+}
+
+// The two surfaces being registered. The caches are only set for modes (or rejectors) that need a k-d tree or per-point
+// geometry.
+struct SurfacePair {
+    const Eigen::MatrixXd& fixed;
+    const Eigen::MatrixXd& moving;
+    const SurfaceCache* fixed_cache;
+    const SurfaceCache* moving_cache;
+};
+
+static double similarity_step(const SurfaceCache& fixed, const SurfaceCache& moving, const Eigen::Matrix4d& transform, const RegistrationOptions& options,
+                              double scale, const CorrespondenceRejection& rejection, double search_epsilon, RegistrationWorkspace& workspace,
+                              Eigen::Matrix4d& transform_next, StageClock* clock) {
+    // Match each moving point to its nearest fixed point under transform, drop the rejected matches, then fit a similarity
+    // transform to the rest. The matches may repeat fixed points: an exhaustive search that claims each point once pairs
+    // clouds of different scales badly, and the fit then shrinks the scale. Returns the (robust) RMS error of transform.
+    find_nearest_points(fixed.tree, moving.points, transform, options.robust_kernel, scale, workspace.lookup, workspace.residuals, search_epsilon,
+                        options.cancellation);
+    if(clock) {
+        clock->lap(&StageTimes::search);
+    }
+    if(rejection.enabled()) {
+        // Normals are compared under the rotation alone.
+        Eigen::Matrix3d rotation = transform.block(0,0,3,3) / std::cbrt(transform.block(0,0,3,3).determinant());
+        int kept;
+        reject_correspondences(rejection, &moving, &fixed, rotation, options.robust_kernel, scale, workspace.residuals, workspace.lookup, kept);
+    }
+    if(clock) {
+        clock->lap(&StageTimes::rejection);
+    }
+    reorder_points(fixed.points, workspace.lookup, workspace.closest_points);
+
+    // The step recomputes the residuals of the pairs kept, and its error is over those pairs.
+    return robust_similarity_step(moving.points, workspace.closest_points, transform, options.robust_kernel, scale, workspace.residuals, transform_next,
+                                  &workspace.lookup);
+}
+
+static double icp_step(const SurfacePair& surfaces, const Eigen::Matrix4d& transform, const RegistrationOptions& options, double scale,
+                       const CorrespondenceRejection& rejection, double search_epsilon, RegistrationWorkspace& workspace, Eigen::Matrix4d& transform_next,
+                       StageClock* clock = 0) {
+    // Match the surfaces under transform, drop the rejected matches, then take one least-squares step from the rest.
+    // Returns the error of transform, and sets transform_next to the estimate from this iteration's correspondences.
+    // All intermediate results live in workspace, so a steady-state iteration does not allocate. search_epsilon loosens
+    // the k-d tree search of the tree-based modes; the exhaustive point-to-point search is always exact. clock, if given, is
+    // lapped at the end of each stage.
+    if(options.mode != RegistrationMode::PointToPoint) {
+        double error;
+        if(options.mode == RegistrationMode::Similarity) {
+            error = similarity_step(*surfaces.fixed_cache, *surfaces.moving_cache, transform, options, scale, rejection, search_epsilon, workspace,
+                                    transform_next, clock);
+        } else if(options.mode == RegistrationMode::Generalized) {
+            error = gicp_step(*surfaces.fixed_cache, *surfaces.moving_cache, transform, options.robust_kernel, scale, rejection, workspace.lookup,
+                              workspace.residuals, transform_next, search_epsilon, options.cancellation, clock);
+        } else {
+            error = symmetric_step(*surfaces.fixed_cache, *surfaces.moving_cache, transform, options.robust_kernel, scale, rejection, workspace.lookup,
+                                   workspace.residuals, transform_next, search_epsilon, options.cancellation, clock);
+        }
+        if(clock) {
+            clock->lap(&StageTimes::solve);
+        }
+        return error;
+    }
+
+    // Need to match up closest_points information (i.e. reordering) with untransformed surface2.
+    apply_transform(surfaces.moving, transform, workspace.transformed);
+    find_closest_points(surfaces.fixed, workspace.transformed, workspace.lookup, workspace.used, options.cancellation);
+    if(clock) {
+        clock->lap(&StageTimes::search);
+    }
+    // Fixed points left without a partner get no residual (NaN), so that the medians of update_from_residuals skip them.
+    for(int i = 0; i < workspace.lookup.size(); i++) {
+        int j = workspace.lookup(i);
+        workspace.residuals(i) = j >= 0 ? (surfaces.fixed.col(i) - workspace.transformed.col(j)).norm() : std::numeric_limits<double>::quiet_NaN();
+    }
+    if(rejection.enabled()) {
+        // Here the fixed points index the pairs, so their normals are taken into the moving frame.
+        Eigen::Matrix3d inverse_rotation = transform.block(0,0,3,3).transpose();
+        int kept;
+        reject_correspondences(rejection, surfaces.fixed_cache, surfaces.moving_cache, inverse_rotation, options.robust_kernel, scale, workspace.residuals,
+                               workspace.lookup, kept);
+    }
+    if(clock) {
+        clock->lap(&StageTimes::rejection);
+    }
+    reorder_points(surfaces.moving, workspace.lookup, workspace.closest_points);
+
+    double error = robust_rigid_step(workspace.closest_points, surfaces.fixed, transform, options.robust_kernel, scale, workspace.residuals, transform_next,
+                                     &workspace.lookup);
+    if(clock) {
+        clock->lap(&StageTimes::solve);
+    }
+    return error;
+}
+
+RegistrationMode registration_mode_from_string(const std::string& name) {
+    if(name == "point") {
+        return RegistrationMode::PointToPoint;
+    } else if(name == "gicp") {
+        return RegistrationMode::Generalized;
+    } else if(name == "symmetric") {
+        return RegistrationMode::Symmetric;
+    } else if(name == "similarity") {
+        return RegistrationMode::Similarity;
+    }
+
+    std::cerr << "Unknown registration mode " << name << " -- expected point, gicp, symmetric or similarity." << std::endl;
+    throw(PointMatchingEx);
+}
+
+InitialAlignment initial_alignment_from_string(const std::string& name) {
+    if(name == "none") {
+        return InitialAlignment::None;
+    } else if(name == "moments") {
+        return InitialAlignment::Moments;
+    }
+
+    std::cerr << "Unknown initial alignment " << name << " -- expected none or moments." << std::endl;
+    throw(PointMatchingEx);
+}
+
+std::string stop_reason_to_string(StopReason reason) {
+    switch(reason) {
+        case StopReason::ErrorIncreased:
+            return "error stopped decreasing";
+        case StopReason::MaxIterations:
+            return "maximum iterations reached";
+        case StopReason::IncrementConverged:
+            return "transform increment below tolerance";
+        case StopReason::RelativeErrorConverged:
+            return "relative error change below tolerance";
+        case StopReason::ErrorThresholdReached:
+            return "error below threshold";
+        case StopReason::TimeLimitReached:
+            return "time limit reached";
+        case StopReason::EngineConverged:
+            return "converged";
+    }
+    return "unknown";
+}
+
+void transform_increment(const Eigen::Matrix4d& transform_old, const Eigen::Matrix4d& transform, double& angle, double& translation) {
+    // Rotation angle and translation of the change T * T_old^-1.
+    Eigen::Matrix4d increment = transform * transform_old.inverse();
+    double scale = std::cbrt(increment.block(0,0,3,3).determinant());
+    auto cos_angle = (increment.block(0,0,3,3).trace() / scale - 1) / 2;
+    angle = acos(std::min(1.0, std::max(-1.0, cos_angle)));
+    translation = increment.block(0,3,3,1).norm();
+}
+
+bool increment_converged(const Eigen::Matrix4d& transform_old, const Eigen::Matrix4d& transform, const ConvergencePolicy& policy) {
+    // Compare the change T * T_old^-1 against the policy's tolerances, ignoring either one that is zero.
+    if(policy.rotation_tolerance <= 0 && policy.translation_tolerance <= 0) {
+        return false;
+    }
+
+    double angle;
+    double translation;
+    transform_increment(transform_old, transform, angle, translation);
+    return (policy.rotation_tolerance <= 0 || angle <= policy.rotation_tolerance)
+           && (policy.translation_tolerance <= 0 || translation <= policy.translation_tolerance);
+}
+
+void prepare_surface_cache(SurfaceCache& cache, const RegistrationOptions& options) {
+    if(options.mode == RegistrationMode::Generalized) {
+        ensure_covariances(cache, options.covariance_neighbours, options.cancellation);
+    } else if(options.mode == RegistrationMode::Symmetric) {
+        ensure_normals(cache, options.normal_neighbours, options.cancellation);
+    }
+
+    if(options.rejection.reject_boundary) {
+        ensure_boundary(cache, options.normal_neighbours, options.cancellation);
+    } else if(options.rejection.needs_normals()) {
+        ensure_normals(cache, options.normal_neighbours, options.cancellation);
+    }
+}
+
+static void check_surface_cache(const SurfaceCache& cache, const RegistrationOptions& options) {
+    if(options.mode == RegistrationMode::Generalized && cache.covariance_neighbours != options.covariance_neighbours) {
+        std::cerr << "Surface cache has no covariances for this neighbourhood size -- call prepare_surface_cache first." << std::endl;
+        throw(PointMatchingEx);
+    }
+    if((options.mode == RegistrationMode::Symmetric || options.rejection.needs_normals()) && cache.normal_neighbours != options.normal_neighbours) {
+        std::cerr << "Surface cache has no normals for this neighbourhood size -- call prepare_surface_cache first." << std::endl;
+        throw(PointMatchingEx);
+    }
+    if(options.rejection.reject_boundary && cache.boundary_neighbours != options.normal_neighbours) {
+        std::cerr << "Surface cache has no boundary points for this neighbourhood size -- call prepare_surface_cache first." << std::endl;
+        throw(PointMatchingEx);
+    }
+}
+
+static RegistrationResult run_registration(const SurfacePair& surfaces, const Eigen::Matrix4d& transform_init, const RegistrationOptions& options,
+                                           RegistrationWorkspace& workspace);
+
+RegistrationResult register_surfaces(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init, const RegistrationOptions& options) {
+    RegistrationWorkspace workspace;
+    return register_surfaces(surface1, surface2, transform_init, options, workspace);
+}
+
+RegistrationResult register_surfaces(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init, const RegistrationOptions& options,
+                                     RegistrationWorkspace& workspace) {
+    if(options.mode == RegistrationMode::PointToPoint && !options.rejection.needs_normals()) {
+        SurfacePair surfaces = { surface1, surface2, 0, 0 };
+        return run_registration(surfaces, transform_init, options, workspace);
+    }
+
+    SurfaceCache fixed(surface1);
+    SurfaceCache moving(surface2);
+    prepare_surface_cache(fixed, options);
+    prepare_surface_cache(moving, options);
+
+    return register_surfaces(fixed, moving, transform_init, options, workspace);
+}
+
+RegistrationResult register_surfaces(const SurfaceCache& surface1, const SurfaceCache& surface2, const Eigen::Matrix4d& transform_init, const RegistrationOptions& options,
+                                     RegistrationWorkspace& workspace) {
+    check_surface_cache(surface1, options);
+    check_surface_cache(surface2, options);
+
+    SurfacePair surfaces = { surface1.points, surface2.points, &surface1, &surface2 };
+    return run_registration(surfaces, transform_init, options, workspace);
+}
+
+static void update_from_residuals(const RegistrationOptions& options, RegistrationWorkspace& workspace, double& scale, CorrespondenceRejection& rejection) {
+    // The robust scale, then the distance threshold for mad_factor, from the residuals of the last iteration. Only points
+    // that found a partner with agreeing normals, off the boundary, have a residual; the others are NaN and are left out.
+    if(options.robust_kernel == RobustKernel::None && options.rejection.mad_factor <= 0) {
+        return;
+    }
+    int matched = 0;
+    workspace.matched_residuals.resize(workspace.residuals.size());
+    for(int i = 0; i < workspace.residuals.size(); i++) {
+        if(!std::isnan(workspace.residuals(i))) {
+            workspace.matched_residuals(matched++) = workspace.residuals(i);
+        }
+    }
+    if(options.robust_kernel != RobustKernel::None) {
+        scale = robust_scale_from_residuals(workspace.matched_residuals.head(matched));
+    }
+    if(options.rejection.mad_factor > 0) {
+        double threshold = mad_distance_threshold(workspace.matched_residuals.head(matched), options.rejection.mad_factor);
+        rejection.max_distance = options.rejection.max_distance > 0 ? std::min(options.rejection.max_distance, threshold) : threshold;
+    }
+}
+
+static double rescored_error(const RegistrationOptions& options, const Eigen::VectorXd& residuals, double scale, const CorrespondenceRejection& rejection) {
+    // The robust error sqrt(2*sum(rho)/N) of the iterate with these residuals, re-measured under the scale and distance
+    // threshold that the next iteration is measured with, so that the two errors are comparable. Pairs whose distance
+    // exceeds the threshold no longer count; NaN residuals never do.
+    double max_distance = rejection.max_distance > 0 ? rejection.max_distance : std::numeric_limits<double>::infinity();
+    double loss_sum = 0;
+    int used = 0;
+    for(int i = 0; i < residuals.size(); i++) {
+        if(residuals(i) <= max_distance) {
+            loss_sum += robust_loss(options.robust_kernel, residuals(i), scale);
+            used++;
+        }
+    }
+    return used > 0 ? sqrt(2 * loss_sum / used) : std::numeric_limits<double>::infinity();
+}
+
+typedef std::chrono::steady_clock::time_point TimePoint;
+
+// Wall-clock state of a registration with a time limit.
+struct Deadline {
+    TimePoint time;
 
-    auto transformed_pointcloud = apply_transform(surface2, transform);
-    auto lookup_closest = find_closest_points(surface1, transformed_pointcloud);
-    auto closest_points = reorder_points(surface2, lookup_closest);
+    // Latest measured duration of one iteration, per point of the sampled cloud (zero until measured).
+    double seconds_per_point;
+};
 
-    double error = 0;
-    double error_new = fiducial_registration_error(transformed_pointcloud, surface1, transform);
+// Iterations a sample must have time for before anytime registration moves on to it.
+static const int iterations_per_sample = 4;
 
-    int iterations_left = 100;
+static bool out_of_time(const Deadline& deadline, int points, int iterations) {
+    // Whether the given iterations over the given number of points are expected to overrun the deadline.
+    auto now = std::chrono::steady_clock::now();
+    double predicted = deadline.seconds_per_point * points * iterations;
+    return now >= deadline.time || std::chrono::duration<double>(deadline.time - now).count() < predicted;
+}
+
+static int sampled_points(const SurfacePair& surfaces, const RegistrationOptions& options) {
+    // The cloud whose points index the correspondences, and so set the cost of an iteration: the fixed one for the
+    // exhaustive point-to-point search, and the moving one for the tree-based modes.
+    return options.mode == RegistrationMode::PointToPoint ? surfaces.fixed.cols() : surfaces.moving.cols();
+}
+
+static void iterate_registration(const SurfacePair& surfaces, const Eigen::Matrix4d& transform_init, const RegistrationOptions& options, double search_epsilon,
+                                 Deadline* deadline, RegistrationWorkspace& workspace, RegistrationResult& result) {
+    // Run ICP from transform_init until a stopping criterion is met, counting iterations on from result.iterations and
+    // keeping the best transform in result. With a deadline, stops before any iteration not expected to finish in time.
+    const auto& policy = options.convergence;
+    Eigen::Matrix4d transform = transform_init;
+    workspace.reserve(surfaces.fixed.cols(), surfaces.moving.cols());
+    int points = sampled_points(surfaces, options);
+
+    // The robust scale and the MAD rejection threshold lag one iteration behind, so that residuals, weights and the weighted
+    // covariance all come from one pass. Their initial values come from the residuals at transform_init. Each time they
+    // move, the current and best errors are re-measured under the new values, so errors are only compared under one
+    // objective.
+    Eigen::Matrix4d transform_next;
+    double scale = 0;
+    CorrespondenceRejection rejection = options.rejection;
+    bool reestimated = options.robust_kernel != RobustKernel::None || options.rejection.mad_factor > 0;
+    if(reestimated) {
+        icp_step(surfaces, transform, options, scale, rejection, search_epsilon, workspace, transform_next);
+        update_from_residuals(options, workspace, scale, rejection);
+    }
+
+    double error = icp_step(surfaces, transform, options, scale, rejection, search_epsilon, workspace, transform_next);
+
+    result.transform = transform;
+    result.error = error;
+    if(reestimated) {
+        workspace.best_residuals = workspace.residuals;
+    }
+    result.stop_reason = StopReason::MaxIterations;
+    result.sample_size = points;
+
+    // ICP is the fixed-point iteration T <- transform_next(T); with Anderson acceleration it is extrapolated in se(3).
+    AndersonAcceleration anderson(options.anderson_history > 0 ? options.anderson_history : 1, 6);
+    Vector6d accelerated;
+
+    while(result.iterations < policy.max_iterations) {
+        TimePoint iteration_start;
+        if(deadline) {
+            if(out_of_time(*deadline, points, 1)) {
+                result.stop_reason = StopReason::TimeLimitReached;
+                break;
+            }
+            iteration_start = std::chrono::steady_clock::now();
+        }
+
+        // Stage times are only measured for an observer.
+        StageTimes times;
+        StageClock clock(options.observer ? &times : 0);
+
+        Eigen::Matrix4d candidate = transform_next;
+        if(options.anderson_history > 0) {
+            anderson.compute(se3_log(transform), se3_log(transform_next), accelerated);
+            candidate = se3_exp(accelerated);
+        }
+
+        Eigen::Matrix4d candidate_next;
+        double error_new = icp_step(surfaces, candidate, options, scale, rejection, search_epsilon, workspace, candidate_next, &clock);
+
+        // Safeguard: an extrapolated pose that increases the energy is replaced by the plain ICP update, at the cost of a
+        // second correspondence search in that iteration.
+        if(options.anderson_history > 0 && !(error_new < error) && !candidate.isApprox(transform_next)) {
+            anderson.reset();
+            candidate = transform_next;
+            error_new = icp_step(surfaces, candidate, options, scale, rejection, search_epsilon, workspace, candidate_next, &clock);
+        }
+
+        result.iterations++;
+        if(error_new < result.error) {
+            result.transform = candidate;
+            result.error = error_new;
+            if(reestimated) {
+                workspace.best_residuals = workspace.residuals;
+            }
+        }
+
+        auto transform_old = transform;
+        transform = candidate;
+        transform_next = candidate_next;
+        update_from_residuals(options, workspace, scale, rejection);
+
+        if(deadline) {
+            deadline->seconds_per_point = std::chrono::duration<double>(std::chrono::steady_clock::now() - iteration_start).count() / points;
+        }
+
+        if(options.observer) {
+            IterationStats stats;
+            stats.iteration = result.iterations;
+            stats.error = error_new;
+            stats.best_error = result.error;
+            transform_increment(transform_old, transform, stats.rotation_increment, stats.translation_increment);
+            stats.correspondences = (workspace.lookup >= 0).count();
+            stats.points = points;
+            stats.times = times;
+            options.observer->iteration(stats);
+        }
+
+        if(policy.stop_on_error_increase && !(error_new < error)) {
+            result.stop_reason = StopReason::ErrorIncreased;
+            break;
+        }
+        if(policy.absolute_error_tolerance > 0 && error_new <= policy.absolute_error_tolerance) {
+            result.stop_reason = StopReason::ErrorThresholdReached;
+            break;
+        }
+        if(increment_converged(transform_old, transform, policy)) {
+            result.stop_reason = StopReason::IncrementConverged;
+            break;
+        }
+        if(policy.relative_error_tolerance > 0 && std::abs(error - error_new) <= policy.relative_error_tolerance * error) {
+            result.stop_reason = StopReason::RelativeErrorConverged;
+            break;
+        }
 
-     do {
-        transform_old = transform;
         error = error_new;
+        if(reestimated) {
+            error = rescored_error(options, workspace.residuals, scale, rejection);
+            result.error = rescored_error(options, workspace.best_residuals, scale, rejection);
+        }
+    }
 
-        // Need to match up closest_points information (i.e. reordering) with untransformed surface2.
-        transform = estimate_rigid_transform(closest_points, surface1);
-        transformed_pointcloud = apply_transform(closest_points, transform);
-        lookup_closest = find_closest_points(surface1, transformed_pointcloud);
-        closest_points = reorder_points(closest_points, lookup_closest);
+    result.converged = result.stop_reason != StopReason::MaxIterations && result.stop_reason != StopReason::TimeLimitReached;
+}
 
-        error_new = fiducial_registration_error(closest_points, surface1, transform);
+static const SurfaceCache* gather_sample(const SurfacePair& surfaces, const std::vector<int>& indices, const RegistrationOptions& options,
+                                         RegistrationWorkspace& workspace) {
+    // Copy the points of the sampled cloud at indices (and their cached geometry) into the workspace, and return the
+    // sample's cache, or null if the cloud has none. Point-to-point samples the fixed cloud, the other modes the moving one.
+    bool sample_fixed = options.mode == RegistrationMode::PointToPoint;
+    const SurfaceCache* source_cache = sample_fixed ? surfaces.fixed_cache : surfaces.moving_cache;
+    if(source_cache) {
+        gather_surface_cache(*source_cache, indices, workspace.sample);
+        return &workspace.sample;
+    }
+
+    const Eigen::MatrixXd& source = sample_fixed ? surfaces.fixed : surfaces.moving;
+    workspace.sample.points.resize(3, indices.size());
+    for(unsigned int k = 0; k < indices.size(); k++) {
+        workspace.sample.points.col(k) = source.col(indices[k]);
+    }
+    return 0;
+}
 
-        iterations_left--;
-    } while(error_new < error && iterations_left > 1);
+static void iterate_on_sample(const SurfacePair& surfaces, const std::vector<int>& indices, const Eigen::Matrix4d& transform_init,
+                              const RegistrationOptions& options, double search_epsilon, Deadline* deadline, RegistrationWorkspace& workspace,
+                              RegistrationResult& result) {
+    // As iterate_registration, with the sampled cloud replaced by its points at indices (and their cached geometry).
+    const SurfaceCache* sample_cache = gather_sample(surfaces, indices, options, workspace);
+    if(options.mode == RegistrationMode::PointToPoint) {
+        SurfacePair sample = { workspace.sample.points, surfaces.moving, sample_cache, surfaces.moving_cache };
+        iterate_registration(sample, transform_init, options, search_epsilon, deadline, workspace, result);
+    } else {
+        SurfacePair sample = { surfaces.fixed, workspace.sample.points, surfaces.fixed_cache, sample_cache };
+        iterate_registration(sample, transform_init, options, search_epsilon, deadline, workspace, result);
+    }
+}
 
-    return transform_old;
+static RegistrationResult run_anytime_registration(const SurfacePair& surfaces, const Eigen::Matrix4d& transform_init, const RegistrationOptions& options,
+                                                   Deadline& deadline, RegistrationWorkspace& workspace) {
+    // Coarse to fine over nested random samples of the sampled cloud. Each sample starts from the best transform of the
+    // one before, with a search tolerance that halves as the sample quadruples, and is iterated to convergence; then the
+    // largest sample with time for a few iterations is taken next, until all points have been used with an exact search.
+    const auto& policy = options.convergence;
+    int n = sampled_points(surfaces, options);
+    std::vector<int> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::mt19937 generator(1);
+    std::shuffle(order.begin(), order.end(), generator);
+
+    RegistrationResult result;
+    result.transform = transform_init;
+    result.iterations = 0;
+
+    int first_sample_size = std::max(1, std::min(n, policy.initial_sample_size));
+    int sample_size = first_sample_size;
+    while(true) {
+        if(sample_size < n) {
+            double search_epsilon = policy.initial_search_epsilon * sqrt(double(first_sample_size) / sample_size);
+            std::vector<int> indices(order.begin(), order.begin() + sample_size);
+            iterate_on_sample(surfaces, indices, result.transform, options, search_epsilon, &deadline, workspace, result);
+        } else {
+            iterate_registration(surfaces, result.transform, options, 0, &deadline, workspace, result);
+        }
+
+        if(sample_size == n || !result.converged) {
+            break;
+        }
+
+        int next_size = std::min(n, 4 * sample_size);
+        if(out_of_time(deadline, next_size, iterations_per_sample)) {
+            result.stop_reason = StopReason::TimeLimitReached;
+            break;
+        }
+        while(next_size < n && !out_of_time(deadline, std::min(n, 4 * next_size), iterations_per_sample)) {
+            next_size = std::min(n, 4 * next_size);
+        }
+        sample_size = next_size;
+    }
+
+    // Only convergence on every point counts; a smaller sample was merely the best that time allowed.
+    result.converged = result.converged && sample_size == n;
+    return result;
+}
+
+static double icp_step_on_sample(const SurfacePair& surfaces, const std::vector<int>& indices, const Eigen::Matrix4d& transform,
+                                 const RegistrationOptions& options, double scale, const CorrespondenceRejection& rejection,
+                                 RegistrationWorkspace& workspace, Eigen::Matrix4d& transform_next, StageClock* clock) {
+    // As icp_step, with the sampled cloud replaced by its points at indices (and their cached geometry).
+    const SurfaceCache* sample_cache = gather_sample(surfaces, indices, options, workspace);
+    if(options.mode == RegistrationMode::PointToPoint) {
+        SurfacePair sample = { workspace.sample.points, surfaces.moving, sample_cache, surfaces.moving_cache };
+        workspace.reserve(sample.fixed.cols(), sample.moving.cols());
+        return icp_step(sample, transform, options, scale, rejection, 0, workspace, transform_next, clock);
+    }
+    SurfacePair sample = { surfaces.fixed, workspace.sample.points, surfaces.fixed_cache, sample_cache };
+    workspace.reserve(sample.fixed.cols(), sample.moving.cols());
+    return icp_step(sample, transform, options, scale, rejection, 0, workspace, transform_next, clock);
+}
+
+static RegistrationResult run_mini_batch_registration(const SurfacePair& surfaces, const Eigen::Matrix4d& transform_init, const RegistrationOptions& options,
+                                                      RegistrationWorkspace& workspace) {
+    // ICP steps on fresh random batches of the sampled cloud, drawn by a partial shuffle, with the batch growing whenever
+    // its error flattens; then ordinary ICP on the final sample, or on every point, from where the batches left off.
+    const auto& policy = options.convergence;
+    const auto& schedule = options.mini_batch;
+    int n = sampled_points(surfaces, options);
+    int final_size = schedule.final_batch_size > 0 ? std::min(n, schedule.final_batch_size) : n;
+    int batch_size = std::max(1, std::min(final_size, schedule.initial_batch_size));
+
+    std::vector<int> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::mt19937 generator(1);
+    std::vector<int> batch;
+    auto draw_batch = [&]() {
+        for(int k = 0; k < batch_size; k++) {
+            std::uniform_int_distribution<int> pick(k, n - 1);
+            std::swap(order[k], order[pick(generator)]);
+        }
+        batch.assign(order.begin(), order.begin() + batch_size);
+    };
+
+    RegistrationResult result;
+    result.iterations = 0;
+    Eigen::Matrix4d transform = transform_init;
+    Eigen::Matrix4d transform_next;
+    double scale = 0;
+    CorrespondenceRejection rejection = options.rejection;
+    draw_batch();
+    if(options.robust_kernel != RobustKernel::None || options.rejection.mad_factor > 0) {
+        icp_step_on_sample(surfaces, batch, transform, options, scale, rejection, workspace, transform_next, 0);
+        update_from_residuals(options, workspace, scale, rejection);
+    }
+    double error = icp_step_on_sample(surfaces, batch, transform, options, scale, rejection, workspace, transform_next, 0);
+
+    while(batch_size < final_size && result.iterations < policy.max_iterations) {
+        StageTimes times;
+        StageClock clock(options.observer ? &times : 0);
+
+        draw_batch();
+        Eigen::Matrix4d candidate_next;
+        double error_new = icp_step_on_sample(surfaces, batch, transform_next, options, scale, rejection, workspace, candidate_next, &clock);
+        result.iterations++;
+
+        auto transform_old = transform;
+        transform = transform_next;
+        transform_next = candidate_next;
+        update_from_residuals(options, workspace, scale, rejection);
+
+        if(options.observer) {
+            IterationStats stats;
+            stats.iteration = result.iterations;
+            stats.error = error_new;
+            stats.best_error = error_new;
+            transform_increment(transform_old, transform, stats.rotation_increment, stats.translation_increment);
+            stats.correspondences = (workspace.lookup >= 0).count();
+            stats.points = batch_size;
+            stats.times = times;
+            options.observer->iteration(stats);
+        }
+
+        if(error - error_new < schedule.flat_fraction * error) {
+            batch_size = std::min(final_size, static_cast<int>(std::ceil(batch_size * schedule.growth)));
+        }
+        error = error_new;
+        if(options.robust_kernel != RobustKernel::None || options.rejection.mad_factor > 0) {
+            error = rescored_error(options, workspace.residuals, scale, rejection);
+        }
+    }
+
+    if(final_size < n) {
+        draw_batch();
+        iterate_on_sample(surfaces, batch, transform_next, options, 0, 0, workspace, result);
+    } else {
+        iterate_registration(surfaces, transform_next, options, 0, 0, workspace, result);
+    }
+    return result;
+}
+
+// Fewest points a batch can hold: point-to-point fits need four, and the plane-based modes six for a full-rank solve.
+static int minimum_batch_size(RegistrationMode mode) {
+    return mode == RegistrationMode::PointToPoint || mode == RegistrationMode::Similarity ? 4 : 6;
+}
+
+static RegistrationResult run_registration(const SurfacePair& surfaces, const Eigen::Matrix4d& transform_init, const RegistrationOptions& options,
+                                           RegistrationWorkspace& workspace) {
+    const auto& policy = options.convergence;
+    if(policy.time_limit > 0 && options.mini_batch.initial_batch_size > 0) {
+        std::cerr << "Mini-batch registration cannot be combined with a time limit." << std::endl;
+        throw(PointMatchingEx);
+    }
+    if(options.mode == RegistrationMode::Similarity && options.anderson_history > 0) {
+        std::cerr << "Anderson acceleration extrapolates rigid transforms, so cannot be used in similarity mode." << std::endl;
+        throw(PointMatchingEx);
+    }
+    if(options.mini_batch.initial_batch_size > 0 && !(options.mini_batch.growth > 1)) {
+        std::cerr << "Mini-batches must grow by a factor greater than one." << std::endl;
+        throw(PointMatchingEx);
+    }
+    const auto& schedule = options.mini_batch;
+    int minimum = minimum_batch_size(options.mode);
+    if(schedule.initial_batch_size > 0 && (schedule.initial_batch_size < minimum || (schedule.final_batch_size > 0 && schedule.final_batch_size < minimum))) {
+        std::cerr << "Mini-batches must hold at least " << minimum << " points in this mode." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    Deadline deadline;
+    if(policy.time_limit > 0) {
+        deadline.time = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(policy.time_limit));
+        deadline.seconds_per_point = 0;
+    }
+
+    Eigen::Matrix4d transform = transform_init;
+    if(options.initial_alignment == InitialAlignment::Moments) {
+        transform = moment_alignment(surfaces.fixed, surfaces.moving);
+    }
+
+    if(policy.time_limit > 0) {
+        return run_anytime_registration(surfaces, transform, options, deadline, workspace);
+    }
+    if(options.mini_batch.initial_batch_size > 0) {
+        return run_mini_batch_registration(surfaces, transform, options, workspace);
+    }
+
+    RegistrationResult result;
+    result.iterations = 0;
+    iterate_registration(surfaces, transform, options, 0, 0, workspace, result);
+    return result;
+}
+
+Eigen::Matrix4d register_surfaces(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init) {
+    return register_surfaces(surface1, surface2, transform_init, RegistrationOptions()).transform;
 }
 
 Eigen::Matrix4d register_surfaces(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2) {
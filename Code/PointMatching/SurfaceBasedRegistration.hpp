@@ -1,12 +1,187 @@
 #ifndef SURFACEBASEDREGISTRATION_INCLUDED
 #define SURFACEBASEDREGISTRATION_INCLUDED
 
+#include <string>
+#include <vector>
+
 #include <Eigen/Dense>
 
+#include <Cancellation.hpp>
+#include <CorrespondenceRejection.hpp>
+#include <RegistrationObserver.hpp>
+#include <RobustEstimation.hpp>
+#include <SurfaceCache.hpp>
+
+// PointToPoint is the original exhaustive closest-point ICP. Generalized is plane-to-plane Generalized-ICP, and Symmetric is
+// symmetric ICP using the normals of both surfaces, and Similarity is point-to-point ICP that also estimates a uniform
+// scale, for clouds whose units differ (it cannot be combined with Anderson acceleration); these three match through a
+// k-d tree.
+enum class RegistrationMode { PointToPoint, Generalized, Symmetric, Similarity };
+
+RegistrationMode registration_mode_from_string(const std::string& name);
+
+// Moments starts from moment_alignment of the two clouds, in place of transform_init.
+enum class InitialAlignment { None, Moments };
+
+InitialAlignment initial_alignment_from_string(const std::string& name);
+
+// EngineConverged reports a registration by another engine (NDT, CPD or a signed distance field) in ICP's terms: it met
+// that engine's own criterion, rather than any of the policy's below.
+enum class StopReason { ErrorIncreased, MaxIterations, IncrementConverged, RelativeErrorConverged, ErrorThresholdReached, TimeLimitReached, EngineConverged };
+
+std::string stop_reason_to_string(StopReason reason);
+
+struct ConvergencePolicy {
+    int max_iterations = 100;
+
+    // Each tolerance below is disabled when zero.
+
+    // Stop once one iteration changes the transform by less than both of these (radians, and distance units), or by less
+    // than the one that is set.
+    double rotation_tolerance = 0;
+    double translation_tolerance = 0;
+
+    // Stop once the error changes by less than this fraction of itself between iterations.
+    double relative_error_tolerance = 0;
+
+    // Stop once the error falls below this.
+    double absolute_error_tolerance = 0;
+
+    // Stop as soon as an iteration fails to decrease the error. When false, the iteration carries on through noisy
+    // increases until another criterion is met.
+    bool stop_on_error_increase = true;
+
+    // Seconds after which the best transform found so far is returned (zero for no limit). With a limit, ICP runs coarse
+    // to fine over random samples of one cloud (the fixed cloud for point-to-point ICP, the moving cloud otherwise): it
+    // starts on initial_sample_size points, with a k-d tree search allowed to return neighbours up to (1 +
+    // initial_search_epsilon) times too far, and whenever a sample converges moves on to the largest sample that the
+    // remaining time allows, with a correspondingly tighter search, finishing on every point with an exact search. The
+    // limit does not cover building the clouds' caches, which can be prepared beforehand.
+    double time_limit = 0;
+    int initial_sample_size = 500;
+    double initial_search_epsilon = 1;
+};
+
+// Stochastic mini-batch ICP: each iteration matches a fresh random batch of the sampled cloud (the fixed cloud for
+// point-to-point ICP, the moving cloud otherwise) instead of every point. Whenever an iteration reduces the batch's error
+// by less than flat_fraction of it, the batch grows by growth, and once it reaches final_batch_size (zero for every
+// point) ICP carries on over that one sample, or over every point, until the convergence policy stops it. Only this last
+// stage is tested against the policy's tolerances, as batch errors are too noisy to compare; max_iterations counts every
+// iteration. Cannot be combined with a time limit or multi-start registration.
+struct MiniBatchSchedule {
+    // Points in the first batch; zero disables mini-batches. At least four for point-to-point and similarity ICP, and six
+    // otherwise.
+    int initial_batch_size = 0;
+
+    // Factor by which a batch grows once its error flattens; must exceed one.
+    double growth = 2;
+
+    // An iteration that reduces the batch's error by less than this fraction of it counts as flat.
+    double flat_fraction = 0.05;
+
+    // Size of the last sample, on which ICP runs to convergence (zero for every point); no smaller than the least
+    // initial_batch_size allowed.
+    int final_batch_size = 0;
+};
+
+struct RegistrationResult {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    // The transform with the lowest error seen, and that error.
+    Eigen::Matrix4d transform;
+    double error;
+
+    int iterations;
+    StopReason stop_reason;
+
+    // True when a stopping criterion was met on every point, rather than the iteration or time limit ending the search.
+    bool converged;
+
+    // Points of the sampled cloud used by the last iterations, which error is measured over; all of them unless a time
+    // limit stopped the registration early.
+    int sample_size;
+};
+
+struct RegistrationOptions {
+    RegistrationMode mode = RegistrationMode::PointToPoint;
+
+    InitialAlignment initial_alignment = InitialAlignment::None;
+
+    // Neighbourhood sizes for the per-point covariances used by Generalized-ICP, and the normals used by symmetric ICP.
+    int covariance_neighbours = 20;
+    int normal_neighbours = 10;
+
+    // Kernel used to down-weight outlying correspondences. RobustKernel::None gives ordinary least squares.
+    RobustKernel robust_kernel = RobustKernel::None;
+
+    // Correspondences dropped before each solve. Normal and boundary rejection use normal_neighbours.
+    CorrespondenceRejection rejection;
+
+    // Number of previous iterates used for Anderson acceleration in se(3); zero disables it.
+    int anderson_history = 0;
+
+    ConvergencePolicy convergence;
+
+    MiniBatchSchedule mini_batch;
+
+    // When set, registration polls this token (as do the correspondence search and the per-point geometry estimates) and
+    // throws RegistrationCancelledEx soon after it is cancelled.
+    const CancellationToken* cancellation = 0;
+
+    // When set, called at the end of every iteration. Nothing is timed or counted for it otherwise.
+    RegistrationObserver* observer = 0;
+};
+
+struct RegistrationWorkspace {
+    // Buffers for one registration problem, sized on first use and then reused across iterations and calls, so that
+    // steady-state ICP iterations make no heap allocations.
+    Eigen::MatrixXd transformed;
+    Eigen::MatrixXd closest_points;
+    Eigen::ArrayXi lookup;
+    std::vector<char> used;
+    Eigen::VectorXd residuals;
+    Eigen::VectorXd matched_residuals;
+
+    // Residuals of the best iterate so far, so that its error can be re-measured when the robust scale or the MAD
+    // threshold moves.
+    Eigen::VectorXd best_residuals;
+
+    // The points (and cached geometry) of the current sample, for anytime and mini-batch registration. No tree is built
+    // over them.
+    SurfaceCache sample;
+
+    void reserve(int fixed_points, int moving_points);
+};
+
+// Rotation angle and translation of the change transform * transform_old^-1, and whether they are within the policy's
+// increment tolerances. Any change of scale is divided out of the rotation.
+void transform_increment(const Eigen::Matrix4d& transform_old, const Eigen::Matrix4d& transform, double& angle, double& translation);
+
+bool increment_converged(const Eigen::Matrix4d& transform_old, const Eigen::Matrix4d& transform, const ConvergencePolicy& policy);
+
 Eigen::ArrayXi find_closest_points(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2);
 
+void find_closest_points(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, Eigen::ArrayXi& lookup_table, std::vector<char>& used,
+                         const CancellationToken* cancellation = 0);
+
+double find_nearest_points(const KdTree& tree, const Eigen::MatrixXd& surface, const Eigen::Matrix4d& transform, RobustKernel kernel, double scale,
+                           Eigen::ArrayXi& lookup_table, Eigen::VectorXd& distances, double search_epsilon = 0, const CancellationToken* cancellation = 0);
+
 Eigen::MatrixXd reorder_points(const Eigen::MatrixXd& surface, const Eigen::ArrayXi& lookup_table);
 
+void reorder_points(const Eigen::MatrixXd& surface, const Eigen::ArrayXi& lookup_table, Eigen::MatrixXd& reordered);
+
+RegistrationResult register_surfaces(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init, const RegistrationOptions& options);
+
+RegistrationResult register_surfaces(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init, const RegistrationOptions& options,
+                                     RegistrationWorkspace& workspace);
+
+// Compute whatever per-cloud data the options' mode needs, so that the cache can be reused across registrations.
+void prepare_surface_cache(SurfaceCache& cache, const RegistrationOptions& options);
+
+RegistrationResult register_surfaces(const SurfaceCache& surface1, const SurfaceCache& surface2, const Eigen::Matrix4d& transform_init, const RegistrationOptions& options,
+                                     RegistrationWorkspace& workspace);
+
 Eigen::Matrix4d register_surfaces(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, const Eigen::Matrix4d& transform_init);
 
 Eigen::Matrix4d register_surfaces(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2);
@@ -1,3 +1,4 @@
+#include <initializer_list>
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -5,7 +6,15 @@
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
 
+#include <Cpd.hpp>
+#include <GlobalRegistration.hpp>
+#include <MeshRegistration.hpp>
+#include <MultiStartRegistration.hpp>
+#include <Ndt.hpp>
+#include <SdfRegistration.hpp>
+#include <Super4Pcs.hpp>
 #include <SurfaceBasedRegistration.hpp>
+#include <Tracking.hpp>
 
 #include <Util.hpp>
 
@@ -18,6 +27,21 @@ int main(int argc, char** argv) {
         std::string out;
 
         std::string init_file;
+        std::string robust;
+        std::string mode;
+        std::string global_method;
+        int anderson = 0;
+        GlobalRegistrationOptions global_options;
+        MultiStartOptions multi_start_options;
+        Super4PcsOptions super4pcs_options;
+        ConvergencePolicy convergence;
+        MiniBatchSchedule mini_batch;
+        CorrespondenceRejection rejection;
+        NdtOptions ndt_options;
+        CpdOptions cpd_options;
+        SdfRegistrationOptions sdf_options;
+        double sdf_cell_size = 0;
+        double sdf_band = 0;
 
         namespace opts = boost::program_options;
         opts::options_description desc("Options");
@@ -27,6 +51,38 @@ int main(int argc, char** argv) {
                 ("data2", opts::value<std::string> (&data2)->required(), "Second point cloud filename.")
                 ("out", opts::value<std::string> (&out), "Output filename.")
                 ("init_file", opts::value<std::string> (&init_file), "Filename for transformation initialisation matrix (4x4).")
+                ("moment_init", "Initialise by aligning the centroids and principal axes of the clouds (instead of init_file).")
+                ("global_init", "Initialise with FPFH feature matching and RANSAC, for clouds in arbitrary frames (instead of init_file).")
+                ("global_method", opts::value<std::string> (&global_method)->default_value("ransac"), "Global initialisation method: ransac, or fgr (fast global registration).")
+                ("super4pcs", "Initialise with Super4PCS, for clouds in arbitrary frames that only partly overlap (instead of init_file).")
+                ("overlap", opts::value<double> (&super4pcs_options.overlap)->default_value(0.5), "Rough fraction of the second cloud that overlaps the first, for Super4PCS.")
+                ("voxel_size", opts::value<double> (&global_options.voxel_size)->default_value(0), "Voxel size for global initialisation or Super4PCS (0 picks 1/50 of the first cloud's extent).")
+                ("multi_start", opts::value<int> (&multi_start_options.starts), "Run ICP from 24 or 60 rotations covering SO(3) and keep the best (instead of init_file).")
+                ("mode", opts::value<std::string> (&mode)->default_value("point"), "Registration mode: point (point-to-point), gicp (Generalized-ICP), symmetric (symmetric ICP) or similarity (point-to-point, also estimating scale).")
+                ("mesh", "Read data1 as a VTK POLYDATA mesh, and register to its triangles rather than its vertices.")
+                ("sdf", "With mesh, register to a narrow-band signed distance field of the mesh instead of its triangles.")
+                ("sdf_cell_size", opts::value<double> (&sdf_cell_size)->default_value(0), "Cell size of the signed distance field (0 picks 1/100 of the mesh's extent).")
+                ("sdf_band", opts::value<double> (&sdf_band)->default_value(0), "Half-width of the signed distance field's band, which should exceed the initial misalignment (0 picks 1/10 of the mesh's extent).")
+                ("track", "Read data2 as a list of point cloud filenames, one per line, and register each in turn to data1 as frames of a sequence, each starting from the motion of the previous two (and the first from init_file).")
+                ("ndt", "Register with the normal distributions transform instead of ICP.")
+                ("ndt_voxel_size", opts::value<double> (&ndt_options.voxel_size)->default_value(0), "Voxel size for the normal distributions transform (0 picks 1/20 of the first cloud's extent).")
+                ("cpd", "Register with rigid coherent point drift instead of ICP.")
+                ("cpd_outlier_weight", opts::value<double> (&cpd_options.outlier_weight)->default_value(0.1), "Weight of the outlier component for coherent point drift, between 0 and 1.")
+                ("robust", opts::value<std::string> (&robust)->default_value("none"), "Robust kernel for outlier down-weighting: none, huber, tukey or cauchy.")
+                ("max_distance", opts::value<double> (&rejection.max_distance)->default_value(0), "Reject correspondences farther apart than this (0 disables).")
+                ("mad_factor", opts::value<double> (&rejection.mad_factor)->default_value(0), "Reject correspondences farther apart than the median distance plus this many MAD-estimated standard deviations (0 disables).")
+                ("max_normal_angle", opts::value<double> (&rejection.max_normal_angle)->default_value(0), "Reject correspondences whose normals differ by more than this (radians, 0 disables).")
+                ("reject_boundary", "Reject correspondences involving boundary points of either cloud, for clouds that only partly overlap.")
+                ("anderson", opts::value<int> (&anderson)->default_value(0), "History length for Anderson acceleration of ICP (0 disables).")
+                ("max_iterations", opts::value<int> (&convergence.max_iterations)->default_value(100), "Maximum number of ICP iterations (or NDT, CPD or SDF iterations with ndt, cpd or sdf).")
+                ("rotation_tolerance", opts::value<double> (&convergence.rotation_tolerance)->default_value(0), "Stop when an iteration rotates by less than this (radians) and translates by less than translation_tolerance (if set).")
+                ("translation_tolerance", opts::value<double> (&convergence.translation_tolerance)->default_value(0), "Stop when an iteration translates by less than this and rotates by less than rotation_tolerance (if set).")
+                ("relative_error_tolerance", opts::value<double> (&convergence.relative_error_tolerance)->default_value(0), "Stop when the relative change in error falls below this.")
+                ("error_tolerance", opts::value<double> (&convergence.absolute_error_tolerance)->default_value(0), "Stop when the error falls below this.")
+                ("continue_on_error_increase", "Keep iterating when the error increases, rather than stopping.")
+                ("trace", "Print the error, transform increment, correspondences and stage times of every ICP iteration.")
+                ("mini_batch", opts::value<int> (&mini_batch.initial_batch_size)->default_value(0), "Start ICP on random batches of this many points, growing as the error flattens, and finish on every point (0 disables).")
+                ("time_limit", opts::value<double> (&convergence.time_limit)->default_value(0), "Return the best transform found within this many seconds, registering coarse to fine on samples of the clouds (0 for no limit).")
         ;
 
         opts::positional_options_description positionalOptions;
@@ -72,19 +128,211 @@ int main(int argc, char** argv) {
             std::cout << "Transform initialised as " << std::endl << init_matrix << std::endl;
         }
       
+        if(vm.count("init_file") + vm.count("moment_init") + vm.count("global_init") + vm.count("super4pcs") + vm.count("multi_start") > 1) {
+            std::cerr << "ERROR: only one of init_file, moment_init, global_init, super4pcs and multi_start can be used." << std::endl << std::endl;
+            return 1;
+        }
+        if(vm.count("ndt") + vm.count("cpd") + vm.count("mesh") > 1) {
+            std::cerr << "ERROR: only one of ndt, cpd and mesh can be used." << std::endl << std::endl;
+            return 1;
+        }
+        if(vm.count("sdf") && !vm.count("mesh")) {
+            std::cerr << "ERROR: sdf needs mesh." << std::endl << std::endl;
+            return 1;
+        }
+        if((vm.count("ndt") || vm.count("cpd") || vm.count("mesh")) && (vm.count("moment_init") || vm.count("multi_start"))) {
+            std::cerr << "ERROR: ndt, cpd and mesh cannot be combined with moment_init or multi_start." << std::endl << std::endl;
+            return 1;
+        }
+        // The other engines take few of ICP's options, and refuse the rest rather than ignore them.
+        auto refuses = [&](const char* engine, std::initializer_list<const char*> ignored) {
+            for(const char* option : ignored) {
+                if(vm.count(option) && !vm[option].defaulted()) {
+                    std::cerr << "ERROR: " << engine << " cannot be combined with " << option << "." << std::endl << std::endl;
+                    return true;
+                }
+            }
+            return false;
+        };
+        // As do NDT and CPD below, registration to a signed distance field shares only max_iterations.
+        if(vm.count("sdf") && refuses("sdf", { "mode", "robust", "anderson", "max_distance", "mad_factor", "max_normal_angle", "reject_boundary", "rotation_tolerance",
+                                               "translation_tolerance", "relative_error_tolerance", "error_tolerance", "continue_on_error_increase", "trace",
+                                               "mini_batch", "time_limit" })) {
+            return 1;
+        }
+        // Registration to a mesh shares only max_distance and the other convergence criteria with ICP.
+        if(vm.count("mesh") && refuses("mesh", { "mode", "robust", "anderson", "mad_factor", "max_normal_angle", "reject_boundary", "trace", "mini_batch", "time_limit" })) {
+            return 1;
+        }
+        // NDT and CPD share only max_iterations.
+        if(vm.count("cpd") && refuses("cpd", { "mode", "robust", "anderson", "max_distance", "mad_factor", "max_normal_angle", "reject_boundary", "rotation_tolerance",
+                                               "translation_tolerance", "relative_error_tolerance", "error_tolerance", "continue_on_error_increase", "trace",
+                                               "mini_batch", "time_limit" })) {
+            return 1;
+        }
+        if(vm.count("ndt") && refuses("ndt", { "mode", "robust", "anderson", "max_distance", "mad_factor", "max_normal_angle", "reject_boundary", "rotation_tolerance",
+                                               "translation_tolerance", "relative_error_tolerance", "error_tolerance", "continue_on_error_increase", "trace",
+                                               "mini_batch", "time_limit" })) {
+            return 1;
+        }
+        if(!vm["max_iterations"].defaulted()) {
+            ndt_options.max_iterations = convergence.max_iterations;
+            cpd_options.max_iterations = convergence.max_iterations;
+            sdf_options.max_iterations = convergence.max_iterations;
+        }
+        if(vm.count("multi_start") && (anderson > 0 || convergence.time_limit > 0 || mini_batch.initial_batch_size > 0)) {
+            std::cerr << "ERROR: multi_start cannot be combined with anderson, time_limit or mini_batch." << std::endl << std::endl;
+            return 1;
+        }
+        if(vm.count("track") && vm.count("ndt") + vm.count("cpd") + vm.count("mesh") + vm.count("moment_init") + vm.count("global_init")
+                                + vm.count("super4pcs") + vm.count("multi_start") > 0) {
+            std::cerr << "ERROR: track can only be combined with init_file." << std::endl << std::endl;
+            return 1;
+        }
+
         Eigen::MatrixXd pointcloud1;
         Eigen::MatrixXd pointcloud2;
 
-        auto cloud1 = load_pointcloud_from_file(data1);
-        auto cloud2 = load_pointcloud_from_file(data2);
+        // A mesh's vertices stand in for the first cloud wherever a point cloud is needed.
+        TriangleMesh mesh;
+        if(vm.count("mesh")) {
+            mesh = load_mesh_from_vtk_file(data1);
+        }
+        auto cloud1 = vm.count("mesh") ? mesh.vertices : load_pointcloud_from_file(data1);
+        auto cloud2 = vm.count("track") ? Eigen::MatrixXd() : load_pointcloud_from_file(data2);
+
+
+        RegistrationOptions options;
+        options.mode = registration_mode_from_string(mode);
+        options.robust_kernel = robust_kernel_from_string(robust);
+        options.anderson_history = anderson;
+        options.rejection = rejection;
+        options.rejection.reject_boundary = vm.count("reject_boundary") > 0;
+        if(vm.count("moment_init")) {
+            options.initial_alignment = InitialAlignment::Moments;
+        }
+        options.convergence = convergence;
+        options.convergence.stop_on_error_increase = vm.count("continue_on_error_increase") == 0;
+        options.mini_batch = mini_batch;
+
+        auto trace = make_observer([](const IterationStats& stats) {
+            std::cout << "Iteration " << stats.iteration << ": error " << stats.error << ", rotated " << stats.rotation_increment << " and translated "
+                      << stats.translation_increment << ", " << stats.correspondences << " of " << stats.points << " points matched, "
+                      << stats.times.search << "s search, " << stats.times.rejection << "s rejection, " << stats.times.solve << "s solve" << std::endl;
+        });
+        if(vm.count("trace")) {
+            options.observer = &trace;
+        }
+
+        if(vm.count("track")) {
+            std::ifstream frame_list(data2);
+            if(!frame_list) {
+                std::cerr << "ERROR: could not open the frame list " << data2 << "." << std::endl << std::endl;
+                return 1;
+            }
+            TrackingOptions tracking_options;
+            tracking_options.registration = options;
+            RegistrationTracker tracker(cloud1, vm.count("init_file") ? Eigen::Matrix4d(init_matrix.inverse()) : Eigen::Matrix4d::Identity(), tracking_options);
+            Eigen::Matrix4d transform = tracker.predicted_transform();
+            std::string frame_file;
+            while(std::getline(frame_list, frame_file)) {
+                if(frame_file.empty()) {
+                    continue;
+                }
+                auto frame_result = tracker.track(load_pointcloud_from_file(frame_file));
+                transform = frame_result.transform;
+                std::cout << "Frame " << tracker.frames() << " (" << frame_file << ") stopped after " << frame_result.iterations << " iterations ("
+                          << stop_reason_to_string(frame_result.stop_reason) << "), with error " << frame_result.error << std::endl;
+                std::cout << "Estimated transform was " << std::endl << transform.inverse() << std::endl;
+            }
+
+            // As for a single registration, out receives the transform of the last frame.
+            if(vm.count("out")) {
+                write_matrix_to_file(transform.inverse(), out);
+            }
+            return 0;
+        }
 
+        // Refine an initial transform with ICP, to the mesh's triangles if there is one, or with NDT or CPD when asked to
+        // (reported in ICP's terms).
+        auto refine = [&](const Eigen::Matrix4d& transform_init) {
+            if(vm.count("sdf")) {
+                // One hierarchy fills the field and measures the final error.
+                double extent = (mesh.vertices.rowwise().maxCoeff() - mesh.vertices.rowwise().minCoeff()).norm();
+                TriangleBvh bvh(mesh);
+                SignedDistanceField field(mesh, bvh, sdf_cell_size > 0 ? sdf_cell_size : extent / 100, sdf_band > 0 ? sdf_band : extent / 10);
+                auto sdf_result = sdf_register_surfaces(field, cloud2, transform_init, sdf_options);
+                std::cout << "SDF matched " << sdf_result.matched_points << " points within the band, with RMS distance " << sdf_result.error << std::endl;
+                RegistrationResult result;
+                result.transform = sdf_result.transform;
+                result.iterations = sdf_result.iterations;
+                result.converged = sdf_result.converged;
+                result.stop_reason = sdf_result.converged ? StopReason::EngineConverged : StopReason::MaxIterations;
+                result.sample_size = cloud2.cols();
+                Eigen::MatrixXd closest_points;
+                Eigen::ArrayXi triangles;
+                Eigen::VectorXd distances;
+                result.error = project_onto_mesh(bvh, cloud2, result.transform, closest_points, triangles, distances);
+                return result;
+            }
+            if(vm.count("mesh")) {
+                MeshRegistrationOptions mesh_options;
+                mesh_options.max_distance = rejection.max_distance;
+                mesh_options.convergence = options.convergence;
+                return register_surface_to_mesh(mesh, cloud2, transform_init, mesh_options);
+            }
+            if(!vm.count("ndt") && !vm.count("cpd")) {
+                return register_surfaces(cloud1, cloud2, transform_init, options);
+            }
+            RegistrationResult result;
+            if(vm.count("ndt")) {
+                auto ndt_result = ndt_register_surfaces(cloud1, cloud2, transform_init, ndt_options);
+                std::cout << "NDT matched " << ndt_result.matched_points << " points to " << ndt_result.voxels << " voxels, with score " << ndt_result.score << std::endl;
+                result.transform = ndt_result.transform;
+                result.iterations = ndt_result.iterations;
+                result.converged = ndt_result.converged;
+            } else {
+                auto cpd_result = cpd_register_surfaces(cloud1, cloud2, transform_init, cpd_options);
+                std::cout << "CPD finished with mixture standard deviation " << sqrt(cpd_result.sigma2) << std::endl;
+                result.transform = cpd_result.transform;
+                result.iterations = cpd_result.iterations;
+                result.converged = cpd_result.converged;
+            }
+            KdTree tree(cloud1);
+            Eigen::ArrayXi correspondences;
+            Eigen::VectorXd distances;
+            result.error = find_nearest_points(tree, cloud2, result.transform, RobustKernel::None, 1, correspondences, distances);
+            result.stop_reason = result.converged ? StopReason::EngineConverged : StopReason::MaxIterations;
+            return result;
+        };
 
-        Eigen::Matrix4d transform;
+        RegistrationResult result;
         if(vm.count("init_file")) {
-            transform = register_surfaces(cloud1, cloud2, init_matrix.inverse());
+            result = refine(init_matrix.inverse());
+        } else if(vm.count("global_init")) {
+            global_options.method = global_registration_method_from_string(global_method);
+            auto global_result = global_register_surfaces(cloud1, cloud2, global_options);
+            std::cout << "Global initialisation found " << global_result.inliers << " inliers among " << global_result.correspondences
+                      << " feature matches, after " << global_result.hypotheses << " hypotheses" << std::endl;
+            result = refine(global_result.transform);
+        } else if(vm.count("super4pcs")) {
+            super4pcs_options.voxel_size = global_options.voxel_size;
+            auto super4pcs_result = super4pcs_register_surfaces(cloud1, cloud2, super4pcs_options);
+            std::cout << "Super4PCS aligned " << super4pcs_result.overlap << " of the sample, after " << super4pcs_result.bases << " bases and "
+                      << super4pcs_result.candidates << " candidate poses" << std::endl;
+            result = refine(super4pcs_result.transform);
+        } else if(vm.count("multi_start")) {
+            auto multi_start_result = multi_start_register_surfaces(cloud1, cloud2, options, multi_start_options);
+            std::cout << "Best of " << multi_start_options.starts << " starts was start " << multi_start_result.best_start << ", with "
+                      << multi_start_result.abandoned << " abandoned early" << std::endl;
+            result = multi_start_result.best;
         } else {
-            transform = register_surfaces(cloud1, cloud2);
+            result = refine(Eigen::Matrix4d::Identity());
         }
+        Eigen::Matrix4d transform = result.transform;
+
+        std::cout << "Stopped after " << result.iterations << " iterations (" << stop_reason_to_string(result.stop_reason)
+                  << "), with error " << result.error << (result.converged ? "" : ", before converging") << std::endl;
 
         if(vm.count("out")) {
             write_matrix_to_file(transform.inverse(), out);
@@ -0,0 +1,147 @@
+/* Per-cloud data that is expensive to compute, built once and shared by every registration involving that cloud */
+#include <SurfaceCache.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include <Eigen/Dense>
+#include <Eigen/Eigenvalues>
+
+#include <Exceptions.hpp>
+#include <GeneralizedIcp.hpp>
+
+SurfaceCache::SurfaceCache() : covariance_neighbours(0), normal_neighbours(0), boundary_neighbours(0) {
+}
+
+SurfaceCache::SurfaceCache(const Eigen::MatrixXd& points) : points(points), tree(points), covariance_neighbours(0), normal_neighbours(0), boundary_neighbours(0) {
+}
+
+Eigen::MatrixXd compute_point_normals(const Eigen::MatrixXd& surface, const KdTree& tree, int neighbours, const CancellationToken* cancellation) {
+    // The normal at each point is the direction of least variance in its neighbourhood.
+    if(neighbours < 3) {
+        std::cerr << "At least three neighbours are needed to estimate a normal." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    Eigen::MatrixXd normals(3, surface.cols());
+    std::vector<int> indices;
+    std::vector<double> squared_distances;
+
+    for(int i = 0; i < surface.cols(); i++) {
+        if(i % cancellation_block == 0) {
+            throw_if_cancelled(cancellation);
+        }
+        tree.nearest_k(surface.col(i), neighbours, indices, squared_distances);
+
+        Eigen::Vector3d mean = Eigen::Vector3d::Zero();
+        for(unsigned int k = 0; k < indices.size(); k++) {
+            mean += surface.col(indices[k]);
+        }
+        mean /= indices.size();
+
+        Eigen::Matrix3d covariance = Eigen::Matrix3d::Zero();
+        for(unsigned int k = 0; k < indices.size(); k++) {
+            Eigen::Vector3d offset = surface.col(indices[k]) - mean;
+            covariance += offset * offset.transpose();
+        }
+
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigen(covariance);
+        normals.col(i) = eigen.eigenvectors().col(0);
+    }
+
+    return normals;
+}
+
+std::vector<char> compute_boundary_points(const Eigen::MatrixXd& surface, const KdTree& tree, const Eigen::MatrixXd& normals, int neighbours,
+                                          double max_gap, const CancellationToken* cancellation) {
+    // The neighbours are projected onto the tangent plane, and the largest gap between consecutive directions to them
+    // (going once around the point) is compared with max_gap.
+    std::vector<char> boundary(surface.cols(), false);
+    std::vector<int> indices;
+    std::vector<double> squared_distances;
+    std::vector<double> angles;
+
+    for(int i = 0; i < surface.cols(); i++) {
+        if(i % cancellation_block == 0) {
+            throw_if_cancelled(cancellation);
+        }
+        Eigen::Vector3d normal = normals.col(i);
+        Eigen::Vector3d u = normal.unitOrthogonal();
+        Eigen::Vector3d v = normal.cross(u);
+
+        tree.nearest_k(surface.col(i), neighbours + 1, indices, squared_distances);
+        angles.clear();
+        for(unsigned int k = 0; k < indices.size(); k++) {
+            Eigen::Vector3d offset = surface.col(indices[k]) - surface.col(i);
+            if(indices[k] != i && offset.squaredNorm() > 0) {
+                angles.push_back(atan2(offset.dot(v), offset.dot(u)));
+            }
+        }
+        if(angles.size() < 2) {
+            boundary[i] = true;
+            continue;
+        }
+
+        std::sort(angles.begin(), angles.end());
+        double largest_gap = angles.front() + 2 * M_PI - angles.back();
+        for(unsigned int k = 1; k < angles.size(); k++) {
+            largest_gap = std::max(largest_gap, angles[k] - angles[k - 1]);
+        }
+        boundary[i] = largest_gap > max_gap;
+    }
+
+    return boundary;
+}
+
+void ensure_covariances(SurfaceCache& cache, int neighbours, const CancellationToken* cancellation) {
+    // Covariances are only recomputed if they are missing or were computed with a different neighbourhood size.
+    if(cache.covariance_neighbours != neighbours) {
+        cache.covariances = compute_point_covariances(cache.points, cache.tree, neighbours, 1E-3, cancellation);
+        cache.covariance_neighbours = neighbours;
+    }
+}
+
+void ensure_normals(SurfaceCache& cache, int neighbours, const CancellationToken* cancellation) {
+    if(cache.normal_neighbours != neighbours) {
+        cache.normals = compute_point_normals(cache.points, cache.tree, neighbours, cancellation);
+        cache.normal_neighbours = neighbours;
+    }
+}
+
+void ensure_boundary(SurfaceCache& cache, int neighbours, const CancellationToken* cancellation) {
+    ensure_normals(cache, neighbours, cancellation);
+    if(cache.boundary_neighbours != neighbours) {
+        cache.boundary = compute_boundary_points(cache.points, cache.tree, cache.normals, neighbours, M_PI / 2, cancellation);
+        cache.boundary_neighbours = neighbours;
+    }
+}
+
+void gather_surface_cache(const SurfaceCache& cache, const std::vector<int>& indices, SurfaceCache& sample) {
+    int n = indices.size();
+    sample.points.resize(3, n);
+    for(int k = 0; k < n; k++) {
+        sample.points.col(k) = cache.points.col(indices[k]);
+    }
+    if(sample.tree.size() > 0) {
+        sample.tree = KdTree();
+    }
+
+    sample.covariances.resize(cache.covariance_neighbours > 0 ? n : 0);
+    for(int k = 0; k < static_cast<int>(sample.covariances.size()); k++) {
+        sample.covariances[k] = cache.covariances[indices[k]];
+    }
+    sample.covariance_neighbours = cache.covariance_neighbours;
+
+    sample.normals.resize(3, cache.normal_neighbours > 0 ? n : 0);
+    for(int k = 0; k < sample.normals.cols(); k++) {
+        sample.normals.col(k) = cache.normals.col(indices[k]);
+    }
+    sample.normal_neighbours = cache.normal_neighbours;
+
+    sample.boundary.resize(cache.boundary_neighbours > 0 ? n : 0);
+    for(int k = 0; k < static_cast<int>(sample.boundary.size()); k++) {
+        sample.boundary[k] = cache.boundary[indices[k]];
+    }
+    sample.boundary_neighbours = cache.boundary_neighbours;
+}
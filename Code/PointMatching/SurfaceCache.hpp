@@ -0,0 +1,52 @@
+/* Per-cloud data that is expensive to compute, built once and shared by every registration involving that cloud */
+#ifndef SURFACECACHE_INCLUDED
+#define SURFACECACHE_INCLUDED
+
+#include <cmath>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include <Cancellation.hpp>
+#include <KdTree.hpp>
+
+struct SurfaceCache {
+    // An empty cache with an empty tree, to be filled by gather_surface_cache.
+    SurfaceCache();
+
+    explicit SurfaceCache(const Eigen::MatrixXd& points);
+
+    Eigen::MatrixXd points;
+    KdTree tree;
+
+    // Regularised per-point covariances for Generalized-ICP, and the neighbourhood size used (zero until computed).
+    std::vector<Eigen::Matrix3d> covariances;
+    int covariance_neighbours;
+
+    // Unit surface normals (3xN), unoriented, and the neighbourhood size used (zero until computed).
+    Eigen::MatrixXd normals;
+    int normal_neighbours;
+
+    // Flags for the points on the boundary of the surface, and the neighbourhood size used (zero until computed).
+    std::vector<char> boundary;
+    int boundary_neighbours;
+};
+
+Eigen::MatrixXd compute_point_normals(const Eigen::MatrixXd& surface, const KdTree& tree, int neighbours, const CancellationToken* cancellation = 0);
+
+// A point is on the boundary when its neighbours, seen along its normal, leave an angular gap wider than max_gap around it.
+std::vector<char> compute_boundary_points(const Eigen::MatrixXd& surface, const KdTree& tree, const Eigen::MatrixXd& normals, int neighbours,
+                                          double max_gap = M_PI / 2, const CancellationToken* cancellation = 0);
+
+void ensure_covariances(SurfaceCache& cache, int neighbours, const CancellationToken* cancellation = 0);
+
+void ensure_normals(SurfaceCache& cache, int neighbours, const CancellationToken* cancellation = 0);
+
+// Also computes normals with the same neighbourhood size, which the boundary test needs.
+void ensure_boundary(SurfaceCache& cache, int neighbours, const CancellationToken* cancellation = 0);
+
+// Fills sample with the points of cache at indices, in that order, reusing its buffers. Covariances, normals and boundary
+// flags are carried over rather than recomputed, so they still describe neighbourhoods in the whole cloud. No tree is
+// built (sample.tree is left empty), so the sample can only stand in for a cloud whose own tree is not searched.
+void gather_surface_cache(const SurfaceCache& cache, const std::vector<int>& indices, SurfaceCache& sample);
+#endif
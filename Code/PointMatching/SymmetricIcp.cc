@@ -0,0 +1,107 @@
+/* Symmetric ICP, after "A Symmetric Objective Function for ICP", Rusinkiewicz, 2019. Each match is penalised along the sum
+   of the normals at both of its points, and the pose is linearised about the midpoint of the two surfaces. */
+#include <cmath>
+
+#include <Eigen/Geometry>
+
+#include <SurfaceBasedRegistration.hpp>
+#include <SurfaceCache.hpp>
+#include <SymmetricIcp.hpp>
+
+static Eigen::Matrix4d translation_matrix(const Eigen::Vector3d& translation) {
+    Eigen::Matrix4d matrix = Eigen::Matrix4d::Identity();
+    matrix.block(0,3,3,1) = translation;
+    return matrix;
+}
+
+double symmetric_step(const SurfaceCache& fixed, const SurfaceCache& moving, const Eigen::Matrix4d& transform, RobustKernel kernel, double scale,
+                      const CorrespondenceRejection& rejection, Eigen::ArrayXi& correspondences, Eigen::VectorXd& residuals, Eigen::Matrix4d& transform_next,
+                      double search_epsilon, const CancellationToken* cancellation, StageClock* clock) {
+    // Match each moving point p to its nearest fixed point q under transform, drop the rejected matches, then solve the linearised symmetric objective
+    // sum(((p - q) . (n_p + n_q) + ((p + q) x (n_p + n_q)) . a + (n_p + n_q) . t)^2) for the half-rotation a and translation t,
+    // with p and q taken about their weighted centroids. Returns the (robust) RMS point-to-point error of transform. clock,
+    // if given, is lapped after the search and after the rejection.
+    auto n = moving.points.cols();
+    double error = find_nearest_points(fixed.tree, moving.points, transform, kernel, scale, correspondences, residuals, search_epsilon, cancellation);
+    if(clock) {
+        clock->lap(&StageTimes::search);
+    }
+
+    Eigen::Matrix3d rotation = transform.block(0,0,3,3);
+    Eigen::Vector3d translation = transform.block(0,3,3,1);
+    if(rejection.enabled()) {
+        int kept;
+        error = reject_correspondences(rejection, &moving, &fixed, rotation, kernel, scale, residuals, correspondences, kept);
+    }
+    if(clock) {
+        clock->lap(&StageTimes::rejection);
+    }
+
+    // First pass: weighted centroids of both sides of the matches.
+    Eigen::Vector3d moving_centroid = Eigen::Vector3d::Zero();
+    Eigen::Vector3d fixed_centroid = Eigen::Vector3d::Zero();
+    double weight_sum = 0;
+    for(int i = 0; i < n; i++) {
+        auto w = robust_weight(kernel, residuals(i), scale);
+        if(correspondences(i) < 0 || w <= 0) {
+            continue;
+        }
+        moving_centroid += w * (rotation * moving.points.col(i) + translation);
+        fixed_centroid += w * fixed.points.col(correspondences(i));
+        weight_sum += w;
+    }
+
+    transform_next = transform;
+    if(weight_sum <= 0) {
+        return error;
+    }
+    moving_centroid /= weight_sum;
+    fixed_centroid /= weight_sum;
+
+    // Second pass: accumulate the 6x6 normal equations.
+    Eigen::Matrix<double, 6, 6> AtA = Eigen::Matrix<double, 6, 6>::Zero();
+    Eigen::Matrix<double, 6, 1> Atb = Eigen::Matrix<double, 6, 1>::Zero();
+    for(int i = 0; i < n; i++) {
+        int j = correspondences(i);
+        auto w = robust_weight(kernel, residuals(i), scale);
+        if(j < 0 || w <= 0) {
+            continue;
+        }
+
+        Eigen::Vector3d p = rotation * moving.points.col(i) + translation - moving_centroid;
+        Eigen::Vector3d q = fixed.points.col(j) - fixed_centroid;
+        Eigen::Vector3d moving_normal = rotation * moving.normals.col(i);
+        Eigen::Vector3d fixed_normal = fixed.normals.col(j);
+        // Normals are unoriented, so pick the sign that makes the pair agree.
+        if(moving_normal.dot(fixed_normal) < 0) {
+            fixed_normal = -fixed_normal;
+        }
+        Eigen::Vector3d normal = moving_normal + fixed_normal;
+
+        Eigen::Matrix<double, 6, 1> row;
+        row << (p + q).cross(normal), normal;
+        AtA += w * row * row.transpose();
+        Atb -= w * row * (p - q).dot(normal);
+    }
+
+    Eigen::Matrix<double, 6, 1> solution = AtA.ldlt().solve(Atb);
+    if(!solution.allFinite()) {
+        return error;
+    }
+
+    // a = tan(theta) * axis, and the translation is scaled back by cos(theta); the moving side is rotated by theta about the
+    // centroids, then translated, then rotated by theta again.
+    Eigen::Vector3d a = solution.head(3);
+    double theta = atan(a.norm());
+    Eigen::Matrix4d half_rotation = Eigen::Matrix4d::Identity();
+    if(a.norm() > 0) {
+        half_rotation.block(0,0,3,3) = Eigen::AngleAxisd(theta, a.normalized()).toRotationMatrix();
+    }
+    Eigen::Vector3d step_translation = solution.tail(3) * cos(theta);
+
+    Eigen::Matrix4d increment = translation_matrix(fixed_centroid) * half_rotation * translation_matrix(step_translation) * half_rotation
+                                * translation_matrix(-moving_centroid);
+    transform_next = increment * transform;
+
+    return error;
+}
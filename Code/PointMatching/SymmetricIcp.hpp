@@ -0,0 +1,18 @@
+/* Symmetric ICP, after "A Symmetric Objective Function for ICP", Rusinkiewicz, 2019. Each match is penalised along the sum
+   of the normals at both of its points, and the pose is linearised about the midpoint of the two surfaces. */
+#ifndef SYMMETRICICP_INCLUDED
+#define SYMMETRICICP_INCLUDED
+
+#include <Eigen/Dense>
+
+#include <Cancellation.hpp>
+#include <CorrespondenceRejection.hpp>
+#include <RegistrationObserver.hpp>
+#include <RobustEstimation.hpp>
+
+struct SurfaceCache;
+
+double symmetric_step(const SurfaceCache& fixed, const SurfaceCache& moving, const Eigen::Matrix4d& transform, RobustKernel kernel, double scale,
+                      const CorrespondenceRejection& rejection, Eigen::ArrayXi& correspondences, Eigen::VectorXd& residuals, Eigen::Matrix4d& transform_next,
+                      double search_epsilon = 0, const CancellationToken* cancellation = 0, StageClock* clock = 0);
+#endif
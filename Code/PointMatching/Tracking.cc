@@ -0,0 +1,56 @@
+/* Tracking: registers a stream of frames, one at a time, to a fixed model. The model's cache (k-d tree, and normals or
+   covariances) is built once and kept for the whole stream, the registration buffers are reused from frame to frame, and
+   each registration starts from the pose predicted by the motion over the previous two frames, so that a frame whose
+   motion is close to its predecessor's converges in a few iterations. */
+#include <Tracking.hpp>
+
+#include <iostream>
+
+#include <Exceptions.hpp>
+
+RegistrationTracker::RegistrationTracker(const Eigen::MatrixXd& model, const Eigen::Matrix4d& transform_init, const TrackingOptions& options)
+    : options(options), model(model), previous(transform_init), current(transform_init), frame_count(0) {
+    if(options.registration.initial_alignment != InitialAlignment::None) {
+        std::cerr << "Tracking starts each frame from its prediction, so initial_alignment must be None." << std::endl;
+        throw(PointMatchingEx);
+    }
+    prepare_surface_cache(this->model, options.registration);
+}
+
+RegistrationResult RegistrationTracker::track(const Eigen::MatrixXd& frame) {
+    // Exhaustive point-to-point ICP needs no cache of the frame; the other modes need its k-d tree and geometry, which
+    // change with every frame.
+    const RegistrationOptions& registration = options.registration;
+    RegistrationResult result;
+    if(registration.mode == RegistrationMode::PointToPoint && !registration.rejection.needs_normals()) {
+        result = register_surfaces(model.points, frame, predicted_transform(), registration, workspace);
+    } else {
+        SurfaceCache moving(frame);
+        prepare_surface_cache(moving, registration);
+        result = register_surfaces(model, moving, predicted_transform(), registration, workspace);
+    }
+
+    previous = current;
+    current = result.transform;
+    frame_count++;
+    return result;
+}
+
+Eigen::Matrix4d RegistrationTracker::predicted_transform() const {
+    // With T_k mapping frame k onto the model, the motion between the last two frames is T_{k-1}^-1 T_k, expressed in the
+    // frame; applying it again gives T_k T_{k-1}^-1 T_k.
+    if(!options.predict_motion || frame_count < 2) {
+        return current;
+    }
+    return current * previous.inverse() * current;
+}
+
+int RegistrationTracker::frames() const {
+    return frame_count;
+}
+
+void RegistrationTracker::reset(const Eigen::Matrix4d& transform_init) {
+    previous = transform_init;
+    current = transform_init;
+    frame_count = 0;
+}
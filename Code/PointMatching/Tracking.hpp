@@ -0,0 +1,52 @@
+/* Tracking: registers a stream of frames, one at a time, to a fixed model. The model's cache (k-d tree, and normals or
+   covariances) is built once and kept for the whole stream, the registration buffers are reused from frame to frame, and
+   each registration starts from the pose predicted by the motion over the previous two frames, so that a frame whose
+   motion is close to its predecessor's converges in a few iterations. */
+#ifndef TRACKING_INCLUDED
+#define TRACKING_INCLUDED
+
+#include <Eigen/Dense>
+
+#include <SurfaceBasedRegistration.hpp>
+#include <SurfaceCache.hpp>
+
+struct TrackingOptions {
+    // Options for each frame's registration, with the model as the fixed surface. Tracking needs an increment or error
+    // tolerance in the convergence policy to stop early on well-predicted frames, and initial_alignment must be None.
+    RegistrationOptions registration;
+
+    // Start each frame from a constant-velocity prediction, applying the previous frame-to-frame motion once more; when
+    // false, or for the second frame, each frame starts from the pose of the previous one.
+    bool predict_motion = true;
+};
+
+class RegistrationTracker {
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    // transform_init, mapping the first frame onto the model, is where tracking starts.
+    RegistrationTracker(const Eigen::MatrixXd& model, const Eigen::Matrix4d& transform_init = Eigen::Matrix4d::Identity(),
+                        const TrackingOptions& options = TrackingOptions());
+
+    // Registers the next frame to the model from the predicted transform, and returns the registration, whose transform
+    // maps the frame onto the model. If registration throws, the tracker's state is unchanged.
+    RegistrationResult track(const Eigen::MatrixXd& frame);
+
+    // The transform the next frame's registration will start from.
+    Eigen::Matrix4d predicted_transform() const;
+
+    // Number of frames tracked since construction or the last reset.
+    int frames() const;
+
+    // Starts again from transform_init, forgetting the motion so far (after losing track, or at a cut in the stream).
+    void reset(const Eigen::Matrix4d& transform_init);
+
+private:
+    TrackingOptions options;
+    SurfaceCache model;
+    RegistrationWorkspace workspace;
+    Eigen::Matrix4d previous;
+    Eigen::Matrix4d current;
+    int frame_count;
+};
+#endif
@@ -0,0 +1,343 @@
+/* Bounding volume hierarchy over the triangles of a mesh, for closest-point queries. The tree is built top-down with the
+   surface area heuristic over binned triangle centroids, and stored flattened in depth-first order, so that a node's left
+   child follows it in memory and a query walks the nodes with an explicit stack. Leaf triangles are packed four at a
+   time into structure-of-arrays packets, whose closest points are found together in branch-free SIMD arithmetic. */
+#include <TriangleBvh.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+#include <Exceptions.hpp>
+
+// Centroids are binned into this many slabs along each axis, and splits are only considered between bins.
+static const int sah_bins = 16;
+
+// Cost of visiting an inner node, relative to testing one packet of triangles.
+static const double traversal_cost = 0.5;
+
+// Below this depth, splits fall back to the median, which bounds the depth of the tree and so the query stack.
+static const int max_sah_depth = 48;
+static const int max_stack = 128;
+
+static double surface_area(const Eigen::Vector3d& lower, const Eigen::Vector3d& upper) {
+    Eigen::Vector3d extent = (upper - lower).cwiseMax(0);
+    return 2 * (extent(0) * extent(1) + extent(1) * extent(2) + extent(2) * extent(0));
+}
+
+static int packet_count(int triangles) {
+    return (triangles + 3) / 4;
+}
+
+static float round_down(double x) {
+    float f = static_cast<float>(x);
+    return f > x ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+static float round_up(double x) {
+    float f = static_cast<float>(x);
+    return f < x ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+TriangleBvh::TriangleBvh(const TriangleMesh& mesh, int leaf_size) {
+    int count = mesh.triangles.cols();
+    if(count < 1 || mesh.vertices.rows() != 3) {
+        std::cerr << "Cannot build a bounding volume hierarchy over a mesh without triangles." << std::endl;
+        throw(PointMatchingEx);
+    }
+    if(mesh.triangles.minCoeff() < 0 || mesh.triangles.maxCoeff() >= mesh.vertices.cols()) {
+        std::cerr << "Mesh triangles refer to vertices that do not exist." << std::endl;
+        throw(PointMatchingEx);
+    }
+
+    std::vector<BuildTriangle> triangles(count);
+    triangle_normals.resize(3, count);
+    for(int t = 0; t < count; t++) {
+        Eigen::Vector3d a = mesh.vertices.col(mesh.triangles(0, t));
+        Eigen::Vector3d b = mesh.vertices.col(mesh.triangles(1, t));
+        Eigen::Vector3d c = mesh.vertices.col(mesh.triangles(2, t));
+        triangles[t].lower = a.cwiseMin(b).cwiseMin(c);
+        triangles[t].upper = a.cwiseMax(b).cwiseMax(c);
+        triangles[t].centroid = (a + b + c) / 3;
+        triangles[t].index = t;
+
+        Eigen::Vector3d normal = (b - a).cross(c - a);
+        double length = normal.norm();
+        triangle_normals.col(t) = length > 0 ? Eigen::Vector3d(normal / length) : Eigen::Vector3d::Zero();
+    }
+
+    nodes.reserve(2 * count / std::max(1, leaf_size) + 1);
+    packets.reserve(packet_count(count) + count / std::max(1, leaf_size) + 1);
+    build(mesh, triangles, 0, count, std::max(1, leaf_size), 0);
+}
+
+int TriangleBvh::size() const {
+    return triangle_normals.cols();
+}
+
+const Eigen::MatrixXd& TriangleBvh::normals() const {
+    return triangle_normals;
+}
+
+int TriangleBvh::build(const TriangleMesh& mesh, std::vector<BuildTriangle>& triangles, int begin, int end, int leaf_size, int depth) {
+    // Split where the expected cost of a query, the areas of the children (which give the chance of visiting them) times
+    // their packets, is least, or make a leaf if no split beats testing every packet here.
+    int node_index = nodes.size();
+    nodes.push_back(Node());
+
+    Eigen::Vector3d lower = triangles[begin].lower;
+    Eigen::Vector3d upper = triangles[begin].upper;
+    Eigen::Vector3d centroid_lower = triangles[begin].centroid;
+    Eigen::Vector3d centroid_upper = centroid_lower;
+    for(int i = begin + 1; i < end; i++) {
+        lower = lower.cwiseMin(triangles[i].lower);
+        upper = upper.cwiseMax(triangles[i].upper);
+        centroid_lower = centroid_lower.cwiseMin(triangles[i].centroid);
+        centroid_upper = centroid_upper.cwiseMax(triangles[i].centroid);
+    }
+    for(int d = 0; d < 3; d++) {
+        nodes[node_index].lower[d] = round_down(lower(d));
+        nodes[node_index].upper[d] = round_up(upper(d));
+    }
+
+    int count = end - begin;
+    Eigen::Vector3d centroid_extent = centroid_upper - centroid_lower;
+    if(count <= leaf_size || centroid_extent.maxCoeff() <= 0) {
+        make_leaf(mesh, triangles, begin, end, nodes[node_index]);
+        return node_index;
+    }
+
+    int best_axis = -1;
+    int best_bin = 0;
+    double best_cost = std::numeric_limits<double>::infinity();
+    if(depth < max_sah_depth) {
+        for(int axis = 0; axis < 3; axis++) {
+            if(centroid_extent(axis) <= 0) {
+                continue;
+            }
+            int bin_counts[sah_bins] = {};
+            Eigen::Vector3d bin_lower[sah_bins];
+            Eigen::Vector3d bin_upper[sah_bins];
+            for(int b = 0; b < sah_bins; b++) {
+                bin_lower[b].setConstant(std::numeric_limits<double>::infinity());
+                bin_upper[b].setConstant(-std::numeric_limits<double>::infinity());
+            }
+            double bin_scale = sah_bins / centroid_extent(axis);
+            for(int i = begin; i < end; i++) {
+                int b = std::min(sah_bins - 1, static_cast<int>((triangles[i].centroid(axis) - centroid_lower(axis)) * bin_scale));
+                bin_counts[b]++;
+                bin_lower[b] = bin_lower[b].cwiseMin(triangles[i].lower);
+                bin_upper[b] = bin_upper[b].cwiseMax(triangles[i].upper);
+            }
+
+            // Sweep from the right to get the cost of every right-hand side, then from the left.
+            double right_costs[sah_bins];
+            Eigen::Vector3d running_lower = bin_lower[sah_bins - 1];
+            Eigen::Vector3d running_upper = bin_upper[sah_bins - 1];
+            int running_count = 0;
+            for(int b = sah_bins - 1; b > 0; b--) {
+                running_count += bin_counts[b];
+                running_lower = running_lower.cwiseMin(bin_lower[b]);
+                running_upper = running_upper.cwiseMax(bin_upper[b]);
+                right_costs[b] = running_count > 0 ? surface_area(running_lower, running_upper) * packet_count(running_count) : 0;
+            }
+            running_lower = bin_lower[0];
+            running_upper = bin_upper[0];
+            running_count = 0;
+            for(int b = 1; b < sah_bins; b++) {
+                running_count += bin_counts[b - 1];
+                running_lower = running_lower.cwiseMin(bin_lower[b - 1]);
+                running_upper = running_upper.cwiseMax(bin_upper[b - 1]);
+                if(running_count == 0 || running_count == count) {
+                    continue;
+                }
+                double cost = surface_area(running_lower, running_upper) * packet_count(running_count) + right_costs[b];
+                if(cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = b;
+                }
+            }
+        }
+    }
+
+    int middle;
+    double area = surface_area(lower, upper);
+    if(best_axis >= 0) {
+        // Oversized leaves are split anyway, so that no leaf grows much beyond leaf_size.
+        double split_cost = traversal_cost + (area > 0 ? best_cost / area : packet_count(count));
+        if(split_cost >= packet_count(count) && count <= 4 * leaf_size) {
+            make_leaf(mesh, triangles, begin, end, nodes[node_index]);
+            return node_index;
+        }
+        double bin_scale = sah_bins / centroid_extent(best_axis);
+        double axis_lower = centroid_lower(best_axis);
+        middle = std::partition(triangles.begin() + begin, triangles.begin() + end, [&](const BuildTriangle& triangle) {
+            return std::min(sah_bins - 1, static_cast<int>((triangle.centroid(best_axis) - axis_lower) * bin_scale)) < best_bin;
+        }) - triangles.begin();
+    } else {
+        int axis;
+        centroid_extent.maxCoeff(&axis);
+        middle = begin + count / 2;
+        std::nth_element(triangles.begin() + begin, triangles.begin() + middle, triangles.begin() + end,
+                         [axis](const BuildTriangle& a, const BuildTriangle& b) { return a.centroid(axis) < b.centroid(axis); });
+    }
+
+    build(mesh, triangles, begin, middle, leaf_size, depth + 1);
+    int right = build(mesh, triangles, middle, end, leaf_size, depth + 1);
+    nodes[node_index].offset = right;
+    nodes[node_index].count = 0;
+    return node_index;
+}
+
+void TriangleBvh::make_leaf(const TriangleMesh& mesh, const std::vector<BuildTriangle>& triangles, int begin, int end, Node& node) {
+    node.offset = packets.size();
+    node.count = packet_count(end - begin);
+    double nan = std::numeric_limits<double>::quiet_NaN();
+    for(int first = begin; first < end; first += 4) {
+        Packet packet;
+        for(int lane = 0; lane < 4; lane++) {
+            int t = triangles[std::min(first + lane, end - 1)].index;
+            Eigen::Vector3d a = mesh.vertices.col(mesh.triangles(0, t));
+            Eigen::Vector3d e0 = mesh.vertices.col(mesh.triangles(1, t)) - a;
+            Eigen::Vector3d e1 = mesh.vertices.col(mesh.triangles(2, t)) - a;
+            for(int d = 0; d < 3; d++) {
+                packet.a[d](lane) = a(d);
+                packet.e0[d](lane) = e0(d);
+                packet.e1[d](lane) = e1(d);
+            }
+            double d00 = e0.squaredNorm();
+            double d01 = e0.dot(e1);
+            double d11 = e1.squaredNorm();
+            double d22 = (e1 - e0).squaredNorm();
+            double determinant = d00 * d11 - d01 * d01;
+            packet.d00(lane) = d00;
+            packet.d01(lane) = d01;
+            packet.d11(lane) = d11;
+            packet.inverse_d00(lane) = d00 > 0 ? 1 / d00 : 0;
+            packet.inverse_d11(lane) = d11 > 0 ? 1 / d11 : 0;
+            packet.inverse_d22(lane) = d22 > 0 ? 1 / d22 : 0;
+            packet.inverse_determinant(lane) = determinant > 1E-12 * d00 * d11 ? 1 / determinant : nan;
+            packet.triangles[lane] = t;
+        }
+        packets.push_back(packet);
+    }
+}
+
+double TriangleBvh::box_distance(const Node& node, const Eigen::Vector3d& query) const {
+    double squared_distance = 0;
+    for(int d = 0; d < 3; d++) {
+        double outside = std::max(0.0, std::max(node.lower[d] - query(d), query(d) - node.upper[d]));
+        squared_distance += outside * outside;
+    }
+    return squared_distance;
+}
+
+static inline Eigen::Array4d clamp_unit(const Eigen::Array4d& t) {
+    return t.max(0.0).min(1.0);
+}
+
+int TriangleBvh::closest_point(const Eigen::Vector3d& query, Eigen::Vector3d& point, double& squared_distance) const {
+    return closest_point(query, std::numeric_limits<double>::infinity(), point, squared_distance);
+}
+
+int TriangleBvh::closest_point(const Eigen::Vector3d& query, double max_distance, Eigen::Vector3d& point, double& squared_distance) const {
+    // Nodes are visited nearer child first, and skipped once their boxes are further than the best triangle so far (or
+    // than max_distance, to begin with).
+    int best = -1;
+    Eigen::Vector3d best_offset = Eigen::Vector3d::Zero();
+    double best_distance = max_distance * max_distance;
+
+    int stack[max_stack];
+    double stack_distances[max_stack];
+    int top = 0;
+    int node_index = 0;
+    double node_distance = box_distance(nodes[0], query);
+    while(true) {
+        if(node_distance < best_distance) {
+            const Node& node = nodes[node_index];
+            if(node.count == 0) {
+                int left = node_index + 1;
+                int right = node.offset;
+                double left_distance = box_distance(nodes[left], query);
+                double right_distance = box_distance(nodes[right], query);
+                bool left_first = left_distance <= right_distance;
+                stack[top] = left_first ? right : left;
+                stack_distances[top] = left_first ? right_distance : left_distance;
+                top++;
+                node_index = left_first ? left : right;
+                node_distance = left_first ? left_distance : right_distance;
+                continue;
+            }
+
+            // Offsets r = p - q from the closest point q on each of the packet's triangles to the query p: the projection
+            // onto the triangle's plane if it falls inside the triangle, otherwise the closest point on its three edges.
+            for(int k = node.offset; k < node.offset + node.count; k++) {
+                const Packet& packet = packets[k];
+                Eigen::Array4d d[3];
+                for(int axis = 0; axis < 3; axis++) {
+                    d[axis] = query(axis) - packet.a[axis];
+                }
+                Eigen::Array4d d20 = d[0] * packet.e0[0] + d[1] * packet.e0[1] + d[2] * packet.e0[2];
+                Eigen::Array4d d21 = d[0] * packet.e1[0] + d[1] * packet.e1[1] + d[2] * packet.e1[2];
+
+                Eigen::Array4d v = (packet.d11 * d20 - packet.d01 * d21) * packet.inverse_determinant;
+                Eigen::Array4d w = (packet.d00 * d21 - packet.d01 * d20) * packet.inverse_determinant;
+                auto inside = (v >= 0) && (w >= 0) && (v + w <= 1);
+
+                Eigen::Array4d t_ab = clamp_unit(d20 * packet.inverse_d00);
+                Eigen::Array4d t_ac = clamp_unit(d21 * packet.inverse_d11);
+                Eigen::Array4d t_bc = clamp_unit(((d[0] - packet.e0[0]) * (packet.e1[0] - packet.e0[0]) + (d[1] - packet.e0[1]) * (packet.e1[1] - packet.e0[1])
+                                                  + (d[2] - packet.e0[2]) * (packet.e1[2] - packet.e0[2])) * packet.inverse_d22);
+
+                Eigen::Array4d r[3];
+                Eigen::Array4d r_ac[3];
+                Eigen::Array4d r_bc[3];
+                for(int axis = 0; axis < 3; axis++) {
+                    r[axis] = d[axis] - t_ab * packet.e0[axis];
+                    r_ac[axis] = d[axis] - t_ac * packet.e1[axis];
+                    r_bc[axis] = d[axis] - packet.e0[axis] - t_bc * (packet.e1[axis] - packet.e0[axis]);
+                }
+                Eigen::Array4d distances = r[0].square() + r[1].square() + r[2].square();
+                Eigen::Array4d ac_distances = r_ac[0].square() + r_ac[1].square() + r_ac[2].square();
+                Eigen::Array4d bc_distances = r_bc[0].square() + r_bc[1].square() + r_bc[2].square();
+                auto ac_closer = ac_distances < distances;
+                for(int axis = 0; axis < 3; axis++) {
+                    r[axis] = ac_closer.select(r_ac[axis], r[axis]);
+                }
+                distances = ac_closer.select(ac_distances, distances);
+                auto bc_closer = bc_distances < distances;
+                for(int axis = 0; axis < 3; axis++) {
+                    r[axis] = bc_closer.select(r_bc[axis], r[axis]);
+                }
+                distances = bc_closer.select(bc_distances, distances);
+
+                for(int axis = 0; axis < 3; axis++) {
+                    r[axis] = inside.select(d[axis] - v * packet.e0[axis] - w * packet.e1[axis], r[axis]);
+                }
+                distances = inside.select(r[0].square() + r[1].square() + r[2].square(), distances);
+
+                int lane;
+                double distance = distances.minCoeff(&lane);
+                if(distance < best_distance) {
+                    best_distance = distance;
+                    best = packet.triangles[lane];
+                    best_offset = Eigen::Vector3d(r[0](lane), r[1](lane), r[2](lane));
+                }
+            }
+        }
+        if(top == 0) {
+            break;
+        }
+        top--;
+        node_index = stack[top];
+        node_distance = stack_distances[top];
+    }
+
+    if(best >= 0) {
+        point = query - best_offset;
+        squared_distance = best_distance;
+    }
+    return best;
+}
@@ -0,0 +1,80 @@
+/* Bounding volume hierarchy over the triangles of a mesh, for closest-point queries. The tree is built top-down with the
+   surface area heuristic over binned triangle centroids, and stored flattened in depth-first order, so that a node's left
+   child follows it in memory and a query walks the nodes with an explicit stack. Leaf triangles are packed four at a
+   time into structure-of-arrays packets, whose closest points are found together in branch-free SIMD arithmetic. */
+#ifndef TRIANGLEBVH_INCLUDED
+#define TRIANGLEBVH_INCLUDED
+
+#include <vector>
+
+#include <Eigen/Dense>
+#include <Eigen/StdVector>
+
+#include <TriangleMesh.hpp>
+
+class TriangleBvh {
+public:
+    // Leaves hold up to leaf_size triangles, unless the surface area heuristic finds splitting them no cheaper.
+    explicit TriangleBvh(const TriangleMesh& mesh, int leaf_size = 4);
+
+    int size() const;
+
+    // Index (column of mesh.triangles) of the triangle closest to query, with the closest point on it and its squared
+    // distance.
+    int closest_point(const Eigen::Vector3d& query, Eigen::Vector3d& point, double& squared_distance) const;
+
+    // As above, but only looking for triangles within max_distance of query, which prunes far more of the tree. Returns
+    // -1, leaving point and squared_distance unset, if there are none.
+    int closest_point(const Eigen::Vector3d& query, double max_distance, Eigen::Vector3d& point, double& squared_distance) const;
+
+    // Unit normals of the triangles, in the order of mesh.triangles (zero for degenerate triangles).
+    const Eigen::MatrixXd& normals() const;
+
+private:
+    // Bounds are rounded outwards to single precision, which keeps a node to half a cache line.
+    struct Node {
+        float lower[3];
+        float upper[3];
+
+        // Inner nodes have count == 0, their left child next in the array and their right child at offset. Leaves own
+        // count packets starting at offset.
+        int offset;
+        int count;
+    };
+
+    // Four triangles, as a vertex a and edges e0 = b - a and e1 = c - a, with the reciprocals the closest-point test needs
+    // (zero for zero-length edges, and NaN for degenerate triangles). Short leaves are padded by repeating a triangle.
+    struct Packet {
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+        Eigen::Array4d a[3];
+        Eigen::Array4d e0[3];
+        Eigen::Array4d e1[3];
+        Eigen::Array4d d00;
+        Eigen::Array4d d01;
+        Eigen::Array4d d11;
+        Eigen::Array4d inverse_d00;
+        Eigen::Array4d inverse_d11;
+        Eigen::Array4d inverse_d22;
+        Eigen::Array4d inverse_determinant;
+        int triangles[4];
+    };
+
+    struct BuildTriangle {
+        Eigen::Vector3d lower;
+        Eigen::Vector3d upper;
+        Eigen::Vector3d centroid;
+        int index;
+    };
+
+    int build(const TriangleMesh& mesh, std::vector<BuildTriangle>& triangles, int begin, int end, int leaf_size, int depth);
+
+    void make_leaf(const TriangleMesh& mesh, const std::vector<BuildTriangle>& triangles, int begin, int end, Node& node);
+
+    double box_distance(const Node& node, const Eigen::Vector3d& query) const;
+
+    std::vector<Node> nodes;
+    std::vector<Packet, Eigen::aligned_allocator<Packet> > packets;
+    Eigen::MatrixXd triangle_normals;
+};
+#endif
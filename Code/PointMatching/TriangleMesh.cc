@@ -0,0 +1,109 @@
+/* Triangle meshes, as read from legacy VTK POLYDATA files, so that a fixed surface can be registered to as a surface
+   rather than through its vertices alone. */
+#include <TriangleMesh.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <Exceptions.hpp>
+
+static void mesh_file_error(const std::string& filename, const std::string& reason) {
+    std::cerr << "Could not read mesh file " << filename << ": " << reason << std::endl;
+    throw(PointMatchingEx);
+}
+
+TriangleMesh load_mesh_from_vtk_file(std::string filename) {
+    std::ifstream infile(filename);
+    if(!infile.is_open()) {
+        mesh_file_error(filename, "cannot open it");
+    }
+
+    // The header is a version line, a title line, the format and the dataset type; the rest is whitespace-separated.
+    std::string version;
+    std::string title;
+    std::string format;
+    std::getline(infile, version);
+    std::getline(infile, title);
+    infile >> format;
+    if(version.compare(0, 5, "# vtk") != 0 || format != "ASCII") {
+        mesh_file_error(filename, "not an ASCII legacy VTK file");
+    }
+    std::string keyword;
+    std::string dataset;
+    if(!(infile >> keyword >> dataset) || keyword != "DATASET" || dataset != "POLYDATA") {
+        mesh_file_error(filename, "not POLYDATA");
+    }
+
+    TriangleMesh mesh;
+    std::vector<int> triangles;
+    while(infile >> keyword) {
+        if(keyword == "POINTS") {
+            int count;
+            std::string type;
+            if(!(infile >> count >> type) || count < 0) {
+                mesh_file_error(filename, "bad POINTS header");
+            }
+            mesh.vertices.resize(3, count);
+            for(int i = 0; i < count; i++) {
+                if(!(infile >> mesh.vertices(0, i) >> mesh.vertices(1, i) >> mesh.vertices(2, i))) {
+                    mesh_file_error(filename, "too few points");
+                }
+            }
+        } else if(keyword == "POLYGONS" || keyword == "TRIANGLE_STRIPS" || keyword == "VERTICES" || keyword == "LINES") {
+            // Each cell is its number of points followed by their indices.
+            int cells;
+            int size;
+            if(!(infile >> cells >> size)) {
+                mesh_file_error(filename, "bad " + keyword + " header");
+            }
+            std::vector<int> cell;
+            for(int c = 0; c < cells; c++) {
+                int points;
+                if(!(infile >> points) || points < 0) {
+                    mesh_file_error(filename, "bad " + keyword + " cell");
+                }
+                cell.resize(points);
+                for(int p = 0; p < points; p++) {
+                    if(!(infile >> cell[p])) {
+                        mesh_file_error(filename, "bad " + keyword + " cell");
+                    }
+                }
+                if(keyword == "POLYGONS") {
+                    for(int p = 2; p < points; p++) {
+                        triangles.insert(triangles.end(), { cell[0], cell[p - 1], cell[p] });
+                    }
+                } else if(keyword == "TRIANGLE_STRIPS") {
+                    // Every other triangle of a strip is flipped to keep a consistent orientation.
+                    for(int p = 2; p < points; p++) {
+                        if(p % 2 == 0) {
+                            triangles.insert(triangles.end(), { cell[p - 2], cell[p - 1], cell[p] });
+                        } else {
+                            triangles.insert(triangles.end(), { cell[p - 1], cell[p - 2], cell[p] });
+                        }
+                    }
+                }
+            }
+        } else if(keyword == "POINT_DATA" || keyword == "CELL_DATA") {
+            break;
+        } else {
+            mesh_file_error(filename, "unexpected section " + keyword);
+        }
+    }
+
+    int count = static_cast<int>(triangles.size()) / 3;
+    if(mesh.vertices.cols() == 0 || count == 0) {
+        mesh_file_error(filename, "no triangles");
+    }
+    mesh.triangles.resize(3, count);
+    for(int t = 0; t < count; t++) {
+        for(int k = 0; k < 3; k++) {
+            int index = triangles[3 * t + k];
+            if(index < 0 || index >= mesh.vertices.cols()) {
+                mesh_file_error(filename, "vertex index out of range");
+            }
+            mesh.triangles(k, t) = index;
+        }
+    }
+    return mesh;
+}
@@ -0,0 +1,19 @@
+/* Triangle meshes, as read from legacy VTK POLYDATA files, so that a fixed surface can be registered to as a surface
+   rather than through its vertices alone. */
+#ifndef TRIANGLEMESH_INCLUDED
+#define TRIANGLEMESH_INCLUDED
+
+#include <string>
+
+#include <Eigen/Dense>
+
+struct TriangleMesh {
+    // Vertices as a 3xN matrix, like a point cloud, and each triangle as a column of three vertex indices.
+    Eigen::MatrixXd vertices;
+    Eigen::Matrix<int, 3, Eigen::Dynamic> triangles;
+};
+
+// Reads the points and polygons of an ASCII legacy VTK POLYDATA file. Polygons are split into fans of triangles, and
+// triangle strips into their triangles; vertices, lines and point or cell data are ignored.
+TriangleMesh load_mesh_from_vtk_file(std::string filename);
+#endif
@@ -2,11 +2,13 @@
 #include <Util.hpp>
 
 #include <cstdlib>
+#include <cmath>
 #include <iostream>
 #include <fstream>
 #include <exception>
 
 #include <Eigen/Dense>
+#include <Eigen/Geometry>
 #include <Exceptions.hpp>
 
 bool isApproxEqual(double a, double b, double eps) {
@@ -49,18 +51,82 @@ Eigen::Matrix4d compose_final_transform(const Eigen::Matrix3d& rotation, const E
     return final_transform;
 }
 
-Eigen::MatrixXd apply_transform(const Eigen::MatrixXd& pointset, const Eigen::Matrix4d& transform) {
-    // Need to add a one on the end of each vector, for the translation part of the transform.
-    Eigen::MatrixXd pointset_augmented(4,pointset.cols());
-    pointset_augmented.block(0,0,3,pointset.cols()) << pointset;
-    pointset_augmented.block(3,0,1,pointset.cols()) << Eigen::MatrixXd::Constant(1, pointset.cols(), 1);
+Eigen::Matrix3d skew(const Eigen::Vector3d& v) {
+    // Cross-product matrix, such that skew(a)*b == a.cross(b).
+    Eigen::Matrix3d m;
+    m <<     0, -v(2),  v(1),
+          v(2),     0, -v(0),
+         -v(1),  v(0),     0;
+    return m;
+}
 
-    auto proposed_pointset = transform * pointset_augmented;
+Eigen::Matrix4d se3_exp(const Vector6d& twist) {
+    // Map a twist (omega, v) to a rigid transform. Series expansions are used near zero rotation.
+    Eigen::Vector3d omega = twist.head<3>();
+    Eigen::Vector3d v = twist.tail<3>();
+
+    auto theta = omega.norm();
+    auto omega_hat = skew(omega);
+    auto omega_hat_sq = omega_hat * omega_hat;
+
+    double a, b, c;
+    if(theta < 1E-6) {
+        a = 1 - theta * theta / 6;
+        b = 0.5 - theta * theta / 24;
+        c = 1.0 / 6 - theta * theta / 120;
+    } else {
+        a = sin(theta) / theta;
+        b = (1 - cos(theta)) / (theta * theta);
+        c = (theta - sin(theta)) / (theta * theta * theta);
+    }
 
-    // Now remove the unnecessary bottom row of the transformed pointset.
-    auto proposed_pointset_reduced = proposed_pointset.block(0,0,3,pointset.cols());
+    Eigen::Matrix3d rotation = Eigen::Matrix3d::Identity() + a * omega_hat + b * omega_hat_sq;
+    Eigen::Matrix3d V = Eigen::Matrix3d::Identity() + b * omega_hat + c * omega_hat_sq;
+
+    return compose_final_transform(rotation, V * v);
+}
 
-    return proposed_pointset_reduced;
+Vector6d se3_log(const Eigen::Matrix4d& transform) {
+    // Inverse of se3_exp, for rotations of less than pi.
+    Eigen::Matrix3d rotation = transform.block(0,0,3,3);
+    Eigen::Vector3d translation = transform.block(0,3,3,1);
+
+    Eigen::AngleAxisd angle_axis(rotation);
+    auto theta = angle_axis.angle();
+    Eigen::Vector3d omega = theta * angle_axis.axis();
+
+    auto omega_hat = skew(omega);
+
+    double d;
+    if(theta < 1E-6) {
+        d = 1.0 / 12 + theta * theta / 720;
+    } else {
+        auto half_theta = theta / 2;
+        d = (1 - half_theta * cos(half_theta) / sin(half_theta)) / (theta * theta);
+    }
+    Eigen::Matrix3d V_inverse = Eigen::Matrix3d::Identity() - 0.5 * omega_hat + d * omega_hat * omega_hat;
+
+    Vector6d twist;
+    twist << omega, V_inverse * translation;
+    return twist;
+}
+
+Eigen::MatrixXd apply_transform(const Eigen::MatrixXd& pointset, const Eigen::Matrix4d& transform) {
+    Eigen::MatrixXd transformed(3, pointset.cols());
+    apply_transform(pointset, transform, transformed);
+    return transformed;
+}
+
+void apply_transform(const Eigen::MatrixXd& pointset, const Eigen::Matrix4d& transform, Eigen::MatrixXd& transformed) {
+    // Apply the rotation and translation parts column by column, writing into transformed without allocating when it is
+    // already 3xN. This avoids building a 4xN augmented copy of the pointset.
+    Eigen::Matrix3d rotation = transform.block(0,0,3,3);
+    Eigen::Vector3d translation = transform.block(0,3,3,1);
+
+    transformed.resize(3, pointset.cols());
+    for(int i = 0; i < pointset.cols(); i++) {
+        transformed.col(i) = rotation * pointset.col(i) + translation;
+    }
 }
 
 Eigen::MatrixXd load_pointcloud_from_file(std::string filename) {
@@ -4,6 +4,9 @@
 
 #include <Eigen/Dense>
 
+// A twist in se(3), ordered as rotation (omega) then translation (v).
+typedef Eigen::Matrix<double, 6, 1> Vector6d;
+
 bool isApproxEqual(double a, double b, double eps);
 
 bool isApproxEqual(double a, double b);
@@ -18,8 +21,16 @@ double root_mean_square(const Eigen::VectorXd& v);
 
 Eigen::Matrix4d compose_final_transform(const Eigen::Matrix3d& rotation, const Eigen::Vector3d& translation);
 
+Eigen::Matrix3d skew(const Eigen::Vector3d& v);
+
+Eigen::Matrix4d se3_exp(const Vector6d& twist);
+
+Vector6d se3_log(const Eigen::Matrix4d& transform);
+
 Eigen::MatrixXd apply_transform(const Eigen::MatrixXd& pointset, const Eigen::Matrix4d& transform);
 
+void apply_transform(const Eigen::MatrixXd& pointset, const Eigen::Matrix4d& transform, Eigen::MatrixXd& transformed);
+
 Eigen::MatrixXd load_pointcloud_from_file(std::string filename);
 
 Eigen::Matrix4d load_transform_from_file(std::string filename);
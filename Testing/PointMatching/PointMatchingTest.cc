@@ -1,9 +1,145 @@
 #define CATCH_CONFIG_MAIN  // This tells Catch to provide a main() - only do this in one cpp file
 #include <catch.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <thread>
+#include <random>
 #include <SurfaceBasedRegistration.hpp>
 #include <PointMatching.hpp>
 #include <Exceptions.hpp>
 #include <Util.hpp>
+#include <RobustEstimation.hpp>
+#include <AndersonAcceleration.hpp>
+#include <KdTree.hpp>
+#include <GeneralizedIcp.hpp>
+#include <Features.hpp>
+#include <GlobalRegistration.hpp>
+#include <MultiStartRegistration.hpp>
+#include <DistanceField.hpp>
+#include <GoIcp.hpp>
+#include <FastGlobalRegistration.hpp>
+#include <Super4Pcs.hpp>
+#include <MomentAlignment.hpp>
+#include <CorrespondenceRejection.hpp>
+#include <Ndt.hpp>
+#include <GaussTransform.hpp>
+#include <Cpd.hpp>
+#include <MeshRegistration.hpp>
+#include <SdfRegistration.hpp>
+#include <MultiViewRegistration.hpp>
+#include <Tracking.hpp>
+#include <PoseSolver.hpp>
+#include <Cancellation.hpp>
+#include <SurfaceCache.hpp>
+
+#if defined(__GLIBC__)
+// Count heap allocations by interposing on glibc's malloc. Eigen and operator new both allocate through malloc, so this
+// sees every dynamic allocation made by the library.
+extern "C" void* __libc_malloc(size_t size);
+
+// Threaded tests allocate too, so the count is atomic.
+static std::atomic<long> allocation_count(0);
+
+extern "C" void* malloc(size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+#endif
+
+// A rotation of 0.1 radians, scaled by scale about centre, and a translation of a few millimetres: a start from which
+// local registration of the test data should recover.
+static Eigen::Matrix4d test_perturbation(double scale = 1, const Eigen::Vector3d& centre = Eigen::Vector3d::Zero()) {
+    Eigen::Matrix4d perturbation = Eigen::Matrix4d::Identity();
+    perturbation.block(0,0,3,3) = scale * Eigen::AngleAxisd(0.1, Eigen::Vector3d(1, -1, 2).normalized()).toRotationMatrix();
+    perturbation.block(0,3,3,1) = centre - perturbation.block(0,0,3,3) * centre + Eigen::Vector3d(0.005, -0.005, 0.003);
+    return perturbation;
+}
+
+// A rotation of two radians and a translation comparable to the test data's extent: a frame from which only global
+// methods can register it.
+static Eigen::Matrix4d test_arbitrary_motion() {
+    Eigen::Matrix4d motion = Eigen::Matrix4d::Identity();
+    motion.block(0,0,3,3) = Eigen::AngleAxisd(2.0, Eigen::Vector3d(1, 2, 3).normalized()).toRotationMatrix();
+    motion.block(0,3,3,1) = Eigen::Vector3d(0.3, -0.2, 0.1);
+    return motion;
+}
+
+// The smooth surface z = 0.3 sin(3x) cos(2y) + 0.2 x^2 sampled on an n x n grid over [-0.5, 0.5]^2, with the grid shifted
+// along x by offset spacings, so that a shifted copy has no point in common with the unshifted one.
+static Eigen::MatrixXd test_grid_surface(int n, double offset = 0) {
+    Eigen::MatrixXd surface(3, n*n);
+    for(int i = 0; i < n; i++) {
+        for(int j = 0; j < n; j++) {
+            double x = (i + offset) / (n - 1.0) - 0.5;
+            double y = j / (n - 1.0) - 0.5;
+            surface.col(i*n + j) << x, y, 0.3*sin(3*x)*cos(2*y) + 0.2*x*x;
+        }
+    }
+    return surface;
+}
+
+// A motion of a few hundredths of a radian and unit, which ICP undoes on test_grid_surface from the identity.
+static Eigen::Matrix4d test_grid_motion() {
+    Vector6d twist;
+    twist << 0.02, -0.01, 0.03, 0.01, 0.005, -0.01;
+    return se3_exp(twist);
+}
+
+// Keeps the kept_tenths of surface1 at the upper end along x as fixed, and the same share of surface2 at the lower end
+// (by surface1's x, as the clouds correspond point for point) as moving.
+static void split_along_x(const Eigen::MatrixXd& surface1, const Eigen::MatrixXd& surface2, int kept_tenths, Eigen::MatrixXd& fixed,
+                          Eigen::MatrixXd& moving) {
+    std::vector<double> xs(surface1.cols());
+    for(int i = 0; i < surface1.cols(); i++) {
+        xs[i] = surface1(0, i);
+    }
+    std::sort(xs.begin(), xs.end());
+    double lower = xs[xs.size() * (10 - kept_tenths) / 10];
+    double upper = xs[xs.size() * kept_tenths / 10];
+
+    std::vector<int> fixed_indices;
+    std::vector<int> moving_indices;
+    for(int i = 0; i < surface1.cols(); i++) {
+        if(surface1(0, i) >= lower) {
+            fixed_indices.push_back(i);
+        }
+        if(surface1(0, i) <= upper) {
+            moving_indices.push_back(i);
+        }
+    }
+    fixed.resize(3, fixed_indices.size());
+    moving.resize(3, moving_indices.size());
+    for(unsigned int k = 0; k < fixed_indices.size(); k++) {
+        fixed.col(k) = surface1.col(fixed_indices[k]);
+    }
+    for(unsigned int k = 0; k < moving_indices.size(); k++) {
+        moving.col(k) = surface2.col(moving_indices[k]);
+    }
+}
+
+// Random points inside the triangles of mesh, so that few of them are near a vertex. triangles receives the triangle
+// each point lies in.
+static Eigen::MatrixXd sample_mesh_triangles(const TriangleMesh& mesh, int count, std::mt19937& generator, std::vector<int>& triangles) {
+    std::uniform_int_distribution<int> pick(0, mesh.triangles.cols() - 1);
+    std::uniform_real_distribution<double> uniform(0, 1);
+    Eigen::MatrixXd samples(3, count);
+    triangles.resize(count);
+    for(int k = 0; k < count; k++) {
+        int t = pick(generator);
+        double u = uniform(generator);
+        double v = uniform(generator);
+        if(u + v > 1) {
+            u = 1 - u;
+            v = 1 - v;
+        }
+        samples.col(k) = mesh.vertices.col(mesh.triangles(0, t)) + u * (mesh.vertices.col(mesh.triangles(1, t)) - mesh.vertices.col(mesh.triangles(0, t)))
+                         + v * (mesh.vertices.col(mesh.triangles(2, t)) - mesh.vertices.col(mesh.triangles(0, t)));
+        triangles[k] = t;
+    }
+    return samples;
+}
 
 TEST_CASE( "can find pointset average", "[find_pointset_average]" ) {
     // Create an example pointset with a known average.
@@ -349,3 +485,1500 @@ TEST_CASE( "surface-based registration for test data" ) {
 
     REQUIRE( estimated_transform.isApprox(expected_transform.inverse(), 0.01) );
 }
+
+TEST_CASE( "robust kernels down-weight large residuals", "[robust_weight]" ) {
+    SECTION( "plain least squares weights everything equally" ) {
+        REQUIRE( robust_weight(RobustKernel::None, 100, 1) == Approx(1) );
+    }
+
+    SECTION( "small residuals keep full weight" ) {
+        REQUIRE( robust_weight(RobustKernel::Huber, 0.5, 1) == Approx(1) );
+        REQUIRE( robust_weight(RobustKernel::Tukey, 0, 1) == Approx(1) );
+        REQUIRE( robust_weight(RobustKernel::Cauchy, 0, 1) == Approx(1) );
+    }
+
+    SECTION( "gross outliers are down-weighted, or rejected outright by Tukey" ) {
+        REQUIRE( robust_weight(RobustKernel::Huber, 13.45, 1) == Approx(0.1) );
+        REQUIRE( robust_weight(RobustKernel::Tukey, 10, 1) == Approx(0) );
+        REQUIRE( robust_weight(RobustKernel::Cauchy, 23.85, 1) == Approx(1.0 / 101) );
+    }
+
+    SECTION( "scale is estimated from the median residual" ) {
+        Eigen::VectorXd residuals(5);
+        residuals << 5, -1, 100, 2, 3;
+
+        REQUIRE( robust_scale_from_residuals(residuals) == Approx(1.4826 * 3) );
+    }
+}
+
+TEST_CASE( "robust IRLS recovers a transform despite gross outliers", "[robust_rigid_step]" ) {
+    Eigen::MatrixXd pointset = Eigen::MatrixXd::Random(3,40);
+
+    Eigen::Matrix3d true_rotation(Eigen::AngleAxisd(M_PI / 4, Eigen::Vector3d::UnitZ()));
+    auto true_transform = compose_final_transform(true_rotation, Eigen::Vector3d(0.5, -0.2, 1.0));
+
+    Eigen::MatrixXd pointset_dash = apply_transform(pointset, true_transform);
+    for(int i = 0; i < 6; i++) {
+        pointset_dash.col(i) += Eigen::Vector3d(5, -3, 4);
+    }
+
+    auto transform = estimate_rigid_transform(pointset, pointset_dash);
+    REQUIRE_FALSE( transform.isApprox(true_transform, 0.01) );
+
+    Eigen::VectorXd residuals;
+    Eigen::Matrix4d next_transform;
+    double scale = 0;
+    for(int i = 0; i < 30; i++) {
+        robust_rigid_step(pointset, pointset_dash, transform, RobustKernel::Tukey, scale, residuals, next_transform);
+        scale = robust_scale_from_residuals(residuals);
+        transform = next_transform;
+    }
+
+    REQUIRE( transform.isApprox(true_transform, 1E-6) );
+}
+
+TEST_CASE( "robust surface-based registration for test data", "[register_surfaces]" ) {
+    auto data1 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt";
+    auto data2 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut_transformed.txt";
+    auto transform_file = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/matrix.4x4";
+
+    auto surface1 = load_pointcloud_from_file(data1);
+    auto surface2 = load_pointcloud_from_file(data2);
+    auto expected_transform = load_transform_from_file(transform_file);
+
+    RegistrationOptions options;
+    options.robust_kernel = RobustKernel::Huber;
+    auto estimated_transform = register_surfaces(surface1, surface2, expected_transform.inverse(), options).transform;
+
+    REQUIRE( estimated_transform.isApprox(expected_transform.inverse(), 0.01) );
+}
+
+TEST_CASE( "robust registration of more fixed than moving points ignores stale residuals", "[register_surfaces]" ) {
+    auto data1 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt";
+    auto data2 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut_transformed.txt";
+    auto transform_file = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/matrix.4x4";
+
+    // Half the fixed points are left without a partner, so the robust scale must come from the matched ones alone, not
+    // from whatever the workspace held before.
+    Eigen::MatrixXd fixed = load_pointcloud_from_file(data1).leftCols(400);
+    Eigen::MatrixXd moving = load_pointcloud_from_file(data2).leftCols(200);
+    auto expected_transform = load_transform_from_file(transform_file);
+
+    for(auto kernel : {RobustKernel::Huber, RobustKernel::Tukey}) {
+        RegistrationOptions options;
+        options.robust_kernel = kernel;
+
+        std::vector<Eigen::Matrix4d> transforms;
+        for(double stale : {0.0, 1.0, 1000.0}) {
+            RegistrationWorkspace workspace;
+            workspace.reserve(fixed.cols(), moving.cols());
+            workspace.residuals.setConstant(stale);
+            transforms.push_back(register_surfaces(fixed, moving, expected_transform.inverse(), options, workspace).transform);
+        }
+
+        REQUIRE( transforms[1] == transforms[0] );
+        REQUIRE( transforms[2] == transforms[0] );
+        REQUIRE( transforms[0].isApprox(expected_transform.inverse(), 0.01) );
+    }
+}
+
+TEST_CASE( "robust registration compares errors under one scale, so it stops where plain registration does", "[register_surfaces]" ) {
+    auto data1 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt";
+    auto data2 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut_transformed.txt";
+    auto transform_file = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/matrix.4x4";
+
+    auto surface1 = load_pointcloud_from_file(data1);
+    auto surface2 = load_pointcloud_from_file(data2);
+    Eigen::Matrix4d true_transform = load_transform_from_file(transform_file).inverse();
+    Eigen::Matrix4d perturbation = test_perturbation();
+
+    // The robust scale shrinks as the surfaces come together, which would make every error look smaller than the one
+    // before if each were measured under its own scale.
+    std::vector<std::pair<RegistrationMode, RobustKernel>> runs = {{RegistrationMode::Symmetric, RobustKernel::Huber},
+                                                                   {RegistrationMode::Generalized, RobustKernel::Tukey}};
+    std::vector<Eigen::Matrix4d> starts = {perturbation * true_transform, perturbation * perturbation * true_transform};
+    for(unsigned int k = 0; k < runs.size(); k++) {
+        RegistrationOptions options;
+        options.mode = runs[k].first;
+        auto plain = register_surfaces(surface1, surface2, starts[k], options);
+
+        options.robust_kernel = runs[k].second;
+        auto robust = register_surfaces(surface1, surface2, starts[k], options);
+
+        REQUIRE( robust.stop_reason == StopReason::ErrorIncreased );
+        REQUIRE( robust.iterations <= plain.iterations );
+        REQUIRE( robust.transform.isApprox(true_transform, 0.01) );
+    }
+}
+
+TEST_CASE( "se(3) exponential and logarithm are inverses", "[se3_exp]" ) {
+    Vector6d twist;
+    twist << 0.3, -0.2, 0.5, 1.0, 2.0, -3.0;
+
+    auto transform = se3_exp(twist);
+    REQUIRE( transform.block(0,0,3,3).determinant() == Approx(1) );
+    REQUIRE( se3_log(transform).isApprox(twist, 1E-9) );
+
+    SECTION( "small rotations use the series expansion" ) {
+        Vector6d small_twist;
+        small_twist << 1E-8, 0, 0, 1, 0, 0;
+        REQUIRE( se3_log(se3_exp(small_twist)).isApprox(small_twist, 1E-9) );
+    }
+}
+
+TEST_CASE( "Anderson acceleration speeds up a slowly converging fixed-point iteration", "[AndersonAcceleration]" ) {
+    // G(u) = A*u + b is a contraction with rate 0.95, so plain iteration converges slowly to (I - A)^-1 b.
+    Eigen::Matrix3d A;
+    A << 0.95, 0.00, 0.00,
+         0.00, 0.50, 0.10,
+         0.00, 0.00, 0.80;
+    Eigen::Vector3d b(1, 2, 3);
+    Eigen::Vector3d fixed_point = (Eigen::Matrix3d::Identity() - A).inverse() * b;
+
+    Eigen::VectorXd plain = Eigen::Vector3d::Zero();
+    Eigen::VectorXd accelerated = Eigen::Vector3d::Zero();
+    AndersonAcceleration anderson(3, 3);
+    for(int i = 0; i < 10; i++) {
+        plain = A * plain + b;
+        Eigen::VectorXd image = A * accelerated + b;
+        anderson.compute(accelerated, image, accelerated);
+    }
+
+    REQUIRE( (plain - fixed_point).norm() > 1 );
+    REQUIRE( (accelerated - fixed_point).norm() < 1E-6 );
+}
+
+TEST_CASE( "Anderson-accelerated registration matches plain registration in fewer iterations", "[register_surfaces]" ) {
+    // A densely sampled, nearly spherical cap: rotations about its centre are only weakly constrained, so plain
+    // point-to-point ICP creeps towards the answer. The fixed points are a sparse subset of the moving ones.
+    int n = 200;
+    int stride = 20;
+    Eigen::MatrixXd moving(3,n*n);
+    Eigen::MatrixXd fixed(3,(n/stride)*(n/stride));
+    for(int i = 0; i < n; i++) {
+        for(int j = 0; j < n; j++) {
+            double theta = 1.8 * (i / (n - 1.0) - 0.5);
+            double phi = 1.8 * (j / (n - 1.0) - 0.5);
+            moving.col(i*n + j) << sin(theta)*cos(phi), 1.2*sin(phi), 1.4*cos(theta)*cos(phi);
+            if(i % stride == 0 && j % stride == 0) {
+                fixed.col((i/stride)*(n/stride) + j/stride) = moving.col(i*n + j);
+            }
+        }
+    }
+
+    Vector6d twist;
+    twist << 0.1, -0.05, 0.03, 0.01, 0, 0;
+    auto true_transform = se3_exp(twist);
+    auto surface2 = apply_transform(moving, true_transform.inverse());
+
+    // Both run to the same increment tolerance.
+    RegistrationOptions options;
+    options.convergence.stop_on_error_increase = false;
+    options.convergence.max_iterations = 500;
+    options.convergence.rotation_tolerance = 1E-6;
+    options.convergence.translation_tolerance = 1E-6;
+    auto plain = register_surfaces(fixed, surface2, Eigen::Matrix4d::Identity(), options);
+
+    options.anderson_history = 5;
+    auto accelerated = register_surfaces(fixed, surface2, Eigen::Matrix4d::Identity(), options);
+
+    REQUIRE( plain.stop_reason == StopReason::IncrementConverged );
+    REQUIRE( accelerated.stop_reason == StopReason::IncrementConverged );
+    REQUIRE( plain.transform.isApprox(true_transform, 0.01) );
+    REQUIRE( accelerated.transform.isApprox(true_transform, 0.01) );
+    REQUIRE( accelerated.iterations < plain.iterations );
+}
+
+TEST_CASE( "convergence policy decides when registration stops", "[register_surfaces]" ) {
+    int n = 15;
+    auto surface1 = test_grid_surface(n);
+    auto true_transform = test_grid_motion();
+    auto surface2 = apply_transform(surface1, true_transform.inverse());
+
+    RegistrationOptions options;
+
+    SECTION( "an exact fit stops on the error threshold" ) {
+        options.convergence.absolute_error_tolerance = 1E-9;
+        auto result = register_surfaces(surface1, surface2, Eigen::Matrix4d::Identity(), options);
+
+        REQUIRE( result.stop_reason == StopReason::ErrorThresholdReached );
+        REQUIRE( result.error < 1E-9 );
+        REQUIRE( result.transform.isApprox(true_transform, 1E-6) );
+    }
+
+    SECTION( "the iteration cap is respected and reported" ) {
+        options.convergence.max_iterations = 1;
+        auto result = register_surfaces(surface1, surface2, Eigen::Matrix4d::Identity(), options);
+
+        REQUIRE( result.stop_reason == StopReason::MaxIterations );
+        REQUIRE( result.iterations == 1 );
+    }
+
+    SECTION( "small transform increments stop the iteration" ) {
+        surface2 = apply_transform(test_grid_surface(n, 0.2), true_transform.inverse());
+
+        options.convergence.stop_on_error_increase = false;
+        options.convergence.rotation_tolerance = 1E-6;
+        options.convergence.translation_tolerance = 1E-6;
+        auto result = register_surfaces(surface1, surface2, Eigen::Matrix4d::Identity(), options);
+
+        REQUIRE( result.stop_reason == StopReason::IncrementConverged );
+        REQUIRE( result.iterations < options.convergence.max_iterations );
+        REQUIRE( result.transform.isApprox(true_transform, 0.05) );
+
+        // A tolerance left at zero is ignored, rather than demanding an exactly zero increment.
+        options.convergence.translation_tolerance = 0;
+        options.convergence.rotation_tolerance = 1E-4;
+        auto rotation_result = register_surfaces(surface1, surface2, Eigen::Matrix4d::Identity(), options);
+        REQUIRE( rotation_result.stop_reason == StopReason::IncrementConverged );
+        REQUIRE( rotation_result.iterations < options.convergence.max_iterations );
+    }
+}
+
+#if defined(__GLIBC__)
+TEST_CASE( "steady-state ICP iterations make no heap allocations", "[RegistrationWorkspace]" ) {
+    int n = 12;
+    auto surface1 = test_grid_surface(n);
+    auto surface2 = apply_transform(test_grid_surface(n, 0.3), test_grid_motion().inverse());
+
+    RegistrationOptions options;
+    options.convergence.stop_on_error_increase = false;
+
+    SECTION( "plain and robust ICP, with and without Anderson acceleration" ) {
+        for(int variant = 0; variant < 2; variant++) {
+            options.robust_kernel = variant == 0 ? RobustKernel::None : RobustKernel::Huber;
+            options.anderson_history = variant == 0 ? 0 : 3;
+
+            RegistrationWorkspace workspace;
+            register_surfaces(surface1, surface2, Eigen::Matrix4d::Identity(), options, workspace);
+
+            options.convergence.max_iterations = 2;
+            long before = allocation_count.load();
+            auto short_run = register_surfaces(surface1, surface2, Eigen::Matrix4d::Identity(), options, workspace);
+            long short_allocations = allocation_count.load() - before;
+
+            options.convergence.max_iterations = 12;
+            before = allocation_count.load();
+            auto long_run = register_surfaces(surface1, surface2, Eigen::Matrix4d::Identity(), options, workspace);
+            long long_allocations = allocation_count.load() - before;
+
+            // Per-call setup allocates, which also shows that the counter is live.
+            REQUIRE( short_allocations > 0 );
+            REQUIRE( short_run.iterations == 2 );
+            REQUIRE( long_run.iterations == 12 );
+            REQUIRE( long_allocations == short_allocations );
+        }
+    }
+}
+#endif
+
+TEST_CASE( "k-d tree queries agree with exhaustive search", "[KdTree]" ) {
+    Eigen::MatrixXd points = Eigen::MatrixXd::Random(3,500);
+    KdTree tree(points);
+
+    for(int q = 0; q < 20; q++) {
+        Eigen::Vector3d query = Eigen::Vector3d::Random();
+        Eigen::VectorXd distances = (points.colwise() - query).colwise().squaredNorm();
+
+        int expected;
+        double expected_distance = distances.minCoeff(&expected);
+
+        double squared_distance;
+        REQUIRE( tree.nearest(query, squared_distance) == expected );
+        REQUIRE( squared_distance == Approx(expected_distance) );
+
+        std::vector<int> indices;
+        std::vector<double> squared_distances;
+        tree.nearest_k(query, 5, indices, squared_distances);
+        REQUIRE( indices.size() == 5 );
+        REQUIRE( indices[0] == expected );
+        for(int k = 0; k < 5; k++) {
+            REQUIRE( squared_distances[k] == Approx(distances(indices[k])) );
+            REQUIRE( (distances.array() < squared_distances[k]).count() == k );
+        }
+
+        tree.within_radius(query, 0.3, indices);
+        REQUIRE( (int)indices.size() == (distances.array() <= 0.09).count() );
+
+        // The approximate search may return a farther point, but never by more than the factor allowed.
+        int approximate = tree.nearest(query, squared_distance, 0.5);
+        REQUIRE( squared_distance == Approx(distances(approximate)) );
+        REQUIRE( squared_distance <= 1.5 * 1.5 * expected_distance );
+    }
+}
+
+TEST_CASE( "Generalized-ICP registers test data without an initial transform", "[register_surfaces]" ) {
+    auto data1 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt";
+    auto data2 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut_transformed.txt";
+    auto transform_file = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/matrix.4x4";
+
+    auto surface1 = load_pointcloud_from_file(data1);
+    auto surface2 = load_pointcloud_from_file(data2);
+    auto expected_transform = load_transform_from_file(transform_file);
+
+    RegistrationOptions options;
+    options.mode = RegistrationMode::Generalized;
+    auto result = register_surfaces(surface1, surface2, Eigen::Matrix4d::Identity(), options);
+
+    REQUIRE( result.transform.isApprox(expected_transform.inverse(), 0.01) );
+
+    // A prepared cache gives the same answer, and can be reused across registrations.
+    SurfaceCache fixed(surface1);
+    SurfaceCache moving(surface2);
+    prepare_surface_cache(fixed, options);
+    prepare_surface_cache(moving, options);
+
+    RegistrationWorkspace workspace;
+    auto cached_result = register_surfaces(fixed, moving, Eigen::Matrix4d::Identity(), options, workspace);
+    REQUIRE( cached_result.transform.isApprox(result.transform) );
+}
+
+TEST_CASE( "symmetric ICP registers test data without an initial transform", "[register_surfaces]" ) {
+    auto data1 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt";
+    auto data2 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut_transformed.txt";
+    auto transform_file = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/matrix.4x4";
+
+    auto surface1 = load_pointcloud_from_file(data1);
+    auto surface2 = load_pointcloud_from_file(data2);
+    auto expected_transform = load_transform_from_file(transform_file);
+
+    RegistrationOptions options;
+    options.mode = RegistrationMode::Symmetric;
+    auto result = register_surfaces(surface1, surface2, Eigen::Matrix4d::Identity(), options);
+
+    REQUIRE( result.transform.isApprox(expected_transform.inverse(), 0.01) );
+    REQUIRE( result.error < 1E-3 );
+
+    // A cache prepared for another mode has no normals.
+    SurfaceCache fixed(surface1);
+    SurfaceCache moving(surface2);
+    RegistrationWorkspace workspace;
+    REQUIRE_THROWS( register_surfaces(fixed, moving, Eigen::Matrix4d::Identity(), options, workspace) );
+}
+
+TEST_CASE( "FPFH features do not change under rigid motion", "[compute_fpfh_features]" ) {
+    auto surface = load_pointcloud_from_file("../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt");
+    surface = voxel_downsample(surface, 0.008);
+
+    Eigen::Matrix4d motion = test_arbitrary_motion();
+    auto moved = apply_transform(surface, motion);
+
+    KdTree tree(surface);
+    KdTree moved_tree(moved);
+    auto normals = compute_point_normals(surface, tree, 10);
+    auto moved_normals = compute_point_normals(moved, moved_tree, 10);
+    orient_normals_from_centroid(surface, normals);
+    orient_normals_from_centroid(moved, moved_normals);
+
+    auto features = compute_fpfh_features(surface, normals, tree, 0.03, 2);
+    auto moved_features = compute_fpfh_features(moved, moved_normals, moved_tree, 0.03, 1);
+
+    REQUIRE( features.rows() == fpfh_dimension );
+    REQUIRE( features.cols() == surface.cols() );
+    // Angles that fall on a bin edge can land either side of it, so only a few entries may differ.
+    REQUIRE( (features - moved_features).norm() < 0.01 * features.norm() );
+}
+
+TEST_CASE( "global initialisation registers test data in an arbitrary frame", "[global_register_surfaces]" ) {
+    auto data1 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt";
+    auto data2 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut_transformed.txt";
+    auto transform_file = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/matrix.4x4";
+
+    auto surface1 = load_pointcloud_from_file(data1);
+    auto surface2 = load_pointcloud_from_file(data2);
+    auto expected_transform = load_transform_from_file(transform_file);
+
+    // Move the second surface far beyond what ICP alone can recover from.
+    Eigen::Matrix4d motion = test_arbitrary_motion();
+    surface2 = apply_transform(surface2, motion);
+    Eigen::Matrix4d true_transform = expected_transform.inverse() * motion.inverse();
+
+    GlobalRegistrationOptions global_options;
+    global_options.voxel_size = 0.008;
+    global_options.threads = 2;
+    SECTION( "RANSAC" ) {
+        global_options.method = GlobalRegistrationMethod::Ransac;
+    }
+    SECTION( "fast global registration" ) {
+        global_options.method = GlobalRegistrationMethod::FastGlobal;
+    }
+    auto global_result = global_register_surfaces(surface1, surface2, global_options);
+
+    REQUIRE( global_result.inliers > global_result.correspondences / 2 );
+    REQUIRE( global_result.transform.isApprox(true_transform, 0.1) );
+
+    RegistrationOptions options;
+    options.mode = RegistrationMode::Generalized;
+    auto result = register_surfaces(surface1, surface2, global_result.transform, options);
+    REQUIRE( result.transform.isApprox(true_transform, 0.01) );
+}
+
+TEST_CASE( "fast global registration recovers a transform from matches with outliers", "[fast_global_registration]" ) {
+    std::mt19937 generator(3);
+    std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+
+    const int count = 200;
+    Eigen::MatrixXd fixed(3, count);
+    for(int i = 0; i < count; ++i) {
+        fixed.col(i) = Eigen::Vector3d(uniform(generator), uniform(generator), uniform(generator));
+    }
+
+    Eigen::Matrix4d motion = Eigen::Matrix4d::Identity();
+    motion.block(0,0,3,3) = Eigen::AngleAxisd(2.5, Eigen::Vector3d(-1, 3, 2).normalized()).toRotationMatrix();
+    motion.block(0,3,3,1) = Eigen::Vector3d(0.5, 1.0, -0.4);
+    auto moving = apply_transform(fixed, motion);
+
+    // A third of the matches point at the wrong fixed point.
+    Eigen::ArrayXi matches(count);
+    std::uniform_int_distribution<int> any_point(0, count - 1);
+    int outliers = 0;
+    for(int i = 0; i < count; ++i) {
+        matches(i) = i % 3 == 0 ? any_point(generator) : i;
+        outliers += matches(i) != i;
+    }
+
+    FastGlobalRegistrationOptions options;
+    options.max_correspondence_distance = 0.05;
+    auto result = fast_global_registration(fixed, moving, matches, options);
+
+    // The few outliers that survive the tuple test still pull slightly on the estimate.
+    REQUIRE( result.transform.isApprox(motion.inverse(), 1e-3) );
+    REQUIRE( result.inliers <= result.correspondences );
+    REQUIRE( result.inliers >= 0.9 * (count - outliers) );
+}
+
+TEST_CASE( "Super4PCS registers partly overlapping test data in an arbitrary frame", "[super4pcs_register_surfaces]" ) {
+    auto data1 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt";
+    auto data2 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut_transformed.txt";
+    auto transform_file = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/matrix.4x4";
+
+    auto surface1 = load_pointcloud_from_file(data1);
+    auto surface2 = load_pointcloud_from_file(data2);
+    auto expected_transform = load_transform_from_file(transform_file);
+
+    // Keep the 70% of each cloud at opposite ends along x, so that each overlaps the other by little more than half.
+    Eigen::MatrixXd fixed;
+    Eigen::MatrixXd moving;
+    split_along_x(surface1, surface2, 7, fixed, moving);
+
+    Eigen::Matrix4d motion = test_arbitrary_motion();
+    moving = apply_transform(moving, motion);
+    Eigen::Matrix4d true_transform = expected_transform.inverse() * motion.inverse();
+
+    Super4PcsOptions super4pcs_options;
+    super4pcs_options.overlap = 0.45;
+    super4pcs_options.voxel_size = 0.01;
+    super4pcs_options.threads = 2;
+    auto super4pcs_result = super4pcs_register_surfaces(fixed, moving, super4pcs_options);
+
+    REQUIRE( super4pcs_result.overlap >= 0.45 );
+    REQUIRE( super4pcs_result.transform.isApprox(true_transform, 0.1) );
+
+    RegistrationOptions options;
+    options.mode = RegistrationMode::Generalized;
+    options.robust_kernel = RobustKernel::Tukey;
+    auto result = register_surfaces(fixed, moving, super4pcs_result.transform, options);
+    REQUIRE( result.transform.isApprox(true_transform, 0.01) );
+}
+
+TEST_CASE( "cloud moments from one parallel pass match the two-pass definition", "[compute_cloud_moments]" ) {
+    std::mt19937 generator(5);
+    std::normal_distribution<double> normal(0.0, 1.0);
+
+    // Far from the origin, where raw sums of squares would lose most of their precision.
+    Eigen::MatrixXd surface(3, 1001);
+    for(int i = 0; i < surface.cols(); i++) {
+        surface.col(i) = Eigen::Vector3d(1000 + normal(generator), -2000 + 2 * normal(generator), 500 + 0.5 * normal(generator));
+    }
+
+    Eigen::Vector3d centroid = surface.rowwise().mean();
+    Eigen::MatrixXd centred = surface.colwise() - centroid;
+    Eigen::Matrix3d covariance = centred * centred.transpose() / surface.cols();
+
+    auto moments = compute_cloud_moments(surface, 3);
+    REQUIRE( moments.count == surface.cols() );
+    REQUIRE( (moments.centroid - centroid).norm() < 1e-9 );
+    REQUIRE( (moments.covariance - covariance).norm() < 1e-9 );
+}
+
+TEST_CASE( "moment alignment initialises registration of test data in an arbitrary frame", "[moment_alignment]" ) {
+    auto data1 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt";
+    auto data2 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut_transformed.txt";
+    auto transform_file = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/matrix.4x4";
+
+    auto surface1 = load_pointcloud_from_file(data1);
+    auto surface2 = load_pointcloud_from_file(data2);
+    auto expected_transform = load_transform_from_file(transform_file);
+
+    Eigen::Matrix4d motion = test_arbitrary_motion();
+    surface2 = apply_transform(surface2, motion);
+    Eigen::Matrix4d true_transform = expected_transform.inverse() * motion.inverse();
+
+    // The clouds hold the same points (up to rounding in the files), so the axes alone nearly recover the transform.
+    REQUIRE( moment_alignment(surface1, surface2).isApprox(true_transform, 1e-3) );
+
+    RegistrationOptions options;
+    options.mode = RegistrationMode::Generalized;
+    options.initial_alignment = InitialAlignment::Moments;
+    auto result = register_surfaces(surface1, surface2, Eigen::Matrix4d::Identity(), options);
+    REQUIRE( result.transform.isApprox(true_transform, 0.01) );
+}
+
+TEST_CASE( "correspondence rejection drops distant and boundary pairs in place", "[reject_correspondences]" ) {
+    // A 10x10 grid in the plane z = 0, whose 36 outer points are its boundary.
+    Eigen::MatrixXd grid(3, 100);
+    for(int i = 0; i < 100; i++) {
+        grid.col(i) = Eigen::Vector3d(i % 10, i / 10, 0);
+    }
+    SurfaceCache cache(grid);
+    ensure_boundary(cache, 10);
+
+    int boundary_points = 0;
+    bool boundary_correct = true;
+    for(int i = 0; i < 100; i++) {
+        bool outer = i % 10 == 0 || i % 10 == 9 || i / 10 == 0 || i / 10 == 9;
+        boundary_points += cache.boundary[i];
+        boundary_correct = boundary_correct && (cache.boundary[i] != 0) == outer;
+    }
+    REQUIRE( boundary_points == 36 );
+    REQUIRE( boundary_correct );
+
+    // Pair each point with itself, a few of them at a large distance.
+    Eigen::ArrayXi lookup(100);
+    Eigen::VectorXd distances(100);
+    for(int i = 0; i < 100; i++) {
+        lookup(i) = i;
+        distances(i) = i % 7 == 0 ? 5.0 : 0.1;
+    }
+
+    CorrespondenceRejection rejection;
+    rejection.max_distance = 1;
+    rejection.reject_boundary = true;
+    int kept;
+    double error = reject_correspondences(rejection, &cache, &cache, Eigen::Matrix3d::Identity(), RobustKernel::None, 0, distances, lookup, kept);
+
+    int expected_kept = 0;
+    bool lookup_correct = true;
+    for(int i = 0; i < 100; i++) {
+        bool keep = !cache.boundary[i] && i % 7 != 0;
+        expected_kept += keep;
+        lookup_correct = lookup_correct && lookup(i) == (keep ? i : -1);
+    }
+    REQUIRE( kept == expected_kept );
+    REQUIRE( lookup_correct );
+    REQUIRE( error == Approx(0.1) );
+
+    // Boundary pairs lose their distance, so that a later threshold cannot bring them back; distant ones keep it.
+    bool distances_correct = true;
+    for(int i = 0; i < 100; i++) {
+        distances_correct = distances_correct && (cache.boundary[i] ? std::isnan(distances(i)) : distances(i) == (i % 7 == 0 ? 5.0 : 0.1));
+    }
+    REQUIRE( distances_correct );
+
+    // Normals turned a right angle away from each other never agree.
+    rejection = CorrespondenceRejection();
+    rejection.max_normal_angle = 0.3;
+    lookup.setConstant(0);
+    Eigen::Matrix3d quarter_turn = Eigen::AngleAxisd(M_PI / 2, Eigen::Vector3d::UnitX()).toRotationMatrix();
+    REQUIRE_THROWS_AS( reject_correspondences(rejection, &cache, &cache, quarter_turn, RobustKernel::None, 0, distances, lookup, kept), PointMatchingException );
+}
+
+TEST_CASE( "boundary rejection lets ICP register surfaces that overlap by a third", "[register_surfaces]" ) {
+    auto data1 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt";
+    auto data2 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut_transformed.txt";
+    auto transform_file = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/matrix.4x4";
+
+    auto surface1 = load_pointcloud_from_file(data1);
+    auto surface2 = load_pointcloud_from_file(data2);
+    auto expected_transform = load_transform_from_file(transform_file);
+
+    // Keep the 60% of each cloud at opposite ends along x, so that each overlaps the other by a third.
+    Eigen::MatrixXd fixed;
+    Eigen::MatrixXd moving;
+    split_along_x(surface1, surface2, 6, fixed, moving);
+
+    Eigen::Matrix4d true_transform = expected_transform.inverse();
+    Eigen::Matrix4d perturbation = test_perturbation();
+
+    RegistrationOptions options;
+    options.mode = RegistrationMode::Generalized;
+    options.rejection.reject_boundary = true;
+    options.rejection.mad_factor = 3;
+    auto result = register_surfaces(fixed, moving, perturbation * true_transform, options);
+    REQUIRE( result.transform.isApprox(true_transform, 0.01) );
+}
+
+TEST_CASE( "rotation groups are closed sets of distinct rotations", "[rotation_group]" ) {
+    for(int order : {24, 60}) {
+        auto group = rotation_group(order);
+        REQUIRE( group.size() == static_cast<unsigned int>(order) );
+
+        bool rotations = true;
+        bool distinct = true;
+        for(unsigned int i = 0; i < group.size(); i++) {
+            rotations = rotations && group[i].isUnitary(1E-9) && isApproxEqual(group[i].determinant(), 1);
+            for(unsigned int j = 0; j < i; j++) {
+                distinct = distinct && !group[i].isApprox(group[j], 1E-6);
+            }
+        }
+        REQUIRE( rotations );
+        REQUIRE( distinct );
+
+        // The product of two elements is an element.
+        Eigen::Matrix3d product = group[order / 3] * group[order / 2];
+        bool found = false;
+        for(unsigned int i = 0; i < group.size(); i++) {
+            found = found || group[i].isApprox(product, 1E-6);
+        }
+        REQUIRE( found );
+    }
+
+    REQUIRE_THROWS( rotation_group(12) );
+}
+
+TEST_CASE( "multi-start registration finds the global minimum from an arbitrary frame", "[multi_start_register_surfaces]" ) {
+    auto data1 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt";
+    auto data2 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut_transformed.txt";
+    auto transform_file = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/matrix.4x4";
+
+    // Downsampled, to keep the number of registrations affordable.
+    auto surface1 = voxel_downsample(load_pointcloud_from_file(data1), 0.012);
+    auto surface2 = voxel_downsample(load_pointcloud_from_file(data2), 0.012);
+    auto expected_transform = load_transform_from_file(transform_file);
+
+    Eigen::Matrix4d motion = test_arbitrary_motion();
+    surface2 = apply_transform(surface2, motion);
+    Eigen::Matrix4d true_transform = expected_transform.inverse() * motion.inverse();
+
+    RegistrationOptions options;
+    options.mode = RegistrationMode::Symmetric;
+    auto single_start = register_surfaces(surface1, surface2, Eigen::Matrix4d::Identity(), options);
+    REQUIRE( !single_start.transform.isApprox(true_transform, 0.1) );
+
+    MultiStartOptions multi_start_options;
+    multi_start_options.threads = 2;
+    auto result = multi_start_register_surfaces(surface1, surface2, options, multi_start_options);
+
+    REQUIRE( result.best.transform.isApprox(true_transform, 0.01) );
+    REQUIRE( result.best.error < single_start.error );
+    REQUIRE( result.failed == 0 );
+
+    // Rounds restart each registration, so state that must carry across them is refused.
+    options.anderson_history = 3;
+    REQUIRE_THROWS_AS( multi_start_register_surfaces(surface1, surface2, options, multi_start_options), PointMatchingException );
+    options.anderson_history = 0;
+    options.convergence.time_limit = 0.05;
+    REQUIRE_THROWS_AS( multi_start_register_surfaces(surface1, surface2, options, multi_start_options), PointMatchingException );
+    options.convergence.time_limit = 0;
+    options.mini_batch.initial_batch_size = 50;
+    REQUIRE_THROWS_AS( multi_start_register_surfaces(surface1, surface2, options, multi_start_options), PointMatchingException );
+
+    // Moment alignment would replace every start's rotation with the same transform.
+    options.mini_batch.initial_batch_size = 0;
+    options.initial_alignment = InitialAlignment::Moments;
+    REQUIRE_THROWS_AS( multi_start_register_surfaces(surface1, surface2, options, multi_start_options), PointMatchingException );
+}
+
+TEST_CASE( "distance field agrees with nearest-neighbour distances near the surface", "[DistanceField]" ) {
+    auto surface = load_pointcloud_from_file("../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt");
+    double cell_size = 0.005;
+    DistanceField field(surface, cell_size, 0.02);
+    KdTree tree(surface);
+
+    // Nodes are exact to within interpolation; between them the error is bounded by the cell size.
+    std::mt19937 random(3);
+    std::uniform_real_distribution<double> unit(0, 1);
+    Eigen::Vector3d lower = field.lower_corner();
+    Eigen::Vector3d upper = field.upper_corner();
+    double worst_error = 0;
+    for(int k = 0; k < 1000; k++) {
+        Eigen::Vector3d point;
+        for(int d = 0; d < 3; d++) {
+            point(d) = lower(d) + (upper(d) - lower(d)) * unit(random);
+        }
+        double squared_distance;
+        tree.nearest(point, squared_distance);
+        if(sqrt(squared_distance) < 2 * cell_size) {
+            worst_error = std::max(worst_error, std::abs(field.distance(point) - sqrt(squared_distance)));
+        }
+    }
+    REQUIRE( worst_error < cell_size );
+
+    // Beyond the grid, distance keeps growing.
+    Eigen::Vector3d outside = upper + Eigen::Vector3d(0.1, 0, 0);
+    REQUIRE( field.distance(outside) > 0.1 );
+
+    // lower_distance never exceeds the true distance, inside the grid or beyond it.
+    int overestimates = 0;
+    for(int k = 0; k < 1000; k++) {
+        Eigen::Vector3d point;
+        for(int d = 0; d < 3; d++) {
+            point(d) = lower(d) - 0.05 + (upper(d) - lower(d) + 0.1) * unit(random);
+        }
+        double squared_distance;
+        tree.nearest(point, squared_distance);
+        overestimates += field.lower_distance(point) > sqrt(squared_distance);
+    }
+    REQUIRE( overestimates == 0 );
+}
+
+TEST_CASE( "Go-ICP finds the global optimum, or reports its gap when out of time", "[go_icp_register_surfaces]" ) {
+    // Three perpendicular arms of different lengths, so that only one pose aligns them.
+    int lengths[3] = { 10, 6, 3 };
+    Eigen::MatrixXd surface1(3, 19);
+    int k = 0;
+    for(int axis = 0; axis < 3; axis++) {
+        for(int i = 1; i <= lengths[axis]; i++) {
+            surface1.col(k) = Eigen::Vector3d::Zero();
+            surface1(axis, k) = 0.1 * i;
+            k++;
+        }
+    }
+
+    Eigen::Matrix4d motion = Eigen::Matrix4d::Identity();
+    motion.block(0,0,3,3) = Eigen::AngleAxisd(2.0, Eigen::Vector3d(1, 2, 3).normalized()).toRotationMatrix();
+    motion.block(0,3,3,1) = Eigen::Vector3d(0.1, -0.2, 0.1);
+    auto surface2 = apply_transform(surface1, motion);
+
+    GoIcpOptions options;
+    options.local_options.mode = RegistrationMode::PointToPoint;
+    options.threads = 2;
+    auto result = go_icp_register_surfaces(surface1, surface2, options);
+
+    REQUIRE( result.optimal );
+    REQUIRE( result.transform.isApprox(motion.inverse(), 1E-6) );
+    REQUIRE( result.error < 1E-6 );
+    REQUIRE( result.lower_bound <= result.error );
+    REQUIRE( result.gap >= 0 );
+
+    // With no time to search and an unreachable tolerance, the best pose so far comes back with an honest gap. The first
+    // local registration can still find the optimum on data this clean, so optimal is not checked.
+    options.time_limit = 1E-3;
+    options.tolerance = 1E-12;
+    auto capped = go_icp_register_surfaces(surface1, surface2, options);
+    REQUIRE( capped.lower_bound <= capped.error );
+    REQUIRE( capped.gap == capped.error - capped.lower_bound );
+
+    options.local_options.initial_alignment = InitialAlignment::Moments;
+    REQUIRE_THROWS_AS( go_icp_register_surfaces(surface1, surface2, options), PointMatchingException );
+}
+
+TEST_CASE( "pose solver minimises point-to-point and point-to-plane metrics", "[solve_pose]" ) {
+    std::mt19937 generator(11);
+    std::normal_distribution<double> normal(0.0, 1.0);
+
+    Eigen::Matrix4d motion = Eigen::Matrix4d::Identity();
+    motion.block(0,0,3,3) = Eigen::AngleAxisd(0.4, Eigen::Vector3d(1, -2, 1).normalized()).toRotationMatrix();
+    motion.block(0,3,3,1) = Eigen::Vector3d(0.5, -0.3, 0.2);
+
+    Eigen::MatrixXd moving(3, 500);
+    Eigen::MatrixXd normals(3, 500);
+    for(int i = 0; i < moving.cols(); i++) {
+        moving.col(i) = Eigen::Vector3d(normal(generator), normal(generator), normal(generator));
+        normals.col(i) = Eigen::Vector3d(normal(generator), normal(generator), normal(generator)).normalized();
+    }
+    Eigen::MatrixXd fixed = apply_transform(moving, motion);
+    Eigen::ArrayXi correspondences = Eigen::ArrayXi::LinSpaced(moving.cols(), 0, moving.cols() - 1);
+
+    SECTION( "point-to-point, with noise, agrees with the closed-form estimate on any number of threads" ) {
+        for(int i = 0; i < fixed.cols(); i++) {
+            fixed.col(i) += 0.01 * Eigen::Vector3d(normal(generator), normal(generator), normal(generator));
+        }
+        Eigen::Matrix4d expected = estimate_rigid_transform(moving, fixed);
+
+        PointToPointMetric metric(fixed, moving, correspondences);
+        PoseSolverOptions options;
+        auto single = solve_pose(metric, Eigen::Matrix4d::Identity(), options);
+        REQUIRE( single.transform.isApprox(expected, 1e-9) );
+
+        options.threads = 3;
+        auto threaded = solve_pose(metric, Eigen::Matrix4d::Identity(), options);
+        REQUIRE( threaded.transform.isApprox(single.transform, 1e-12) );
+        REQUIRE( threaded.cost == Approx(single.cost) );
+    }
+
+    SECTION( "point-to-plane converges to the exact pose under either step rule" ) {
+        Eigen::MatrixXd fixed_normals = motion.block(0,0,3,3) * normals;
+        PointToPlaneMetric metric(fixed, fixed_normals, moving, correspondences);
+        PoseSolverOptions options;
+        options.max_iterations = 20;
+        auto damped = solve_pose(metric, Eigen::Matrix4d::Identity(), options);
+        REQUIRE( damped.transform.isApprox(motion, 1e-9) );
+        REQUIRE( damped.cost < 1e-20 );
+
+        options.levenberg_marquardt = false;
+        auto undamped = solve_pose(metric, Eigen::Matrix4d::Identity(), options);
+        REQUIRE( undamped.transform.isApprox(motion, 1e-9) );
+    }
+}
+
+TEST_CASE( "anytime registration returns the best transform so far within its time limit", "[register_surfaces]" ) {
+    auto data1 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt";
+    auto data2 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut_transformed.txt";
+    auto transform_file = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/matrix.4x4";
+
+    auto surface1 = load_pointcloud_from_file(data1);
+    auto surface2 = load_pointcloud_from_file(data2);
+    auto expected_transform = load_transform_from_file(transform_file);
+
+    Eigen::Matrix4d true_transform = expected_transform.inverse();
+    Eigen::Matrix4d perturbation = test_perturbation();
+
+    RegistrationOptions options;
+    options.mode = RegistrationMode::Generalized;
+    options.convergence.initial_sample_size = 100;
+    SurfaceCache fixed(surface1);
+    SurfaceCache moving(surface2);
+    prepare_surface_cache(fixed, options);
+    prepare_surface_cache(moving, options);
+    RegistrationWorkspace workspace;
+
+    SECTION( "with time to spare, it finishes on every point" ) {
+        options.convergence.time_limit = 100;
+        auto result = register_surfaces(fixed, moving, perturbation * true_transform, options, workspace);
+        REQUIRE( result.converged );
+        REQUIRE( result.sample_size == surface2.cols() );
+        REQUIRE( result.stop_reason != StopReason::TimeLimitReached );
+        REQUIRE( result.transform.isApprox(true_transform, 1e-3) );
+    }
+
+    SECTION( "with too little time, it stops early on a sample" ) {
+        options.convergence.time_limit = 1e-4;
+        auto result = register_surfaces(fixed, moving, perturbation * true_transform, options, workspace);
+
+        REQUIRE( !result.converged );
+        REQUIRE( result.stop_reason == StopReason::TimeLimitReached );
+        REQUIRE( result.sample_size < surface2.cols() );
+        REQUIRE( std::isfinite(result.error) );
+    }
+}
+
+TEST_CASE( "cancelled registrations stop promptly, at every stage", "[CancellationToken]" ) {
+    auto data1 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt";
+    auto data2 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut_transformed.txt";
+
+    auto surface1 = load_pointcloud_from_file(data1);
+    auto surface2 = load_pointcloud_from_file(data2);
+
+    SECTION( "an already cancelled token stops each stage before it does any work" ) {
+        CancellationToken token;
+        token.cancel();
+
+        KdTree tree(surface1);
+        REQUIRE_THROWS_AS( compute_point_normals(surface1, tree, 10, &token), RegistrationCancelledException );
+
+        RegistrationOptions options;
+        options.cancellation = &token;
+        REQUIRE_THROWS_AS( register_surfaces(surface1, surface2, Eigen::Matrix4d::Identity(), options), RegistrationCancelledException );
+        options.mode = RegistrationMode::Generalized;
+        REQUIRE_THROWS_AS( register_surfaces(surface1, surface2, Eigen::Matrix4d::Identity(), options), RegistrationCancelledException );
+
+        MultiStartOptions multi_start_options;
+        multi_start_options.threads = 2;
+        REQUIRE_THROWS_AS( multi_start_register_surfaces(surface1, surface2, options, multi_start_options), RegistrationCancelledException );
+
+        GlobalRegistrationOptions global_options;
+        global_options.cancellation = &token;
+        REQUIRE_THROWS_AS( global_register_surfaces(surface1, surface2, global_options), RegistrationCancelledException );
+
+        // Once reset, the token lets the same work run to completion.
+        token.reset();
+        REQUIRE_NOTHROW( compute_point_normals(surface1, tree, 10, &token) );
+    }
+
+    SECTION( "a registration cancelled from another thread stops within its current block" ) {
+        CancellationToken token;
+        RegistrationOptions options;
+        options.cancellation = &token;
+        options.convergence.stop_on_error_increase = false;
+        options.convergence.max_iterations = 1000;
+
+        auto registration = std::async(std::launch::async, [&]() {
+            return register_surfaces(surface1, surface2, Eigen::Matrix4d::Identity(), options);
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        token.cancel();
+        REQUIRE_THROWS_AS( registration.get(), RegistrationCancelledException );
+    }
+}
+
+TEST_CASE( "an observer sees every iteration's error, increment, correspondences and stage times", "[RegistrationObserver]" ) {
+    auto data1 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt";
+    auto data2 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut_transformed.txt";
+    auto transform_file = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/matrix.4x4";
+
+    auto surface1 = load_pointcloud_from_file(data1);
+    auto surface2 = load_pointcloud_from_file(data2);
+    auto expected_transform = load_transform_from_file(transform_file);
+
+    Eigen::Matrix4d true_transform = expected_transform.inverse();
+    Eigen::Matrix4d perturbation = test_perturbation();
+
+    std::vector<IterationStats> history;
+    auto observer = make_observer([&history](const IterationStats& stats) { history.push_back(stats); });
+
+    RegistrationOptions options;
+    options.mode = RegistrationMode::Generalized;
+    options.rejection.max_distance = 0.01;
+    options.observer = &observer;
+    auto result = register_surfaces(surface1, surface2, perturbation * true_transform, options);
+
+    REQUIRE( (int)history.size() == result.iterations );
+    REQUIRE( history.back().best_error == result.error );
+    for(unsigned int k = 0; k < history.size(); k++) {
+        REQUIRE( history[k].iteration == (int)k + 1 );
+        REQUIRE( history[k].points == surface2.cols() );
+        REQUIRE( history[k].correspondences > 0 );
+        REQUIRE( history[k].correspondences <= surface2.cols() );
+        REQUIRE( history[k].times.search > 0 );
+        REQUIRE( history[k].times.rejection >= 0 );
+        REQUIRE( history[k].times.solve > 0 );
+    }
+
+    // The first steps undo the perturbation; the last ones only polish the result.
+    REQUIRE( history.front().rotation_increment > 0.01 );
+    REQUIRE( history.back().rotation_increment < 1e-3 );
+    // From the perturbed start some matches are beyond the rejection distance; once aligned, (nearly) none are.
+    REQUIRE( history.front().correspondences < history.back().correspondences );
+}
+
+TEST_CASE( "NDT registers test data from a perturbed start, whatever the number of threads", "[ndt_register_surfaces]" ) {
+    auto data1 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt";
+    auto data2 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut_transformed.txt";
+    auto transform_file = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/matrix.4x4";
+
+    auto surface1 = load_pointcloud_from_file(data1);
+    auto surface2 = load_pointcloud_from_file(data2);
+    auto expected_transform = load_transform_from_file(transform_file);
+
+    Eigen::Matrix4d true_transform = expected_transform.inverse();
+    Eigen::Matrix4d perturbation = test_perturbation();
+
+    // The voxel statistics are merged across threads, so only rounding may differ.
+    double voxel_size = (surface1.rowwise().maxCoeff() - surface1.rowwise().minCoeff()).norm() / 20;
+    auto grid = build_ndt_grid(surface1, voxel_size, 6, 1);
+    auto threaded_grid = build_ndt_grid(surface1, voxel_size, 6, 3);
+    REQUIRE( grid.voxels.size() > 100 );
+    REQUIRE( threaded_grid.voxels.size() == grid.voxels.size() );
+    bool voxels_match = true;
+    for(unsigned int v = 0; v < grid.voxels.size(); v++) {
+        voxels_match = voxels_match && threaded_grid.voxels[v].count == grid.voxels[v].count
+                       && threaded_grid.voxels[v].mean.isApprox(grid.voxels[v].mean, 1e-12)
+                       && threaded_grid.voxels[v].inverse_covariance.isApprox(grid.voxels[v].inverse_covariance, 1e-8);
+    }
+    REQUIRE( voxels_match );
+
+    // Every third moving point is plenty for NDT, and keeps the test quick.
+    Eigen::MatrixXd sample(3, (surface2.cols() + 2) / 3);
+    for(int k = 0; k < sample.cols(); k++) {
+        sample.col(k) = surface2.col(3 * k);
+    }
+    auto result = ndt_register_surfaces(threaded_grid, sample, perturbation * true_transform);
+    REQUIRE( result.converged );
+    REQUIRE( result.transform.isApprox(true_transform, 1e-2) );
+    REQUIRE( result.score < -0.5 );
+    REQUIRE( result.matched_points > sample.cols() / 2 );
+
+    REQUIRE_THROWS_AS( ndt_register_surfaces(surface1, surface2, true_transform, NdtOptions{-1}), PointMatchingException );
+}
+
+TEST_CASE( "Fast and truncated Gauss transforms match the direct sum", "[gauss_transform]" ) {
+    auto data = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt";
+    auto surface = load_pointcloud_from_file(data);
+
+    Eigen::MatrixXd sources(3, (surface.cols() + 3) / 4);
+    Eigen::MatrixXd targets(3, (surface.cols() + 2) / 4);
+    for(int k = 0; k < sources.cols(); k++) {
+        sources.col(k) = surface.col(4 * k);
+    }
+    for(int k = 0; k < targets.cols(); k++) {
+        targets.col(k) = surface.col(4 * k + 1);
+    }
+    std::mt19937 generator(5);
+    std::uniform_real_distribution<double> uniform(-1, 1);
+    Eigen::MatrixXd weights(2, sources.cols());
+    for(int k = 0; k < sources.cols(); k++) {
+        weights(0, k) = 1;
+        weights(1, k) = uniform(generator);
+    }
+    double weight_sum = weights.cwiseAbs().rowwise().sum().maxCoeff();
+
+    GaussTransformOptions options;
+    options.threads = 3;
+    Eigen::MatrixXd direct;
+    Eigen::MatrixXd sums;
+    double extent = (surface.rowwise().maxCoeff() - surface.rowwise().minCoeff()).norm();
+    for(double bandwidth : {extent, extent / 50}) {
+        options.method = GaussTransformMethod::Direct;
+        gauss_transform(sources, weights, targets, bandwidth, direct, options);
+        for(auto method : {GaussTransformMethod::Truncated, GaussTransformMethod::Fast}) {
+            options.method = method;
+            REQUIRE( gauss_transform(sources, weights, targets, bandwidth, sums, options) == method );
+            REQUIRE( (sums - direct).cwiseAbs().maxCoeff() < 1e-5 * weight_sum );
+        }
+    }
+
+    // A tighter epsilon shrinks the clusters, so the expansions keep up with it.
+    options.method = GaussTransformMethod::Direct;
+    gauss_transform(sources, weights, targets, extent, direct, options);
+    options.method = GaussTransformMethod::Fast;
+    options.epsilon = 1e-10;
+    gauss_transform(sources, weights, targets, extent, sums, options);
+    REQUIRE( (sums - direct).cwiseAbs().maxCoeff() < 1e-9 * weight_sum );
+    options.epsilon = 1e-6;
+
+    // Wide kernels are expanded, and narrow ones summed over close pairs.
+    options.method = GaussTransformMethod::Automatic;
+    REQUIRE( gauss_transform(sources, weights, targets, extent, sums, options) == GaussTransformMethod::Fast );
+    REQUIRE( gauss_transform(sources, weights, targets, extent / 200, sums, options) == GaussTransformMethod::Truncated );
+
+    REQUIRE_THROWS_AS( gauss_transform(sources, weights, targets, 0, sums), PointMatchingException );
+}
+
+TEST_CASE( "Rigid CPD registers test data from a perturbed start", "[cpd_register_surfaces]" ) {
+    auto data1 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt";
+    auto data2 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut_transformed.txt";
+    auto transform_file = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/matrix.4x4";
+
+    auto surface1 = load_pointcloud_from_file(data1);
+    auto surface2 = load_pointcloud_from_file(data2);
+    auto expected_transform = load_transform_from_file(transform_file);
+
+    Eigen::Matrix4d true_transform = expected_transform.inverse();
+    Eigen::Matrix4d perturbation = test_perturbation();
+
+    // Every fifth point of each cloud keeps the test quick; the samples are of different points, so the fit is not exact.
+    Eigen::MatrixXd sample1(3, (surface1.cols() + 4) / 5);
+    Eigen::MatrixXd sample2(3, (surface2.cols() + 3) / 5);
+    for(int k = 0; k < sample1.cols(); k++) {
+        sample1.col(k) = surface1.col(5 * k);
+    }
+    for(int k = 0; k < sample2.cols(); k++) {
+        sample2.col(k) = surface2.col(5 * k + 1);
+    }
+
+    CpdOptions options;
+    options.gauss_transform.threads = 3;
+    auto result = cpd_register_surfaces(sample1, sample2, perturbation * true_transform, options);
+    REQUIRE( result.converged );
+    REQUIRE( result.transform.isApprox(true_transform, 1e-2) );
+    REQUIRE( result.points.cols() == sample2.cols() );
+    REQUIRE( sqrt(result.sigma2) < 0.01 );
+}
+
+TEST_CASE( "Non-rigid CPD undoes a smooth deformation", "[cpd_deform_surfaces]" ) {
+    auto data = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt";
+    auto surface = load_pointcloud_from_file(data);
+
+    Eigen::MatrixXd fixed(3, (surface.cols() + 6) / 7);
+    for(int k = 0; k < fixed.cols(); k++) {
+        fixed.col(k) = surface.col(7 * k);
+    }
+    Eigen::Vector3d centre = fixed.rowwise().mean();
+    Eigen::MatrixXd moving = fixed;
+    for(int k = 0; k < moving.cols(); k++) {
+        Eigen::Vector3d p = fixed.col(k) - centre;
+        moving.col(k) += Eigen::Vector3d(0.01 * sin(30 * p(1)), 0.01 * cos(20 * p(0)), 0.005 * sin(25 * p(2)));
+    }
+    double initial_error = sqrt((moving - fixed).colwise().squaredNorm().mean());
+
+    // Fewer landmarks than points, so that the kernel is approximated.
+    CpdOptions options;
+    options.rank = 60;
+    auto result = cpd_deform_surfaces(fixed, moving, Eigen::Matrix4d::Identity(), options);
+    double error = sqrt((result.points - fixed).colwise().squaredNorm().mean());
+    REQUIRE( result.converged );
+    REQUIRE( result.transform == Eigen::Matrix4d::Identity() );
+    REQUIRE( error < initial_error / 10 );
+
+    options.lambda = 0;
+    REQUIRE_THROWS_AS( cpd_deform_surfaces(fixed, moving, Eigen::Matrix4d::Identity(), options), PointMatchingException );
+}
+
+TEST_CASE( "A triangle BVH finds the exact closest points on a mesh", "[TriangleBvh]" ) {
+    // One triangle, queried from each of its Voronoi regions.
+    TriangleMesh triangle;
+    triangle.vertices.resize(3, 3);
+    triangle.vertices << 0, 1, 0,
+                         0, 0, 1,
+                         0, 0, 0;
+    triangle.triangles.resize(3, 1);
+    triangle.triangles << 0, 1, 2;
+    TriangleBvh single(triangle);
+    REQUIRE( single.normals().col(0).isApprox(Eigen::Vector3d(0, 0, 1)) );
+
+    Eigen::Vector3d point;
+    double squared_distance;
+    std::vector<std::pair<Eigen::Vector3d, Eigen::Vector3d> > cases = {
+        { Eigen::Vector3d(0.25, 0.25, 2), Eigen::Vector3d(0.25, 0.25, 0) },
+        { Eigen::Vector3d(-1, -1, 1), Eigen::Vector3d(0, 0, 0) },
+        { Eigen::Vector3d(2, -1, 0), Eigen::Vector3d(1, 0, 0) },
+        { Eigen::Vector3d(0.5, -1, -1), Eigen::Vector3d(0.5, 0, 0) },
+        { Eigen::Vector3d(-3, 0.5, 0), Eigen::Vector3d(0, 0.5, 0) },
+        { Eigen::Vector3d(1, 1, 1), Eigen::Vector3d(0.5, 0.5, 0) },
+    };
+    for(const auto& query : cases) {
+        REQUIRE( single.closest_point(query.first, point, squared_distance) == 0 );
+        REQUIRE( (point - query.second).norm() < 1e-12 );
+        REQUIRE( squared_distance == Approx((query.first - query.second).squaredNorm()) );
+    }
+
+    // The test mesh, against a hierarchy with a single leaf, so that every triangle is tested.
+    auto mesh = load_mesh_from_vtk_file("../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.vtk");
+    REQUIRE( mesh.vertices.cols() == 2205 );
+    REQUIRE( mesh.triangles.cols() == 4224 );
+    TriangleBvh bvh(mesh);
+    TriangleBvh exhaustive(mesh, mesh.triangles.cols());
+
+    std::mt19937 generator(11);
+    Eigen::Vector3d lower = mesh.vertices.rowwise().minCoeff();
+    Eigen::Vector3d extent = mesh.vertices.rowwise().maxCoeff() - lower;
+    std::uniform_real_distribution<double> uniform(-0.25, 1.25);
+    bool all_match = true;
+    for(int k = 0; k < 50; k++) {
+        Eigen::Vector3d query = lower + Eigen::Vector3d(uniform(generator), uniform(generator), uniform(generator)).cwiseProduct(extent);
+        Eigen::Vector3d expected_point;
+        double expected_distance;
+        exhaustive.closest_point(query, expected_point, expected_distance);
+        bvh.closest_point(query, point, squared_distance);
+        all_match = all_match && std::abs(squared_distance - expected_distance) <= 1e-15 && (point - query).squaredNorm() == Approx(squared_distance);
+    }
+    REQUIRE( all_match );
+
+    REQUIRE_THROWS_AS( load_mesh_from_vtk_file("../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt"), PointMatchingException );
+}
+
+TEST_CASE( "ICP to a mesh registers points on its surface beyond the vertex spacing", "[register_surface_to_mesh]" ) {
+    auto mesh = load_mesh_from_vtk_file("../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.vtk");
+    auto transform_file = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/matrix.4x4";
+    auto expected_transform = load_transform_from_file(transform_file);
+
+    Eigen::Matrix4d true_transform = expected_transform.inverse();
+    Eigen::Matrix4d perturbation = test_perturbation();
+
+    // Random points inside the triangles, moved like the transformed test data.
+    std::mt19937 generator(3);
+    std::vector<int> triangles;
+    Eigen::MatrixXd surface2 = apply_transform(sample_mesh_triangles(mesh, 400, generator, triangles), expected_transform);
+
+    MeshRegistrationOptions options;
+    options.threads = 3;
+    auto result = register_surface_to_mesh(mesh, surface2, perturbation * true_transform, options);
+    REQUIRE( result.converged );
+    REQUIRE( result.error < 1e-6 );
+    REQUIRE( result.transform.isApprox(true_transform, 1e-5) );
+
+    options.point_to_plane = false;
+    auto point_result = register_surface_to_mesh(mesh, surface2, perturbation * true_transform, options);
+    REQUIRE( point_result.transform.isApprox(true_transform, 1e-2) );
+
+    // Matching to the vertices alone leaves an error of the order of their spacing.
+    auto cloud_result = register_surfaces(mesh.vertices, surface2, perturbation * true_transform, RegistrationOptions());
+    REQUIRE( cloud_result.error > 100 * result.error );
+}
+
+TEST_CASE( "Registration to a narrow-band signed distance field needs no correspondences", "[sdf_register_surfaces]" ) {
+    auto mesh = load_mesh_from_vtk_file("../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.vtk");
+    auto transform_file = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/matrix.4x4";
+    auto expected_transform = load_transform_from_file(transform_file);
+
+    Eigen::Matrix4d true_transform = expected_transform.inverse();
+    Eigen::Matrix4d perturbation = test_perturbation();
+
+    double cell_size = 0.005;
+    double band = 0.015;
+    SignedDistanceField field(mesh, cell_size, band, 3);
+
+    // Just off the middle of a triangle, the field is signed by the side of its normal and its gradient is the normal.
+    std::mt19937 generator(3);
+    std::vector<int> triangles;
+    Eigen::MatrixXd samples = sample_mesh_triangles(mesh, 400, generator, triangles);
+    TriangleBvh bvh(mesh);
+    int consistent = 0;
+    int tested = 0;
+    for(int k = 0; k < samples.cols(); k += 4) {
+        double offset = (k % 8 == 0 ? 1 : -1) * cell_size / 2;
+        double value;
+        Eigen::Vector3d gradient;
+        tested++;
+        if(field.distance(samples.col(k) + offset * bvh.normals().col(triangles[k]), value, gradient)) {
+            consistent += std::abs(value - offset) < cell_size / 4 && gradient.normalized().dot(bvh.normals().col(triangles[k])) > 0.9;
+        }
+    }
+    REQUIRE( consistent > 0.9 * tested );
+    REQUIRE( field.distance(mesh.vertices.rowwise().maxCoeff() + Eigen::Vector3d::Constant(2 * band)) == band );
+
+    // Points sampled on the surface, moved like the transformed test data.
+    Eigen::MatrixXd surface2 = apply_transform(samples, expected_transform);
+    SdfRegistrationOptions options;
+    options.threads = 3;
+    auto result = sdf_register_surfaces(field, surface2, perturbation * true_transform, options);
+    REQUIRE( result.matched_points == surface2.cols() );
+    REQUIRE( result.error < cell_size / 10 );
+    REQUIRE( result.transform.isApprox(true_transform, 1e-3) );
+    REQUIRE( result.converged );
+
+    // Too few iterations to reach the step tolerance.
+    options.max_iterations = 1;
+    REQUIRE( !sdf_register_surfaces(field, surface2, perturbation * true_transform, options).converged );
+
+    REQUIRE_THROWS_AS( SignedDistanceField(mesh, 0, band), PointMatchingException );
+}
+
+TEST_CASE( "Multi-view registration brings overlapping partial scans into one frame", "[multi_view_register_surfaces]" ) {
+    auto data = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt";
+    auto surface = load_pointcloud_from_file(data);
+
+    // Six slabs along x, each holding three eighths of the points and overlapping the next by two thirds, seen from
+    // random frames.
+    std::vector<int> order(surface.cols());
+    for(int i = 0; i < surface.cols(); i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](int a, int b) { return surface(0, a) < surface(0, b); });
+
+    std::mt19937 generator(5);
+    std::uniform_real_distribution<double> uniform(-1, 1);
+    int scan_count = 6;
+    int scan_size = 3 * surface.cols() / 8;
+    std::vector<Eigen::MatrixXd> scans(scan_count);
+    std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d> > true_poses(scan_count, Eigen::Matrix4d::Identity());
+    std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d> > initial_poses(scan_count);
+    for(int k = 0; k < scan_count; k++) {
+        Eigen::Vector3d axis(uniform(generator), uniform(generator), uniform(generator));
+        true_poses[k].block(0,0,3,3) = Eigen::AngleAxisd(3 * uniform(generator), axis.normalized()).toRotationMatrix();
+        true_poses[k].block(0,3,3,1) = Eigen::Vector3d(uniform(generator), uniform(generator), uniform(generator));
+        Eigen::Matrix4d to_scan = true_poses[k].inverse();
+        scans[k].resize(3, scan_size);
+        for(int i = 0; i < scan_size; i++) {
+            scans[k].col(i) = to_scan.block(0,0,3,3) * surface.col(order[k * surface.cols() / 8 + i]) + to_scan.block(0,3,3,1);
+        }
+
+        Eigen::Matrix4d perturbation = Eigen::Matrix4d::Identity();
+        Eigen::Vector3d perturbation_axis(uniform(generator), uniform(generator), uniform(generator));
+        perturbation.block(0,0,3,3) = Eigen::AngleAxisd(0.05, perturbation_axis.normalized()).toRotationMatrix();
+        perturbation.block(0,3,3,1) = 0.003 * Eigen::Vector3d(uniform(generator), uniform(generator), uniform(generator));
+        initial_poses[k] = perturbation * true_poses[k];
+    }
+
+    MultiViewOptions options;
+    options.pairwise.mode = RegistrationMode::Symmetric;
+    options.pairwise.rejection.reject_boundary = true;
+    options.pairwise.rejection.mad_factor = 3;
+    options.threads = 3;
+
+    // The boxes of slabs two or more apart can still overlap, though they share few or no points and register wrongly.
+    options.max_edge_error = 1e-4;
+    auto result = multi_view_register_surfaces(scans, initial_poses, options);
+    REQUIRE( result.poses.size() == scans.size() );
+    REQUIRE( result.edges.size() > scans.size() - 1 );
+    for(const auto& edge : result.edges) {
+        REQUIRE( (edge.used || edge.to > edge.from + 1) );
+    }
+    REQUIRE( result.poses[0].isApprox(Eigen::Matrix4d::Identity()) );
+    for(int k = 1; k < scan_count; k++) {
+        REQUIRE( result.poses[k].isApprox(true_poses[0].inverse() * true_poses[k], 1e-3) );
+    }
+
+    REQUIRE_THROWS_AS( multi_view_register_surfaces(std::vector<Eigen::MatrixXd>(1, scans[0]), initial_poses, options), PointMatchingException );
+    options.pairwise.initial_alignment = InitialAlignment::Moments;
+    REQUIRE_THROWS_AS( multi_view_register_surfaces(scans, initial_poses, options), PointMatchingException );
+    options.pairwise.initial_alignment = InitialAlignment::None;
+
+    // Options that the caches reject, while they are prepared in parallel.
+    options.pairwise.normal_neighbours = 2;
+    REQUIRE_THROWS_AS( multi_view_register_surfaces(scans, initial_poses, options), PointMatchingException );
+}
+
+TEST_CASE( "Tracking warm-starts each frame from the predicted motion", "[RegistrationTracker]" ) {
+    auto data = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt";
+    auto surface = load_pointcloud_from_file(data);
+
+    // Every other point keeps the test quick.
+    Eigen::MatrixXd model(3, (surface.cols() + 1) / 2);
+    for(int k = 0; k < model.cols(); k++) {
+        model.col(k) = surface.col(2 * k);
+    }
+
+    // Frames of the model seen from a sensor moving with a slowly changing velocity.
+    Vector6d velocity;
+    velocity << 0.02, -0.01, 0.015, 0.002, 0.001, -0.0015;
+    Vector6d acceleration;
+    acceleration << 0.001, 0.0005, -0.0005, 0.0001, -0.0001, 0.00005;
+    int frame_count = 8;
+    std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d> > true_transforms(frame_count);
+    std::vector<Eigen::MatrixXd> frames(frame_count);
+    Eigen::Matrix4d pose = Eigen::Matrix4d::Identity();
+    for(int k = 0; k < frame_count; k++) {
+        pose = pose * se3_exp(velocity + k * acceleration);
+        true_transforms[k] = pose;
+        Eigen::Matrix4d to_frame = pose.inverse();
+        frames[k] = (to_frame.block(0,0,3,3) * model).colwise() + Eigen::Vector3d(to_frame.block(0,3,3,1));
+    }
+
+    TrackingOptions options;
+    options.registration.mode = RegistrationMode::Symmetric;
+    options.registration.convergence.rotation_tolerance = 1e-6;
+    options.registration.convergence.translation_tolerance = 1e-6;
+    RegistrationTracker tracker(model, Eigen::Matrix4d::Identity(), options);
+    int predicted_iterations = 0;
+    for(int k = 0; k < frame_count; k++) {
+        auto result = tracker.track(frames[k]);
+        REQUIRE( result.transform.isApprox(true_transforms[k], 1e-4) );
+        if(k >= 2) {
+            REQUIRE( result.iterations <= 3 );
+            predicted_iterations += result.iterations;
+        }
+    }
+    REQUIRE( tracker.frames() == frame_count );
+
+    // Starting each frame from the previous pose instead takes more iterations.
+    options.predict_motion = false;
+    RegistrationTracker unpredicted(model, Eigen::Matrix4d::Identity(), options);
+    int unpredicted_iterations = 0;
+    for(int k = 0; k < frame_count; k++) {
+        auto result = unpredicted.track(frames[k]);
+        if(k >= 2) {
+            unpredicted_iterations += result.iterations;
+        }
+    }
+    REQUIRE( unpredicted_iterations > predicted_iterations );
+
+    tracker.reset(true_transforms[0]);
+    REQUIRE( tracker.frames() == 0 );
+    REQUIRE( tracker.predicted_transform().isApprox(true_transforms[0]) );
+
+    options.registration.initial_alignment = InitialAlignment::Moments;
+    REQUIRE_THROWS_AS( RegistrationTracker(model, Eigen::Matrix4d::Identity(), options), PointMatchingException );
+}
+
+TEST_CASE( "Mini-batch ICP grows its batches and finishes on every point", "[register_surfaces]" ) {
+    auto data1 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt";
+    auto data2 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut_transformed.txt";
+    auto transform_file = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/matrix.4x4";
+
+    auto surface1 = load_pointcloud_from_file(data1);
+    auto surface2 = load_pointcloud_from_file(data2);
+    auto expected_transform = load_transform_from_file(transform_file);
+
+    Eigen::Matrix4d true_transform = expected_transform.inverse();
+    Eigen::Matrix4d perturbation = test_perturbation();
+
+    std::vector<IterationStats> history;
+    auto observer = make_observer([&history](const IterationStats& stats) { history.push_back(stats); });
+
+    RegistrationOptions options;
+    options.mode = RegistrationMode::Symmetric;
+    options.mini_batch.initial_batch_size = 50;
+    options.convergence.rotation_tolerance = 1e-7;
+    options.convergence.translation_tolerance = 1e-7;
+    options.observer = &observer;
+    auto result = register_surfaces(surface1, surface2, perturbation * true_transform, options);
+    REQUIRE( result.transform.isApprox(true_transform, 1e-3) );
+    REQUIRE( result.converged );
+    REQUIRE( result.sample_size == surface2.cols() );
+    REQUIRE( (int)history.size() == result.iterations );
+    REQUIRE( history.front().points == 50 );
+    REQUIRE( history.back().points == surface2.cols() );
+    for(unsigned int k = 1; k < history.size(); k++) {
+        REQUIRE( history[k].points >= history[k - 1].points );
+    }
+
+    // Point-to-point ICP samples the fixed cloud, here finishing on a fixed sample of it.
+    options.mode = RegistrationMode::PointToPoint;
+    options.mini_batch.final_batch_size = 400;
+    history.clear();
+    result = register_surfaces(surface1, surface2, perturbation * true_transform, options);
+    REQUIRE( result.sample_size == 400 );
+    REQUIRE( history.back().points == 400 );
+    // Point-to-point ICP on part of a cloud slides along it, so the sample leaves it short of the exact answer.
+    REQUIRE( result.error < history.front().error / 2 );
+    REQUIRE( result.transform.isApprox(true_transform, 0.05) );
+
+    options.convergence.time_limit = 1;
+    REQUIRE_THROWS_AS( register_surfaces(surface1, surface2, perturbation * true_transform, options), PointMatchingException );
+
+    // Batches too small for a point-to-point fit.
+    options.convergence.time_limit = 0;
+    options.mini_batch.initial_batch_size = 3;
+    REQUIRE_THROWS_AS( register_surfaces(surface1, surface2, perturbation * true_transform, options), PointMatchingException );
+}
+
+TEST_CASE( "Umeyama's method recovers a similarity transform, far from the origin", "[estimate_similarity_transform]" ) {
+    std::mt19937 generator(7);
+    std::uniform_real_distribution<double> uniform(-1, 1);
+    Eigen::MatrixXd pointset(3, 50);
+    for(int i = 0; i < pointset.cols(); i++) {
+        pointset.col(i) = Eigen::Vector3d(1E4, -2E4, 5E3) + Eigen::Vector3d(uniform(generator), uniform(generator), uniform(generator));
+    }
+
+    Eigen::Matrix4d expected_transform = Eigen::Matrix4d::Identity();
+    expected_transform.block(0,0,3,3) = 2.5 * Eigen::AngleAxisd(0.7, Eigen::Vector3d(1, 2, -1).normalized()).toRotationMatrix();
+    expected_transform.block(0,3,3,1) = Eigen::Vector3d(3, -1, 2);
+    Eigen::MatrixXd pointset_dash = (expected_transform.block(0,0,3,3) * pointset).colwise() + Eigen::Vector3d(expected_transform.block(0,3,3,1));
+
+    auto estimated_transform = estimate_similarity_transform(pointset, pointset_dash);
+    REQUIRE( estimated_transform.isApprox(expected_transform, 1e-6) );
+
+    // Without a change of scale, it agrees with the rigid fit, noise and all.
+    Eigen::Matrix4d rigid_transform = Eigen::Matrix4d::Identity();
+    rigid_transform.block(0,0,3,3) = expected_transform.block(0,0,3,3) / 2.5;
+    Eigen::MatrixXd noisy_dash = (rigid_transform.block(0,0,3,3) * pointset).colwise() + Eigen::Vector3d(1, 1, 1);
+    for(int i = 0; i < noisy_dash.cols(); i++) {
+        noisy_dash.col(i) += 0.01 * Eigen::Vector3d(uniform(generator), uniform(generator), uniform(generator));
+    }
+    Eigen::Matrix3d noisy_rotation = estimate_similarity_transform(pointset, noisy_dash).block(0,0,3,3);
+    REQUIRE( std::abs(std::cbrt(noisy_rotation.determinant()) - 1) < 0.01 );
+    REQUIRE( (noisy_rotation / std::cbrt(noisy_rotation.determinant())).isApprox(estimate_rigid_transform(pointset, noisy_dash).block(0,0,3,3), 1e-6) );
+
+    // The robust step finds the same transform with its lookup table's pairs, ignoring the rest.
+    Eigen::ArrayXi lookup = Eigen::ArrayXi::Zero(pointset.cols());
+    for(int i = 0; i < 5; i++) {
+        pointset_dash.col(i) += Eigen::Vector3d(100, 0, 0);
+        lookup(i) = -1;
+    }
+    Eigen::VectorXd residuals;
+    Eigen::Matrix4d next_transform;
+    robust_similarity_step(pointset, pointset_dash, Eigen::Matrix4d::Identity(), RobustKernel::None, 1, residuals, next_transform, &lookup);
+    REQUIRE( next_transform.isApprox(expected_transform, 1e-6) );
+
+    REQUIRE_THROWS_AS( estimate_similarity_transform(pointset.leftCols(3), pointset_dash.leftCols(3)), PointMatchingException );
+    REQUIRE_THROWS_AS( estimate_similarity_transform(pointset, pointset_dash.leftCols(40)), PointMatchingException );
+}
+
+TEST_CASE( "Similarity ICP registers test data whose units differ", "[register_surfaces]" ) {
+    auto data1 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut.txt";
+    auto data2 = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/fran_cut_transformed.txt";
+    auto transform_file = "../Testing/SurfaceBasedRegistrationData/SurfaceBasedRegistrationData/matrix.4x4";
+
+    auto surface1 = load_pointcloud_from_file(data1);
+    auto surface2 = load_pointcloud_from_file(data2);
+    auto expected_transform = load_transform_from_file(transform_file);
+
+    // The moving cloud in millimetres rather than metres.
+    Eigen::MatrixXd scaled_surface2 = 1000 * surface2;
+    Eigen::Matrix4d true_transform = expected_transform.inverse();
+    true_transform.block(0,0,3,3) /= 1000;
+
+    // A start 10% too large, about the fixed cloud's centroid, as well as rotated and translated.
+    Eigen::Matrix4d perturbation = test_perturbation(1.1, surface1.rowwise().mean());
+
+    RegistrationOptions options;
+    options.mode = RegistrationMode::Similarity;
+    options.convergence.rotation_tolerance = 1e-7;
+    options.convergence.translation_tolerance = 1e-7;
+    auto result = register_surfaces(surface1, scaled_surface2, perturbation * true_transform, options);
+    double scale = std::cbrt(result.transform.block(0,0,3,3).determinant());
+    REQUIRE( std::abs(scale * 1000 - 1) < 0.01 );
+    REQUIRE( result.transform.isApprox(true_transform, 0.01) );
+
+    // Rigid ICP cannot close the gap.
+    options.mode = RegistrationMode::PointToPoint;
+    auto rigid_result = register_surfaces(surface1, scaled_surface2, perturbation * true_transform, options);
+    REQUIRE( rigid_result.error > 5 * result.error );
+
+    options.mode = RegistrationMode::Similarity;
+    options.anderson_history = 3;
+    REQUIRE_THROWS_AS( register_surfaces(surface1, scaled_surface2, perturbation * true_transform, options), PointMatchingException );
+}